@@ -94,10 +94,12 @@ public:
 	int configure(CameraConfiguration *config);
 
 	Request *createRequest(uint64_t cookie = 0);
+	std::unique_ptr<Request> createReusableRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
 
 	int start();
 	int stop();
+	int reconfigure(CameraConfiguration *config);
 
 private:
 	Camera(PipelineHandler *pipe, const std::string &id,
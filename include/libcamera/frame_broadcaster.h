@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_broadcaster.h - Delivery of completed requests to multiple consumers
+ */
+#ifndef __LIBCAMERA_FRAME_BROADCASTER_H__
+#define __LIBCAMERA_FRAME_BROADCASTER_H__
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class FrameBroadcaster;
+class Request;
+
+class FrameSubscriber
+{
+public:
+	enum DropPolicy {
+		DropOldest,
+		DropNewest,
+	};
+
+	struct Statistics {
+		uint64_t frames;
+		uint64_t dropped;
+		unsigned int queued;
+		unsigned int maxQueued;
+	};
+
+	FrameSubscriber(const FrameSubscriber &) = delete;
+	FrameSubscriber &operator=(const FrameSubscriber &) = delete;
+
+	unsigned int depth() const { return depth_; }
+	DropPolicy policy() const { return policy_; }
+
+	std::shared_ptr<Request> nextFrame();
+	Statistics statistics() const;
+
+	Signal<FrameSubscriber *> frameAvailable;
+
+private:
+	friend class FrameBroadcaster;
+
+	FrameSubscriber(unsigned int depth, DropPolicy policy);
+
+	void deliver(const std::shared_ptr<Request> &frame);
+	void drop();
+	void clear();
+
+	const unsigned int depth_;
+	const DropPolicy policy_;
+
+	mutable std::mutex mutex_;
+	std::deque<std::shared_ptr<Request>> queue_;
+	Statistics stats_;
+};
+
+class FrameBroadcaster
+{
+public:
+	FrameBroadcaster(std::shared_ptr<Camera> camera,
+			 unsigned int requestCount);
+	FrameBroadcaster(const FrameBroadcaster &) = delete;
+	FrameBroadcaster &operator=(const FrameBroadcaster &) = delete;
+
+	~FrameBroadcaster();
+
+	FrameSubscriber *subscribe(unsigned int depth,
+				   FrameSubscriber::DropPolicy policy);
+	void unsubscribe(FrameSubscriber *subscriber);
+
+	Signal<Request *> requestReleased;
+
+private:
+	struct Releaser;
+
+	void requestComplete(Request *request);
+	void releaseRequest(Request *request);
+
+	std::shared_ptr<Camera> camera_;
+	const unsigned int requestCount_;
+	std::shared_ptr<Releaser> releaser_;
+
+	std::mutex mutex_;
+	std::vector<std::shared_ptr<FrameSubscriber>> subscribers_;
+	unsigned int pinned_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_FRAME_BROADCASTER_H__ */
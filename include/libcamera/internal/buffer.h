@@ -7,12 +7,21 @@
 #ifndef __LIBCAMERA_INTERNAL_BUFFER_H__
 #define __LIBCAMERA_INTERNAL_BUFFER_H__
 
+#include <list>
+#include <map>
+#include <memory>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <libcamera/buffer.h>
+#include <libcamera/file_descriptor.h>
 #include <libcamera/span.h>
 
+#include "libcamera/internal/thread.h"
+
 namespace libcamera {
 
 class MappedBuffer
@@ -42,6 +51,83 @@ public:
 	MappedFrameBuffer(const FrameBuffer *buffer, int flags);
 };
 
+class MappedBufferCache
+{
+public:
+	class Mapping
+	{
+	public:
+		Mapping(void *address, size_t length, int prot, bool dmaBuf);
+		~Mapping();
+
+		uint8_t *address() const { return static_cast<uint8_t *>(address_); }
+		size_t length() const { return length_; }
+		int prot() const { return prot_; }
+		bool isDmaBuf() const { return dmaBuf_; }
+
+	private:
+		void *address_;
+		size_t length_;
+		int prot_;
+		bool dmaBuf_;
+	};
+
+	static MappedBufferCache *instance();
+
+	int map(const FileDescriptor &fd, size_t length, int prot,
+		std::shared_ptr<Mapping> *mapping);
+	void release(const FileDescriptor &fd);
+	void evict(const FileDescriptor &fd);
+	void clear();
+
+	void setLimit(unsigned int limit);
+	unsigned int size() const;
+
+private:
+	using Identity = std::pair<dev_t, ino_t>;
+
+	struct Entry {
+		FileDescriptor fd;
+		std::shared_ptr<Mapping> mapping;
+		std::list<int>::iterator lru;
+	};
+
+	struct SharedEntry {
+		std::shared_ptr<Mapping> mapping;
+		std::list<Identity>::iterator lru;
+	};
+
+	MappedBufferCache();
+
+	static int identify(int fd, Identity *identity, bool *shareable,
+			    bool *dmaBuf);
+	void trim();
+
+	mutable Mutex mutex_;
+	unsigned int limit_;
+
+	std::unordered_map<int, Entry> entries_;
+	std::list<int> lru_;
+
+	std::map<Identity, SharedEntry> shared_;
+	std::list<Identity> sharedLru_;
+};
+
+class CachedMappedFrameBuffer : public MappedBuffer
+{
+public:
+	CachedMappedFrameBuffer(const FrameBuffer *buffer, int flags,
+				bool sync = true);
+	~CachedMappedFrameBuffer();
+
+private:
+	void syncDmaBufs(uint64_t flags);
+
+	std::vector<std::pair<int, std::shared_ptr<MappedBufferCache::Mapping>>> mappings_;
+	int flags_;
+	bool sync_;
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_INTERNAL_BUFFER_H__ */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capability_cache.h - Persistent cache of device capabilities
+ */
+#ifndef __LIBCAMERA_INTERNAL_CAPABILITY_CACHE_H__
+#define __LIBCAMERA_INTERNAL_CAPABILITY_CACHE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/span.h>
+
+#include "libcamera/internal/file.h"
+#include "libcamera/internal/thread.h"
+
+namespace libcamera {
+
+class CapabilityCache
+{
+public:
+	using Formats = std::map<unsigned int, std::vector<SizeRange>>;
+
+	CapabilityCache();
+	~CapabilityCache();
+
+	static Span<const uint8_t> lookup(const std::string &key);
+	static void store(const std::string &key, Span<const uint8_t> data);
+
+	static bool lookupFormats(const std::string &key, Formats *formats);
+	static void storeFormats(const std::string &key, const Formats &formats);
+
+	static void save();
+
+private:
+	struct Entry {
+		Span<const uint8_t> data;
+		bool used;
+	};
+
+	static CapabilityCache *self_;
+
+	static std::string cachePath();
+
+	bool load();
+	int write(const std::string &path);
+
+	std::string path_;
+	File file_;
+
+	Mutex mutex_;
+	std::map<std::string, Entry> entries_;
+	std::map<std::string, std::vector<uint8_t>> added_;
+	bool dirty_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_CAPABILITY_CACHE_H__ */
@@ -49,8 +49,11 @@ public:
 
 protected:
 	std::unique_ptr<MediaDevice> createDevice(const std::string &deviceNode);
+	std::vector<std::unique_ptr<MediaDevice>>
+	createDevices(const std::vector<std::string> &deviceNodes);
 	void addDevice(std::unique_ptr<MediaDevice> &&media);
-	void removeDevice(const std::string &deviceNode);
+	std::shared_ptr<MediaDevice> removeDevice(const std::string &deviceNode);
+	int refreshDevice(const std::string &deviceNode);
 
 private:
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
@@ -55,10 +55,12 @@ private:
 	};
 
 	int addUdevDevice(struct udev_device *dev);
+	int addMediaDevice(std::unique_ptr<MediaDevice> &&media);
 	int populateMediaDevice(MediaDevice *media, DependencyMap *deps);
 	std::string lookupDeviceNode(dev_t devnum);
 
 	int addV4L2Device(dev_t devnum);
+	void changeMediaDevice(struct udev_device *dev);
 	void udevNotify(EventNotifier *notifier);
 
 	struct udev *udev_;
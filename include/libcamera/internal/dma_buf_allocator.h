@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_buf_allocator.h - dma-buf and memfd buffer allocator
+ */
+#ifndef __LIBCAMERA_INTERNAL_DMA_BUF_ALLOCATOR_H__
+#define __LIBCAMERA_INTERNAL_DMA_BUF_ALLOCATOR_H__
+
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class DmaBufAllocator
+{
+public:
+	enum DmaBufAllocatorFlag {
+		CmaHeap = 1 << 0,
+		SystemHeap = 1 << 1,
+		UDmaBuf = 1 << 2,
+		Memfd = 1 << 3,
+	};
+
+	explicit DmaBufAllocator(unsigned int types = CmaHeap | SystemHeap | UDmaBuf);
+	~DmaBufAllocator();
+
+	bool isValid() const { return type_ != 0; }
+	DmaBufAllocatorFlag type() const { return type_; }
+
+	FileDescriptor alloc(const char *name, size_t size);
+	void release(FileDescriptor fd);
+
+	int exportFrameBuffers(const char *name, unsigned int count,
+			       const std::vector<unsigned int> &planeSizes,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	void recycle(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
+	void setPoolLimit(size_t limit);
+	size_t poolLimit() const { return poolLimit_; }
+	size_t poolSize() const { return poolSize_; }
+	void clear();
+
+	static size_t sizeClass(size_t size);
+
+private:
+	FileDescriptor allocFromHeap(const char *name, size_t size);
+	FileDescriptor allocFromUDmaBuf(const char *name, size_t size);
+	FileDescriptor allocFromMemfd(const char *name, size_t size);
+
+	DmaBufAllocatorFlag type_;
+	FileDescriptor providerHandle_;
+
+	size_t poolLimit_;
+	size_t poolSize_;
+	std::map<size_t, std::vector<FileDescriptor>> pool_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_DMA_BUF_ALLOCATOR_H__ */
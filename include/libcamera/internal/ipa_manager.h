@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 #define __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 
+#include <map>
 #include <stdint.h>
 #include <vector>
 
@@ -36,11 +37,13 @@ private:
 		      std::vector<std::string> &files);
 	unsigned int addDir(const char *libDir, unsigned int maxDepth = 0);
 
-	bool isSignatureValid(IPAModule *ipa) const;
+	bool isSignatureValid(IPAModule *ipa);
 
 	std::vector<IPAModule *> modules_;
 
 #if HAVE_IPA_PUBKEY
+	std::map<const IPAModule *, bool> signatures_;
+
 	static const uint8_t publicKeyData_[];
 	static const PubKey pubKey_;
 #endif
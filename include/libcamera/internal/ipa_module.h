@@ -43,6 +43,7 @@ protected:
 
 private:
 	int loadIPAModuleInfo();
+	int parseIPAModuleInfo();
 
 	struct IPAModuleInfo info_;
 	std::vector<uint8_t> signature_;
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_process_pool.h - Pool of isolated IPA worker processes
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_PROCESS_POOL_H__
+#define __LIBCAMERA_INTERNAL_IPA_PROCESS_POOL_H__
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include <libcamera/object.h>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/process.h"
+
+namespace libcamera {
+
+class IPAModule;
+
+enum IPAWorkerCommand : uint32_t {
+	IPAWorkerCommandReset = 0xffff0001,
+};
+
+struct IPAWorker {
+	IPAModule *module;
+	std::string path;
+	std::unique_ptr<Process> process;
+	std::unique_ptr<IPCUnixSocket> socket;
+};
+
+class IPAProcessPool : public Object
+{
+public:
+	IPAProcessPool(unsigned int spares = 1);
+	~IPAProcessPool();
+
+	static std::unique_ptr<IPAWorker> acquire(IPAModule *ipam,
+						  const std::string &workerPath);
+	static void release(std::unique_ptr<IPAWorker> worker);
+
+	void clear();
+
+private:
+	static IPAProcessPool *self_;
+
+	static std::unique_ptr<IPAWorker> spawn(IPAModule *ipam,
+						const std::string &workerPath);
+
+	void refill(IPAModule *ipam, const std::string &workerPath);
+	void workerFinished(Process *process, enum Process::ExitStatus status,
+			    int exitCode);
+
+	unsigned int spares_;
+	std::map<IPAModule *, std::list<std::unique_ptr<IPAWorker>>> idle_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_PROCESS_POOL_H__ */
@@ -7,9 +7,9 @@
 #ifndef __LIBCAMERA_INTERNAL_MEDIA_DEVICE_H__
 #define __LIBCAMERA_INTERNAL_MEDIA_DEVICE_H__
 
-#include <map>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
@@ -35,12 +35,14 @@ public:
 	void unlock();
 
 	int populate();
+	int refreshLinks();
 	bool valid() const { return valid_; }
 
 	const std::string driver() const { return driver_; }
 	const std::string deviceNode() const { return deviceNode_; }
 	const std::string model() const { return model_; }
 	unsigned int version() const { return version_; }
+	const std::string &cacheKey() const { return cacheKey_; }
 
 	const std::vector<MediaEntity *> &entities() const { return entities_; }
 	MediaEntity *getEntityByName(const std::string &name) const;
@@ -51,6 +53,7 @@ public:
 			const MediaEntity *sink, unsigned int sinkIdx);
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
+	int setupLinks(const std::vector<MediaLink *> &links);
 
 	Signal<MediaDevice *> disconnected;
 
@@ -64,6 +67,10 @@ private:
 	MediaObject *object(unsigned int id);
 	bool addObject(MediaObject *object);
 	void clear();
+	int readTopology(struct media_v2_topology *topology);
+	void updateLinks(const struct media_v2_topology &topology);
+	std::string computeCacheKey(const struct media_device_info &info,
+				    const struct media_v2_topology &topology);
 
 	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
 						 unsigned int entityId);
@@ -79,13 +86,28 @@ private:
 	std::string deviceNode_;
 	std::string model_;
 	unsigned int version_;
+	std::string cacheKey_;
 
 	int fd_;
 	bool valid_;
 	bool acquired_;
 	bool lockOwner_;
 
-	std::map<unsigned int, MediaObject *> objects_;
+	__u64 topologyVersion_;
+	std::vector<struct media_v2_entity> topologyEntities_;
+	std::vector<struct media_v2_interface> topologyInterfaces_;
+	std::vector<struct media_v2_pad> topologyPads_;
+	std::vector<struct media_v2_link> topologyLinks_;
+
+	MediaEntity *entityStore_;
+	unsigned int numEntities_;
+	MediaPad *padStore_;
+	unsigned int numPads_;
+	MediaLink *linkStore_;
+	unsigned int numLinks_;
+
+	std::unordered_map<unsigned int, MediaObject *> objects_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
 	std::vector<MediaEntity *> entities_;
 };
 
@@ -37,7 +37,7 @@ class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe)
+		: pipe_(pipe), initialized_(false)
 	{
 	}
 	virtual ~CameraData() {}
@@ -50,8 +50,12 @@ public:
 	std::unique_ptr<IPAProxy> ipa_;
 
 private:
+	friend class PipelineHandler;
+
 	CameraData(const CameraData &) = delete;
 	CameraData &operator=(const CameraData &) = delete;
+
+	bool initialized_;
 };
 
 class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>,
@@ -71,6 +75,8 @@ public:
 	const ControlInfoMap &controls(Camera *camera);
 	const ControlList &properties(Camera *camera);
 
+	int initCamera(Camera *camera);
+
 	virtual CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) = 0;
 	virtual int configure(Camera *camera, CameraConfiguration *config) = 0;
@@ -80,6 +86,7 @@ public:
 
 	virtual int start(Camera *camera) = 0;
 	virtual void stop(Camera *camera) = 0;
+	virtual int reconfigure(Camera *camera, CameraConfiguration *config);
 
 	int queueRequest(Camera *camera, Request *request);
 
@@ -94,6 +101,7 @@ protected:
 			    std::unique_ptr<CameraData> data);
 	void hotplugMediaDevice(MediaDevice *media);
 
+	virtual int initCameraDevice(Camera *camera);
 	virtual int queueRequestDevice(Camera *camera, Request *request) = 0;
 
 	CameraData *cameraData(const Camera *camera);
@@ -43,8 +43,11 @@ protected:
 
 	int fd() { return fd_; }
 
+	std::string cacheKey_;
+
 private:
 	void listControls();
+	std::vector<struct v4l2_query_ext_ctrl> queryControls();
 	void updateControls(ControlList *ctrls,
 			    const struct v4l2_ext_control *v4l2Ctrls,
 			    unsigned int count);
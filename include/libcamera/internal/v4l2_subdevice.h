@@ -67,6 +67,7 @@ protected:
 	std::string logPrefix() const override;
 
 private:
+	std::string formatsCacheKey(unsigned int pad);
 	std::vector<unsigned int> enumPadCodes(unsigned int pad);
 	std::vector<SizeRange> enumPadSizes(unsigned int pad,
 					    unsigned int code);
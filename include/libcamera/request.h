@@ -31,6 +31,11 @@ public:
 		RequestCancelled,
 	};
 
+	enum ReuseFlag {
+		Default = 0,
+		ReuseBuffers = (1 << 0),
+	};
+
 	using BufferMap = std::map<const Stream *, FrameBuffer *>;
 
 	Request(Camera *camera, uint64_t cookie = 0);
@@ -38,6 +43,8 @@ public:
 	Request &operator=(const Request &) = delete;
 	~Request();
 
+	void reuse(ReuseFlag flags = Default);
+
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
 	const BufferMap &buffers() const { return bufferMap_; }
@@ -50,6 +57,8 @@ public:
 	bool hasPendingBuffers() const { return !pending_.empty(); }
 
 private:
+	friend class Camera;
+	friend class FrameBroadcaster;
 	friend class PipelineHandler;
 
 	void complete();
@@ -66,6 +75,7 @@ private:
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
+	bool reusable_;
 };
 
 } /* namespace libcamera */
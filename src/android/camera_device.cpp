@@ -12,10 +12,12 @@
 #include <tuple>
 #include <vector>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/utils.h"
@@ -195,6 +197,17 @@ CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
 
 CameraDevice::Camera3RequestDescriptor::~Camera3RequestDescriptor()
 {
+	/*
+	 * The file descriptors of the frame buffers are duplicated for every
+	 * request. Release them from the mapping cache, the mappings of the
+	 * underlying buffers stay cached for the next requests.
+	 */
+	MappedBufferCache *cache = MappedBufferCache::instance();
+	for (const std::unique_ptr<FrameBuffer> &buffer : frameBuffers) {
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			cache->release(plane.fd);
+	}
+
 	delete[] buffers;
 }
 
@@ -273,7 +286,10 @@ int CameraDevice::initialize()
 
 	ret = initializeStreamConfigurations();
 	camera_->release();
-	return ret;
+	if (ret)
+		return ret;
+
+	return initializeResultMetadata();
 }
 
 /*
@@ -460,6 +476,18 @@ void CameraDevice::close()
 	camera_->stop();
 	camera_->release();
 
+	/*
+	 * Don't keep the stream buffers mapped once the camera is closed. The
+	 * cache is shared with the other cameras, evict our buffers only.
+	 */
+	MappedBufferCache *cache = MappedBufferCache::instance();
+	for (const auto &it : mappedBuffers_) {
+		for (const FileDescriptor &fd : it.second)
+			cache->evict(fd);
+	}
+
+	mappedBuffers_.clear();
+
 	running_ = false;
 }
 
@@ -1373,7 +1401,7 @@ void CameraDevice::requestComplete(Request *request)
 {
 	const Request::BufferMap &buffers = request->buffers();
 	camera3_buffer_status status = CAMERA3_BUFFER_STATUS_OK;
-	std::unique_ptr<CameraMetadata> resultMetadata;
+	CameraMetadata *resultMetadata;
 	Camera3RequestDescriptor *descriptor =
 		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
 
@@ -1390,10 +1418,11 @@ void CameraDevice::requestComplete(Request *request)
 	 * pipeline handlers) timestamp in the Request itself.
 	 */
 	FrameBuffer *buffer = buffers.begin()->second;
-	resultMetadata = getResultMetadata(descriptor->frameNumber,
-					   buffer->metadata().timestamp);
+	resultMetadata = getResultMetadata(buffer->metadata().timestamp,
+					   request->metadata());
 
 	/* Handle any JPEG compression. */
+	bool jpegResultAdded = false;
 	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
 		CameraStream *cameraStream =
 			static_cast<CameraStream *>(descriptor->buffers[i].stream->priv);
@@ -1428,6 +1457,18 @@ void CameraDevice::requestComplete(Request *request)
 		}
 
 		int jpeg_size = encoder->encode(buffer, mapped.maps()[0]);
+
+		/*
+		 * The encoder maps the source buffer through the mapping
+		 * cache. Record its planes, indexed by the output buffer to
+		 * bound the number of file descriptors kept open.
+		 */
+		std::vector<FileDescriptor> &planes =
+			mappedBuffers_[*descriptor->buffers[i].buffer];
+		planes.clear();
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			planes.push_back(plane.fd);
+
 		if (jpeg_size < 0) {
 			LOG(HAL, Error) << "Failed to encode stream image";
 			status = CAMERA3_BUFFER_STATUS_ERROR;
@@ -1453,17 +1494,14 @@ void CameraDevice::requestComplete(Request *request)
 		blob->jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
 		blob->jpeg_size = jpeg_size;
 
-		/* Update the JPEG result Metadata. */
-		resultMetadata->addEntry(ANDROID_JPEG_SIZE,
-					 &jpeg_size, 1);
-
-		const uint32_t jpeg_quality = 95;
-		resultMetadata->addEntry(ANDROID_JPEG_QUALITY,
-					 &jpeg_quality, 1);
-
-		const uint32_t jpeg_orientation = 0;
-		resultMetadata->addEntry(ANDROID_JPEG_ORIENTATION,
-					 &jpeg_orientation, 1);
+		/*
+		 * Update the JPEG result metadata. The capacity of the result
+		 * metadata pack only accounts for one set of JPEG entries.
+		 */
+		if (!jpegResultAdded) {
+			addJpegResultMetadata(resultMetadata, jpeg_size);
+			jpegResultAdded = true;
+		}
 	}
 
 	/* Prepare to call back the Android camera stack. */
@@ -1539,73 +1577,177 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
 }
 
 /*
- * Produce a set of fixed result metadata.
+ * Prepare the capture result metadata.
+ *
+ * The result metadata template stores all the entries reported for every
+ * frame. Entries with a fixed value are initialized once, while the
+ * dynamic entries are set to a default value and updated in place for every
+ * completed request by getResultMetadata(). The result metadata pack is
+ * allocated with enough capacity to hold a copy of the template and the
+ * additional JPEG entries, so that no memory allocation takes place at
+ * request completion time.
  */
-std::unique_ptr<CameraMetadata> CameraDevice::getResultMetadata(int frame_number,
-								int64_t timestamp)
+int CameraDevice::initializeResultMetadata()
 {
 	/*
-	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 18 entries, 62 bytes
+	 * Populate a scratch pack large enough for all entries, and size the
+	 * result metadata template from the entries actually added, to avoid
+	 * hardcoding their number.
 	 */
-	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(18, 62);
-	if (!resultMetadata->isValid()) {
-		LOG(HAL, Error) << "Failed to allocate static metadata";
-		return nullptr;
+	CameraMetadata result(32, 256);
+	if (!addResultTemplateEntries(&result)) {
+		LOG(HAL, Error) << "Failed to construct result metadata template";
+		return -EINVAL;
+	}
+
+	size_t entryCount = get_camera_metadata_entry_count(result.get());
+	size_t dataCount = get_camera_metadata_data_count(result.get());
+
+	resultTemplate_ = std::make_unique<CameraMetadata>(entryCount, dataCount);
+	if (!resultTemplate_->copyFrom(result)) {
+		LOG(HAL, Error) << "Failed to allocate result metadata template";
+		return -ENOMEM;
+	}
+
+	/*
+	 * The JPEG entries are added to the result metadata for requests that
+	 * contain a JPEG stream. Size the result metadata pack to fit them by
+	 * adding them to a scratch pack, to avoid hardcoding their number.
+	 */
+	CameraMetadata jpegResult(8, 32);
+	if (!addJpegResultMetadata(&jpegResult, 0)) {
+		LOG(HAL, Error) << "Failed to construct JPEG result metadata";
+		return -EINVAL;
+	}
+
+	const camera_metadata_t *resultTemplate = resultTemplate_->get();
+	size_t entryCapacity = get_camera_metadata_entry_count(resultTemplate)
+			     + get_camera_metadata_entry_count(jpegResult.get());
+	size_t dataCapacity = get_camera_metadata_data_count(resultTemplate)
+			    + get_camera_metadata_data_count(jpegResult.get());
+
+	resultMetadata_ = std::make_unique<CameraMetadata>(entryCapacity,
+							   dataCapacity);
+	if (!resultMetadata_->isValid()) {
+		LOG(HAL, Error) << "Failed to allocate result metadata";
+		return -ENOMEM;
 	}
 
+	return 0;
+}
+
+/*
+ * Add the entries of the result metadata template to \a metadata. Entries
+ * updated for every completed request are set to a default value.
+ */
+bool CameraDevice::addResultTemplateEntries(CameraMetadata *metadata)
+{
 	const uint8_t ae_state = ANDROID_CONTROL_AE_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
+	metadata->addEntry(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
 
 	const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
+	metadata->addEntry(ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
 
 	uint8_t af_state = ANDROID_CONTROL_AF_STATE_INACTIVE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_STATE, &af_state, 1);
+	metadata->addEntry(ANDROID_CONTROL_AF_STATE, &af_state, 1);
 
 	const uint8_t awb_state = ANDROID_CONTROL_AWB_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_STATE, &awb_state, 1);
+	metadata->addEntry(ANDROID_CONTROL_AWB_STATE, &awb_state, 1);
 
 	const uint8_t awb_lock = ANDROID_CONTROL_AWB_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1);
+	metadata->addEntry(ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1);
 
 	const uint8_t lens_state = ANDROID_LENS_STATE_STATIONARY;
-	resultMetadata->addEntry(ANDROID_LENS_STATE, &lens_state, 1);
+	metadata->addEntry(ANDROID_LENS_STATE, &lens_state, 1);
 
 	int32_t sensorSizes[] = {
 		0, 0, 2560, 1920,
 	};
-	resultMetadata->addEntry(ANDROID_SCALER_CROP_REGION, sensorSizes, 4);
+	metadata->addEntry(ANDROID_SCALER_CROP_REGION, sensorSizes, 4);
 
-	resultMetadata->addEntry(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+	const int64_t timestamp = 0;
+	metadata->addEntry(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
 
 	/* 33.3 msec */
 	const int64_t rolling_shutter_skew = 33300000;
-	resultMetadata->addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
-				 &rolling_shutter_skew, 1);
+	metadata->addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
+			   &rolling_shutter_skew, 1);
 
 	/* 16.6 msec */
 	const int64_t exposure_time = 16600000;
-	resultMetadata->addEntry(ANDROID_SENSOR_EXPOSURE_TIME,
-				 &exposure_time, 1);
+	metadata->addEntry(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
 
 	const uint8_t lens_shading_map_mode =
 				ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
-				 &lens_shading_map_mode, 1);
+	metadata->addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
+			   &lens_shading_map_mode, 1);
 
 	const uint8_t scene_flicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
-	resultMetadata->addEntry(ANDROID_STATISTICS_SCENE_FLICKER,
-				 &scene_flicker, 1);
+	metadata->addEntry(ANDROID_STATISTICS_SCENE_FLICKER, &scene_flicker, 1);
+
+	return metadata->isValid();
+}
+
+/*
+ * Add the JPEG result entries for an image of \a jpegSize bytes to \a metadata.
+ * This is also used at initialization time to size the result metadata pack.
+ */
+bool CameraDevice::addJpegResultMetadata(CameraMetadata *metadata,
+					 int32_t jpegSize)
+{
+	metadata->addEntry(ANDROID_JPEG_SIZE, &jpegSize, 1);
+
+	const uint32_t jpeg_quality = 95;
+	metadata->addEntry(ANDROID_JPEG_QUALITY, &jpeg_quality, 1);
+
+	const uint32_t jpeg_orientation = 0;
+	metadata->addEntry(ANDROID_JPEG_ORIENTATION, &jpeg_orientation, 1);
+
+	return metadata->isValid();
+}
+
+/*
+ * Produce the result metadata for a completed request from the result
+ * template, updating the dynamic entries with the values reported by the
+ * libcamera request metadata.
+ *
+ * The returned metadata pack is owned by the CameraDevice and is overwritten
+ * for every completed request. This is safe as the Android camera framework
+ * copies the result metadata during the process_capture_result() call.
+ */
+CameraMetadata *CameraDevice::getResultMetadata(int64_t timestamp,
+						const ControlList &metadata)
+{
+	if (!resultMetadata_->copyFrom(*resultTemplate_)) {
+		LOG(HAL, Error) << "Failed to copy result metadata template";
+		return resultMetadata_.get();
+	}
+
+	resultMetadata_->updateEntry(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+
+	if (metadata.contains(controls::AeLocked)) {
+		const uint8_t ae_state = metadata.get(controls::AeLocked)
+				       ? ANDROID_CONTROL_AE_STATE_CONVERGED
+				       : ANDROID_CONTROL_AE_STATE_SEARCHING;
+		resultMetadata_->updateEntry(ANDROID_CONTROL_AE_STATE,
+					     &ae_state, 1);
+	}
+
+	if (metadata.contains(controls::ExposureTime)) {
+		/* libcamera reports the exposure time in microseconds. */
+		const int64_t exposure_time =
+			metadata.get(controls::ExposureTime) * 1000LL;
+		resultMetadata_->updateEntry(ANDROID_SENSOR_EXPOSURE_TIME,
+					     &exposure_time, 1);
+	}
 
 	/*
 	 * Return the result metadata pack even is not valid: get() will return
 	 * nullptr.
 	 */
-	if (!resultMetadata->isValid()) {
+	if (!resultMetadata_->isValid()) {
 		LOG(HAL, Error) << "Failed to construct result metadata";
 	}
 
-	return resultMetadata;
+	return resultMetadata_.get();
 }
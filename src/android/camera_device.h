@@ -16,6 +16,8 @@
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/file_descriptor.h>
 #include <libcamera/geometry.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
@@ -89,14 +91,17 @@ private:
 	};
 
 	int initializeStreamConfigurations();
+	int initializeResultMetadata();
 	std::tuple<uint32_t, uint32_t> calculateStaticMetadataSize();
 	libcamera::FrameBuffer *createFrameBuffer(const buffer_handle_t camera3buffer);
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
 	void notifyError(uint32_t frameNumber, camera3_stream_t *stream);
 	CameraMetadata *requestTemplatePreview();
 	libcamera::PixelFormat toPixelFormat(int format);
-	std::unique_ptr<CameraMetadata> getResultMetadata(int frame_number,
-							  int64_t timestamp);
+	CameraMetadata *getResultMetadata(int64_t timestamp,
+					  const libcamera::ControlList &metadata);
+	bool addResultTemplateEntries(CameraMetadata *metadata);
+	bool addJpegResultMetadata(CameraMetadata *metadata, int32_t jpegSize);
 
 	unsigned int id_;
 	camera3_device_t camera3Device_;
@@ -107,6 +112,8 @@ private:
 
 	CameraMetadata *staticMetadata_;
 	std::map<unsigned int, const CameraMetadata *> requestTemplates_;
+	std::unique_ptr<CameraMetadata> resultTemplate_;
+	std::unique_ptr<CameraMetadata> resultMetadata_;
 	const camera3_callback_ops_t *callbacks_;
 
 	std::vector<Camera3StreamConfiguration> streamConfigurations_;
@@ -117,6 +124,12 @@ private:
 	int orientation_;
 
 	unsigned int maxJpegBufferSize_;
+
+	/*
+	 * The planes of the buffers mapped through the MappedBufferCache by
+	 * the JPEG encoder, to evict them when the camera is closed.
+	 */
+	std::map<buffer_handle_t, std::vector<libcamera::FileDescriptor>> mappedBuffers_;
 };
 
 #endif /* __ANDROID_CAMERA_DEVICE_H__ */
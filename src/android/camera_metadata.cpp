@@ -73,6 +73,36 @@ bool CameraMetadata::updateEntry(uint32_t tag, const void *data, size_t count)
 	return true;
 }
 
+/*
+ * Replace the content of the metadata pack with a copy of the entries of
+ * \a other. The copy is performed in place in the memory allocated at
+ * construction time, and thus requires the metadata pack capacity to be large
+ * enough to store all entries of \a other. The capacity is retained, so that
+ * entries can be added after the copy without any memory allocation.
+ */
+bool CameraMetadata::copyFrom(const CameraMetadata &other)
+{
+	if (!metadata_ || !other.valid_)
+		return false;
+
+	size_t entryCapacity = get_camera_metadata_entry_capacity(metadata_);
+	size_t dataCapacity = get_camera_metadata_data_capacity(metadata_);
+
+	place_camera_metadata(metadata_, get_camera_metadata_size(metadata_),
+			      entryCapacity, dataCapacity);
+
+	if (append_camera_metadata(metadata_, other.metadata_)) {
+		LOG(CameraMetadata, Error)
+			<< "Failed to copy metadata: insufficient capacity";
+		valid_ = false;
+		return false;
+	}
+
+	valid_ = true;
+
+	return true;
+}
+
 camera_metadata_t *CameraMetadata::get()
 {
 	return valid_ ? metadata_ : nullptr;
@@ -20,6 +20,7 @@ public:
 	bool isValid() const { return valid_; }
 	bool addEntry(uint32_t tag, const void *data, size_t data_count);
 	bool updateEntry(uint32_t tag, const void *data, size_t data_count);
+	bool copyFrom(const CameraMetadata &other);
 
 	camera_metadata_t *get();
 	const camera_metadata_t *get() const;
@@ -182,7 +182,7 @@ void EncoderLibJpeg::compressNV(const libcamera::MappedBuffer *frame)
 int EncoderLibJpeg::encode(const FrameBuffer *source,
 			   const libcamera::Span<uint8_t> &dest)
 {
-	MappedFrameBuffer frame(source, PROT_READ);
+	CachedMappedFrameBuffer frame(source, PROT_READ);
 	if (!frame.isValid()) {
 		LOG(JPEG, Error) << "Failed to map FrameBuffer : "
 				 << strerror(frame.error());
@@ -5,25 +5,89 @@
  * buffer_writer.cpp - Buffer writer
  */
 
+#include <algorithm>
+#include <errno.h>
 #include <fcntl.h>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "buffer_writer.h"
+#include "capture_file.h"
 
 using namespace libcamera;
 
+/*
+ * Number of frames that can be queued for writing. When all staging slots are
+ * in use the storage can't keep up with the capture rate, and new frames are
+ * dropped instead of stalling the event loop.
+ */
+static constexpr unsigned int kQueueDepth = 8;
+
+/* Minimum amount of disk space reserved ahead of the write offset. */
+static constexpr off_t kReserveSize = 64 * 1024 * 1024;
+
 BufferWriter::BufferWriter(const std::string &pattern)
-	: pattern_(pattern)
+	: pattern_(pattern), error_(0), exit_(false), dropped_(0), fd_(-1),
+	  offset_(0), reserved_(0)
 {
+	static const std::string containerExt = ".lcr";
+
+	if (pattern_.find_first_of('#') != std::string::npos)
+		mode_ = OutputFiles;
+	else if (pattern_.size() > containerExt.size() &&
+		 pattern_.compare(pattern_.size() - containerExt.size(),
+				  containerExt.size(), containerExt) == 0)
+		mode_ = OutputContainer;
+	else
+		mode_ = OutputRaw;
+
+	for (unsigned int i = 0; i < kQueueDepth; ++i) {
+		frames_.emplace_back(new Frame());
+		free_.push_back(frames_.back().get());
+	}
+
+	/*
+	 * The writer thread notifies the event loop through an eventfd when
+	 * it has copied a buffer. Without it buffers would never be released,
+	 * refuse all frames.
+	 */
+	releaseFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (releaseFd_ < 0) {
+		error_ = -errno;
+		std::cerr << "failed to create eventfd: " << strerror(-error_)
+			  << std::endl;
+	} else {
+		releaseNotifier_ = std::make_unique<EventNotifier>(releaseFd_,
+								   EventNotifier::Read);
+		releaseNotifier_->activated.connect(this, &BufferWriter::buffersReleased);
+	}
+
+	thread_ = std::thread(&BufferWriter::run, this);
 }
 
 BufferWriter::~BufferWriter()
 {
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		exit_ = true;
+	}
+	cond_.notify_one();
+	thread_.join();
+
+	releaseNotifier_.reset();
+	if (releaseFd_ >= 0)
+		close(releaseFd_);
+
+	if (dropped_)
+		std::cerr << dropped_ << " frames dropped by the writer"
+			  << std::endl;
+
 	for (auto &iter : mappedBuffers_) {
 		void *memory = iter.second.first;
 		unsigned int length = iter.second.second;
@@ -32,6 +96,20 @@ BufferWriter::~BufferWriter()
 	mappedBuffers_.clear();
 }
 
+void BufferWriter::addStream(const Stream *stream,
+			     const StreamConfiguration &cfg,
+			     const std::string &name)
+{
+	if (mode_ == OutputContainer && streams_.size() >= kCaptureFileMaxStreams) {
+		std::cerr << "Too many streams, " << name
+			  << " will not be recorded" << std::endl;
+		return;
+	}
+
+	streamIndex_[stream] = streams_.size();
+	streams_.push_back({ name, cfg });
+}
+
 void BufferWriter::mapBuffer(FrameBuffer *buffer)
 {
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
@@ -43,46 +121,393 @@ void BufferWriter::mapBuffer(FrameBuffer *buffer)
 	}
 }
 
-int BufferWriter::write(FrameBuffer *buffer, const std::string &streamName)
+/*
+ * Queue the buffer for the writer thread, which copies its content to a
+ * staging slot and emits bufferReleased from the event loop once done. The
+ * buffer must not be reused by the caller until then, regardless of the time
+ * it takes to write the frame to storage.
+ *
+ * Return 0 if the buffer has been queued, or a negative error code if the
+ * frame can't be written, in which case the buffer isn't retained. -ENOSPC
+ * reports that all staging slots are in use and the frame has been dropped,
+ * other errors are fatal and stop the writer.
+ */
+int BufferWriter::write(FrameBuffer *buffer, const Stream *stream,
+			const ControlList &metadata)
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
+	auto iter = streamIndex_.find(stream);
+	if (iter == streamIndex_.end())
+		return -EINVAL;
 
-	filename = pattern_;
-	pos = filename.find_first_of('#');
-	if (pos != std::string::npos) {
-		std::stringstream ss;
-		ss << streamName << "-" << std::setw(6)
-		   << std::setfill('0') << buffer->metadata().sequence;
-		filename.replace(pos, 1, ss.str());
+	Frame *frame;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		if (error_)
+			return error_;
+
+		if (free_.empty()) {
+			dropped_++;
+			return -ENOSPC;
+		}
+
+		frame = free_.back();
+		free_.pop_back();
+	}
+
+	frame->buffer = buffer;
+	frame->stream = iter->second;
+
+	/* The request metadata doesn't outlive the completion handler. */
+	if (mode_ == OutputContainer)
+		frame->metadata = metadata;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		pending_.push(frame);
 	}
+	cond_.notify_one();
+
+	return 0;
+}
+
+/* Copy the buffer content to the frame staging memory, in the writer thread. */
+void BufferWriter::copyFrame(Frame *frame)
+{
+	FrameBuffer *buffer = frame->buffer;
+
+	size_t headerSize = mode_ == OutputContainer ? kCaptureFileAlignment : 0;
+	size_t size = 0;
+	for (const FrameBuffer::Plane &plane : buffer->planes())
+		size += plane.length;
+
+	if (mode_ == OutputContainer)
+		size = captureFileAlign(headerSize + size);
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1)
-		return -errno;
+	/* The staging memory is only allocated once per slot. */
+	if (frame->data.size() < size)
+		frame->data.resize(size);
 
+	frame->sequence = buffer->metadata().sequence;
+	frame->size = size;
+
+	uint8_t *dst = frame->data.data() + headerSize;
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		void *data = mappedBuffers_[plane.fd.fd()].first;
-		unsigned int length = plane.length;
+		const void *data = mappedBuffers_.at(plane.fd.fd()).first;
+		memcpy(dst, data, plane.length);
+		dst += plane.length;
+	}
 
-		ret = ::write(fd, data, length);
-		if (ret < 0) {
-			ret = -errno;
-			std::cerr << "write error: " << strerror(-ret)
-				  << std::endl;
+	if (mode_ == OutputContainer) {
+		memset(dst, 0, frame->data.data() + size - dst);
+		fillRecord(frame, buffer, frame->metadata);
+	}
+}
+
+void BufferWriter::fillRecord(Frame *frame, FrameBuffer *buffer,
+			      const ControlList &metadata)
+{
+	const FrameMetadata &info = buffer->metadata();
+
+	memset(frame->data.data(), 0, kCaptureFileAlignment);
+
+	CaptureFileRecord *record =
+		reinterpret_cast<CaptureFileRecord *>(frame->data.data());
+	record->magic = kCaptureRecordMagic;
+	record->stream = frame->stream;
+	record->sequence = info.sequence;
+	record->status = info.status;
+	record->timestamp = info.timestamp;
+	record->size = frame->size;
+
+	unsigned int i = 0;
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		if (i >= kCaptureFileMaxPlanes)
 			break;
-		} else if (ret != (int)length) {
-			std::cerr << "write error: only " << ret
-				  << " bytes written instead of "
-				  << length << std::endl;
+
+		record->planes[i].length = plane.length;
+		record->planes[i].bytesused = i < info.planes.size()
+					    ? info.planes[i].bytesused : 0;
+		++i;
+	}
+	record->numPlanes = i;
+
+	/*
+	 * Only scalar controls fit in the fixed-size record, array controls
+	 * are skipped.
+	 */
+	i = 0;
+	for (const auto &ctrl : metadata) {
+		const ControlValue &value = ctrl.second;
+		if (value.isArray() || value.data().size() > sizeof(record->controls[i].value))
+			continue;
+		if (i >= kCaptureFileMaxControls)
 			break;
+
+		CaptureFileControl &control = record->controls[i++];
+		control.id = ctrl.first;
+		control.type = value.type();
+		memcpy(control.value, value.data().data(), value.data().size());
+	}
+	record->numControls = i;
+}
+
+void BufferWriter::releaseBuffer(FrameBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		released_.push_back(buffer);
+	}
+
+	uint64_t value = 1;
+	if (::write(releaseFd_, &value, sizeof(value)) < 0)
+		std::cerr << "failed to release buffer: " << strerror(errno)
+			  << std::endl;
+}
+
+void BufferWriter::buffersReleased(EventNotifier *notifier)
+{
+	uint64_t value;
+	if (read(releaseFd_, &value, sizeof(value)) < 0)
+		return;
+
+	std::vector<FrameBuffer *> buffers;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		buffers.swap(released_);
+	}
+
+	for (FrameBuffer *buffer : buffers)
+		bufferReleased.emit(buffer);
+}
+
+void BufferWriter::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cond_.wait(locker, [&] { return exit_ || !pending_.empty(); });
+
+		/* Drain all pending frames before exiting. */
+		if (pending_.empty())
+			break;
+
+		Frame *frame = pending_.front();
+		pending_.pop();
+
+		/* Frames queued before an error are released unwritten. */
+		bool failed = error_ != 0;
+
+		locker.unlock();
+
+		if (!failed)
+			copyFrame(frame);
+		releaseBuffer(frame->buffer);
+
+		int ret = failed ? 0 : writeFrame(*frame);
+
+		locker.lock();
+
+		if (ret < 0)
+			error_ = ret;
+		free_.push_back(frame);
+	}
+
+	locker.unlock();
+
+	if (fd_ != -1) {
+		/* Release the space reserved past the end of the data. */
+		if (reserved_ > offset_ && ftruncate(fd_, offset_) < 0)
+			std::cerr << "failed to release reserved space: "
+				  << strerror(errno) << std::endl;
+		close(fd_);
+		fd_ = -1;
+
+		if (mode_ == OutputRaw)
+			writeIndex();
+	}
+}
+
+/*
+ * Write all data, resuming after partial writes. A short write is only
+ * reported when the underlying write() fails.
+ */
+int BufferWriter::writeData(int fd, const uint8_t *data, size_t size)
+{
+	while (size) {
+		ssize_t ret = ::write(fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ret = -errno;
+			std::cerr << "write error: " << strerror(-ret) << std::endl;
+			return ret;
+		} else if (ret == 0) {
+			std::cerr << "write error: " << size
+				  << " bytes left unwritten" << std::endl;
+			return -EIO;
 		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+int BufferWriter::openFile()
+{
+	int flags = O_CREAT | O_WRONLY;
+	int ret;
+
+	flags |= mode_ == OutputContainer ? O_TRUNC : O_APPEND;
+	fd_ = open(pattern_.c_str(), flags,
+		   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd_ == -1) {
+		ret = -errno;
+		std::cerr << "failed to open " << pattern_ << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	offset_ = lseek(fd_, 0, SEEK_END);
+	reserved_ = offset_;
+
+	if (mode_ != OutputContainer)
+		return 0;
+
+	std::vector<uint8_t> data(kCaptureFileAlignment);
+	CaptureFileHeader *header =
+		reinterpret_cast<CaptureFileHeader *>(data.data());
+
+	header->magic = kCaptureFileMagic;
+	header->version = kCaptureFileVersion;
+	header->headerSize = kCaptureFileAlignment;
+	header->recordHeaderSize = kCaptureFileAlignment;
+	header->numStreams = streams_.size();
+
+	for (unsigned int i = 0; i < streams_.size(); ++i) {
+		const StreamInfo &info = streams_[i];
+		CaptureFileStream &stream = header->streams[i];
+
+		strncpy(stream.name, info.name.c_str(), sizeof(stream.name) - 1);
+		stream.pixelFormat = info.cfg.pixelFormat.fourcc();
+		stream.modifier = info.cfg.pixelFormat.modifier();
+		stream.width = info.cfg.size.width;
+		stream.height = info.cfg.size.height;
+		stream.stride = info.cfg.stride;
+		stream.frameSize = info.cfg.frameSize;
+	}
+
+	ret = writeData(fd_, data.data(), data.size());
+	if (ret < 0) {
+		close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	offset_ = data.size();
+	reserved_ = offset_;
+
+	return 0;
+}
+
+int BufferWriter::writeFrame(const Frame &frame)
+{
+	int ret;
+
+	if (mode_ == OutputFiles) {
+		std::string filename = pattern_;
+		size_t pos = filename.find_first_of('#');
+		std::stringstream ss;
+		ss << streams_[frame.stream].name << "-" << std::setw(6)
+		   << std::setfill('0') << frame.sequence;
+		filename.replace(pos, 1, ss.str());
+
+		int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			ret = -errno;
+			std::cerr << "failed to open " << filename << ": "
+				  << strerror(-ret) << std::endl;
+			return ret;
+		}
+
+		ret = writeData(fd, frame.data.data(), frame.size);
+		close(fd);
+
+		/* Don't leave a partial frame behind. */
+		if (ret < 0)
+			unlink(filename.c_str());
+
+		return ret;
+	}
+
+	/*
+	 * All frames go to a single file, kept open for the whole capture
+	 * session. Disk space is reserved ahead of the write offset to avoid
+	 * extending the file allocation on every write. In raw mode the
+	 * location of each frame is recorded in an index written when capture
+	 * stops, while the container format embeds it in the frame records.
+	 */
+	if (fd_ == -1) {
+		ret = openFile();
+		if (ret < 0)
+			return ret;
+	}
+
+	off_t end = offset_ + static_cast<off_t>(frame.size);
+	if (end > reserved_) {
+		off_t length = std::max<off_t>(kReserveSize, frame.size * kQueueDepth);
+
+		/* Failure to reserve space isn't fatal, ignore it. */
+		if (!fallocate(fd_, FALLOC_FL_KEEP_SIZE, offset_, length))
+			reserved_ = offset_ + length;
+		else
+			reserved_ = end;
+	}
+
+	ret = writeData(fd_, frame.data.data(), frame.size);
+	if (ret < 0) {
+		/*
+		 * Truncate the partially written frame to keep the file end in
+		 * sync with offset_ and the index. This also releases the
+		 * reserved space, or retries when closing the file on failure.
+		 */
+		if (ftruncate(fd_, offset_) < 0 ||
+		    lseek(fd_, offset_, SEEK_SET) < 0)
+			std::cerr << "failed to truncate " << pattern_ << ": "
+				  << strerror(errno) << std::endl;
+		else
+			reserved_ = offset_;
+
+		return ret;
+	}
+
+	if (mode_ == OutputRaw)
+		index_.push_back({ frame.stream, frame.sequence, offset_, frame.size });
+	offset_ = end;
+
+	return 0;
+}
+
+void BufferWriter::writeIndex()
+{
+	if (index_.empty())
+		return;
+
+	std::string filename = pattern_ + ".idx";
+	std::ofstream file(filename, std::ios::out | std::ios::app);
+	if (!file) {
+		std::cerr << "failed to open index " << filename << std::endl;
+		return;
 	}
 
-	close(fd);
+	for (const IndexEntry &entry : index_)
+		file << streams_[entry.stream].name << " " << entry.sequence << " "
+		     << entry.offset << " " << entry.size << std::endl;
 
-	return ret;
+	index_.clear();
 }
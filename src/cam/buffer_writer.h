@@ -7,10 +7,21 @@
 #ifndef __CAM_BUFFER_WRITER_H__
 #define __CAM_BUFFER_WRITER_H__
 
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <libcamera/buffer.h>
+#include <libcamera/controls.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
 
 class BufferWriter
 {
@@ -18,14 +29,89 @@ public:
 	BufferWriter(const std::string &pattern = "frame-#.bin");
 	~BufferWriter();
 
+	void addStream(const libcamera::Stream *stream,
+		       const libcamera::StreamConfiguration &cfg,
+		       const std::string &name);
 	void mapBuffer(libcamera::FrameBuffer *buffer);
 
 	int write(libcamera::FrameBuffer *buffer,
-		  const std::string &streamName);
+		  const libcamera::Stream *stream,
+		  const libcamera::ControlList &metadata);
+
+	libcamera::Signal<libcamera::FrameBuffer *> bufferReleased;
 
 private:
+	enum OutputMode {
+		OutputFiles,
+		OutputRaw,
+		OutputContainer,
+	};
+
+	struct StreamInfo {
+		std::string name;
+		libcamera::StreamConfiguration cfg;
+	};
+
+	struct Frame {
+		libcamera::FrameBuffer *buffer;
+		libcamera::ControlList metadata;
+		unsigned int stream;
+		unsigned int sequence;
+		std::vector<uint8_t> data;
+		size_t size;
+	};
+
+	struct IndexEntry {
+		unsigned int stream;
+		unsigned int sequence;
+		off_t offset;
+		size_t size;
+	};
+
+	void copyFrame(Frame *frame);
+	void fillRecord(Frame *frame, libcamera::FrameBuffer *buffer,
+			const libcamera::ControlList &metadata);
+
+	void releaseBuffer(libcamera::FrameBuffer *buffer);
+	void buffersReleased(libcamera::EventNotifier *notifier);
+
+	void run();
+	int openFile();
+	int writeFrame(const Frame &frame);
+	int writeData(int fd, const uint8_t *data, size_t size);
+	void writeIndex();
+
 	std::string pattern_;
+	OutputMode mode_;
+
+	std::vector<StreamInfo> streams_;
+	std::map<const libcamera::Stream *, unsigned int> streamIndex_;
 	std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
+
+	/* Staging slots, owned by the writer and recycled once written */
+	std::vector<std::unique_ptr<Frame>> frames_;
+
+	/* Protected by mutex_ */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::queue<Frame *> pending_;
+	std::vector<Frame *> free_;
+	std::vector<libcamera::FrameBuffer *> released_;
+	int error_;
+	bool exit_;
+
+	std::thread thread_;
+	unsigned int dropped_;
+
+	/* Wakes up the event loop to release buffers copied by the writer */
+	int releaseFd_;
+	std::unique_ptr<libcamera::EventNotifier> releaseNotifier_;
+
+	/* Single file output, accessed from the writer thread only */
+	int fd_;
+	off_t offset_;
+	off_t reserved_;
+	std::vector<IndexEntry> index_;
 };
 
 #endif /* __CAM_BUFFER_WRITER_H__ */
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <limits.h>
 #include <sstream>
+#include <string.h>
 
 #include "capture.h"
 #include "main.h"
@@ -41,14 +42,6 @@ int Capture::run(const OptionsParser::Options &options)
 		return ret;
 	}
 
-	streamName_.clear();
-	for (unsigned int index = 0; index < config_->size(); ++index) {
-		StreamConfiguration &cfg = config_->at(index);
-		streamName_[cfg.stream()] = "stream" + std::to_string(index);
-	}
-
-	camera_->requestCompleted.connect(this, &Capture::requestComplete);
-
 	if (options.isSet(OptFile)) {
 		if (!options[OptFile].toString().empty())
 			writer_ = new BufferWriter(options[OptFile]);
@@ -56,6 +49,19 @@ int Capture::run(const OptionsParser::Options &options)
 			writer_ = new BufferWriter();
 	}
 
+	streamName_.clear();
+	for (unsigned int index = 0; index < config_->size(); ++index) {
+		StreamConfiguration &cfg = config_->at(index);
+		streamName_[cfg.stream()] = "stream" + std::to_string(index);
+
+		if (writer_)
+			writer_->addStream(cfg.stream(), cfg,
+					   streamName_[cfg.stream()]);
+	}
+
+	camera_->requestCompleted.connect(this, &Capture::requestComplete);
+	if (writer_)
+		writer_->bufferReleased.connect(this, &Capture::bufferReleased);
 
 	FrameBufferAllocator *allocator = new FrameBufferAllocator(camera_);
 
@@ -64,6 +70,7 @@ int Capture::run(const OptionsParser::Options &options)
 	if (options.isSet(OptFile)) {
 		delete writer_;
 		writer_ = nullptr;
+		pending_.clear();
 	}
 
 	delete allocator;
@@ -168,6 +175,9 @@ void Capture::requestComplete(Request *request)
 	std::stringstream info;
 	info << "fps: " << std::fixed << std::setprecision(2) << fps;
 
+	std::shared_ptr<PendingBuffers> pending;
+	int error = 0;
+
 	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
 		const Stream *stream = it->first;
 		FrameBuffer *buffer = it->second;
@@ -186,23 +196,72 @@ void Capture::requestComplete(Request *request)
 				info << "/";
 		}
 
-		if (writer_)
-			writer_->write(buffer, name);
+		if (!writer_)
+			continue;
+
+		/*
+		 * The writer holds on to the buffer until it has copied its
+		 * content. Frames dropped because the writer is busy don't
+		 * stop the capture.
+		 */
+		int ret = writer_->write(buffer, stream, request->metadata());
+		if (ret == -ENOSPC)
+			continue;
+		if (ret < 0) {
+			error = ret;
+			continue;
+		}
+
+		if (!pending)
+			pending = std::make_shared<PendingBuffers>(PendingBuffers{ buffers, 0 });
+		pending->count++;
+		pending_[buffer] = pending;
 	}
 
 	std::cout << info.str() << std::endl;
 
+	if (error) {
+		std::cerr << "Failed to write frame: " << strerror(-error)
+			  << std::endl;
+		loop_->exit(error);
+		return;
+	}
+
 	captureCount_++;
 	if (captureLimit_ && captureCount_ >= captureLimit_) {
 		loop_->exit(0);
 		return;
 	}
 
-	/*
-	 * Create a new request and populate it with one buffer for each
-	 * stream.
-	 */
-	request = camera_->createRequest();
+	/* Requeue the buffers once the writer has released all of them. */
+	if (!pending)
+		queueRequest(buffers);
+}
+
+void Capture::bufferReleased(FrameBuffer *buffer)
+{
+	auto iter = pending_.find(buffer);
+	if (iter == pending_.end())
+		return;
+
+	std::shared_ptr<PendingBuffers> pending = iter->second;
+	pending_.erase(iter);
+
+	if (--pending->count)
+		return;
+
+	if (captureLimit_ && captureCount_ >= captureLimit_)
+		return;
+
+	queueRequest(pending->buffers);
+}
+
+/*
+ * Create a new request and populate it with one buffer for each stream.
+ */
+void Capture::queueRequest(const Request::BufferMap &buffers)
+{
+	Request *request = camera_->createRequest();
 	if (!request) {
 		std::cerr << "Can't create request" << std::endl;
 		return;
@@ -32,12 +32,21 @@ private:
 	int capture(libcamera::FrameBufferAllocator *allocator);
 
 	void requestComplete(libcamera::Request *request);
+	void bufferReleased(libcamera::FrameBuffer *buffer);
+	void queueRequest(const libcamera::Request::BufferMap &buffers);
+
+	/* Buffers of a completed request that are being copied by the writer */
+	struct PendingBuffers {
+		libcamera::Request::BufferMap buffers;
+		unsigned int count;
+	};
 
 	std::shared_ptr<libcamera::Camera> camera_;
 	libcamera::CameraConfiguration *config_;
 
 	std::map<const libcamera::Stream *, std::string> streamName_;
 	BufferWriter *writer_;
+	std::map<libcamera::FrameBuffer *, std::shared_ptr<PendingBuffers>> pending_;
 	std::chrono::steady_clock::time_point last_;
 
 	EventLoop *loop_;
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capture_file.cpp - cam - Multi-frame capture file reader
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+
+CaptureFileReader::CaptureFileReader()
+	: memory_(nullptr), size_(0), header_(nullptr)
+{
+}
+
+CaptureFileReader::~CaptureFileReader()
+{
+	close();
+}
+
+/*
+ * Map the whole file and index the records it contains. Only the record
+ * headers are accessed, the frame data is paged in on demand when accessed
+ * through data().
+ */
+int CaptureFileReader::open(const std::string &filename)
+{
+	struct stat st;
+	int ret;
+
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		std::cerr << "Failed to open " << filename << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	ret = fstat(fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		::close(fd);
+		return ret;
+	}
+
+	size_ = st.st_size;
+	if (size_ < sizeof(CaptureFileHeader)) {
+		std::cerr << filename << " is not a capture file" << std::endl;
+		::close(fd);
+		return -EINVAL;
+	}
+
+	memory_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory_ == MAP_FAILED) {
+		ret = -errno;
+		memory_ = nullptr;
+		return ret;
+	}
+
+	const uint8_t *base = static_cast<const uint8_t *>(memory_);
+
+	header_ = reinterpret_cast<const CaptureFileHeader *>(base);
+	if (header_->magic != kCaptureFileMagic ||
+	    header_->version != kCaptureFileVersion ||
+	    header_->headerSize < sizeof(CaptureFileHeader) ||
+	    header_->recordHeaderSize < sizeof(CaptureFileRecord) ||
+	    header_->numStreams > kCaptureFileMaxStreams) {
+		std::cerr << filename << " is not a valid capture file"
+			  << std::endl;
+		close();
+		return -EINVAL;
+	}
+
+	size_t offset = header_->headerSize;
+	while (offset + header_->recordHeaderSize <= size_) {
+		const CaptureFileRecord *record =
+			reinterpret_cast<const CaptureFileRecord *>(base + offset);
+
+		/* Stop at the first truncated or corrupted record. */
+		if (record->magic != kCaptureRecordMagic ||
+		    record->size < header_->recordHeaderSize ||
+		    record->size > size_ - offset ||
+		    record->numPlanes > kCaptureFileMaxPlanes ||
+		    record->numControls > kCaptureFileMaxControls) {
+			std::cerr << "Invalid record at offset " << offset
+				  << ", ignoring the rest of the file"
+				  << std::endl;
+			break;
+		}
+
+		size_t length = 0;
+		for (unsigned int i = 0; i < record->numPlanes; ++i)
+			length += record->planes[i].length;
+
+		if (length > record->size - header_->recordHeaderSize) {
+			std::cerr << "Invalid record at offset " << offset
+				  << ", ignoring the rest of the file"
+				  << std::endl;
+			break;
+		}
+
+		records_.push_back(record);
+		offset += record->size;
+	}
+
+	return 0;
+}
+
+void CaptureFileReader::close()
+{
+	if (memory_)
+		munmap(memory_, size_);
+
+	memory_ = nullptr;
+	size_ = 0;
+	header_ = nullptr;
+	records_.clear();
+}
+
+const uint8_t *CaptureFileReader::data(const CaptureFileRecord *record) const
+{
+	return reinterpret_cast<const uint8_t *>(record) + header_->recordHeaderSize;
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capture_file.h - cam - Multi-frame capture file format
+ */
+#ifndef __CAM_CAPTURE_FILE_H__
+#define __CAM_CAPTURE_FILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * A capture file stores frames from all streams of a capture session in a
+ * single file. It starts with a CaptureFileHeader describing the streams,
+ * followed by one record per frame. Each record is made of a fixed-size
+ * CaptureFileRecord header followed by the data of all planes of the frame,
+ * and is padded to a multiple of kCaptureFileAlignment. The frame data is thus
+ * page-aligned, and records can be located by walking the record sizes
+ * without reading the frame data.
+ *
+ * All fields are stored in the native endianness of the system that recorded
+ * the file.
+ */
+
+static constexpr uint32_t kCaptureFileMagic = 0x524c434c; /* "LCLR" */
+static constexpr uint32_t kCaptureRecordMagic = 0x4d52464c; /* "LFRM" */
+static constexpr uint32_t kCaptureFileVersion = 1;
+
+static constexpr size_t kCaptureFileAlignment = 4096;
+static constexpr unsigned int kCaptureFileMaxStreams = 8;
+static constexpr unsigned int kCaptureFileMaxPlanes = 4;
+static constexpr unsigned int kCaptureFileMaxControls = 32;
+
+struct CaptureFileStream {
+	char name[32];
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint64_t modifier;
+	uint32_t frameSize;
+	uint32_t reserved;
+};
+
+struct CaptureFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t recordHeaderSize;
+	uint32_t numStreams;
+	uint32_t reserved[3];
+	CaptureFileStream streams[kCaptureFileMaxStreams];
+};
+
+struct CaptureFileControl {
+	uint32_t id;
+	uint32_t type;
+	uint8_t value[8];
+};
+
+struct CaptureFilePlane {
+	uint32_t length;
+	uint32_t bytesused;
+};
+
+struct CaptureFileRecord {
+	uint32_t magic;
+	uint32_t stream;
+	uint32_t sequence;
+	uint32_t status;
+	uint64_t timestamp;
+	uint64_t size;
+	uint32_t numPlanes;
+	uint32_t numControls;
+	CaptureFilePlane planes[kCaptureFileMaxPlanes];
+	CaptureFileControl controls[kCaptureFileMaxControls];
+};
+
+static_assert(sizeof(CaptureFileStream) == 64, "Invalid stream layout");
+static_assert(sizeof(CaptureFileHeader) <= kCaptureFileAlignment,
+	      "Capture file header too large");
+static_assert(sizeof(CaptureFileRecord) <= kCaptureFileAlignment,
+	      "Capture file record header too large");
+
+static inline size_t captureFileAlign(size_t size)
+{
+	return (size + kCaptureFileAlignment - 1) & ~(kCaptureFileAlignment - 1);
+}
+
+class CaptureFileReader
+{
+public:
+	CaptureFileReader();
+	~CaptureFileReader();
+
+	int open(const std::string &filename);
+	void close();
+
+	const CaptureFileHeader &header() const { return *header_; }
+
+	const std::vector<const CaptureFileRecord *> &records() const { return records_; }
+	const uint8_t *data(const CaptureFileRecord *record) const;
+
+private:
+	void *memory_;
+	size_t size_;
+
+	const CaptureFileHeader *header_;
+	std::vector<const CaptureFileRecord *> records_;
+};
+
+#endif /* __CAM_CAPTURE_FILE_H__ */
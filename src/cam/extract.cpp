@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * extract.cpp - cam-extract - Inspect and extract frames from capture files
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/pixel_format.h>
+
+#include "capture_file.h"
+#include "options.h"
+
+using namespace libcamera;
+
+enum {
+	OptHelp = 'h',
+	OptInput = 'i',
+	OptList = 'l',
+	OptOutput = 'o',
+	OptStream = 's',
+};
+
+static std::string controlToString(const CaptureFileControl &control)
+{
+	std::stringstream ss;
+
+	auto iter = controls::controls.find(control.id);
+	if (iter != controls::controls.end())
+		ss << iter->second->name();
+	else
+		ss << "0x" << std::hex << control.id << std::dec;
+
+	ss << "=";
+
+	switch (control.type) {
+	case ControlTypeBool: {
+		bool value;
+		memcpy(&value, control.value, sizeof(value));
+		ss << (value ? "true" : "false");
+		break;
+	}
+	case ControlTypeByte: {
+		uint8_t value;
+		memcpy(&value, control.value, sizeof(value));
+		ss << static_cast<unsigned int>(value);
+		break;
+	}
+	case ControlTypeInteger32: {
+		int32_t value;
+		memcpy(&value, control.value, sizeof(value));
+		ss << value;
+		break;
+	}
+	case ControlTypeInteger64: {
+		int64_t value;
+		memcpy(&value, control.value, sizeof(value));
+		ss << value;
+		break;
+	}
+	case ControlTypeFloat: {
+		float value;
+		memcpy(&value, control.value, sizeof(value));
+		ss << value;
+		break;
+	}
+	default:
+		ss << "<unknown>";
+		break;
+	}
+
+	return ss.str();
+}
+
+static void listFile(const CaptureFileReader &reader, int streamFilter)
+{
+	const CaptureFileHeader &header = reader.header();
+
+	for (unsigned int i = 0; i < header.numStreams; ++i) {
+		const CaptureFileStream &stream = header.streams[i];
+		PixelFormat format(stream.pixelFormat, stream.modifier);
+		std::string name(stream.name, strnlen(stream.name, sizeof(stream.name)));
+
+		std::cout << i << ": " << name << " " << stream.width << "x"
+			  << stream.height << "-" << format.toString()
+			  << " stride " << stream.stride
+			  << " frame size " << stream.frameSize << std::endl;
+	}
+
+	for (const CaptureFileRecord *record : reader.records()) {
+		if (streamFilter >= 0 && record->stream != static_cast<unsigned int>(streamFilter))
+			continue;
+
+		std::cout << "stream " << record->stream
+			  << " seq: " << std::setw(6) << std::setfill('0')
+			  << record->sequence << std::setfill(' ')
+			  << " timestamp: " << record->timestamp
+			  << " status: " << record->status
+			  << " bytesused: ";
+
+		for (unsigned int i = 0; i < record->numPlanes; ++i) {
+			std::cout << record->planes[i].bytesused;
+			if (i + 1 < record->numPlanes)
+				std::cout << "/";
+		}
+
+		for (unsigned int i = 0; i < record->numControls; ++i)
+			std::cout << " " << controlToString(record->controls[i]);
+
+		std::cout << std::endl;
+	}
+}
+
+static int extractFrames(const CaptureFileReader &reader, int streamFilter,
+			 const std::string &pattern)
+{
+	const CaptureFileHeader &header = reader.header();
+	size_t pos = pattern.find_first_of('#');
+
+	if (pos == std::string::npos) {
+		std::cerr << "The output file name must contain a '#' character"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	for (const CaptureFileRecord *record : reader.records()) {
+		if (streamFilter >= 0 && record->stream != static_cast<unsigned int>(streamFilter))
+			continue;
+
+		std::string name;
+		if (record->stream < header.numStreams) {
+			const char *streamName = header.streams[record->stream].name;
+			name.assign(streamName, strnlen(streamName, sizeof(header.streams[0].name)));
+		} else {
+			name = "stream" + std::to_string(record->stream);
+		}
+
+		std::stringstream ss;
+		ss << name << "-" << std::setw(6) << std::setfill('0')
+		   << record->sequence;
+
+		std::string filename = pattern;
+		filename.replace(pos, 1, ss.str());
+
+		int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			int ret = -errno;
+			std::cerr << "Failed to open " << filename << ": "
+				  << strerror(-ret) << std::endl;
+			return ret;
+		}
+
+		const uint8_t *data = reader.data(record);
+		size_t size = 0;
+		for (unsigned int i = 0; i < record->numPlanes; ++i)
+			size += record->planes[i].length;
+
+		ssize_t ret = write(fd, data, size);
+		close(fd);
+
+		if (ret < 0 || static_cast<size_t>(ret) != size) {
+			std::cerr << "Failed to write " << filename << std::endl;
+			return ret < 0 ? -errno : -EIO;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	OptionsParser parser;
+	parser.addOption(OptHelp, OptionNone, "Display this help message",
+			 "help");
+	parser.addOption(OptInput, OptionString, "Capture file to read",
+			 "input", ArgumentRequired, "file");
+	parser.addOption(OptList, OptionNone,
+			 "List the streams and frames stored in the capture file",
+			 "list");
+	parser.addOption(OptOutput, OptionString,
+			 "Extract frames to individual files\n"
+			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
+			 "The default file name is 'frame-#.bin'.",
+			 "output", ArgumentOptional, "filename");
+	parser.addOption(OptStream, OptionInteger,
+			 "Only process frames from stream <index>", "stream",
+			 ArgumentRequired, "index");
+
+	OptionsParser::Options options = parser.parse(argc, argv);
+	if (!options.valid())
+		return EXIT_FAILURE;
+
+	if (options.empty() || options.isSet(OptHelp) || !options.isSet(OptInput)) {
+		parser.usage();
+		return options.isSet(OptHelp) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	int streamFilter = options.isSet(OptStream)
+			 ? options[OptStream].toInteger() : -1;
+
+	CaptureFileReader reader;
+	int ret = reader.open(options[OptInput].toString());
+	if (ret < 0)
+		return EXIT_FAILURE;
+
+	if (options.isSet(OptList))
+		listFile(reader, streamFilter);
+
+	if (options.isSet(OptOutput)) {
+		std::string pattern = options[OptOutput].toString();
+		if (pattern.empty())
+			pattern = "frame-#.bin";
+
+		ret = extractFrames(reader, streamFilter, pattern);
+		if (ret < 0)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -182,6 +182,8 @@ int CamApp::parseOptions(int argc, char *argv[])
 	parser.addOption(OptFile, OptionString,
 			 "Write captured frames to disk\n"
 			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
+			 "Without a '#' character all frames are appended to a single file, and their location is recorded in a '.idx' index file.\n"
+			 "File names ending in '.lcr' store all frames along with their metadata in a capture file, which can be read back with cam-extract.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename");
 	parser.addOption(OptStream, &streamKeyValue,
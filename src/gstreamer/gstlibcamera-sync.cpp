@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-sync.cpp - Multi-camera frame synchronisation helpers
+ */
+
+#include "gstlibcamera-sync.h"
+
+/*
+ * \a window is expressed in the time base of the samples passed to update().
+ */
+LatencyTracker::LatencyTracker(uint64_t window)
+	: window_(window), reported_(0)
+{
+}
+
+void LatencyTracker::reset()
+{
+	samples_.clear();
+	reported_ = 0;
+}
+
+/*
+ * Record the \a latency sampled at \a time, and return true when the latency
+ * needs to be reported again. Increases of the windowed maximum are reported
+ * immediately, as late buffers would otherwise be dropped downstream, while
+ * decreases are only reported once the maximum has fallen by more than 1/8th
+ * of the reported value, to avoid flooding the pipeline with latency
+ * recalculations.
+ */
+bool LatencyTracker::update(uint64_t time, uint64_t latency)
+{
+	/* Smaller samples can't be the maximum anymore. */
+	while (!samples_.empty() && samples_.back().second <= latency)
+		samples_.pop_back();
+
+	samples_.emplace_back(time, latency);
+
+	while (samples_.front().first + window_ < time)
+		samples_.pop_front();
+
+	uint64_t maximum = samples_.front().second;
+
+	if (maximum > reported_ ||
+	    reported_ - maximum > reported_ / 8) {
+		reported_ = maximum;
+		return true;
+	}
+
+	return false;
+}
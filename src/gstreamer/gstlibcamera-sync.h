@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-sync.h - Multi-camera frame synchronisation helpers
+ */
+
+#ifndef __GST_LIBCAMERA_SYNC_H__
+#define __GST_LIBCAMERA_SYNC_H__
+
+#include <algorithm>
+#include <deque>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/*
+ * The helpers don't depend on GStreamer, times are expressed in nanoseconds
+ * as GstClockTime.
+ */
+
+/**
+ * \class FrameSetMatcher
+ * \brief Match the frames of several cameras into sets on their timestamps
+ *
+ * Completed frames are pushed to the queue of their camera. A set is made of
+ * the oldest frame of every camera, when all of them have been captured
+ * within the tolerance of the newest one. Older frames have no counterpart
+ * on at least one camera, and are discarded.
+ */
+template<typename Frame>
+class FrameSetMatcher
+{
+public:
+	enum DropReason {
+		DropUnmatched,
+		DropStarving,
+	};
+
+	void reset(unsigned int cameras)
+	{
+		/* Don't resize, deques of move-only frames can't be relocated. */
+		queues_ = std::vector<Queue>(cameras);
+	}
+
+	void push(unsigned int camera, uint64_t timestamp, Frame frame)
+	{
+		queues_[camera].emplace_back(timestamp, std::move(frame));
+	}
+
+	bool empty() const
+	{
+		for (const Queue &queue : queues_) {
+			if (!queue.empty())
+				return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * Match the oldest frames of all cameras into \a set, in camera
+	 * order. When a set can't be completed, a camera for which \a starving
+	 * returns true has its oldest frame discarded, to avoid running out of
+	 * queued requests while waiting for the other cameras. Discarded frames
+	 * are passed to \a drop, along with their camera index, age relative to
+	 * the newest candidate and reason.
+	 *
+	 * Return true if a complete set has been moved to \a set.
+	 */
+	template<typename Starving, typename Drop>
+	bool match(uint64_t tolerance, std::vector<Frame> *set,
+		   Starving starving, Drop drop)
+	{
+		while (true) {
+			uint64_t newest = 0;
+			bool complete = true;
+
+			for (const Queue &queue : queues_) {
+				if (queue.empty()) {
+					complete = false;
+					continue;
+				}
+
+				newest = std::max(newest, queue.front().first);
+			}
+
+			if (!complete) {
+				for (unsigned int i = 0; i < queues_.size(); ++i) {
+					if (queues_[i].empty() || !starving(i))
+						continue;
+
+					pop(i, 0, DropStarving, drop);
+				}
+
+				return false;
+			}
+
+			bool matched = true;
+			for (unsigned int i = 0; i < queues_.size(); ++i) {
+				uint64_t age = newest - queues_[i].front().first;
+				if (age <= tolerance)
+					continue;
+
+				pop(i, age, DropUnmatched, drop);
+				matched = false;
+			}
+
+			if (!matched)
+				continue;
+
+			for (Queue &queue : queues_) {
+				set->push_back(std::move(queue.front().second));
+				queue.pop_front();
+			}
+
+			return true;
+		}
+	}
+
+private:
+	using Queue = std::deque<std::pair<uint64_t, Frame>>;
+
+	template<typename Drop>
+	void pop(unsigned int camera, uint64_t age, DropReason reason, Drop drop)
+	{
+		Queue &queue = queues_[camera];
+		Frame frame = std::move(queue.front().second);
+		queue.pop_front();
+
+		drop(camera, std::move(frame), age, reason);
+	}
+
+	std::vector<Queue> queues_;
+};
+
+/**
+ * \class LatencyTracker
+ * \brief Track the maximum capture latency over a sliding window
+ */
+class LatencyTracker
+{
+public:
+	LatencyTracker(uint64_t window);
+
+	void reset();
+	bool update(uint64_t time, uint64_t latency);
+
+	uint64_t latency() const { return reported_; }
+
+private:
+	uint64_t window_;
+
+	/* Samples in time order, with strictly decreasing latencies. */
+	std::deque<std::pair<uint64_t, uint64_t>> samples_;
+	uint64_t reported_;
+};
+
+#endif /* __GST_LIBCAMERA_SYNC_H__ */
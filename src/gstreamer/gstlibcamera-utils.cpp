@@ -10,6 +10,8 @@
 
 #include <libcamera/formats.h>
 
+#include <gst/allocators/allocators.h>
+
 using namespace libcamera;
 
 static struct {
@@ -113,24 +115,103 @@ gst_libcamera_stream_formats_to_caps(const StreamFormats &formats)
 		}
 	}
 
-	return caps;
+	/*
+	 * All buffers are backed by dmabufs, advertise raw formats with the
+	 * memory:DMABuf caps feature too to let downstream elements that can
+	 * import them select zero-copy operation. System memory caps come
+	 * first, to keep them preferred by elements that accept any caps
+	 * features without handling them.
+	 */
+	GstCaps *dmabuf_caps = gst_caps_new_empty();
+
+	for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+		GstStructure *s = gst_caps_get_structure(caps, i);
+
+		if (!gst_structure_has_name(s, "video/x-raw"))
+			continue;
+
+		gst_caps_append_structure_full(dmabuf_caps, gst_structure_copy(s),
+					       gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF, nullptr));
+	}
+
+	return gst_caps_merge(caps, dmabuf_caps);
 }
 
 GstCaps *
-gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg)
+gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg,
+					   bool dmabuf)
 {
 	GstCaps *caps = gst_caps_new_empty();
 	GstStructure *s = bare_structure_from_format(stream_cfg.pixelFormat);
+	GstCapsFeatures *features = nullptr;
 
 	gst_structure_set(s,
 			  "width", G_TYPE_INT, stream_cfg.size.width,
 			  "height", G_TYPE_INT, stream_cfg.size.height,
 			  nullptr);
-	gst_caps_append_structure(caps, s);
+
+	if (dmabuf && gst_structure_has_name(s, "video/x-raw"))
+		features = gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF, nullptr);
+
+	gst_caps_append_structure_full(caps, s, features);
 
 	return caps;
 }
 
+bool
+gst_libcamera_stream_configuration_to_video_info(const StreamConfiguration &stream_cfg,
+						 GstVideoInfo *info)
+{
+	GstVideoFormat gst_format = pixel_format_to_gst_format(stream_cfg.pixelFormat);
+	if (gst_format == GST_VIDEO_FORMAT_UNKNOWN ||
+	    gst_format == GST_VIDEO_FORMAT_ENCODED)
+		return false;
+
+	if (!gst_video_info_set_format(info, gst_format, stream_cfg.size.width,
+				       stream_cfg.size.height))
+		return false;
+
+	/*
+	 * Compute the plane layout from the stride reported by the camera.
+	 * When the camera doesn't report a stride, keep the default GStreamer
+	 * layout.
+	 */
+	if (!stream_cfg.stride)
+		return true;
+
+	/*
+	 * The camera reports the stride of the first plane only. Scale it for
+	 * the other planes by the ratio of their pixel strides, and by their
+	 * horizontal subsampling, based on the first component they store.
+	 */
+	const GstVideoFormatInfo *finfo = info->finfo;
+	gint plane_comp[GST_VIDEO_MAX_PLANES] = { -1, -1, -1, -1 };
+	for (guint c = 0; c < GST_VIDEO_FORMAT_INFO_N_COMPONENTS(finfo); c++) {
+		guint plane = GST_VIDEO_FORMAT_INFO_PLANE(finfo, c);
+		if (plane_comp[plane] < 0)
+			plane_comp[plane] = c;
+	}
+
+	gint pstride0 = GST_VIDEO_FORMAT_INFO_PSTRIDE(finfo, plane_comp[0]);
+	gsize offset = 0;
+	for (guint i = 0; i < GST_VIDEO_INFO_N_PLANES(info); i++) {
+		gint comp = plane_comp[i];
+		gint stride = stream_cfg.stride
+			    * GST_VIDEO_FORMAT_INFO_PSTRIDE(finfo, comp) / pstride0;
+		stride = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH(finfo, comp, stride);
+		gint lines = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT(finfo, comp,
+								stream_cfg.size.height);
+
+		GST_VIDEO_INFO_PLANE_STRIDE(info, i) = stride;
+		GST_VIDEO_INFO_PLANE_OFFSET(info, i) = offset;
+		offset += stride * lines;
+	}
+
+	GST_VIDEO_INFO_SIZE(info) = offset;
+
+	return true;
+}
+
 void
 gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
 					 GstCaps *caps)
@@ -178,3 +259,91 @@ gst_libcamera_resume_task(GstTask *task)
 		GST_TASK_SIGNAL(task);
 	}
 }
+
+G_LOCK_DEFINE_STATIC(cm_singleton_lock);
+static CameraManager *cm_singleton = nullptr;
+static guint cm_singleton_refcount = 0;
+
+static void
+gst_libcamera_camera_manager_release(CameraManager *cm)
+{
+	G_LOCK(cm_singleton_lock);
+
+	g_assert(cm == cm_singleton);
+
+	/*
+	 * Destroy the camera manager with the lock held, to prevent a new one
+	 * from being created while the previous one still exists.
+	 */
+	if (--cm_singleton_refcount == 0) {
+		delete cm_singleton;
+		cm_singleton = nullptr;
+	}
+
+	G_UNLOCK(cm_singleton_lock);
+}
+
+/*
+ * Only a single CameraManager can exist in a process. Share one started
+ * instance between all the elements and the device provider of the plugin,
+ * and destroy it when the last user releases its reference.
+ */
+std::shared_ptr<CameraManager>
+gst_libcamera_get_camera_manager(int &ret)
+{
+	G_LOCK(cm_singleton_lock);
+
+	if (!cm_singleton) {
+		CameraManager *cm = new CameraManager();
+
+		ret = cm->start();
+		if (ret) {
+			delete cm;
+			G_UNLOCK(cm_singleton_lock);
+			return nullptr;
+		}
+
+		cm_singleton = cm;
+	}
+
+	cm_singleton_refcount++;
+	ret = 0;
+
+	G_UNLOCK(cm_singleton_lock);
+
+	return std::shared_ptr<CameraManager>(cm_singleton,
+					      gst_libcamera_camera_manager_release);
+}
+
+/*
+ * Check if a clock runs in the CLOCK_MONOTONIC domain of the libcamera frame
+ * timestamps. This is the case of the system clock in monotonic mode.
+ */
+bool
+gst_libcamera_clock_is_monotonic(GstClock *clock)
+{
+	GstClockType type;
+
+	if (!clock || !GST_IS_SYSTEM_CLOCK(clock))
+		return false;
+
+	g_object_get(clock, "clock-type", &type, nullptr);
+	return type == GST_CLOCK_TYPE_MONOTONIC;
+}
+
+/*
+ * Sample the offset between a clock and CLOCK_MONOTONIC. The clock query is
+ * bracketed by two system time samples to halve the sampling error. The
+ * system time of the sample is returned in \a sys_time.
+ */
+GstClockTimeDiff
+gst_libcamera_clock_get_offset(GstClock *clock, GstClockTime *sys_time)
+{
+	GstClockTime before = g_get_monotonic_time() * 1000;
+	GstClockTime clock_time = gst_clock_get_time(clock);
+	GstClockTime after = g_get_monotonic_time() * 1000;
+
+	*sys_time = before + (after - before) / 2;
+
+	return GST_CLOCK_DIFF(*sys_time, clock_time);
+}
@@ -9,16 +9,26 @@
 #ifndef __GST_LIBCAMERA_UTILS_H__
 #define __GST_LIBCAMERA_UTILS_H__
 
+#include <memory>
+
 #include <gst/gst.h>
 #include <gst/video/video.h>
 
+#include <libcamera/camera_manager.h>
 #include <libcamera/stream.h>
 
 GstCaps *gst_libcamera_stream_formats_to_caps(const libcamera::StreamFormats &formats);
-GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfiguration &stream_cfg);
+GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfiguration &stream_cfg,
+						    bool dmabuf);
+bool gst_libcamera_stream_configuration_to_video_info(const libcamera::StreamConfiguration &stream_cfg,
+						      GstVideoInfo *info);
 void gst_libcamera_configure_stream_from_caps(libcamera::StreamConfiguration &stream_cfg,
 					      GstCaps *caps);
 void gst_libcamera_resume_task(GstTask *task);
+std::shared_ptr<libcamera::CameraManager> gst_libcamera_get_camera_manager(int &ret);
+bool gst_libcamera_clock_is_monotonic(GstClock *clock);
+GstClockTimeDiff gst_libcamera_clock_get_offset(GstClock *clock,
+						GstClockTime *sys_time);
 
 /**
  * \class GLibLocker
@@ -6,6 +6,7 @@
  * gstlibcamera.c - GStreamer plugin
  */
 
+#include "gstlibcameramultisrc.h"
 #include "gstlibcameraprovider.h"
 #include "gstlibcamerasrc.h"
 
@@ -14,6 +15,8 @@ plugin_init(GstPlugin *plugin)
 {
 	if (!gst_element_register(plugin, "libcamerasrc", GST_RANK_PRIMARY,
 				  GST_TYPE_LIBCAMERA_SRC) ||
+	    !gst_element_register(plugin, "libcameramultisrc", GST_RANK_NONE,
+				  GST_TYPE_LIBCAMERA_MULTI_SRC) ||
 	    !gst_device_provider_register(plugin, "libcameraprovider",
 					  GST_RANK_PRIMARY,
 					  GST_TYPE_LIBCAMERA_PROVIDER))
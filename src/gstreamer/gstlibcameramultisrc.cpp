@@ -0,0 +1,1046 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcameramultisrc.cpp - GStreamer Multi-Camera Synchronous Capture Element
+ */
+
+/*
+ * The libcameramultisrc element captures from several cameras at once, with
+ * one source pad per camera, and outputs frame sets made of one frame per
+ * camera, captured within a tolerance of each other. All buffers of a set
+ * carry the same PTS and offset, and the capture time of each frame is
+ * attached as a GstReferenceTimestampMeta.
+ *
+ * Frames are matched on their capture timestamps. When a camera drops a
+ * frame, the frames captured by the other cameras at the same time can't be
+ * matched and are discarded. A camera is never left without queued requests
+ * while waiting for its peers: its oldest frame is discarded instead.
+ *
+ * The reported latency is the maximum delay between capture and output over
+ * the last few seconds, so that a single slow frame doesn't inflate the
+ * pipeline latency for the rest of the session.
+ *
+ * \todo Support multiple streams per camera
+ * \todo Support importing buffers from downstream pools
+ */
+
+#include "gstlibcameramultisrc.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <gst/base/base.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+
+#include "gstlibcameraallocator.h"
+#include "gstlibcamerapad.h"
+#include "gstlibcamerapool.h"
+#include "gstlibcamera-sync.h"
+#include "gstlibcamera-utils.h"
+
+using namespace libcamera;
+
+GST_DEBUG_CATEGORY_STATIC(multi_source_debug);
+#define GST_CAT_DEFAULT multi_source_debug
+
+/* Matching tolerance used until the frame interval has been measured. */
+#define DEFAULT_SYNC_TOLERANCE (5 * GST_MSECOND)
+
+/* Interval between capture latency samples, in frame timestamp time. */
+static constexpr GstClockTime kLatencySampleInterval = 100 * GST_MSECOND;
+
+/* Window over which the maximum capture latency is reported. */
+static constexpr GstClockTime kLatencyWindow = 2 * GST_SECOND;
+
+struct CaptureRequest {
+	CaptureRequest(std::unique_ptr<Request> request);
+	~CaptureRequest();
+
+	void reset();
+
+	std::unique_ptr<Request> request_;
+	GstBuffer *buffer_;
+	GstClockTime timestamp_;
+};
+
+CaptureRequest::CaptureRequest(std::unique_ptr<Request> request)
+	: request_(std::move(request)), buffer_(nullptr), timestamp_(0)
+{
+}
+
+CaptureRequest::~CaptureRequest()
+{
+	if (buffer_)
+		gst_buffer_unref(buffer_);
+}
+
+/* Release the buffer and reset the request, to prepare it for reuse. */
+void CaptureRequest::reset()
+{
+	if (buffer_) {
+		gst_buffer_unref(buffer_);
+		buffer_ = nullptr;
+	}
+
+	request_->reuse();
+}
+
+struct GstLibcameraMultiSrcState;
+
+/* Per-camera state. */
+struct CameraContext {
+	CameraContext(GstLibcameraMultiSrcState *state, unsigned int index,
+		      std::shared_ptr<Camera> cam, GstPad *srcpad);
+
+	void queueRequests();
+	void recycle(std::unique_ptr<CaptureRequest> capture);
+	void requestCompleted(Request *request);
+
+	GstLibcameraMultiSrcState *state_;
+	unsigned int index_;
+	std::shared_ptr<Camera> cam_;
+	std::unique_ptr<CameraConfiguration> config_;
+	GstLibcameraAllocator *allocator_;
+	GstPad *srcpad_;
+
+	/*
+	 * Requests queued to the camera in queueing order, and requests ready
+	 * to be reused. Completed requests wait to be matched in the element
+	 * frame matcher. Protected by the element object lock, as well as the
+	 * fields below.
+	 */
+	std::deque<std::unique_ptr<CaptureRequest>> queued_;
+	std::vector<std::unique_ptr<CaptureRequest>> free_;
+
+	gint64 lastSequence_;
+	GstClockTime lastTimestamp_;
+	GstClockTime interval_;
+	guint64 dropped_;
+	guint64 missed_;
+};
+
+using CaptureMatcher = FrameSetMatcher<std::unique_ptr<CaptureRequest>>;
+
+/* Used for C++ object with destructors. */
+struct GstLibcameraMultiSrcState {
+	GstLibcameraMultiSrc *src_;
+
+	std::shared_ptr<CameraManager> cm_;
+	std::vector<std::unique_ptr<CameraContext>> cameras_;
+	GstCaps *timestampCaps_;
+
+	/* Protected by the object lock. */
+	CaptureMatcher matcher_;
+	guint64 sets_;
+	bool monotonicClock_;
+	GstClockTimeDiff clockOffset_;
+	GstClockTime clockOffsetTime_;
+	GstClockTime lastCaptureTime_;
+	GstClockTime latencySampleTime_;
+	LatencyTracker latency_{ kLatencyWindow };
+	bool latencyChanged_;
+
+	void updateClockOffset();
+	GstClockTime tolerance() const;
+	bool matchFrames(std::vector<std::unique_ptr<CaptureRequest>> &set);
+	std::vector<GstBuffer *> outputSet(std::vector<std::unique_ptr<CaptureRequest>> &set);
+};
+
+struct _GstLibcameraMultiSrc {
+	GstElement parent;
+
+	GRecMutex stream_lock;
+	GstTask *task;
+
+	gchar *camera_names;
+	guint64 sync_tolerance;
+
+	GstLibcameraMultiSrcState *state;
+	GstFlowCombiner *flow_combiner;
+};
+
+enum {
+	PROP_0,
+	PROP_CAMERA_NAMES,
+	PROP_SYNC_TOLERANCE,
+	PROP_STATS,
+};
+
+G_DEFINE_TYPE_WITH_CODE(GstLibcameraMultiSrc, gst_libcamera_multi_src, GST_TYPE_ELEMENT,
+			GST_DEBUG_CATEGORY_INIT(multi_source_debug, "libcameramultisrc", 0,
+						"libcamera Multi-Camera Source"));
+
+/*
+ * System memory caps come first, to keep them preferred by elements that
+ * accept any caps features without handling dmabufs.
+ */
+#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; " \
+				      "video/x-raw(" GST_CAPS_FEATURE_MEMORY_DMABUF "); " \
+				      "image/jpeg")
+
+/* One src pad is created for each camera when the element is opened. */
+GstStaticPadTemplate multi_src_template = {
+	"src_%u", GST_PAD_SRC, GST_PAD_SOMETIMES, TEMPLATE_CAPS
+};
+
+CameraContext::CameraContext(GstLibcameraMultiSrcState *state, unsigned int index,
+			     std::shared_ptr<Camera> cam, GstPad *srcpad)
+	: state_(state), index_(index), cam_(cam), allocator_(nullptr), srcpad_(srcpad),
+	  lastSequence_(-1), lastTimestamp_(0), interval_(0), dropped_(0),
+	  missed_(0)
+{
+}
+
+/*
+ * Queue requests until no more buffers are available. Completed requests are
+ * reused.
+ */
+void CameraContext::queueRequests()
+{
+	GstLibcameraMultiSrc *src = state_->src_;
+	GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad_);
+	Stream *stream = config_->at(0).stream();
+
+	while (true) {
+		std::unique_ptr<CaptureRequest> capture;
+
+		{
+			GLibLocker lock(GST_OBJECT(src));
+
+			if (!free_.empty()) {
+				capture = std::move(free_.back());
+				free_.pop_back();
+			}
+		}
+
+		if (!capture) {
+			std::unique_ptr<Request> request = cam_->createReusableRequest();
+			if (!request)
+				break;
+
+			capture = std::make_unique<CaptureRequest>(std::move(request));
+		}
+
+		GstBuffer *buffer;
+		bool ready = gst_libcamera_pool_acquire(pool, &buffer, false) == GST_FLOW_OK;
+		if (ready) {
+			FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+
+			capture->buffer_ = buffer;
+			ready = capture->request_->addBuffer(stream, fb) == 0;
+		}
+
+		GLibLocker lock(GST_OBJECT(src));
+
+		if (ready) {
+			GST_TRACE_OBJECT(srcpad_, "Requesting buffer");
+			ready = cam_->queueRequest(capture->request_.get()) == 0;
+		}
+
+		if (!ready) {
+			/* Release the buffer and keep the request for later. */
+			recycle(std::move(capture));
+			break;
+		}
+
+		queued_.push_back(std::move(capture));
+	}
+}
+
+/* Must be called with the object lock held. */
+void CameraContext::recycle(std::unique_ptr<CaptureRequest> capture)
+{
+	capture->reset();
+	free_.push_back(std::move(capture));
+}
+
+void CameraContext::requestCompleted(Request *request)
+{
+	GstLibcameraMultiSrc *src = state_->src_;
+	GLibLocker lock(GST_OBJECT(src));
+
+	std::unique_ptr<CaptureRequest> capture = std::move(queued_.front());
+	queued_.pop_front();
+
+	g_return_if_fail(capture->request_.get() == request);
+
+	if (request->status() == Request::RequestCancelled) {
+		GST_DEBUG_OBJECT(srcpad_, "Request was cancelled");
+		recycle(std::move(capture));
+		return;
+	}
+
+	FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(capture->buffer_);
+	const FrameMetadata &metadata = fb->metadata();
+
+	/* Account for the frames the camera failed to capture. */
+	guint64 frames = 1;
+	if (lastSequence_ >= 0 && metadata.sequence > lastSequence_) {
+		frames = metadata.sequence - lastSequence_;
+		missed_ += frames - 1;
+	}
+	lastSequence_ = metadata.sequence;
+
+	if (metadata.status != FrameMetadata::FrameSuccess) {
+		GST_DEBUG_OBJECT(srcpad_, "Dropping frame %u with status %u",
+				 metadata.sequence, (unsigned int)metadata.status);
+		dropped_++;
+		recycle(std::move(capture));
+		gst_libcamera_resume_task(src->task);
+		return;
+	}
+
+	/* Estimate the frame interval, used to derive the matching tolerance. */
+	if (lastTimestamp_ && metadata.timestamp > lastTimestamp_) {
+		GstClockTime interval = (metadata.timestamp - lastTimestamp_) / frames;
+		interval_ = interval_ ? (interval_ * 7 + interval) / 8 : interval;
+	}
+	lastTimestamp_ = metadata.timestamp;
+
+	capture->timestamp_ = metadata.timestamp;
+	state_->matcher_.push(index_, metadata.timestamp, std::move(capture));
+
+	gst_libcamera_resume_task(src->task);
+}
+
+/*
+ * Sample the offset between the element clock and CLOCK_MONOTONIC, at most
+ * once per second of captured frames, from the streaming thread. The frame
+ * timestamps are used as the time base, so checking whether a new sample is
+ * due doesn't require reading the system clock.
+ */
+void
+GstLibcameraMultiSrcState::updateClockOffset()
+{
+	g_autoptr(GstClock) clock = nullptr;
+
+	{
+		GLibLocker lock(GST_OBJECT(src_));
+
+		if (monotonicClock_ || !GST_ELEMENT_CLOCK(src_))
+			return;
+
+		if (GST_CLOCK_TIME_IS_VALID(clockOffsetTime_) &&
+		    (!GST_CLOCK_TIME_IS_VALID(lastCaptureTime_) ||
+		     lastCaptureTime_ < clockOffsetTime_ + GST_SECOND))
+			return;
+
+		clock = GST_CLOCK(gst_object_ref(GST_ELEMENT_CLOCK(src_)));
+	}
+
+	GstClockTime sys_time;
+	GstClockTimeDiff offset = gst_libcamera_clock_get_offset(clock, &sys_time);
+
+	GLibLocker lock(GST_OBJECT(src_));
+	clockOffset_ = offset;
+	clockOffsetTime_ = sys_time;
+}
+
+/*
+ * The maximum capture time difference between the frames of a set. Unless
+ * set explicitly, use half of the shortest frame interval.
+ */
+GstClockTime
+GstLibcameraMultiSrcState::tolerance() const
+{
+	GstClockTime interval = GST_CLOCK_TIME_NONE;
+
+	if (src_->sync_tolerance)
+		return src_->sync_tolerance;
+
+	for (const std::unique_ptr<CameraContext> &camera : cameras_) {
+		if (camera->interval_)
+			interval = std::min(interval, camera->interval_);
+	}
+
+	if (!GST_CLOCK_TIME_IS_VALID(interval))
+		return DEFAULT_SYNC_TOLERANCE;
+
+	return interval / 2;
+}
+
+/*
+ * Match the oldest completed frames of all cameras into a set, discarding the
+ * frames that have no counterpart on at least one camera. Must be called with
+ * the object lock held.
+ *
+ * Return true if a complete set has been moved to \a set.
+ */
+bool
+GstLibcameraMultiSrcState::matchFrames(std::vector<std::unique_ptr<CaptureRequest>> &set)
+{
+	/* Don't let a camera run out of queued requests. */
+	auto starving = [&](unsigned int index) {
+		return cameras_[index]->queued_.empty();
+	};
+
+	auto drop = [&](unsigned int index, std::unique_ptr<CaptureRequest> capture,
+			GstClockTime age, CaptureMatcher::DropReason reason) {
+		CameraContext *camera = cameras_[index].get();
+
+		if (reason == CaptureMatcher::DropStarving)
+			GST_DEBUG_OBJECT(camera->srcpad_,
+					 "No request queued, dropping oldest frame");
+		else
+			GST_DEBUG_OBJECT(camera->srcpad_,
+					 "Dropping unmatched frame (%" GST_TIME_FORMAT
+					 " older than the set)", GST_TIME_ARGS(age));
+
+		camera->dropped_++;
+		camera->recycle(std::move(capture));
+	};
+
+	return matcher_.match(tolerance(), &set, starving, drop);
+}
+
+/*
+ * Detach the buffers of a matched set and timestamp them. All buffers carry
+ * the capture time of the first camera, converted to running time, and the
+ * set index as offset. Must be called with the object lock held.
+ */
+std::vector<GstBuffer *>
+GstLibcameraMultiSrcState::outputSet(std::vector<std::unique_ptr<CaptureRequest>> &set)
+{
+	std::vector<GstBuffer *> buffers;
+	GstClockTime capture_time = GST_CLOCK_TIME_NONE;
+	GstClockTime pts = 0;
+
+	if (GST_ELEMENT_CLOCK(src_)) {
+		GstClockTime base_time = GST_ELEMENT(src_)->base_time;
+
+		/* The offset is zero when the element clock is monotonic. */
+		GstClockTime timestamp = set[0]->timestamp_ + clockOffset_;
+		pts = timestamp > base_time ? timestamp - base_time : 0;
+	}
+
+	for (gsize i = 0; i < set.size(); i++) {
+		std::unique_ptr<CaptureRequest> &capture = set[i];
+		GstBuffer *buffer = capture->buffer_;
+
+		capture->buffer_ = nullptr;
+
+		GST_BUFFER_PTS(buffer) = pts;
+		GST_BUFFER_OFFSET(buffer) = sets_;
+		GST_BUFFER_OFFSET_END(buffer) = sets_;
+		gst_buffer_add_reference_timestamp_meta(buffer, timestampCaps_,
+							capture->timestamp_,
+							GST_CLOCK_TIME_NONE);
+
+		capture_time = std::min(capture_time, capture->timestamp_);
+
+		buffers.push_back(buffer);
+		cameras_[i]->recycle(std::move(capture));
+	}
+
+	/*
+	 * Sample the delay between the capture of the oldest frame of the set
+	 * and its output every kLatencySampleInterval of captured frames, using
+	 * the frame timestamps as the time base, to avoid reading the system
+	 * clock for every set.
+	 */
+	lastCaptureTime_ = capture_time;
+
+	if (!GST_CLOCK_TIME_IS_VALID(latencySampleTime_) ||
+	    capture_time >= latencySampleTime_ + kLatencySampleInterval) {
+		GstClockTime sys_now = g_get_monotonic_time() * 1000;
+
+		latencySampleTime_ = capture_time;
+		if (capture_time <= sys_now &&
+		    latency_.update(capture_time, sys_now - capture_time)) {
+			latencyChanged_ = true;
+
+			for (std::unique_ptr<CameraContext> &camera : cameras_)
+				gst_libcamera_pad_set_latency(camera->srcpad_,
+							      latency_.latency());
+		}
+	}
+
+	sets_++;
+
+	return buffers;
+}
+
+static bool
+gst_libcamera_multi_src_open(GstLibcameraMultiSrc *self)
+{
+	GstLibcameraMultiSrcState *state = self->state;
+	GstPadTemplate *templ = gst_element_get_pad_template(GST_ELEMENT(self), "src_%u");
+	std::vector<std::shared_ptr<Camera>> cameras;
+	std::shared_ptr<CameraManager> cm;
+	gint ret = 0;
+
+	GST_DEBUG_OBJECT(self, "Opening camera devices ...");
+
+	cm = gst_libcamera_get_camera_manager(ret);
+	if (ret) {
+		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
+				  ("Failed listing cameras."),
+				  ("libcamera::CameraMananger::start() failed: %s", g_strerror(-ret)));
+		return false;
+	}
+
+	/* No need to lock here, we didn't start our threads yet. */
+	state->cm_ = cm;
+
+	g_auto(GStrv) names = nullptr;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		if (self->camera_names)
+			names = g_strsplit(self->camera_names, ",", -1);
+	}
+
+	if (names) {
+		for (gchar **name = names; *name; name++) {
+			std::shared_ptr<Camera> cam = cm->get(g_strstrip(*name));
+			if (!cam) {
+				GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+						  ("Could not find a camera named '%s'.", *name),
+						  ("libcamera::CameraMananger::get() returned nullptr"));
+				return false;
+			}
+
+			cameras.push_back(cam);
+		}
+	} else {
+		cameras = cm->cameras();
+	}
+
+	if (cameras.empty()) {
+		GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+				  ("Could not find any supported camera on this system."),
+				  ("libcamera::CameraMananger::cameras() is empty"));
+		return false;
+	}
+
+	for (const std::shared_ptr<Camera> &cam : cameras) {
+		GST_INFO_OBJECT(self, "Using camera '%s'", cam->id().c_str());
+
+		ret = cam->acquire();
+		if (ret) {
+			GST_ELEMENT_ERROR(self, RESOURCE, BUSY,
+					  ("Camera '%s' is already in use.", cam->id().c_str()),
+					  ("libcamera::Camera::acquire() failed: %s", g_strerror(ret)));
+			return false;
+		}
+
+		g_autofree gchar *name = g_strdup_printf("src_%u",
+							 (guint)state->cameras_.size());
+		GstPad *srcpad = gst_pad_new_from_template(templ, name);
+
+		auto camera = std::make_unique<CameraContext>(state, state->cameras_.size(),
+							      cam, srcpad);
+		cam->requestCompleted.connect(camera.get(), &CameraContext::requestCompleted);
+
+		{
+			/* The statistics are read from the cameras under the lock. */
+			GLibLocker lock(GST_OBJECT(self));
+			state->cameras_.push_back(std::move(camera));
+		}
+
+		gst_element_add_pad(GST_ELEMENT(self), srcpad);
+	}
+
+	gst_element_no_more_pads(GST_ELEMENT(self));
+
+	return true;
+}
+
+static void
+gst_libcamera_multi_src_close(GstLibcameraMultiSrc *self)
+{
+	GstLibcameraMultiSrcState *state = self->state;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Releasing resources");
+
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+		/* The camera is shared with other elements, disconnect from it. */
+		camera->cam_->requestCompleted.disconnect(camera.get());
+
+		ret = camera->cam_->release();
+		if (ret) {
+			GST_ELEMENT_WARNING(self, RESOURCE, BUSY,
+					    ("Camera '%s' is still in use.", camera->cam_->id().c_str()),
+					    ("libcamera::Camera.release() failed: %s", g_strerror(-ret)));
+		}
+
+		gst_element_remove_pad(GST_ELEMENT(self), camera->srcpad_);
+	}
+
+	std::vector<std::unique_ptr<CameraContext>> cameras;
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		cameras.swap(state->cameras_);
+	}
+
+	cameras.clear();
+	state->cm_.reset();
+}
+
+static void
+gst_libcamera_multi_src_task_run(gpointer user_data)
+{
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(user_data);
+	GstLibcameraMultiSrcState *state = self->state;
+	std::vector<std::vector<GstBuffer *>> sets;
+	bool latency_changed;
+
+	state->updateClockOffset();
+
+	/*
+	 * Extract the matched sets first, so that the requests of the
+	 * discarded frames can be queued again right away.
+	 */
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		std::vector<std::unique_ptr<CaptureRequest>> set;
+
+		while (state->matchFrames(set)) {
+			sets.push_back(state->outputSet(set));
+			set.clear();
+		}
+
+		latency_changed = state->latencyChanged_;
+		state->latencyChanged_ = false;
+	}
+
+	if (latency_changed)
+		gst_element_post_message(GST_ELEMENT(self),
+					 gst_message_new_latency(GST_OBJECT(self)));
+
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_)
+		camera->queueRequests();
+
+	for (std::vector<GstBuffer *> &buffers : sets) {
+		for (gsize i = 0; i < buffers.size(); i++)
+			gst_libcamera_pad_queue_buffer(state->cameras_[i]->srcpad_,
+						       buffers[i]);
+	}
+
+	GstFlowReturn ret = GST_FLOW_OK;
+	gst_flow_combiner_reset(self->flow_combiner);
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+		ret = gst_libcamera_pad_push_pending(camera->srcpad_);
+		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
+							camera->srcpad_, ret);
+	}
+
+	{
+		/*
+		 * Here we need to decide if we want to pause or stop the task. This
+		 * needs to happen in lock step with the callback thread which may want
+		 * to resume the task.
+		 */
+		GLibLocker lock(GST_OBJECT(self));
+		if (ret != GST_FLOW_OK) {
+			if (ret == GST_FLOW_EOS) {
+				g_autoptr(GstEvent) eos = gst_event_new_eos();
+				guint32 seqnum = gst_util_seqnum_next();
+				gst_event_set_seqnum(eos, seqnum);
+				for (std::unique_ptr<CameraContext> &camera : state->cameras_)
+					gst_pad_push_event(camera->srcpad_, gst_event_ref(eos));
+			} else if (ret != GST_FLOW_FLUSHING) {
+				GST_ELEMENT_FLOW_ERROR(self, ret);
+			}
+			gst_task_stop(self->task);
+			return;
+		}
+
+		bool do_pause = state->matcher_.empty();
+		for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+			if (gst_libcamera_pad_has_pending(camera->srcpad_)) {
+				do_pause = false;
+				break;
+			}
+		}
+
+		if (do_pause)
+			gst_task_pause(self->task);
+	}
+}
+
+static void
+gst_libcamera_multi_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
+{
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(user_data);
+	GLibRecLocker lock(&self->stream_lock);
+	GstLibcameraMultiSrcState *state = self->state;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread has started");
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+
+		state->matcher_.reset(state->cameras_.size());
+		state->sets_ = 0;
+		state->lastCaptureTime_ = GST_CLOCK_TIME_NONE;
+		state->latencySampleTime_ = GST_CLOCK_TIME_NONE;
+		state->latency_.reset();
+		state->latencyChanged_ = false;
+
+		for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+			camera->lastSequence_ = -1;
+			camera->lastTimestamp_ = 0;
+			camera->interval_ = 0;
+			camera->dropped_ = 0;
+			camera->missed_ = 0;
+		}
+	}
+
+	self->flow_combiner = gst_flow_combiner_new();
+
+	/* The streams of all cameras belong to the same group. */
+	guint group_id = gst_util_group_id_next();
+
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+		GstPad *srcpad = camera->srcpad_;
+
+		/* Create stream-id and push stream-start. */
+		g_autofree gchar *stream_id =
+			gst_pad_create_stream_id(srcpad, GST_ELEMENT(self),
+						 camera->cam_->id().c_str());
+		GstEvent *event = gst_event_new_stream_start(stream_id);
+		gst_event_set_group_id(event, group_id);
+		gst_pad_push_event(srcpad, event);
+
+		camera->config_ = camera->cam_->generateConfiguration({ gst_libcamera_pad_get_role(srcpad) });
+		if (!camera->config_ || camera->config_->size() != 1) {
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			gst_task_stop(task);
+			return;
+		}
+
+		StreamConfiguration &stream_cfg = camera->config_->at(0);
+
+		/* Retrieve the supported caps, fixate them and configure the stream. */
+		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
+		if (gst_caps_is_empty(caps)) {
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			gst_task_stop(task);
+			return;
+		}
+
+		caps = gst_caps_make_writable(caps);
+		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
+
+		GstCapsFeatures *features = gst_caps_get_features(caps, 0);
+		bool dmabuf = features &&
+			      gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_DMABUF);
+
+		if (camera->config_->validate() == CameraConfiguration::Invalid) {
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			gst_task_stop(task);
+			return;
+		}
+
+		/*
+		 * Regardless if it has been modified, create clean caps and
+		 * push the caps event. Downstream will decide if the caps are
+		 * acceptable.
+		 */
+		g_autoptr(GstCaps) out_caps =
+			gst_libcamera_stream_configuration_to_caps(stream_cfg, dmabuf);
+		if (!gst_pad_push_event(srcpad, gst_event_new_caps(out_caps))) {
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			gst_task_stop(task);
+			return;
+		}
+
+		/* Send an open segment event with time format. */
+		GstSegment segment;
+		gst_segment_init(&segment, GST_FORMAT_TIME);
+		gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
+
+		ret = camera->cam_->configure(camera->config_.get());
+		if (ret) {
+			GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+					  ("Failed to configure camera '%s': %s",
+					   camera->cam_->id().c_str(), g_strerror(-ret)),
+					  ("Camera::configure() failed with error code %i", ret));
+			gst_task_stop(task);
+			return;
+		}
+
+		camera->allocator_ = gst_libcamera_allocator_new(camera->cam_);
+		if (!camera->allocator_) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+					  ("Failed to allocate memory"),
+					  ("gst_libcamera_allocator_new() failed."));
+			gst_task_stop(task);
+			return;
+		}
+
+		GstLibcameraPool *pool = gst_libcamera_pool_new(camera->allocator_,
+								stream_cfg.stream());
+		g_signal_connect_swapped(pool, "buffer-notify",
+					 G_CALLBACK(gst_libcamera_resume_task), task);
+
+		GstVideoInfo info;
+		if (gst_libcamera_stream_configuration_to_video_info(stream_cfg, &info))
+			gst_libcamera_pool_set_video_info(pool, &info);
+
+		gst_libcamera_pad_set_pool(srcpad, pool);
+		gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
+	}
+
+	/* Start all cameras back to back to minimize the initial offset. */
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+		ret = camera->cam_->start();
+		if (ret) {
+			GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+					  ("Failed to start camera '%s': %s",
+					   camera->cam_->id().c_str(), g_strerror(-ret)),
+					  ("Camera.start() failed with error code %i", ret));
+			gst_task_stop(task);
+			return;
+		}
+	}
+}
+
+static void
+gst_libcamera_multi_src_task_leave(GstTask *task, GThread *thread, gpointer user_data)
+{
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(user_data);
+	GstLibcameraMultiSrcState *state = self->state;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread is about to stop");
+
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_)
+		camera->cam_->stop();
+
+	/* All requests have completed or been cancelled, free them. */
+	{
+		GLibLocker lock(GST_OBJECT(self));
+
+		state->matcher_.reset(state->cameras_.size());
+
+		for (std::unique_ptr<CameraContext> &camera : state->cameras_)
+			camera->free_.clear();
+	}
+
+	for (std::unique_ptr<CameraContext> &camera : state->cameras_) {
+		gst_libcamera_pad_set_pool(camera->srcpad_, nullptr);
+		g_clear_object(&camera->allocator_);
+	}
+
+	g_clear_pointer(&self->flow_combiner,
+			(GDestroyNotify)gst_flow_combiner_free);
+}
+
+static void
+gst_libcamera_multi_src_set_property(GObject *object, guint prop_id,
+				     const GValue *value, GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(object);
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAMES:
+		g_free(self->camera_names);
+		self->camera_names = g_value_dup_string(value);
+		break;
+	case PROP_SYNC_TOLERANCE:
+		self->sync_tolerance = g_value_get_uint64(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_multi_src_get_property(GObject *object, guint prop_id,
+				     GValue *value, GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(object);
+	guint64 dropped = 0;
+	guint64 missed = 0;
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAMES:
+		g_value_set_string(value, self->camera_names);
+		break;
+	case PROP_SYNC_TOLERANCE:
+		g_value_set_uint64(value, self->sync_tolerance);
+		break;
+	case PROP_STATS:
+		for (std::unique_ptr<CameraContext> &camera : self->state->cameras_) {
+			dropped += camera->dropped_;
+			missed += camera->missed_;
+		}
+
+		g_value_take_boxed(value,
+				   gst_structure_new("application/x-libcameramultisrc-stats",
+						     "sets", G_TYPE_UINT64, self->state->sets_,
+						     "dropped", G_TYPE_UINT64, dropped,
+						     "missed", G_TYPE_UINT64, missed,
+						     nullptr));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static gboolean
+gst_libcamera_multi_src_set_clock(GstElement *element, GstClock *clock)
+{
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(element);
+	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_multi_src_parent_class);
+	bool monotonic = gst_libcamera_clock_is_monotonic(clock);
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		self->state->monotonicClock_ = monotonic;
+		self->state->clockOffset_ = 0;
+		self->state->clockOffsetTime_ = GST_CLOCK_TIME_NONE;
+	}
+
+	if (klass->set_clock)
+		return klass->set_clock(element, clock);
+
+	return TRUE;
+}
+
+static GstStateChangeReturn
+gst_libcamera_multi_src_change_state(GstElement *element, GstStateChange transition)
+{
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(element);
+	GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_multi_src_parent_class);
+
+	ret = klass->change_state(element, transition);
+	if (ret == GST_STATE_CHANGE_FAILURE)
+		return ret;
+
+	switch (transition) {
+	case GST_STATE_CHANGE_NULL_TO_READY:
+		if (!gst_libcamera_multi_src_open(self)) {
+			gst_libcamera_multi_src_close(self);
+			return GST_STATE_CHANGE_FAILURE;
+		}
+		break;
+	case GST_STATE_CHANGE_READY_TO_PAUSED:
+		/* This needs to be called after pads activation.*/
+		if (!gst_task_pause(self->task))
+			return GST_STATE_CHANGE_FAILURE;
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+		gst_task_start(self->task);
+		break;
+	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		gst_task_join(self->task);
+		break;
+	case GST_STATE_CHANGE_READY_TO_NULL:
+		gst_libcamera_multi_src_close(self);
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+static void
+gst_libcamera_multi_src_finalize(GObject *object)
+{
+	GObjectClass *klass = G_OBJECT_CLASS(gst_libcamera_multi_src_parent_class);
+	GstLibcameraMultiSrc *self = GST_LIBCAMERA_MULTI_SRC(object);
+
+	g_rec_mutex_clear(&self->stream_lock);
+	g_clear_object(&self->task);
+	g_free(self->camera_names);
+	gst_caps_unref(self->state->timestampCaps_);
+	delete self->state;
+
+	return klass->finalize(object);
+}
+
+static void
+gst_libcamera_multi_src_init(GstLibcameraMultiSrc *self)
+{
+	GstLibcameraMultiSrcState *state = new GstLibcameraMultiSrcState();
+
+	g_rec_mutex_init(&self->stream_lock);
+	self->task = gst_task_new(gst_libcamera_multi_src_task_run, self, nullptr);
+	gst_task_set_enter_callback(self->task, gst_libcamera_multi_src_task_enter, self, nullptr);
+	gst_task_set_leave_callback(self->task, gst_libcamera_multi_src_task_leave, self, nullptr);
+	gst_task_set_lock(self->task, &self->stream_lock);
+
+	state->timestampCaps_ = gst_caps_new_empty_simple("timestamp/x-linux-monotonic");
+	state->sets_ = 0;
+	state->monotonicClock_ = false;
+	state->clockOffset_ = 0;
+	state->clockOffsetTime_ = GST_CLOCK_TIME_NONE;
+	state->lastCaptureTime_ = GST_CLOCK_TIME_NONE;
+	state->latencySampleTime_ = GST_CLOCK_TIME_NONE;
+	state->latencyChanged_ = false;
+	self->sync_tolerance = 0;
+
+	/* C-style friend. */
+	state->src_ = self;
+	self->state = state;
+}
+
+static void
+gst_libcamera_multi_src_class_init(GstLibcameraMultiSrcClass *klass)
+{
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->set_property = gst_libcamera_multi_src_set_property;
+	object_class->get_property = gst_libcamera_multi_src_get_property;
+	object_class->finalize = gst_libcamera_multi_src_finalize;
+
+	element_class->change_state = gst_libcamera_multi_src_change_state;
+	element_class->set_clock = gst_libcamera_multi_src_set_clock;
+
+	gst_element_class_set_metadata(element_class,
+				       "libcamera Multi-Camera Source", "Source/Video",
+				       "Synchronous capture from multiple cameras using libcamera",
+				       "libcamera developers <libcamera-devel@lists.libcamera.org>");
+	gst_element_class_add_static_pad_template_with_gtype(element_class,
+							     &multi_src_template,
+							     GST_TYPE_LIBCAMERA_PAD);
+
+	GParamSpec *spec = g_param_spec_string("camera-names", "Camera Names",
+					       "Comma-separated list of the cameras to use "
+					       "(all cameras if not set)", nullptr,
+					       (GParamFlags)(GST_PARAM_MUTABLE_READY
+							     | G_PARAM_CONSTRUCT
+							     | G_PARAM_READWRITE
+							     | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_CAMERA_NAMES, spec);
+
+	spec = g_param_spec_uint64("sync-tolerance", "Synchronization Tolerance",
+				   "Maximum capture time difference in nanoseconds between "
+				   "the frames of a set (0 = half the frame interval)",
+				   0, G_MAXUINT64, 0,
+				   (GParamFlags)(GST_PARAM_MUTABLE_PLAYING
+						 | G_PARAM_READWRITE
+						 | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_SYNC_TOLERANCE, spec);
+
+	spec = g_param_spec_boxed("stats", "Statistics",
+				  "Streaming statistics: sets is the number of frame sets "
+				  "produced, dropped the number of frames discarded because "
+				  "they couldn't be matched, and missed the number of frames "
+				  "the cameras failed to capture",
+				  GST_TYPE_STRUCTURE,
+				  (GParamFlags)(G_PARAM_READABLE
+						| G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_STATS, spec);
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcameramultisrc.h - GStreamer Multi-Camera Synchronous Capture Element
+ */
+
+#ifndef __GST_LIBCAMERA_MULTI_SRC_H__
+#define __GST_LIBCAMERA_MULTI_SRC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_LIBCAMERA_MULTI_SRC gst_libcamera_multi_src_get_type()
+G_DECLARE_FINAL_TYPE(GstLibcameraMultiSrc, gst_libcamera_multi_src,
+		     GST_LIBCAMERA, MULTI_SRC, GstElement)
+
+G_END_DECLS
+
+#endif /* __GST_LIBCAMERA_MULTI_SRC_H__ */
@@ -8,8 +8,12 @@
 
 #include "gstlibcamerapool.h"
 
+#include <libcamera/buffer.h>
 #include <libcamera/stream.h>
 
+#include <gst/allocators/allocators.h>
+#include <gst/video/gstvideometa.h>
+
 #include "gstlibcamera-utils.h"
 
 using namespace libcamera;
@@ -27,10 +31,145 @@ struct _GstLibcameraPool {
 	GstAtomicQueue *queue;
 	GstLibcameraAllocator *allocator;
 	Stream *stream;
+
+	GstVideoInfo info;
+	bool has_video_info;
+	bool default_layout;
+
+	/* Downstream pool the buffers are imported from, if any. */
+	GstBufferPool *downstream;
 };
 
 G_DEFINE_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_TYPE_BUFFER_POOL);
 
+static GQuark
+gst_libcamera_imported_frame_quark(void)
+{
+	static gsize frame_quark = 0;
+
+	if (g_once_init_enter(&frame_quark)) {
+		GQuark quark = g_quark_from_string("GstLibcameraImportedFrame");
+		g_once_init_leave(&frame_quark, quark);
+	}
+
+	return frame_quark;
+}
+
+static void
+gst_libcamera_imported_frame_free(gpointer data)
+{
+	delete static_cast<FrameBuffer *>(data);
+}
+
+/*
+ * Check that the layout of a downstream buffer matches the layout the camera
+ * will write frames with.
+ */
+static bool
+gst_libcamera_pool_check_layout(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	if (!self->has_video_info)
+		return true;
+
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+	if (!meta)
+		return self->default_layout;
+
+	GstVideoInfo *info = &self->info;
+	if (meta->n_planes != GST_VIDEO_INFO_N_PLANES(info))
+		return false;
+
+	bool single_memory = gst_buffer_n_memory(buffer) == 1;
+
+	for (guint i = 0; i < meta->n_planes; i++) {
+		if (meta->stride[i] != GST_VIDEO_INFO_PLANE_STRIDE(info, i))
+			return false;
+		if (single_memory && meta->offset[i] != GST_VIDEO_INFO_PLANE_OFFSET(info, i))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Wrap the dmabufs of a downstream buffer in a FrameBuffer. The FrameBuffer is
+ * attached to the first memory of the buffer, and is thus reused for as long
+ * as the downstream pool keeps the memory around.
+ */
+static bool
+gst_libcamera_pool_import_buffer(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	GstMemory *first = gst_buffer_peek_memory(buffer, 0);
+	GQuark quark = gst_libcamera_imported_frame_quark();
+
+	if (gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(first), quark))
+		return true;
+
+	if (!gst_libcamera_pool_check_layout(self, buffer)) {
+		GST_WARNING_OBJECT(self, "Downstream buffer layout mismatch");
+		return false;
+	}
+
+	std::vector<FrameBuffer::Plane> planes;
+	for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+		GstMemory *mem = gst_buffer_peek_memory(buffer, i);
+
+		/* FrameBuffer planes can't express an offset in the dmabuf. */
+		if (!gst_is_dmabuf_memory(mem) || mem->offset) {
+			GST_WARNING_OBJECT(self, "Downstream memory can't be imported");
+			return false;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(gst_dmabuf_memory_get_fd(mem));
+		plane.length = mem->size;
+		planes.push_back(std::move(plane));
+	}
+
+	FrameBuffer *fb = new FrameBuffer(planes);
+	gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(first), quark, fb,
+				  gst_libcamera_imported_frame_free);
+
+	return true;
+}
+
+static void
+gst_libcamera_pool_add_video_meta(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	GstVideoInfo *info = &self->info;
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	gsize offsets[GST_VIDEO_MAX_PLANES];
+	gint strides[GST_VIDEO_MAX_PLANES];
+
+	/*
+	 * When the frame buffer has one memory per plane, the plane offsets
+	 * are relative to the start of the concatenated memories. Otherwise
+	 * all planes are stored contiguously in a single memory.
+	 */
+	bool per_plane = gst_buffer_n_memory(buffer) == n_planes;
+	gsize offset = 0;
+
+	for (guint i = 0; i < n_planes; i++) {
+		strides[i] = GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+
+		if (per_plane) {
+			offsets[i] = offset;
+			offset += gst_buffer_peek_memory(buffer, i)->size;
+		} else {
+			offsets[i] = GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+		}
+	}
+
+	GstVideoMeta *meta = gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+							    GST_VIDEO_INFO_FORMAT(info),
+							    GST_VIDEO_INFO_WIDTH(info),
+							    GST_VIDEO_INFO_HEIGHT(info),
+							    n_planes, offsets, strides);
+
+	/* The layout is identical for all buffers, keep the meta across reuses. */
+	GST_META_FLAG_SET(meta, GST_META_FLAG_POOLED);
+}
+
 static GstFlowReturn
 gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 				  GstBufferPoolAcquireParams *params)
@@ -43,6 +182,9 @@ gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 	if (!gst_libcamera_allocator_prepare_buffer(self->allocator, self->stream, buf))
 		return GST_FLOW_ERROR;
 
+	if (self->has_video_info && !gst_buffer_get_video_meta(buf))
+		gst_libcamera_pool_add_video_meta(self, buf);
+
 	*buffer = buf;
 	return GST_FLOW_OK;
 }
@@ -74,6 +216,9 @@ static void
 gst_libcamera_pool_init(GstLibcameraPool *self)
 {
 	self->queue = gst_atomic_queue_new(4);
+	self->has_video_info = false;
+	self->default_layout = true;
+	self->downstream = nullptr;
 }
 
 static void
@@ -86,7 +231,12 @@ gst_libcamera_pool_finalize(GObject *object)
 		gst_buffer_unref(buf);
 
 	gst_atomic_queue_unref(self->queue);
-	g_object_unref(self->allocator);
+	g_clear_object(&self->allocator);
+
+	if (self->downstream) {
+		gst_buffer_pool_set_active(self->downstream, FALSE);
+		gst_object_unref(self->downstream);
+	}
 
 	G_OBJECT_CLASS(gst_libcamera_pool_parent_class)->finalize(object);
 }
@@ -126,16 +276,86 @@ gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream)
 	return pool;
 }
 
-Stream *
-gst_libcamera_pool_get_stream(GstLibcameraPool *self)
+GstLibcameraPool *
+gst_libcamera_pool_new_import(GstBufferPool *downstream, Stream *stream)
 {
-	return self->stream;
+	auto *pool = GST_LIBCAMERA_POOL(g_object_new(GST_TYPE_LIBCAMERA_POOL, nullptr));
+
+	pool->downstream = GST_BUFFER_POOL(gst_object_ref(downstream));
+	pool->stream = stream;
+
+	return pool;
+}
+
+GstFlowReturn
+gst_libcamera_pool_acquire(GstLibcameraPool *self, GstBuffer **buffer,
+			   bool wait)
+{
+	if (!self->downstream)
+		return gst_buffer_pool_acquire_buffer(GST_BUFFER_POOL(self),
+						      buffer, nullptr);
+
+	/*
+	 * Buffers are acquired from the downstream pool directly, so that
+	 * downstream elements recognize their own buffers when they are
+	 * pushed. The downstream pool doesn't notify us when buffers are
+	 * released, the caller thus needs to wait when it has no other event
+	 * to wake it up.
+	 */
+	GstBufferPoolAcquireParams params = {};
+	if (!wait)
+		params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+	GstFlowReturn ret = gst_buffer_pool_acquire_buffer(self->downstream,
+							   buffer, &params);
+	if (ret != GST_FLOW_OK)
+		return ret;
+
+	if (!gst_libcamera_pool_import_buffer(self, *buffer)) {
+		gst_buffer_unref(*buffer);
+		*buffer = nullptr;
+		return GST_FLOW_ERROR;
+	}
+
+	return GST_FLOW_OK;
+}
+
+void
+gst_libcamera_pool_set_flushing(GstLibcameraPool *self, bool flushing)
+{
+	/*
+	 * Only acquisition from downstream pools can block. Setting them to
+	 * flushing wakes up waiters, which then get GST_FLOW_FLUSHING. The
+	 * flushing state is cleared when the pool is activated again.
+	 */
+	if (self->downstream)
+		gst_buffer_pool_set_flushing(self->downstream, flushing);
+}
+
+void
+gst_libcamera_pool_set_video_info(GstLibcameraPool *self, const GstVideoInfo *info)
+{
+	GstVideoInfo default_info;
+
+	self->info = *info;
+	self->has_video_info = true;
+
+	/* Downstream buffers without GstVideoMeta use the default layout. */
+	gst_video_info_set_format(&default_info, GST_VIDEO_INFO_FORMAT(info),
+				  GST_VIDEO_INFO_WIDTH(info),
+				  GST_VIDEO_INFO_HEIGHT(info));
+
+	self->default_layout = true;
+	for (guint i = 0; i < GST_VIDEO_INFO_N_PLANES(info); i++) {
+		if (GST_VIDEO_INFO_PLANE_STRIDE(info, i) != GST_VIDEO_INFO_PLANE_STRIDE(&default_info, i) ||
+		    GST_VIDEO_INFO_PLANE_OFFSET(info, i) != GST_VIDEO_INFO_PLANE_OFFSET(&default_info, i))
+			self->default_layout = false;
+	}
 }
 
 Stream *
-gst_libcamera_buffer_get_stream(GstBuffer *buffer)
+gst_libcamera_pool_get_stream(GstLibcameraPool *self)
 {
-	auto *self = (GstLibcameraPool *)buffer->pool;
 	return self->stream;
 }
 
@@ -143,5 +363,11 @@ FrameBuffer *
 gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer)
 {
 	GstMemory *mem = gst_buffer_peek_memory(buffer, 0);
+
+	auto *fb = static_cast<FrameBuffer *>(gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(mem),
+									gst_libcamera_imported_frame_quark()));
+	if (fb)
+		return fb;
+
 	return gst_libcamera_memory_get_frame_buffer(mem);
 }
@@ -6,7 +6,8 @@
  * gstlibcamerapool.h - GStreamer Buffer Pool
  *
  * This is a partial implementation of GstBufferPool intended for internal use
- * only. This pool cannot be configured or activated.
+ * only. This pool cannot be configured or activated. It either hands out
+ * buffers exported from the camera, or imports buffers from a downstream pool.
  */
 
 #ifndef __GST_LIBCAMERA_POOL_H__
@@ -15,6 +16,7 @@
 #include "gstlibcameraallocator.h"
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <libcamera/stream.h>
 
@@ -24,9 +26,18 @@ G_DECLARE_FINAL_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_LIBCAMERA, POOL,
 GstLibcameraPool *gst_libcamera_pool_new(GstLibcameraAllocator *allocator,
 					 libcamera::Stream *stream);
 
-libcamera::Stream *gst_libcamera_pool_get_stream(GstLibcameraPool *self);
+GstLibcameraPool *gst_libcamera_pool_new_import(GstBufferPool *downstream,
+						libcamera::Stream *stream);
+
+GstFlowReturn gst_libcamera_pool_acquire(GstLibcameraPool *self,
+					 GstBuffer **buffer, bool wait);
+
+void gst_libcamera_pool_set_flushing(GstLibcameraPool *self, bool flushing);
 
-libcamera::Stream *gst_libcamera_buffer_get_stream(GstBuffer *buffer);
+void gst_libcamera_pool_set_video_info(GstLibcameraPool *self,
+				       const GstVideoInfo *info);
+
+libcamera::Stream *gst_libcamera_pool_get_stream(GstLibcameraPool *self);
 
 libcamera::FrameBuffer *gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer);
 
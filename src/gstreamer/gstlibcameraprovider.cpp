@@ -158,7 +158,6 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 
 struct _GstLibcameraProvider {
 	GstDeviceProvider parent;
-	CameraManager *cm;
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraProvider, gst_libcamera_provider,
@@ -170,18 +169,19 @@ static GList *
 gst_libcamera_provider_probe(GstDeviceProvider *provider)
 {
 	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
-	CameraManager *cm = self->cm;
+	std::shared_ptr<CameraManager> cm;
 	GList *devices = nullptr;
 	gint ret;
 
 	GST_INFO_OBJECT(self, "Probing cameras using libcamera");
 
-	/* \todo Move the CameraMananger start()/stop() calls into
-	 * GstDeviceProvider start()/stop() virtual function when CameraMananger
-	 * gains monitoring support. Meanwhile we need to cycle start()/stop()
-	 * to ensure every probe() calls return the latest list.
+	/* \todo Move the CameraMananger acquisition into GstDeviceProvider
+	 * start()/stop() virtual function when CameraMananger gains monitoring
+	 * support. Meanwhile we need to release the camera manager after
+	 * probing, to ensure every probe() calls return the latest list when
+	 * no camera is in use.
 	 */
-	ret = cm->start();
+	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
 		GST_ERROR_OBJECT(self, "Failed to retrieve device list: %s",
 				 g_strerror(-ret));
@@ -194,8 +194,6 @@ gst_libcamera_provider_probe(GstDeviceProvider *provider)
 					g_object_ref_sink(gst_libcamera_device_new(camera)));
 	}
 
-	cm->stop();
-
 	return devices;
 }
 
@@ -204,31 +202,16 @@ gst_libcamera_provider_init(GstLibcameraProvider *self)
 {
 	GstDeviceProvider *provider = GST_DEVICE_PROVIDER(self);
 
-	self->cm = new CameraManager();
-
 	/* Avoid devices being duplicated. */
 	gst_device_provider_hide_provider(provider, "v4l2deviceprovider");
 }
 
-static void
-gst_libcamera_provider_finalize(GObject *object)
-{
-	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(object);
-	gpointer klass = gst_libcamera_provider_parent_class;
-
-	delete self->cm;
-
-	return G_OBJECT_GET_CLASS(klass)->finalize(object);
-}
-
 static void
 gst_libcamera_provider_class_init(GstLibcameraProviderClass *klass)
 {
 	GstDeviceProviderClass *provider_class = GST_DEVICE_PROVIDER_CLASS(klass);
-	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
 	provider_class->probe = gst_libcamera_provider_probe;
-	object_class->finalize = gst_libcamera_provider_finalize;
 
 	gst_device_provider_class_set_metadata(provider_class,
 					       "libcamera Device Provider",
@@ -17,25 +17,50 @@
  *    + Evaluate if a single streaming thread is fine
  *  - Add application driven request (snapshot)
  *  - Add framerate control
- *  - Add buffer importation support
  *
  *  Requires new libcamera API:
  *  - Add framerate negotiation support
  *  - Add colorimetry support
  *  - Add timestamp support
  *  - Use unique names to select the camera devices
- *  - Add GstVideoMeta support (strides and offsets)
  *
  * \todo libcamera UVC drivers picks the lowest possible resolution first, this
  * should be fixed so that we get a decent resolution and framerate for the
  * role by default.
  */
 
+/*
+ * Clocking
+ *
+ * libcamera timestamps frames in the CLOCK_MONOTONIC domain, as set by V4L2
+ * drivers when the frame starts being captured. The element provides a
+ * GstSystemClock running on CLOCK_MONOTONIC, so that when it is selected as
+ * the pipeline clock, buffer timestamps are derived from the sensor
+ * timestamps without any clock sampling. When the pipeline selects another
+ * clock, the offset between that clock and CLOCK_MONOTONIC is sampled once
+ * per second from the streaming thread and applied to the frame timestamps.
+ *
+ * The reported latency is the delay between the start of capture and the
+ * completion of the request, averaged over recent frames. A latency message
+ * is posted on the bus when the average drifts significantly.
+ *
+ * For frame-accurate audio/video synchronisation in low-latency streaming,
+ * enable the provide-clock property and make libcamerasrc the pipeline clock
+ * (for instance with gst_pipeline_use_clock()), and slave audio sources to it
+ * (e.g. alsasrc provide-clock=false slave-method=re-timestamp). Video
+ * timestamps are then exact capture times, and only the audio timestamps are
+ * adjusted for drift. The property is disabled by default, letting the
+ * pipeline select its clock as usual, at the cost of a sampled clock offset.
+ */
+
 #include "gstlibcamerasrc.h"
 
+#include <algorithm>
 #include <queue>
+#include <time.h>
 #include <vector>
 
+#include <gst/allocators/allocators.h>
 #include <gst/base/base.h>
 
 #include <libcamera/camera.h>
@@ -51,20 +76,23 @@ using namespace libcamera;
 GST_DEBUG_CATEGORY_STATIC(source_debug);
 #define GST_CAT_DEFAULT source_debug
 
+/* Interval between capture latency samples, in frame timestamp time. */
+static constexpr GstClockTime kLatencySampleInterval = 100 * GST_MSECOND;
+
 struct RequestWrap {
-	RequestWrap(Request *request);
+	RequestWrap(std::unique_ptr<Request> request);
 	~RequestWrap();
 
-	void attachBuffer(GstBuffer *buffer);
+	void attachBuffer(Stream *stream, GstBuffer *buffer);
 	GstBuffer *detachBuffer(Stream *stream);
+	void reset();
 
-	/* For ptr comparison only. */
-	Request *request_;
+	std::unique_ptr<Request> request_;
 	std::map<Stream *, GstBuffer *> buffers_;
 };
 
-RequestWrap::RequestWrap(Request *request)
-	: request_(request)
+RequestWrap::RequestWrap(std::unique_ptr<Request> request)
+	: request_(std::move(request))
 {
 }
 
@@ -76,16 +104,16 @@ RequestWrap::~RequestWrap()
 	}
 }
 
-void RequestWrap::attachBuffer(GstBuffer *buffer)
+void RequestWrap::attachBuffer(Stream *stream, GstBuffer *buffer)
 {
 	FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
-	Stream *stream = gst_libcamera_buffer_get_stream(buffer);
 
 	request_->addBuffer(stream, fb);
 
 	auto item = buffers_.find(stream);
 	if (item != buffers_.end()) {
-		gst_buffer_unref(item->second);
+		if (item->second)
+			gst_buffer_unref(item->second);
 		item->second = buffer;
 	} else {
 		buffers_[stream] = buffer;
@@ -105,16 +133,56 @@ GstBuffer *RequestWrap::detachBuffer(Stream *stream)
 	return buffer;
 }
 
+/*
+ * Release the buffers that haven't been detached and reset the request, to
+ * prepare the wrapper for reuse.
+ */
+void RequestWrap::reset()
+{
+	for (std::pair<Stream *const, GstBuffer *> &item : buffers_) {
+		if (item.second) {
+			gst_buffer_unref(item.second);
+			item.second = nullptr;
+		}
+	}
+
+	request_->reuse();
+}
+
 /* Used for C++ object with destructors. */
 struct GstLibcameraSrcState {
 	GstLibcameraSrc *src_;
 
-	std::unique_ptr<CameraManager> cm_;
+	std::shared_ptr<CameraManager> cm_;
 	std::shared_ptr<Camera> cam_;
 	std::unique_ptr<CameraConfiguration> config_;
 	std::vector<GstPad *> srcpads_;
+
+	/*
+	 * Requests queued to the camera, in queueing order, and completed
+	 * requests ready to be reused. Protected by the object lock.
+	 */
 	std::queue<std::unique_ptr<RequestWrap>> requests_;
+	std::vector<std::unique_ptr<RequestWrap>> freeRequests_;
+
+	/* Statistics, protected by the object lock. */
+	guint64 underruns_;
 
+	/*
+	 * Conversion from CLOCK_MONOTONIC to the element clock, and latency
+	 * estimation. Protected by the object lock.
+	 */
+	bool monotonicClock_;
+	GstClockTimeDiff clockOffset_;
+	GstClockTime clockOffsetTime_;
+	GstClockTime lastCaptureTime_;
+	GstClockTime latencySampleTime_;
+	GstClockTime latency_;
+	GstClockTime reportedLatency_;
+	bool latencyChanged_;
+
+	void updateClockOffset();
+	void updateLatency(GstClockTime latency);
 	void requestCompleted(Request *request);
 };
 
@@ -124,7 +192,12 @@ struct _GstLibcameraSrc {
 	GRecMutex stream_lock;
 	GstTask *task;
 
+	/* Properties, protected by the object lock. */
 	gchar *camera_name;
+	guint queue_depth;
+	gboolean provide_clock;
+
+	GstClock *clock;
 
 	GstLibcameraSrcState *state;
 	GstLibcameraAllocator *allocator;
@@ -133,14 +206,23 @@ struct _GstLibcameraSrc {
 
 enum {
 	PROP_0,
-	PROP_CAMERA_NAME
+	PROP_CAMERA_NAME,
+	PROP_QUEUE_DEPTH,
+	PROP_PROVIDE_CLOCK,
+	PROP_STATS,
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
 			GST_DEBUG_CATEGORY_INIT(source_debug, "libcamerasrc", 0,
 						"libcamera Source"));
 
-#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; image/jpeg")
+/*
+ * System memory caps come first, to keep them preferred by elements that
+ * accept any caps features without handling dmabufs.
+ */
+#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; " \
+				      "video/x-raw(" GST_CAPS_FEATURE_MEMORY_DMABUF "); " \
+				      "image/jpeg")
 
 /* For the simple case, we have a src pad that is always present. */
 GstStaticPadTemplate src_template = {
@@ -152,6 +234,68 @@ GstStaticPadTemplate request_src_template = {
 	"src_%s", GST_PAD_SRC, GST_PAD_REQUEST, TEMPLATE_CAPS
 };
 
+/*
+ * Sample the offset between the element clock and CLOCK_MONOTONIC. This is
+ * called from the streaming thread and rate-limited to once per second of
+ * captured frames, to keep clock queries out of the request completion path.
+ * The frame timestamps are used as the time base, so checking whether a new
+ * sample is due doesn't require reading the system clock.
+ */
+void
+GstLibcameraSrcState::updateClockOffset()
+{
+	g_autoptr(GstClock) clock = nullptr;
+
+	{
+		GLibLocker lock(GST_OBJECT(src_));
+
+		if (monotonicClock_ || !GST_ELEMENT_CLOCK(src_))
+			return;
+
+		if (GST_CLOCK_TIME_IS_VALID(clockOffsetTime_) &&
+		    (!GST_CLOCK_TIME_IS_VALID(lastCaptureTime_) ||
+		     lastCaptureTime_ < clockOffsetTime_ + GST_SECOND))
+			return;
+
+		clock = GST_CLOCK(gst_object_ref(GST_ELEMENT_CLOCK(src_)));
+	}
+
+	GstClockTime sys_time;
+	GstClockTimeDiff offset = gst_libcamera_clock_get_offset(clock, &sys_time);
+
+	GLibLocker lock(GST_OBJECT(src_));
+	clockOffset_ = offset;
+	clockOffsetTime_ = sys_time;
+}
+
+/*
+ * Smooth the capture latency with an exponential moving average, and only
+ * report it when it deviates from the last reported value by more than 1/8th,
+ * to avoid flooding the pipeline with latency recalculations.
+ */
+void
+GstLibcameraSrcState::updateLatency(GstClockTime latency)
+{
+	if (GST_CLOCK_TIME_IS_VALID(latency_))
+		latency_ = (latency_ * 7 + latency) / 8;
+	else
+		latency_ = latency;
+
+	if (GST_CLOCK_TIME_IS_VALID(reportedLatency_)) {
+		GstClockTime delta = latency_ > reportedLatency_
+				   ? latency_ - reportedLatency_
+				   : reportedLatency_ - latency_;
+		if (delta <= reportedLatency_ / 8)
+			return;
+	}
+
+	reportedLatency_ = latency_;
+	latencyChanged_ = true;
+
+	for (GstPad *srcpad : srcpads_)
+		gst_libcamera_pad_set_latency(srcpad, latency_);
+}
+
 void
 GstLibcameraSrcState::requestCompleted(Request *request)
 {
@@ -162,53 +306,96 @@ GstLibcameraSrcState::requestCompleted(Request *request)
 	std::unique_ptr<RequestWrap> wrap = std::move(requests_.front());
 	requests_.pop();
 
-	g_return_if_fail(wrap->request_ == request);
+	g_return_if_fail(wrap->request_.get() == request);
 
 	if ((request->status() == Request::RequestCancelled)) {
 		GST_DEBUG_OBJECT(src_, "Request was cancelled");
+		wrap->reset();
+		freeRequests_.push_back(std::move(wrap));
 		return;
 	}
 
+	/*
+	 * If no other request is queued, the camera will miss frames until
+	 * the streaming task queues a new request.
+	 */
+	if (requests_.empty()) {
+		underruns_++;
+		GST_DEBUG_OBJECT(src_, "Request queue underrun");
+	}
+
+	/*
+	 * \todo Need to expose which reference clock the timestamp relates to.
+	 * Timestamps are assumed to be CLOCK_MONOTONIC, which is the V4L2
+	 * default.
+	 */
+	GstClockTime capture_time = GST_CLOCK_TIME_NONE;
+
 	GstBuffer *buffer;
 	for (GstPad *srcpad : srcpads_) {
 		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
 		buffer = wrap->detachBuffer(stream);
 
 		FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+		GstClockTime timestamp = fb->metadata().timestamp;
 
 		if (GST_ELEMENT_CLOCK(src_)) {
-			GstClockTime gst_base_time = GST_ELEMENT(src_)->base_time;
-			GstClockTime gst_now = gst_clock_get_time(GST_ELEMENT_CLOCK(src_));
-			/* \todo Need to expose which reference clock the timestamp relates to. */
-			GstClockTime sys_now = g_get_monotonic_time() * 1000;
-
-			/* Deduced from: sys_now - sys_base_time == gst_now - gst_base_time */
-			GstClockTime sys_base_time = sys_now - (gst_now - gst_base_time);
-			GST_BUFFER_PTS(buffer) = fb->metadata().timestamp - sys_base_time;
-			gst_libcamera_pad_set_latency(srcpad, sys_now - fb->metadata().timestamp);
+			GstClockTime base_time = GST_ELEMENT(src_)->base_time;
+
+			/* The offset is zero when the element clock is monotonic. */
+			timestamp += clockOffset_;
+			GST_BUFFER_PTS(buffer) = timestamp > base_time
+					       ? timestamp - base_time : 0;
 		} else {
 			GST_BUFFER_PTS(buffer) = 0;
 		}
 
+		if (fb->metadata().timestamp &&
+		    fb->metadata().timestamp < capture_time)
+			capture_time = fb->metadata().timestamp;
+
 		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
 		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
 
 		gst_libcamera_pad_queue_buffer(srcpad, buffer);
 	}
 
+	/*
+	 * Sample the latency every kLatencySampleInterval of captured frames,
+	 * using the frame timestamps as the time base, to avoid reading the
+	 * system clock for every request.
+	 */
+	if (GST_CLOCK_TIME_IS_VALID(capture_time)) {
+		lastCaptureTime_ = capture_time;
+
+		if (!GST_CLOCK_TIME_IS_VALID(latencySampleTime_) ||
+		    capture_time >= latencySampleTime_ + kLatencySampleInterval) {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			GstClockTime sys_now = GST_TIMESPEC_TO_TIME(ts);
+
+			latencySampleTime_ = capture_time;
+			if (capture_time <= sys_now)
+				updateLatency(sys_now - capture_time);
+		}
+	}
+
+	wrap->reset();
+	freeRequests_.push_back(std::move(wrap));
+
 	gst_libcamera_resume_task(this->src_->task);
 }
 
 static bool
 gst_libcamera_src_open(GstLibcameraSrc *self)
 {
-	std::unique_ptr<CameraManager> cm = std::make_unique<CameraManager>();
+	std::shared_ptr<CameraManager> cm;
 	std::shared_ptr<Camera> cam;
 	gint ret = 0;
 
 	GST_DEBUG_OBJECT(self, "Opening camera device ...");
 
-	ret = cm->start();
+	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
 		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
 				  ("Failed listing cameras."),
@@ -224,10 +411,10 @@ gst_libcamera_src_open(GstLibcameraSrc *self)
 	}
 
 	if (camera_name) {
-		cam = cm->get(self->camera_name);
+		cam = cm->get(camera_name);
 		if (!cam) {
 			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
-					  ("Could not find a camera named '%s'.", self->camera_name),
+					  ("Could not find a camera named '%s'.", camera_name),
 					  ("libcamera::CameraMananger::get() returned nullptr"));
 			return false;
 		}
@@ -265,33 +452,85 @@ gst_libcamera_src_task_run(gpointer user_data)
 {
 	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
 	GstLibcameraSrcState *state = self->state;
+	bool latency_changed;
 
-	Request *request = state->cam_->createRequest();
-	auto wrap = std::make_unique<RequestWrap>(request);
-	for (GstPad *srcpad : state->srcpads_) {
-		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
-		GstBuffer *buffer;
-		GstFlowReturn ret;
+	state->updateClockOffset();
 
-		ret = gst_buffer_pool_acquire_buffer(GST_BUFFER_POOL(pool),
-						     &buffer, nullptr);
-		if (ret != GST_FLOW_OK) {
-			/*
-			 * RequestWrap does not take ownership, and we won't be
-			 * queueing this one due to lack of buffers.
-			 */
-			delete request;
-			request = nullptr;
-			break;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		latency_changed = state->latencyChanged_;
+		state->latencyChanged_ = false;
+	}
+
+	if (latency_changed)
+		gst_element_post_message(GST_ELEMENT(self),
+					 gst_message_new_latency(GST_OBJECT(self)));
+
+	/*
+	 * Queue requests until the configured queue depth is reached, or until
+	 * no more buffers are available. Completed requests are reused.
+	 */
+	while (true) {
+		std::unique_ptr<RequestWrap> wrap;
+		bool idle;
+
+		{
+			GLibLocker lock(GST_OBJECT(self));
+
+			if (self->queue_depth &&
+			    state->requests_.size() >= self->queue_depth)
+				break;
+
+			idle = state->requests_.empty();
+
+			if (!state->freeRequests_.empty()) {
+				wrap = std::move(state->freeRequests_.back());
+				state->freeRequests_.pop_back();
+			}
 		}
 
-		wrap->attachBuffer(buffer);
-	}
+		if (!wrap) {
+			std::unique_ptr<Request> request = state->cam_->createReusableRequest();
+			if (!request)
+				break;
+
+			wrap = std::make_unique<RequestWrap>(std::move(request));
+		}
+
+		/*
+		 * Pools imported from downstream don't notify buffer releases.
+		 * When no request is in flight, no completion will wake the
+		 * task up either, so block until a buffer is available.
+		 */
+		bool ready = true;
+		for (GstPad *srcpad : state->srcpads_) {
+			GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+			GstBuffer *buffer;
+			GstFlowReturn ret;
+
+			ret = gst_libcamera_pool_acquire(pool, &buffer, idle);
+			if (ret != GST_FLOW_OK) {
+				ready = false;
+				break;
+			}
+
+			wrap->attachBuffer(gst_libcamera_pad_get_stream(srcpad), buffer);
+		}
 
-	if (request) {
 		GLibLocker lock(GST_OBJECT(self));
-		GST_TRACE_OBJECT(self, "Requesting buffers");
-		state->cam_->queueRequest(request);
+
+		if (ready) {
+			GST_TRACE_OBJECT(self, "Requesting buffers");
+			ready = state->cam_->queueRequest(wrap->request_.get()) == 0;
+		}
+
+		if (!ready) {
+			/* Release the buffers and keep the request for later. */
+			wrap->reset();
+			state->freeRequests_.push_back(std::move(wrap));
+			break;
+		}
+
 		state->requests_.push(std::move(wrap));
 	}
 
@@ -337,6 +576,68 @@ gst_libcamera_src_task_run(gpointer user_data)
 	}
 }
 
+/*
+ * Try to import buffers from the pool proposed by downstream in response to an
+ * ALLOCATION query, to let the camera capture directly to memory owned by
+ * downstream elements. Return nullptr if no pool is proposed, or if its
+ * buffers can't be imported.
+ */
+static GstLibcameraPool *
+gst_libcamera_src_import_pool(GstLibcameraSrc *self, GstPad *srcpad,
+			      const StreamConfiguration &stream_cfg,
+			      const GstVideoInfo *info)
+{
+	g_autoptr(GstCaps) caps = gst_pad_get_current_caps(srcpad);
+	if (!caps)
+		return nullptr;
+
+	g_autoptr(GstQuery) query = gst_query_new_allocation(caps, TRUE);
+	if (!gst_pad_peer_query(srcpad, query) ||
+	    !gst_query_get_n_allocation_pools(query))
+		return nullptr;
+
+	GstBufferPool *downstream;
+	guint size, min, max;
+	gst_query_parse_nth_allocation_pool(query, 0, &downstream, &size, &min, &max);
+	if (!downstream)
+		return nullptr;
+
+	GstStructure *config = gst_buffer_pool_get_config(downstream);
+	min = std::max(min, stream_cfg.bufferCount);
+	if (max && max < min)
+		max = min;
+	size = std::max(size, stream_cfg.frameSize);
+	gst_buffer_pool_config_set_params(config, caps, size, min, max);
+	if (gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE, nullptr))
+		gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+	if (!gst_buffer_pool_set_config(downstream, config) ||
+	    !gst_buffer_pool_set_active(downstream, TRUE)) {
+		GST_DEBUG_OBJECT(self, "Failed to configure downstream pool");
+		gst_object_unref(downstream);
+		return nullptr;
+	}
+
+	GstLibcameraPool *pool = gst_libcamera_pool_new_import(downstream,
+							       stream_cfg.stream());
+	gst_object_unref(downstream);
+
+	if (info)
+		gst_libcamera_pool_set_video_info(pool, info);
+
+	/* Check that the downstream buffers can be imported. */
+	GstBuffer *buffer;
+	if (gst_libcamera_pool_acquire(pool, &buffer, false) != GST_FLOW_OK) {
+		GST_DEBUG_OBJECT(self, "Can't import downstream buffers");
+		g_object_unref(pool);
+		return nullptr;
+	}
+
+	gst_buffer_unref(buffer);
+
+	return pool;
+}
+
 static void
 gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
 {
@@ -344,10 +645,19 @@ gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
 	GLibRecLocker lock(&self->stream_lock);
 	GstLibcameraSrcState *state = self->state;
 	GstFlowReturn flow_ret = GST_FLOW_OK;
+	std::vector<bool> dmabuf(state->srcpads_.size(), false);
 	gint ret;
 
 	GST_DEBUG_OBJECT(self, "Streaming thread has started");
 
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		state->underruns_ = 0;
+		state->latency_ = GST_CLOCK_TIME_NONE;
+		state->reportedLatency_ = GST_CLOCK_TIME_NONE;
+		state->latencyChanged_ = false;
+	}
+
 	guint group_id = gst_util_group_id_next();
 	StreamRoles roles;
 	for (GstPad *srcpad : state->srcpads_) {
@@ -384,6 +694,10 @@ gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
 		/* Fixate caps and configure the stream. */
 		caps = gst_caps_make_writable(caps);
 		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
+
+		GstCapsFeatures *features = gst_caps_get_features(caps, 0);
+		dmabuf[i] = features &&
+			    gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_DMABUF);
 	}
 
 	if (flow_ret != GST_FLOW_OK)
@@ -403,7 +717,8 @@ gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
 		GstPad *srcpad = state->srcpads_[i];
 		const StreamConfiguration &stream_cfg = state->config_->at(i);
 
-		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg,
+										     dmabuf[i]);
 		if (!gst_pad_push_event(srcpad, gst_event_new_caps(caps))) {
 			flow_ret = GST_FLOW_NOT_NEGOTIATED;
 			break;
@@ -424,23 +739,45 @@ gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
 		return;
 	}
 
-	self->allocator = gst_libcamera_allocator_new(state->cam_);
-	if (!self->allocator) {
-		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
-				  ("Failed to allocate memory"),
-				  ("gst_libcamera_allocator_new() failed."));
-		gst_task_stop(task);
-		return;
-	}
-
 	self->flow_combiner = gst_flow_combiner_new();
 	for (gsize i = 0; i < state->srcpads_.size(); i++) {
 		GstPad *srcpad = state->srcpads_[i];
 		const StreamConfiguration &stream_cfg = state->config_->at(i);
-		GstLibcameraPool *pool = gst_libcamera_pool_new(self->allocator,
-								stream_cfg.stream());
-		g_signal_connect_swapped(pool, "buffer-notify",
-					 G_CALLBACK(gst_libcamera_resume_task), task);
+
+		/*
+		 * Expose the plane layout through GstVideoMeta, so that
+		 * downstream elements don't need to guess strides and offsets
+		 * when importing the dmabufs.
+		 */
+		GstVideoInfo info;
+		bool has_info = gst_libcamera_stream_configuration_to_video_info(stream_cfg,
+										 &info);
+
+		GstLibcameraPool *pool =
+			gst_libcamera_src_import_pool(self, srcpad, stream_cfg,
+						      has_info ? &info : nullptr);
+		if (pool) {
+			GST_INFO_OBJECT(self, "Importing buffers from downstream on %s",
+					GST_PAD_NAME(srcpad));
+		} else {
+			/* Export buffers from the camera. */
+			if (!self->allocator)
+				self->allocator = gst_libcamera_allocator_new(state->cam_);
+			if (!self->allocator) {
+				GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+						  ("Failed to allocate memory"),
+						  ("gst_libcamera_allocator_new() failed."));
+				gst_task_stop(task);
+				return;
+			}
+
+			pool = gst_libcamera_pool_new(self->allocator, stream_cfg.stream());
+			g_signal_connect_swapped(pool, "buffer-notify",
+						 G_CALLBACK(gst_libcamera_resume_task), task);
+
+			if (has_info)
+				gst_libcamera_pool_set_video_info(pool, &info);
+		}
 
 		gst_libcamera_pad_set_pool(srcpad, pool);
 		gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
@@ -476,6 +813,12 @@ gst_libcamera_src_task_leave(GstTask *task, GThread *thread, gpointer user_data)
 
 	state->cam_->stop();
 
+	/* All requests have completed or been cancelled, free them. */
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		state->freeRequests_.clear();
+	}
+
 	for (GstPad *srcpad : state->srcpads_)
 		gst_libcamera_pad_set_pool(srcpad, nullptr);
 
@@ -492,6 +835,9 @@ gst_libcamera_src_close(GstLibcameraSrc *self)
 
 	GST_DEBUG_OBJECT(self, "Releasing resources");
 
+	/* The camera is shared with other elements, disconnect from it. */
+	state->cam_->requestCompleted.disconnect(state);
+
 	ret = state->cam_->release();
 	if (ret) {
 		GST_ELEMENT_WARNING(self, RESOURCE, BUSY,
@@ -500,7 +846,6 @@ gst_libcamera_src_close(GstLibcameraSrc *self)
 	}
 
 	state->cam_.reset();
-	state->cm_->stop();
 	state->cm_.reset();
 }
 
@@ -516,6 +861,16 @@ gst_libcamera_src_set_property(GObject *object, guint prop_id,
 		g_free(self->camera_name);
 		self->camera_name = g_value_dup_string(value);
 		break;
+	case PROP_QUEUE_DEPTH:
+		self->queue_depth = g_value_get_uint(value);
+		break;
+	case PROP_PROVIDE_CLOCK:
+		self->provide_clock = g_value_get_boolean(value);
+		if (self->provide_clock)
+			GST_OBJECT_FLAG_SET(self, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
+		else
+			GST_OBJECT_FLAG_UNSET(self, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -533,12 +888,78 @@ gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_CAMERA_NAME:
 		g_value_set_string(value, self->camera_name);
 		break;
+	case PROP_QUEUE_DEPTH:
+		g_value_set_uint(value, self->queue_depth);
+		break;
+	case PROP_PROVIDE_CLOCK:
+		g_value_set_boolean(value, self->provide_clock);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed(value,
+				   gst_structure_new("application/x-libcamerasrc-stats",
+						     "underruns", G_TYPE_UINT64, self->state->underruns_,
+						     "queued", G_TYPE_UINT, (guint)self->state->requests_.size(),
+						     nullptr));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
 	}
 }
 
+static GstClock *
+gst_libcamera_src_provide_clock(GstElement *element)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	GLibLocker lock(GST_OBJECT(self));
+
+	if (!self->provide_clock)
+		return nullptr;
+
+	return GST_CLOCK(gst_object_ref(self->clock));
+}
+
+static gboolean
+gst_libcamera_src_set_clock(GstElement *element, GstClock *clock)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_src_parent_class);
+
+	/*
+	 * A system clock in monotonic mode, including the one provided by this
+	 * element, runs in the same time domain as the frame timestamps.
+	 */
+	bool monotonic = gst_libcamera_clock_is_monotonic(clock);
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		self->state->monotonicClock_ = monotonic;
+		self->state->clockOffset_ = 0;
+		self->state->clockOffsetTime_ = GST_CLOCK_TIME_NONE;
+	}
+
+	GST_DEBUG_OBJECT(self, "Using %s clock %" GST_PTR_FORMAT,
+			 monotonic ? "monotonic" : "foreign", clock);
+
+	if (klass->set_clock)
+		return klass->set_clock(element, clock);
+
+	return TRUE;
+}
+
+static void
+gst_libcamera_src_set_flushing(GstLibcameraSrc *self, bool flushing)
+{
+	GstLibcameraSrcState *state = self->state;
+	GLibLocker lock(GST_OBJECT(self));
+
+	for (GstPad *srcpad : state->srcpads_) {
+		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+		if (pool)
+			gst_libcamera_pool_set_flushing(pool, flushing);
+	}
+}
+
 static GstStateChangeReturn
 gst_libcamera_src_change_state(GstElement *element, GstStateChange transition)
 {
@@ -546,6 +967,16 @@ gst_libcamera_src_change_state(GstElement *element, GstStateChange transition)
 	GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
 	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_src_parent_class);
 
+	/*
+	 * The streaming thread may block waiting for buffers from a pool
+	 * imported from downstream. Unblock it before pad deactivation, so
+	 * before chaining to the parent change_state function, otherwise
+	 * joining the task below would hang when downstream holds on to all
+	 * its buffers.
+	 */
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+		gst_libcamera_src_set_flushing(self, true);
+
 	ret = klass->change_state(element, transition);
 	if (ret == GST_STATE_CHANGE_FAILURE)
 		return ret;
@@ -568,13 +999,6 @@ gst_libcamera_src_change_state(GstElement *element, GstStateChange transition)
 		ret = GST_STATE_CHANGE_NO_PREROLL;
 		break;
 	case GST_STATE_CHANGE_PAUSED_TO_READY:
-		/*
-		 * \todo this might require some thread unblocking in the future
-		 * if the streaming thread starts doing any kind of blocking
-		 * operations. If this was the case, we would need to do so
-		 * before pad deactivation, so before chaining to the parent
-		 * change_state function.
-		 */
 		gst_task_join(self->task);
 		break;
 	case GST_STATE_CHANGE_READY_TO_NULL:
@@ -596,6 +1020,7 @@ gst_libcamera_src_finalize(GObject *object)
 	g_rec_mutex_clear(&self->stream_lock);
 	g_clear_object(&self->task);
 	g_free(self->camera_name);
+	gst_object_unref(self->clock);
 	delete self->state;
 
 	return klass->finalize(object);
@@ -616,6 +1041,25 @@ gst_libcamera_src_init(GstLibcameraSrc *self)
 	state->srcpads_.push_back(gst_pad_new_from_template(templ, "src"));
 	gst_element_add_pad(GST_ELEMENT(self), state->srcpads_[0]);
 
+	state->underruns_ = 0;
+	state->monotonicClock_ = false;
+	state->clockOffset_ = 0;
+	state->clockOffsetTime_ = GST_CLOCK_TIME_NONE;
+	state->lastCaptureTime_ = GST_CLOCK_TIME_NONE;
+	state->latencySampleTime_ = GST_CLOCK_TIME_NONE;
+	state->latency_ = GST_CLOCK_TIME_NONE;
+	state->reportedLatency_ = GST_CLOCK_TIME_NONE;
+	state->latencyChanged_ = false;
+	self->queue_depth = 0;
+
+	/* The frame timestamps are in the CLOCK_MONOTONIC domain. */
+	self->clock = GST_CLOCK(g_object_new(GST_TYPE_SYSTEM_CLOCK,
+					     "name", "GstLibcameraClock",
+					     "clock-type", GST_CLOCK_TYPE_MONOTONIC,
+					     nullptr));
+	gst_object_ref_sink(self->clock);
+	self->provide_clock = FALSE;
+
 	/* C-style friend. */
 	state->src_ = self;
 	self->state = state;
@@ -632,6 +1076,8 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 	object_class->finalize = gst_libcamera_src_finalize;
 
 	element_class->change_state = gst_libcamera_src_change_state;
+	element_class->provide_clock = gst_libcamera_src_provide_clock;
+	element_class->set_clock = gst_libcamera_src_set_clock;
 
 	gst_element_class_set_metadata(element_class,
 				       "libcamera Source", "Source/Video",
@@ -651,4 +1097,31 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 							     | G_PARAM_READWRITE
 							     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+
+	spec = g_param_spec_uint("queue-depth", "Queue Depth",
+				 "Maximum number of requests kept queued to the camera "
+				 "(0 = limited by the number of buffers)",
+				 0, G_MAXUINT, 0,
+				 (GParamFlags)(GST_PARAM_MUTABLE_PLAYING
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_QUEUE_DEPTH, spec);
+
+	spec = g_param_spec_boolean("provide-clock", "Provide Clock",
+				    "Provide a clock running in the frame timestamps "
+				    "domain (CLOCK_MONOTONIC) to the pipeline",
+				    FALSE,
+				    (GParamFlags)(GST_PARAM_MUTABLE_READY
+						  | G_PARAM_READWRITE
+						  | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_PROVIDE_CLOCK, spec);
+
+	spec = g_param_spec_boxed("stats", "Statistics",
+				  "Streaming statistics: underruns is the number of times "
+				  "the camera ran out of queued requests, queued is the "
+				  "number of requests currently queued",
+				  GST_TYPE_STRUCTURE,
+				  (GParamFlags)(G_PARAM_READABLE
+						| G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_STATS, spec);
 }
@@ -24,6 +24,7 @@
 
 #include <libipa/ipa_interface_wrapper.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/utils.h"
@@ -111,7 +112,7 @@ private:
 	void resampleTable(uint16_t dest[], double const src[12][16], int dest_w, int dest_h);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
-	std::map<unsigned int, void *> buffersMemory_;
+	std::map<unsigned int, CachedMappedFrameBuffer> mappedBuffers_;
 
 	ControlInfoMap unicam_ctrls_;
 	ControlInfoMap isp_ctrls_;
@@ -311,12 +312,17 @@ void IPARPi::mapBuffers(const std::vector<IPABuffer> &buffers)
 					     std::forward_as_tuple(buffer.planes));
 		const FrameBuffer &fb = elem.first->second;
 
-		buffersMemory_[buffer.id] = mmap(nullptr, fb.planes()[0].length,
-						 PROT_READ | PROT_WRITE, MAP_SHARED,
-						 fb.planes()[0].fd.fd(), 0);
+		/*
+		 * The mapping is kept for the lifetime of the buffer, without
+		 * synchronization of CPU accesses.
+		 */
+		auto map = mappedBuffers_.emplace(std::piecewise_construct,
+						  std::forward_as_tuple(buffer.id),
+						  std::forward_as_tuple(&fb, PROT_READ | PROT_WRITE,
+									false));
 
-		if (buffersMemory_[buffer.id] == MAP_FAILED) {
-			int ret = -errno;
+		if (!map.first->second.isValid()) {
+			int ret = map.first->second.error();
 			LOG(IPARPI, Fatal) << "Failed to mmap buffer: " << strerror(-ret);
 		}
 	}
@@ -329,8 +335,9 @@ void IPARPi::unmapBuffers(const std::vector<unsigned int> &ids)
 		if (fb == buffers_.end())
 			continue;
 
-		munmap(buffersMemory_[id], fb->second.planes()[0].length);
-		buffersMemory_.erase(id);
+		mappedBuffers_.erase(id);
+		for (const FrameBuffer::Plane &plane : fb->second.planes())
+			MappedBufferCache::instance()->evict(plane.fd);
 		buffers_.erase(id);
 	}
 }
@@ -773,15 +780,15 @@ void IPARPi::prepareISP(unsigned int bufferId)
 
 bool IPARPi::parseEmbeddedData(unsigned int bufferId, struct DeviceStatus &deviceStatus)
 {
-	auto it = buffersMemory_.find(bufferId);
-	if (it == buffersMemory_.end()) {
+	auto it = mappedBuffers_.find(bufferId);
+	if (it == mappedBuffers_.end()) {
 		LOG(IPARPI, Error) << "Could not find embedded buffer!";
 		return false;
 	}
 
-	int size = buffers_.find(bufferId)->second.planes()[0].length;
-	helper_->Parser().SetBufferSize(size);
-	RPi::MdParser::Status status = helper_->Parser().Parse(it->second);
+	const MappedBuffer::Plane &mem = it->second.maps()[0];
+	helper_->Parser().SetBufferSize(mem.size());
+	RPi::MdParser::Status status = helper_->Parser().Parse(mem.data());
 	if (status != RPi::MdParser::Status::OK) {
 		LOG(IPARPI, Error) << "Embedded Buffer parsing failed, error " << status;
 	} else {
@@ -808,13 +815,14 @@ bool IPARPi::parseEmbeddedData(unsigned int bufferId, struct DeviceStatus &devic
 
 void IPARPi::processStats(unsigned int bufferId)
 {
-	auto it = buffersMemory_.find(bufferId);
-	if (it == buffersMemory_.end()) {
+	auto it = mappedBuffers_.find(bufferId);
+	if (it == mappedBuffers_.end()) {
 		LOG(IPARPI, Error) << "Could not find stats buffer!";
 		return;
 	}
 
-	bcm2835_isp_stats *stats = static_cast<bcm2835_isp_stats *>(it->second);
+	bcm2835_isp_stats *stats =
+		reinterpret_cast<bcm2835_isp_stats *>(it->second.maps()[0].data());
 	RPi::StatisticsPtr statistics = std::make_shared<bcm2835_isp_stats>(*stats);
 	controller_.Process(statistics, &rpiMetadata_);
 
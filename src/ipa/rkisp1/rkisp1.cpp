@@ -23,6 +23,7 @@
 
 #include <libipa/ipa_interface_wrapper.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/utils.h"
 
@@ -56,7 +57,7 @@ private:
 	void metadataReady(unsigned int frame, unsigned int aeState);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
-	std::map<unsigned int, void *> buffersMemory_;
+	std::map<unsigned int, CachedMappedFrameBuffer> mappedBuffers_;
 
 	ControlInfoMap ctrls_;
 
@@ -125,18 +126,16 @@ void IPARkISP1::mapBuffers(const std::vector<IPABuffer> &buffers)
 		const FrameBuffer &fb = elem.first->second;
 
 		/*
-		 * \todo Provide a helper to mmap() buffers (possibly exposed
-		 * to applications).
+		 * The mapping is kept for the lifetime of the buffer, without
+		 * synchronization of CPU accesses.
 		 */
-		buffersMemory_[buffer.id] = mmap(NULL,
-						 fb.planes()[0].length,
-						 PROT_READ | PROT_WRITE,
-						 MAP_SHARED,
-						 fb.planes()[0].fd.fd(),
-						 0);
-
-		if (buffersMemory_[buffer.id] == MAP_FAILED) {
-			int ret = -errno;
+		auto map = mappedBuffers_.emplace(std::piecewise_construct,
+						  std::forward_as_tuple(buffer.id),
+						  std::forward_as_tuple(&fb, PROT_READ | PROT_WRITE,
+									false));
+
+		if (!map.first->second.isValid()) {
+			int ret = map.first->second.error();
 			LOG(IPARkISP1, Fatal) << "Failed to mmap buffer: "
 					      << strerror(-ret);
 		}
@@ -150,8 +149,9 @@ void IPARkISP1::unmapBuffers(const std::vector<unsigned int> &ids)
 		if (fb == buffers_.end())
 			continue;
 
-		munmap(buffersMemory_[id], fb->second.planes()[0].length);
-		buffersMemory_.erase(id);
+		mappedBuffers_.erase(id);
+		for (const FrameBuffer::Plane &plane : fb->second.planes())
+			MappedBufferCache::instance()->evict(plane.fd);
 		buffers_.erase(id);
 	}
 }
@@ -163,8 +163,9 @@ void IPARkISP1::processEvent(const IPAOperationData &event)
 		unsigned int frame = event.data[0];
 		unsigned int bufferId = event.data[1];
 
+		const MappedBuffer &mapped = mappedBuffers_.find(bufferId)->second;
 		const rkisp1_stat_buffer *stats =
-			static_cast<rkisp1_stat_buffer *>(buffersMemory_[bufferId]);
+			reinterpret_cast<rkisp1_stat_buffer *>(mapped.maps()[0].data());
 
 		updateStatistics(frame, stats);
 		break;
@@ -173,8 +174,9 @@ void IPARkISP1::processEvent(const IPAOperationData &event)
 		unsigned int frame = event.data[0];
 		unsigned int bufferId = event.data[1];
 
+		const MappedBuffer &mapped = mappedBuffers_.find(bufferId)->second;
 		rkisp1_isp_params_cfg *params =
-			static_cast<rkisp1_isp_params_cfg *>(buffersMemory_[bufferId]);
+			reinterpret_cast<rkisp1_isp_params_cfg *>(mapped.maps()[0].data());
 
 		queueRequest(frame, params, event.controls[0]);
 		break;
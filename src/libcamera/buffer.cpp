@@ -8,9 +8,16 @@
 #include <libcamera/buffer.h>
 #include "libcamera/internal/buffer.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <linux/magic.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
 #include "libcamera/internal/log.h"
@@ -430,4 +437,413 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, int flags)
 	}
 }
 
+/**
+ * \class MappedBufferCache
+ * \brief Process-wide cache of long-lived CPU mappings of buffers
+ *
+ * Mapping a buffer for CPU access with mmap() and unmapping it with munmap()
+ * for every frame is costly. The MappedBufferCache keeps the mappings of
+ * buffers alive across accesses, so that repeated CPU access to the same
+ * buffer doesn't require any system call after the first one.
+ *
+ * Mappings are looked up by file descriptor number. The cache holds a
+ * reference to the file descriptor of each cached buffer, which guarantees
+ * that the number can't be reused for a different file while the entry exists.
+ *
+ * Buffers that are identified by their inode, dma-bufs and memfds, are further
+ * cached by inode. When a new file descriptor for such a buffer is mapped,
+ * typically because the buffer owner duplicates its file descriptors for every
+ * frame, the mapping is reused without calling mmap(). As dma-bufs share a
+ * single anonymous inode on kernels older than v5.3, they are cached by file
+ * descriptor only on those kernels.
+ *
+ * Mappings are reference-counted, and are unmapped when their last user and
+ * the cache entries that point to them are destroyed. The cache holds a
+ * limited number of file descriptors and of buffers, set by setLimit(), and
+ * evicts the least recently used ones when the limit is exceeded. As cache
+ * entries keep the buffers they reference allocated, users shall release()
+ * file descriptors they close, and owners of buffers shall evict() them when
+ * they free them.
+ *
+ * The MappedBufferCache is a process-wide singleton, accessed through
+ * instance(). All its functions are thread-safe.
+ */
+
+/**
+ * \class MappedBufferCache::Mapping
+ * \brief A CPU mapping of a buffer, shared between the users of the buffer
+ */
+
+/**
+ * \brief Construct a Mapping for a mapped memory region
+ * \param[in] address The address of the mapped region
+ * \param[in] length The length of the mapped region
+ * \param[in] prot The memory protection flags of the mapped region
+ * \param[in] dmaBuf True if the mapped file is a dma-buf
+ *
+ * The Mapping takes ownership of the memory region, and unmaps it when
+ * destroyed.
+ */
+MappedBufferCache::Mapping::Mapping(void *address, size_t length, int prot,
+				    bool dmaBuf)
+	: address_(address), length_(length), prot_(prot), dmaBuf_(dmaBuf)
+{
+}
+
+MappedBufferCache::Mapping::~Mapping()
+{
+	munmap(address_, length_);
+}
+
+/**
+ * \fn MappedBufferCache::Mapping::address()
+ * \brief Retrieve the address of the mapped region
+ * \return The address of the mapped region
+ */
+
+/**
+ * \fn MappedBufferCache::Mapping::length()
+ * \brief Retrieve the length of the mapped region
+ * \return The length of the mapped region in bytes
+ */
+
+/**
+ * \fn MappedBufferCache::Mapping::prot()
+ * \brief Retrieve the memory protection flags of the mapped region
+ * \return The memory protection flags of the mapped region
+ */
+
+/**
+ * \fn MappedBufferCache::Mapping::isDmaBuf()
+ * \brief Check if the mapped file is a dma-buf
+ *
+ * CPU access to dma-bufs shall be bracketed by DMA_BUF_IOCTL_SYNC calls.
+ *
+ * \return True if the mapped file is a dma-buf, false otherwise
+ */
+
+MappedBufferCache::MappedBufferCache()
+	: limit_(64)
+{
+}
+
+/**
+ * \brief Retrieve the MappedBufferCache instance
+ * \return The MappedBufferCache instance
+ */
+MappedBufferCache *MappedBufferCache::instance()
+{
+	static MappedBufferCache instance;
+	return &instance;
+}
+
+/**
+ * \brief Retrieve a CPU mapping of a buffer
+ * \param[in] fd The file descriptor of the buffer
+ * \param[in] length The length of the buffer to map
+ * \param[in] prot The memory protection flags of the mapping
+ * \param[out] mapping The mapping
+ *
+ * Retrieve the cached mapping of \a fd, or of the buffer \a fd refers to, if it
+ * covers \a length bytes with the requested \a prot protection flags, or map
+ * the buffer and cache the mapping otherwise. When an insufficient mapping is
+ * replaced, the new mapping covers the protection flags and length of both the
+ * old mapping and the request. Users of the old mapping are not affected.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MappedBufferCache::map(const FileDescriptor &fd, size_t length, int prot,
+			   std::shared_ptr<Mapping> *mapping)
+{
+	MutexLocker locker(mutex_);
+
+	auto iter = entries_.find(fd.fd());
+	if (iter != entries_.end()) {
+		Entry &entry = iter->second;
+		lru_.splice(lru_.begin(), lru_, entry.lru);
+
+		if (entry.mapping->length() >= length &&
+		    (entry.mapping->prot() & prot) == prot) {
+			*mapping = entry.mapping;
+			return 0;
+		}
+
+		length = std::max(length, entry.mapping->length());
+		prot |= entry.mapping->prot();
+	}
+
+	Identity identity;
+	bool shareable;
+	bool dmaBuf;
+	int ret = identify(fd.fd(), &identity, &shareable, &dmaBuf);
+	if (ret)
+		return ret;
+
+	/* Reuse the mapping of other file descriptors for the same buffer. */
+	std::shared_ptr<Mapping> newMapping;
+	auto sharedIter = shareable ? shared_.find(identity) : shared_.end();
+	if (sharedIter != shared_.end()) {
+		SharedEntry &shared = sharedIter->second;
+		sharedLru_.splice(sharedLru_.begin(), sharedLru_, shared.lru);
+
+		if (shared.mapping->length() >= length &&
+		    (shared.mapping->prot() & prot) == prot) {
+			newMapping = shared.mapping;
+		} else {
+			length = std::max(length, shared.mapping->length());
+			prot |= shared.mapping->prot();
+		}
+	}
+
+	if (!newMapping) {
+		void *address = mmap(nullptr, length, prot, MAP_SHARED, fd.fd(), 0);
+		if (address == MAP_FAILED) {
+			ret = -errno;
+			LOG(Buffer, Error)
+				<< "Failed to mmap buffer: " << strerror(-ret);
+			return ret;
+		}
+
+		newMapping = std::make_shared<Mapping>(address, length, prot,
+						       dmaBuf);
+
+		if (sharedIter != shared_.end()) {
+			sharedIter->second.mapping = newMapping;
+		} else if (shareable) {
+			sharedLru_.push_front(identity);
+			shared_.emplace(identity,
+					SharedEntry{ newMapping, sharedLru_.begin() });
+		}
+	}
+
+	if (iter != entries_.end()) {
+		iter->second.mapping = newMapping;
+	} else {
+		lru_.push_front(fd.fd());
+		entries_.emplace(fd.fd(), Entry{ fd, newMapping, lru_.begin() });
+	}
+
+	trim();
+
+	*mapping = std::move(newMapping);
+	return 0;
+}
+
+/**
+ * \brief Release a file descriptor from the cache
+ * \param[in] fd The file descriptor
+ *
+ * Drop the reference the cache holds to \a fd, allowing the file descriptor
+ * to be closed. The mapping of the buffer stays cached when the buffer is
+ * identified by its inode, and is reused when the buffer is mapped through
+ * another file descriptor. Users that create new file descriptors for the same
+ * buffers for every frame shall release them once done.
+ */
+void MappedBufferCache::release(const FileDescriptor &fd)
+{
+	MutexLocker locker(mutex_);
+
+	auto iter = entries_.find(fd.fd());
+	if (iter == entries_.end())
+		return;
+
+	lru_.erase(iter->second.lru);
+	entries_.erase(iter);
+}
+
+/**
+ * \brief Remove a buffer from the cache
+ * \param[in] fd The file descriptor of the buffer
+ *
+ * Release \a fd and drop the mapping of the buffer it refers to from the cache.
+ * The mapping stays valid for its current users, and for other file
+ * descriptors of the same buffer that are still cached.
+ */
+void MappedBufferCache::evict(const FileDescriptor &fd)
+{
+	release(fd);
+
+	Identity identity;
+	bool shareable;
+	bool dmaBuf;
+	if (identify(fd.fd(), &identity, &shareable, &dmaBuf) || !shareable)
+		return;
+
+	MutexLocker locker(mutex_);
+
+	auto iter = shared_.find(identity);
+	if (iter == shared_.end())
+		return;
+
+	sharedLru_.erase(iter->second.lru);
+	shared_.erase(iter);
+}
+
+/**
+ * \brief Remove all buffers from the cache
+ */
+void MappedBufferCache::clear()
+{
+	MutexLocker locker(mutex_);
+
+	entries_.clear();
+	lru_.clear();
+	shared_.clear();
+	sharedLru_.clear();
+}
+
+/**
+ * \brief Set the maximum number of file descriptors and buffers held by the
+ * cache
+ * \param[in] limit The maximum number of file descriptors and of buffers
+ */
+void MappedBufferCache::setLimit(unsigned int limit)
+{
+	MutexLocker locker(mutex_);
+
+	limit_ = limit;
+	trim();
+}
+
+/**
+ * \brief Retrieve the number of file descriptors held by the cache
+ * \return The number of file descriptors held by the cache
+ */
+unsigned int MappedBufferCache::size() const
+{
+	MutexLocker locker(mutex_);
+
+	return entries_.size();
+}
+
+int MappedBufferCache::identify(int fd, Identity *identity, bool *shareable,
+				bool *dmaBuf)
+{
+	struct stat st;
+	int ret = fstat(fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Buffer, Error) << "Failed to stat buffer: " << strerror(-ret);
+		return ret;
+	}
+
+	struct statfs sfs;
+	*dmaBuf = !fstatfs(fd, &sfs) && sfs.f_type == DMA_BUF_MAGIC;
+
+	/*
+	 * The inode identifies the buffer only for dma-bufs on kernels that
+	 * give them a file system of their own (v5.3 and newer), and for shmem
+	 * files such as memfds. Older kernels create all dma-bufs on a single
+	 * anonymous inode.
+	 */
+	*shareable = *dmaBuf || fcntl(fd, F_GET_SEALS) >= 0;
+	*identity = { st.st_dev, st.st_ino };
+
+	return 0;
+}
+
+void MappedBufferCache::trim()
+{
+	while (entries_.size() > limit_) {
+		entries_.erase(lru_.back());
+		lru_.pop_back();
+	}
+
+	while (shared_.size() > limit_) {
+		shared_.erase(sharedLru_.back());
+		sharedLru_.pop_back();
+	}
+}
+
+/**
+ * \class CachedMappedFrameBuffer
+ * \brief Map a FrameBuffer through the MappedBufferCache
+ *
+ * The CachedMappedFrameBuffer provides CPU access to the planes of a
+ * FrameBuffer like the MappedFrameBuffer, but retrieves the mappings from the
+ * MappedBufferCache instead of creating and destroying them. It is meant to be
+ * constructed for every CPU access to a frame, and makes repeated accesses to
+ * the same buffer cheap.
+ *
+ * When requested, CPU access to dma-buf planes is synchronized with
+ * DMA_BUF_IOCTL_SYNC, started at construction time and ended at destruction
+ * time. Users that keep a CachedMappedFrameBuffer for a long time shall
+ * disable synchronization.
+ *
+ * A CachedMappedFrameBuffer shall not be moved to a MappedBuffer, as the
+ * mappings are owned by the cache.
+ */
+
+/**
+ * \brief Map all planes of a FrameBuffer through the MappedBufferCache
+ * \param[in] buffer FrameBuffer to be mapped
+ * \param[in] flags Protection flags to apply to map
+ * \param[in] sync Synchronize CPU access to dma-buf planes
+ *
+ * The flags are passed directly to mmap and should be either PROT_READ,
+ * PROT_WRITE, or a bitwise-or combination of both. The \a buffer shall stay
+ * valid for the lifetime of the CachedMappedFrameBuffer.
+ */
+CachedMappedFrameBuffer::CachedMappedFrameBuffer(const FrameBuffer *buffer,
+						 int flags, bool sync)
+	: flags_(flags), sync_(sync)
+{
+	MappedBufferCache *cache = MappedBufferCache::instance();
+
+	maps_.reserve(buffer->planes().size());
+
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		std::shared_ptr<MappedBufferCache::Mapping> mapping;
+		int ret = cache->map(plane.fd, plane.length, flags, &mapping);
+		if (ret) {
+			error_ = ret;
+			break;
+		}
+
+		maps_.emplace_back(mapping->address(), plane.length);
+
+		/* Planes may share a buffer, synchronize it only once. */
+		auto iter = std::find_if(mappings_.begin(), mappings_.end(),
+					 [&mapping](const auto &m) {
+						 return m.second == mapping;
+					 });
+		if (iter == mappings_.end())
+			mappings_.emplace_back(plane.fd.fd(), std::move(mapping));
+	}
+
+	if (sync_ && !error_)
+		syncDmaBufs(DMA_BUF_SYNC_START);
+}
+
+CachedMappedFrameBuffer::~CachedMappedFrameBuffer()
+{
+	if (sync_ && !error_)
+		syncDmaBufs(DMA_BUF_SYNC_END);
+
+	/* The mappings are owned by the cache, don't unmap them. */
+	maps_.clear();
+}
+
+void CachedMappedFrameBuffer::syncDmaBufs(uint64_t flags)
+{
+	if (flags_ & PROT_READ)
+		flags |= DMA_BUF_SYNC_READ;
+	if (flags_ & PROT_WRITE)
+		flags |= DMA_BUF_SYNC_WRITE;
+
+	for (const auto &mapping : mappings_) {
+		if (!mapping.second->isDmaBuf())
+			continue;
+
+		struct dma_buf_sync sync = { flags };
+		int ret = ioctl(mapping.first, DMA_BUF_IOCTL_SYNC, &sync);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(Buffer, Error)
+				<< "Failed to synchronize dma-buf: "
+				<< strerror(-ret);
+		}
+	}
+}
+
 } /* namespace libcamera */
@@ -262,6 +262,7 @@ public:
 		CameraAvailable,
 		CameraAcquired,
 		CameraConfigured,
+		CameraReconfiguring,
 		CameraRunning,
 	};
 
@@ -276,6 +277,8 @@ public:
 	void disconnect();
 	void setState(State state);
 
+	int setActiveStreams(const CameraConfiguration &config);
+
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string id_;
 	std::set<Stream *> streams_;
@@ -303,9 +306,29 @@ static const char *const camera_state_names[] = {
 	"Available",
 	"Acquired",
 	"Configured",
+	"Reconfiguring",
 	"Running",
 };
 
+int Camera::Private::setActiveStreams(const CameraConfiguration &config)
+{
+	activeStreams_.clear();
+	for (const StreamConfiguration &cfg : config) {
+		Stream *stream = cfg.stream();
+		if (!stream) {
+			LOG(Camera, Fatal)
+				<< "Pipeline handler failed to update stream configuration";
+			activeStreams_.clear();
+			return -EINVAL;
+		}
+
+		stream->configuration_ = cfg;
+		activeStreams_.insert(stream);
+	}
+
+	return 0;
+}
+
 int Camera::Private::isAccessAllowed(State state, bool allowDisconnected) const
 {
 	if (!allowDisconnected && disconnected_)
@@ -352,7 +375,9 @@ void Camera::Private::disconnect()
 	 * state to Configured state to allow applications to free resources
 	 * and call release() before deleting the camera.
 	 */
-	if (state_.load(std::memory_order_acquire) == Private::CameraRunning)
+	State state = state_.load(std::memory_order_acquire);
+	if (state == Private::CameraRunning ||
+	    state == Private::CameraReconfiguring)
 		state_.store(Private::CameraConfigured, std::memory_order_release);
 
 	disconnected_ = true;
@@ -422,7 +447,7 @@ void Camera::Private::setState(State state)
  *   Configured -> Running [label = "start()"];
  *
  *   Running -> Configured [label = "stop()"];
- *   Running -> Running [label = "createRequest(), queueRequest()"];
+ *   Running -> Running [label = "createRequest(), queueRequest(), reconfigure()"];
  * }
  * \enddot
  *
@@ -444,7 +469,10 @@ void Camera::Private::setState(State state)
  * \subsubsection Running
  * The camera is running and ready to process requests queued by the
  * application. The camera remains in this state until it is stopped and moved
- * to the Configured state.
+ * to the Configured state. It may be reconfigured with reconfigure() without
+ * leaving the Running state. Requests can't be queued while reconfigure() is in
+ * progress, including from the request completion handler for the requests it
+ * cancels.
  */
 
 /**
@@ -592,6 +620,10 @@ int Camera::exportFrameBuffers(Stream *stream,
  * Once exclusive access isn't needed anymore, the device should be released
  * with a call to the release() function.
  *
+ * Pipeline handlers may defer part of the camera initialisation until the
+ * camera is used. The first call to this function completes the
+ * initialisation, and may thus take longer than subsequent calls.
+ *
  * \context This function is \threadsafe. It may only be called when the camera
  * is in the Available state as defined in \ref camera_operation.
  *
@@ -615,6 +647,13 @@ int Camera::acquire()
 		return -EBUSY;
 	}
 
+	ret = p_->pipe_->invokeMethod(&PipelineHandler::initCamera,
+				      ConnectionTypeBlocking, this);
+	if (ret < 0) {
+		p_->pipe_->unlock();
+		return ret;
+	}
+
 	p_->setState(Private::CameraAcquired);
 
 	return 0;
@@ -797,19 +836,9 @@ int Camera::configure(CameraConfiguration *config)
 	if (ret)
 		return ret;
 
-	p_->activeStreams_.clear();
-	for (const StreamConfiguration &cfg : *config) {
-		Stream *stream = cfg.stream();
-		if (!stream) {
-			LOG(Camera, Fatal)
-				<< "Pipeline handler failed to update stream configuration";
-			p_->activeStreams_.clear();
-			return -EINVAL;
-		}
-
-		stream->configuration_ = cfg;
-		p_->activeStreams_.insert(stream);
-	}
+	ret = p_->setActiveStreams(*config);
+	if (ret)
+		return ret;
 
 	p_->setState(Private::CameraConfigured);
 
@@ -846,6 +875,38 @@ Request *Camera::createRequest(uint64_t cookie)
 	return new Request(this, cookie);
 }
 
+/**
+ * \brief Create a reusable request object for the camera
+ * \param[in] cookie Opaque cookie for application use
+ *
+ * This method creates an empty request in the same way as createRequest(),
+ * but the ownership of the request stays with the caller. The camera doesn't
+ * delete reusable requests when they complete. Instead, the application may
+ * reset them with Request::reuse() from the request completion handler or at
+ * a later time, and queue them again. This avoids allocating and populating a
+ * new request for every frame.
+ *
+ * The application shall not delete a reusable request while it is queued to
+ * the camera.
+ *
+ * \context This function is \threadsafe. It may only be called when the camera
+ * is in the Configured or Running state as defined in \ref camera_operation.
+ *
+ * \return A pointer to the newly created request, or nullptr on error
+ */
+std::unique_ptr<Request> Camera::createReusableRequest(uint64_t cookie)
+{
+	int ret = p_->isAccessAllowed(Private::CameraConfigured,
+				      Private::CameraRunning);
+	if (ret < 0)
+		return nullptr;
+
+	std::unique_ptr<Request> request = std::make_unique<Request>(this, cookie);
+	request->reusable_ = true;
+
+	return request;
+}
+
 /**
  * \brief Queue a request to the camera
  * \param[in] request The request to queue to the camera
@@ -860,7 +921,8 @@ Request *Camera::createRequest(uint64_t cookie)
  * through the \ref requestCompleted signal.
  *
  * Ownership of the request is transferred to the camera. It will be deleted
- * automatically after it completes.
+ * automatically after it completes, unless it has been created with
+ * createReusableRequest().
  *
  * \context This function is \threadsafe. It may only be called when the camera
  * is in the Running state as defined in \ref camera_operation.
@@ -965,18 +1027,106 @@ int Camera::stop()
 	return 0;
 }
 
+/**
+ * \brief Reconfigure the camera while capture is running
+ * \param[in] config The new camera configuration
+ *
+ * This method changes the configuration of a running camera, for instance to
+ * switch from a preview resolution to a still capture resolution or to add a
+ * stream. It is equivalent to calling stop(), configure() and start(), but
+ * lets the pipeline handler preserve the resources that are not affected by
+ * the configuration change, such as internal buffers and the IPA state.
+ *
+ * As with configure(), \a config shall be fully valid. Buffers allocated for
+ * the streams of the camera stay valid and can be used with the new
+ * configuration as long as they are large enough for it.
+ *
+ * All requests pending at the time of the call are completed, and may be
+ * cancelled. Requests shall then be queued for the new configuration, as
+ * queueRequest() rejects requests until this method returns.
+ *
+ * If \a config isn't valid, -EINVAL is returned and the camera keeps running
+ * with its current configuration. If the pipeline handler fails to apply a
+ * valid configuration, the camera is stopped and moved to the Configured
+ * state, and shall be configured again before being started.
+ *
+ * \context This function may only be called when the camera is in the Running
+ * state as defined in \ref camera_operation, and shall be synchronized by the
+ * caller with other functions that affect the camera state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so can't be reconfigured
+ * \retval -EINVAL The configuration is not valid
+ */
+int Camera::reconfigure(CameraConfiguration *config)
+{
+	int ret = p_->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	for (auto &it : *config)
+		it.setStream(nullptr);
+
+	if (config->validate() != CameraConfiguration::Valid) {
+		LOG(Camera, Error)
+			<< "Can't reconfigure camera with invalid configuration";
+		return -EINVAL;
+	}
+
+	/*
+	 * Prevent requests from being queued to the pipeline handler while it
+	 * is reconfigured and the active streams are updated.
+	 */
+	p_->setState(Private::CameraReconfiguring);
+
+	std::ostringstream msg("reconfiguring streams:", std::ios_base::ate);
+
+	for (unsigned int index = 0; index < config->size(); ++index) {
+		StreamConfiguration &cfg = config->at(index);
+		msg << " (" << index << ") " << cfg.toString();
+	}
+
+	LOG(Camera, Info) << msg.str();
+
+	ret = p_->pipe_->invokeMethod(&PipelineHandler::reconfigure,
+				      ConnectionTypeBlocking, this, config);
+	if (!ret)
+		ret = p_->setActiveStreams(*config);
+	if (!ret)
+		ret = p_->pipe_->invokeMethod(&PipelineHandler::start,
+					      ConnectionTypeBlocking, this);
+
+	if (ret) {
+		p_->setState(Private::CameraConfigured);
+		return ret;
+	}
+
+	p_->setState(Private::CameraRunning);
+
+	return 0;
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
  *
  * This function is called by the pipeline handler to notify the camera that
  * the request has completed. It emits the requestCompleted signal and deletes
- * the request.
+ * the request, unless it is owned by the application.
  */
 void Camera::requestComplete(Request *request)
 {
+	/*
+	 * The application may delete reusable requests from the completion
+	 * handler, don't access the request after emitting the signal.
+	 */
+	bool reusable = request->reusable_;
+
 	requestCompleted.emit(request);
-	delete request;
+
+	if (!reusable)
+		delete request;
 }
 
 } /* namespace libcamera */
@@ -13,9 +13,11 @@
 #include <libcamera/camera.h>
 #include <libcamera/event_dispatcher.h>
 
+#include "libcamera/internal/capability_cache.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/event_dispatcher_poll.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/ipa_process_pool.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/thread.h"
@@ -66,12 +68,17 @@ private:
 
 	std::unique_ptr<DeviceEnumerator> enumerator_;
 
+	/* The IPA module index is stored in the capability cache. */
+	CapabilityCache capabilityCache_;
 	IPAManager ipaManager_;
+	IPAProcessPool ipaProcessPool_;
 };
 
 CameraManager::Private::Private(CameraManager *cm)
 	: cm_(cm), initialized_(false)
 {
+	/* Spare IPA workers are started from the camera manager thread. */
+	ipaProcessPool_.moveToThread(this);
 }
 
 int CameraManager::Private::start()
@@ -156,6 +163,9 @@ void CameraManager::Private::createPipelineHandlers()
 	}
 
 	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
+
+	/* Persist the capabilities probed while matching pipeline handlers. */
+	CapabilityCache::save();
 }
 
 void CameraManager::Private::cleanup()
@@ -172,6 +182,7 @@ void CameraManager::Private::cleanup()
 	cameras_.clear();
 	dispatchMessages(Message::Type::DeferredDelete);
 
+	ipaProcessPool_.clear();
 	enumerator_.reset(nullptr);
 }
 
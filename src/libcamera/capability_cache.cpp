@@ -0,0 +1,450 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capability_cache.cpp - Persistent cache of device capabilities
+ */
+
+#include "libcamera/internal/capability_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <libcamera/camera_manager.h>
+
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
+
+/**
+ * \file capability_cache.h
+ * \brief Persistent cache of device capabilities
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CapabilityCache)
+
+namespace {
+
+/*
+ * The cache file starts with a header, followed by the libcamera version
+ * string and the entries. Each entry stores the key and data sizes, followed
+ * by the key and the data. All fields are aligned to 8 bytes to allow
+ * accessing the data in place.
+ */
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entries;
+	uint32_t versionLength;
+};
+
+struct CacheEntry {
+	uint32_t keyLength;
+	uint32_t dataLength;
+};
+
+constexpr char cacheMagic[4] = { 'l', 'c', 'c', 'c' };
+constexpr uint32_t cacheVersion = 1;
+constexpr size_t cacheAlignment = 8;
+
+size_t alignUp(size_t size)
+{
+	return (size + cacheAlignment - 1) & ~(cacheAlignment - 1);
+}
+
+void append(std::vector<uint8_t> &data, const void *src, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(src);
+	data.insert(data.end(), bytes, bytes + size);
+	data.resize(alignUp(data.size()));
+}
+
+} /* namespace */
+
+/**
+ * \class CapabilityCache
+ * \brief Persistent cache of the capabilities of V4L2 devices
+ *
+ * Matching pipeline handlers at CameraManager start time enumerates the
+ * formats, frame sizes and controls of all video devices and subdevices.
+ * With complex pipelines this requires hundreds of ioctl calls, which
+ * dominate the start time of short-lived applications. The CapabilityCache
+ * stores the result of those enumerations in a file that is memory-mapped by
+ * the next processes, which can then skip the ioctl calls.
+ *
+ * Data is stored as opaque blobs, identified by a string key. Callers are
+ * responsible for creating keys that identify the device uniquely and change
+ * when its capabilities may change. Keys are based on MediaDevice::cacheKey(),
+ * which covers the device serial number, bus information, hardware and driver
+ * versions, and a hash of the media graph topology. Any mismatch results in a
+ * cache miss, in which case callers fall back to probing the device and
+ * store the result in the cache.
+ *
+ * Only static capabilities shall be cached. Control limits, for instance, may
+ * change at runtime and are always queried from the device, only the list of
+ * supported controls is cached.
+ *
+ * The cache also stores the index of IPA modules, keyed by module path, to
+ * avoid parsing the ELF headers of all modules when the CameraManager starts.
+ *
+ * The cache file is written by save() when new entries have been added. It
+ * only stores the entries that have been looked up or added by the process,
+ * which drops the entries of devices whose keys have changed. The file is
+ * replaced atomically, making it safe to share between processes.
+ *
+ * The file is located in the libcamera directory of the XDG cache directory.
+ * The LIBCAMERA_CAPABILITY_CACHE environment variable overrides its path, and
+ * disables the cache when set to an empty string.
+ *
+ * A single instance of the cache exists, owned by the CameraManager. All
+ * functions are static and do nothing when no instance exists.
+ */
+
+CapabilityCache *CapabilityCache::self_ = nullptr;
+
+/**
+ * \typedef CapabilityCache::Formats
+ * \brief A map of format codes to their supported size ranges
+ */
+
+/**
+ * \brief Construct the CapabilityCache instance and load the cache file
+ */
+CapabilityCache::CapabilityCache()
+	: dirty_(false)
+{
+	if (self_)
+		LOG(CapabilityCache, Fatal)
+			<< "Multiple CapabilityCache objects are not allowed";
+
+	path_ = cachePath();
+	if (!path_.empty() && !load())
+		entries_.clear();
+
+	/* The mapping stays valid until the file is destroyed. */
+	file_.close();
+
+	self_ = this;
+}
+
+CapabilityCache::~CapabilityCache()
+{
+	self_ = nullptr;
+}
+
+std::string CapabilityCache::cachePath()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_CAPABILITY_CACHE");
+	if (path)
+		return path;
+
+	std::string dir;
+	const char *cacheHome = utils::secure_getenv("XDG_CACHE_HOME");
+	if (cacheHome && cacheHome[0] == '/') {
+		dir = cacheHome;
+	} else {
+		const char *home = utils::secure_getenv("HOME");
+		if (!home)
+			return {};
+
+		dir = std::string(home) + "/.cache";
+	}
+
+	return dir + "/libcamera/capabilities";
+}
+
+bool CapabilityCache::load()
+{
+	file_.setFileName(path_);
+	if (!file_.open(File::ReadOnly)) {
+		LOG(CapabilityCache, Debug)
+			<< "No capability cache at " << path_;
+		return false;
+	}
+
+	Span<uint8_t> data = file_.map();
+	if (data.empty())
+		return false;
+
+	const CacheHeader *header = reinterpret_cast<const CacheHeader *>(data.data());
+	size_t offset = alignUp(sizeof(*header));
+	if (data.size() < offset ||
+	    memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) ||
+	    header->version != cacheVersion) {
+		LOG(CapabilityCache, Debug) << "Invalid capability cache";
+		return false;
+	}
+
+	/* Drop the whole cache when libcamera is upgraded. */
+	const std::string &version = CameraManager::version();
+	if (header->versionLength != version.size() ||
+	    data.size() < offset + header->versionLength ||
+	    memcmp(data.data() + offset, version.data(), version.size())) {
+		LOG(CapabilityCache, Debug)
+			<< "Capability cache created by a different version";
+		return false;
+	}
+
+	offset += alignUp(header->versionLength);
+
+	for (unsigned int i = 0; i < header->entries; ++i) {
+		if (data.size() < offset + sizeof(CacheEntry)) {
+			LOG(CapabilityCache, Debug) << "Truncated capability cache";
+			return false;
+		}
+
+		const CacheEntry *entry =
+			reinterpret_cast<const CacheEntry *>(data.data() + offset);
+		offset += alignUp(sizeof(*entry));
+
+		size_t keyOffset = offset;
+		offset += alignUp(entry->keyLength);
+		size_t dataOffset = offset;
+		offset += alignUp(entry->dataLength);
+
+		if (data.size() < offset) {
+			LOG(CapabilityCache, Debug) << "Truncated capability cache";
+			return false;
+		}
+
+		std::string key(reinterpret_cast<const char *>(data.data() + keyOffset),
+				entry->keyLength);
+		entries_[key] = { { data.data() + dataOffset, entry->dataLength }, false };
+	}
+
+	LOG(CapabilityCache, Debug)
+		<< "Loaded " << entries_.size() << " entries from " << path_;
+
+	return true;
+}
+
+/**
+ * \brief Retrieve the data stored in the cache for a key
+ * \param[in] key The key
+ *
+ * The returned data stays valid until the key is stored again or the
+ * CapabilityCache is destroyed.
+ *
+ * This function is \threadsafe.
+ *
+ * \return The data, or an empty span if the key isn't found
+ */
+Span<const uint8_t> CapabilityCache::lookup(const std::string &key)
+{
+	if (!self_ || key.empty())
+		return {};
+
+	MutexLocker locker(self_->mutex_);
+
+	auto added = self_->added_.find(key);
+	if (added != self_->added_.end())
+		return added->second;
+
+	auto it = self_->entries_.find(key);
+	if (it == self_->entries_.end())
+		return {};
+
+	it->second.used = true;
+	return it->second.data;
+}
+
+/**
+ * \brief Store data in the cache
+ * \param[in] key The key
+ * \param[in] data The data
+ *
+ * Data stored with a key already present in the cache replaces the existing
+ * data. The cache file is only updated by save().
+ *
+ * This function is \threadsafe.
+ */
+void CapabilityCache::store(const std::string &key, Span<const uint8_t> data)
+{
+	if (!self_ || key.empty() || data.empty() || self_->path_.empty())
+		return;
+
+	MutexLocker locker(self_->mutex_);
+
+	self_->entries_.erase(key);
+	self_->added_[key] = std::vector<uint8_t>(data.begin(), data.end());
+	self_->dirty_ = true;
+}
+
+/**
+ * \brief Retrieve formats stored in the cache for a key
+ * \param[in] key The key
+ * \param[out] formats The formats
+ *
+ * This function is \threadsafe.
+ *
+ * \return True if the formats have been found in the cache, false otherwise
+ */
+bool CapabilityCache::lookupFormats(const std::string &key, Formats *formats)
+{
+	Span<const uint8_t> data = lookup(key);
+	if (data.empty() || data.size() % sizeof(uint32_t))
+		return false;
+
+	std::vector<uint32_t> words(data.size() / sizeof(uint32_t));
+	memcpy(words.data(), data.data(), data.size());
+
+	size_t pos = 0;
+	auto next = [&]() { return pos < words.size() ? words[pos++] : 0; };
+
+	Formats result;
+	uint32_t count = next();
+
+	for (uint32_t i = 0; i < count; ++i) {
+		/* Don't iterate over a corrupted count past the data end. */
+		if (words.size() - pos < 2)
+			return false;
+
+		uint32_t code = next();
+		uint32_t numSizes = next();
+		if (words.size() - pos < static_cast<size_t>(numSizes) * 6)
+			return false;
+
+		std::vector<SizeRange> &sizes = result[code];
+		for (uint32_t j = 0; j < numSizes; ++j) {
+			SizeRange range;
+			range.min.width = next();
+			range.min.height = next();
+			range.max.width = next();
+			range.max.height = next();
+			range.hStep = next();
+			range.vStep = next();
+			sizes.push_back(range);
+		}
+	}
+
+	if (pos != words.size())
+		return false;
+
+	*formats = std::move(result);
+	return true;
+}
+
+/**
+ * \brief Store formats in the cache
+ * \param[in] key The key
+ * \param[in] formats The formats
+ *
+ * This function is \threadsafe.
+ */
+void CapabilityCache::storeFormats(const std::string &key, const Formats &formats)
+{
+	std::vector<uint32_t> words;
+
+	words.push_back(formats.size());
+	for (const auto &format : formats) {
+		words.push_back(format.first);
+		words.push_back(format.second.size());
+
+		for (const SizeRange &range : format.second) {
+			words.push_back(range.min.width);
+			words.push_back(range.min.height);
+			words.push_back(range.max.width);
+			words.push_back(range.max.height);
+			words.push_back(range.hStep);
+			words.push_back(range.vStep);
+		}
+	}
+
+	store(key, { reinterpret_cast<const uint8_t *>(words.data()),
+		     words.size() * sizeof(uint32_t) });
+}
+
+/**
+ * \brief Write the cache file if entries have been added
+ *
+ * This function is \threadsafe.
+ */
+void CapabilityCache::save()
+{
+	if (!self_)
+		return;
+
+	MutexLocker locker(self_->mutex_);
+
+	if (!self_->dirty_)
+		return;
+
+	/*
+	 * Write to a temporary file and rename it, to replace the cache
+	 * atomically for the processes that may be reading it.
+	 */
+	std::string tmpPath = self_->path_ + "." + std::to_string(getpid());
+	int ret = self_->write(tmpPath);
+	if (!ret && rename(tmpPath.c_str(), self_->path_.c_str()) < 0)
+		ret = -errno;
+
+	if (ret < 0) {
+		LOG(CapabilityCache, Warning)
+			<< "Failed to write capability cache " << self_->path_
+			<< ": " << strerror(-ret);
+		unlink(tmpPath.c_str());
+	}
+
+	self_->dirty_ = false;
+}
+
+int CapabilityCache::write(const std::string &path)
+{
+	std::string dir = utils::dirname(path);
+	if (mkdir(dir.c_str(), 0700) < 0 && errno == ENOENT) {
+		mkdir(utils::dirname(dir).c_str(), 0700);
+		mkdir(dir.c_str(), 0700);
+	}
+
+	unlink(path.c_str());
+
+	const std::string &version = CameraManager::version();
+	std::vector<uint8_t> data;
+
+	CacheHeader header;
+	memcpy(header.magic, cacheMagic, sizeof(header.magic));
+	header.version = cacheVersion;
+	header.entries = 0;
+	header.versionLength = version.size();
+
+	append(data, &header, sizeof(header));
+	append(data, version.data(), version.size());
+
+	auto appendEntry = [&](const std::string &key, Span<const uint8_t> value) {
+		CacheEntry entry = { static_cast<uint32_t>(key.size()),
+				     static_cast<uint32_t>(value.size()) };
+		append(data, &entry, sizeof(entry));
+		append(data, key.data(), key.size());
+		append(data, value.data(), value.size());
+		header.entries++;
+	};
+
+	for (const auto &entry : entries_) {
+		if (entry.second.used)
+			appendEntry(entry.first, entry.second.data);
+	}
+
+	for (const auto &entry : added_)
+		appendEntry(entry.first, entry.second);
+
+	memcpy(data.data(), &header, sizeof(header));
+
+	File file(path);
+	if (!file.open(File::WriteOnly))
+		return file.error();
+
+	ssize_t ret = file.write(data);
+	if (ret < 0)
+		return ret;
+	if (static_cast<size_t>(ret) != data.size())
+		return -ENOSPC;
+
+	return 0;
+}
+
+} /* namespace libcamera */
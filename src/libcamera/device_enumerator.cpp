@@ -9,10 +9,14 @@
 #include "libcamera/internal/device_enumerator_sysfs.h"
 #include "libcamera/internal/device_enumerator_udev.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <string.h>
 
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/thread.h"
 
 /**
  * \file device_enumerator.h
@@ -39,6 +43,33 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(DeviceEnumerator)
 
+namespace {
+
+/*
+ * Worker thread of DeviceEnumerator::createDevices(). Workers are libcamera
+ * threads, so that messages logged while populating media devices carry the
+ * ID of the worker that logged them.
+ */
+class DeviceWorker : public Thread
+{
+public:
+	DeviceWorker(const std::function<void()> &work)
+		: work_(work)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		work_();
+	}
+
+private:
+	std::function<void()> work_;
+};
+
+} /* namespace */
+
 /**
  * \class DeviceMatch
  * \brief Description of a media device search pattern
@@ -227,6 +258,59 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 	return media;
 }
 
+/**
+ * \brief Create media device instances concurrently
+ * \param[in] deviceNodes paths to the media devices to create
+ *
+ * Create a media device for each entry in \a deviceNodes with createDevice().
+ * Populating a media device only involves its own device node, media devices
+ * are thus populated concurrently by a small number of worker threads to
+ * reduce the enumeration time on systems with multiple media devices.
+ *
+ * \return The media devices that have been created successfully, in the order
+ * of \a deviceNodes
+ */
+std::vector<std::unique_ptr<MediaDevice>>
+DeviceEnumerator::createDevices(const std::vector<std::string> &deviceNodes)
+{
+	std::vector<std::unique_ptr<MediaDevice>> devices(deviceNodes.size());
+
+	/*
+	 * Populating media devices is bound by ioctl latency, not by the CPU.
+	 * A few workers are enough to overlap it without spawning one thread
+	 * per device on systems with many media devices.
+	 */
+	static constexpr unsigned int kMaxWorkers = 4;
+	unsigned int numWorkers = std::min<unsigned int>(deviceNodes.size(),
+							 kMaxWorkers);
+
+	if (numWorkers <= 1) {
+		for (unsigned int i = 0; i < deviceNodes.size(); ++i)
+			devices[i] = createDevice(deviceNodes[i]);
+	} else {
+		std::atomic<unsigned int> next(0);
+		auto worker = [this, &devices, &deviceNodes, &next]() {
+			unsigned int i;
+			while ((i = next++) < deviceNodes.size())
+				devices[i] = createDevice(deviceNodes[i]);
+		};
+
+		std::vector<std::unique_ptr<DeviceWorker>> workers;
+		for (unsigned int i = 0; i < numWorkers; ++i) {
+			workers.emplace_back(std::make_unique<DeviceWorker>(worker));
+			workers.back()->start();
+		}
+
+		for (std::unique_ptr<DeviceWorker> &thread : workers)
+			thread->wait();
+	}
+
+	devices.erase(std::remove(devices.begin(), devices.end(), nullptr),
+		      devices.end());
+
+	return devices;
+}
+
 /**
 * \var DeviceEnumerator::devicesAdded
 * \brief Notify of new media devices being found
@@ -264,8 +348,11 @@ void DeviceEnumerator::addDevice(std::unique_ptr<MediaDevice> &&media)
  * Remove the media device identified by \a deviceNode previously added to the
  * enumerator with addDevice(). The media device's MediaDevice::disconnected
  * signal is emitted.
+ *
+ * \return The removed media device, or nullptr if no media device matches
+ * \a deviceNode
  */
-void DeviceEnumerator::removeDevice(const std::string &deviceNode)
+std::shared_ptr<MediaDevice> DeviceEnumerator::removeDevice(const std::string &deviceNode)
 {
 	std::shared_ptr<MediaDevice> media;
 
@@ -281,13 +368,51 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
 		LOG(DeviceEnumerator, Warning)
 			<< "Media device for node " << deviceNode
 			<< " not found";
-		return;
+		return nullptr;
 	}
 
 	LOG(DeviceEnumerator, Debug)
 		<< "Media device for node " << deviceNode << " removed.";
 
 	media->disconnected.emit(media.get());
+
+	return media;
+}
+
+/**
+ * \brief Refresh the media graph of a media device
+ * \param[in] deviceNode Path to the media device to refresh
+ *
+ * Refresh the link flags of the media device identified by \a deviceNode
+ * previously added to the enumerator with addDevice(). The media objects are
+ * preserved.
+ *
+ * If the topology of the media graph has changed, the media device is left
+ * untouched and -ESTALE is returned. As rebuilding the graph would invalidate
+ * the media objects used by pipeline handlers, and lose the device nodes
+ * associated with the entities by the enumerator, the caller shall then
+ * replace the media device by removing it with removeDevice() and adding a
+ * new instance.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV No media device matches \a deviceNode
+ * \retval -ESTALE The topology of the media graph has changed
+ */
+int DeviceEnumerator::refreshDevice(const std::string &deviceNode)
+{
+	for (std::shared_ptr<MediaDevice> &media : devices_) {
+		if (media->deviceNode() != deviceNode)
+			continue;
+
+		int ret = media->refreshLinks();
+		if (ret && ret != -ESTALE)
+			LOG(DeviceEnumerator, Warning)
+				<< "Failed to refresh media device " << deviceNode
+				<< ": " << strerror(-ret);
+		return ret;
+	}
+
+	return -ENODEV;
 }
 
 /**
@@ -31,6 +31,7 @@ int DeviceEnumeratorSysfs::init()
 
 int DeviceEnumeratorSysfs::enumerate()
 {
+	std::vector<std::string> devnodes;
 	struct dirent *ent;
 	DIR *dir;
 
@@ -72,10 +73,12 @@ int DeviceEnumeratorSysfs::enumerate()
 			continue;
 		}
 
-		std::unique_ptr<MediaDevice> media = createDevice(devnode);
-		if (!media)
-			continue;
+		devnodes.push_back(devnode);
+	}
+
+	closedir(dir);
 
+	for (std::unique_ptr<MediaDevice> &media : createDevices(devnodes)) {
 		if (populateMediaDevice(media.get()) < 0) {
 			LOG(DeviceEnumerator, Warning)
 				<< "Failed to populate media device "
@@ -87,8 +90,6 @@ int DeviceEnumeratorSysfs::enumerate()
 		addDevice(std::move(media));
 	}
 
-	closedir(dir);
-
 	return 0;
 }
 
@@ -81,32 +81,7 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 		if (!media)
 			return -ENODEV;
 
-		DependencyMap deps;
-		int ret = populateMediaDevice(media.get(), &deps);
-		if (ret < 0) {
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to populate media device "
-				<< media->deviceNode()
-				<< " (" << media->driver() << "), skipping";
-			return ret;
-		}
-
-		if (!deps.empty()) {
-			LOG(DeviceEnumerator, Debug)
-				<< "Defer media device " << media->deviceNode()
-				<< " due to " << deps.size()
-				<< " missing dependencies";
-
-			pending_.emplace_back(std::move(media), std::move(deps));
-			MediaDeviceDeps *mediaDeps = &pending_.back();
-			for (const auto &dep : mediaDeps->deps_)
-				devMap_[dep.first] = mediaDeps;
-
-			return 0;
-		}
-
-		addDevice(std::move(media));
-		return 0;
+		return addMediaDevice(std::move(media));
 	}
 
 	if (!strcmp(subsystem, "video4linux")) {
@@ -117,10 +92,41 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 	return -ENODEV;
 }
 
+int DeviceEnumeratorUdev::addMediaDevice(std::unique_ptr<MediaDevice> &&media)
+{
+	DependencyMap deps;
+	int ret = populateMediaDevice(media.get(), &deps);
+	if (ret < 0) {
+		LOG(DeviceEnumerator, Warning)
+			<< "Failed to populate media device "
+			<< media->deviceNode()
+			<< " (" << media->driver() << "), skipping";
+		return ret;
+	}
+
+	if (!deps.empty()) {
+		LOG(DeviceEnumerator, Debug)
+			<< "Defer media device " << media->deviceNode()
+			<< " due to " << deps.size()
+			<< " missing dependencies";
+
+		pending_.emplace_back(std::move(media), std::move(deps));
+		MediaDeviceDeps *mediaDeps = &pending_.back();
+		for (const auto &dep : mediaDeps->deps_)
+			devMap_[dep.first] = mediaDeps;
+
+		return 0;
+	}
+
+	addDevice(std::move(media));
+	return 0;
+}
+
 int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::vector<std::string> mediaNodes;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -169,6 +175,18 @@ int DeviceEnumeratorUdev::enumerate()
 			continue;
 		}
 
+		/*
+		 * Defer creation of the media devices to populate them
+		 * concurrently. Their V4L2 devices are added to the orphans
+		 * list in the meantime.
+		 */
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media")) {
+			mediaNodes.push_back(devnode);
+			udev_device_unref(dev);
+			continue;
+		}
+
 		if (addUdevDevice(dev) < 0)
 			LOG(DeviceEnumerator, Warning)
 				<< "Failed to add device for '"
@@ -177,6 +195,9 @@ int DeviceEnumeratorUdev::enumerate()
 		udev_device_unref(dev);
 	}
 
+	for (std::unique_ptr<MediaDevice> &media : createDevices(mediaNodes))
+		addMediaDevice(std::move(media));
+
 done:
 	udev_enumerate_unref(udev_enum);
 	if (ret < 0)
@@ -327,6 +348,47 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 	return 0;
 }
 
+/**
+ * \brief Handle a change of a media device
+ * \param[in] dev The udev device of the media device
+ *
+ * Refresh the links of the media device. If its topology has changed, replace
+ * it with a new media device, populated with the device nodes of its entities
+ * and offered again to the pipeline handlers. Pipeline handlers using the
+ * previous instance see it disconnected.
+ */
+void DeviceEnumeratorUdev::changeMediaDevice(struct udev_device *dev)
+{
+	std::string deviceNode(udev_device_get_devnode(dev));
+
+	if (refreshDevice(deviceNode) != -ESTALE)
+		return;
+
+	LOG(DeviceEnumerator, Debug)
+		<< "Topology of media device " << deviceNode
+		<< " changed, replacing it";
+
+	std::shared_ptr<MediaDevice> media = removeDevice(deviceNode);
+	if (!media)
+		return;
+
+	/*
+	 * The V4L2 devices claimed by the previous instance are still present
+	 * and won't be announced again, make them available to the new one.
+	 */
+	for (MediaEntity *entity : media->entities()) {
+		if (entity->deviceMajor() == 0 && entity->deviceMinor() == 0)
+			continue;
+
+		orphans_.insert(makedev(entity->deviceMajor(),
+					entity->deviceMinor()));
+	}
+
+	media.reset();
+
+	addUdevDevice(dev);
+}
+
 void DeviceEnumeratorUdev::udevNotify(EventNotifier *notifier)
 {
 	struct udev_device *dev = udev_monitor_receive_device(monitor_);
@@ -342,6 +404,10 @@ void DeviceEnumeratorUdev::udevNotify(EventNotifier *notifier)
 		const char *subsystem = udev_device_get_subsystem(dev);
 		if (subsystem && !strcmp(subsystem, "media"))
 			removeDevice(deviceNode);
+	} else if (action == "change") {
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media"))
+			changeMediaDevice(dev);
 	}
 
 	udev_device_unref(dev);
@@ -0,0 +1,450 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_buf_allocator.cpp - dma-buf and memfd buffer allocator
+ */
+
+#include "libcamera/internal/dma_buf_allocator.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iterator>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/log.h"
+
+/**
+ * \file dma_buf_allocator.h
+ * \brief dma-buf and memfd buffer allocator
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaBufAllocator)
+
+namespace {
+
+/*
+ * /dev/dma_heap/linux,cma is the CMA dma-heap allocator. Should the CMA heap
+ * size be specified on the kernel command line instead of DT, the heap gets
+ * named "reserved" instead.
+ */
+const struct {
+	DmaBufAllocator::DmaBufAllocatorFlag type;
+	const char *deviceNode;
+} providerInfos[] = {
+	{ DmaBufAllocator::CmaHeap, "/dev/dma_heap/linux,cma" },
+	{ DmaBufAllocator::CmaHeap, "/dev/dma_heap/reserved" },
+	{ DmaBufAllocator::SystemHeap, "/dev/dma_heap/system" },
+	{ DmaBufAllocator::UDmaBuf, "/dev/udmabuf" },
+};
+
+} /* namespace */
+
+/**
+ * \class DmaBufAllocator
+ * \brief Helper class for dma-buf and memfd allocations
+ *
+ * The DmaBufAllocator allocates memory buffers from the first available
+ * provider among the types selected at construction time, in the order of the
+ * DmaBufAllocatorFlag enumeration. The CMA and system dma-heaps and udmabuf
+ * produce dma-buf file descriptors that can be imported by V4L2 devices, while
+ * the memfd provider produces plain memory file descriptors suitable only for
+ * CPU access, such as buffers shared with IPA modules or software processing.
+ * The memfd provider is always available, and is thus a fallback of last
+ * resort.
+ *
+ * Buffers can optionally be pooled. When a pool limit is set with
+ * setPoolLimit(), allocation sizes are rounded up to a size class (see
+ * sizeClass()), and buffers returned with release() or recycle() are kept, up
+ * to the pool limit, to serve later allocations of the same size class. This
+ * allows pipeline handlers to keep their buffers across stop(), configure()
+ * and start() cycles without tying their lifetime to a device streaming state.
+ * Pooled buffers are not cleared when reused.
+ *
+ * The DmaBufAllocator is not thread-safe.
+ */
+
+/**
+ * \enum DmaBufAllocator::DmaBufAllocatorFlag
+ * \brief Type of the dma-buf provider
+ * \var DmaBufAllocator::CmaHeap
+ * \brief Allocate from a CMA dma-heap, providing physically-contiguous memory
+ * \var DmaBufAllocator::SystemHeap
+ * \brief Allocate from the system dma-heap, using the page allocator
+ * \var DmaBufAllocator::UDmaBuf
+ * \brief Allocate memfd-backed memory, and export it as a dma-buf with udmabuf
+ * \var DmaBufAllocator::Memfd
+ * \brief Allocate memfd memory, not exported as a dma-buf
+ */
+
+/**
+ * \brief Construct a DmaBufAllocator of a given type
+ * \param[in] types The types of the provider to allocate from
+ *
+ * The types parameter accepts an OR-combination of the DmaBufAllocatorFlag
+ * values. The first type that can be opened is used.
+ */
+DmaBufAllocator::DmaBufAllocator(unsigned int types)
+	: type_(static_cast<DmaBufAllocatorFlag>(0)), poolLimit_(0), poolSize_(0)
+{
+	for (const auto &info : providerInfos) {
+		if (!(info.type & types))
+			continue;
+
+		int fd = ::open(info.deviceNode, O_RDWR | O_CLOEXEC, 0);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(DmaBufAllocator, Debug)
+				<< "Failed to open " << info.deviceNode << ": "
+				<< strerror(-ret);
+			continue;
+		}
+
+		LOG(DmaBufAllocator, Debug) << "Using " << info.deviceNode;
+
+		providerHandle_ = FileDescriptor(std::move(fd));
+		type_ = info.type;
+		return;
+	}
+
+	if (types & Memfd) {
+		LOG(DmaBufAllocator, Debug) << "Using memfd";
+		type_ = Memfd;
+		return;
+	}
+
+	LOG(DmaBufAllocator, Error) << "Could not open any dma-buf provider";
+}
+
+/**
+ * \brief Destroy the DmaBufAllocator instance
+ *
+ * Pooled buffers are freed. Buffers handed out by the allocator stay valid.
+ */
+DmaBufAllocator::~DmaBufAllocator() = default;
+
+/**
+ * \fn DmaBufAllocator::isValid()
+ * \brief Check if the DmaBufAllocator instance is valid
+ * \return True if the DmaBufAllocator is valid, false otherwise
+ */
+
+/**
+ * \fn DmaBufAllocator::type()
+ * \brief Retrieve the type of the provider in use
+ * \return The provider type, or 0 if the DmaBufAllocator is not valid
+ */
+
+/**
+ * \brief Allocate a buffer
+ * \param[in] name The name to set for the allocated buffer
+ * \param[in] size The size of the buffer to allocate
+ *
+ * When pooling is enabled, the buffer is taken from the pool if one of the
+ * same size class is available. Its name is not updated in that case.
+ *
+ * \return The file descriptor of the allocated buffer, or an invalid file
+ * descriptor if allocation failed
+ */
+FileDescriptor DmaBufAllocator::alloc(const char *name, size_t size)
+{
+	if (!name || !size)
+		return FileDescriptor();
+
+	if (poolLimit_) {
+		size = sizeClass(size);
+
+		auto iter = pool_.find(size);
+		if (iter != pool_.end()) {
+			FileDescriptor fd = std::move(iter->second.back());
+			iter->second.pop_back();
+			if (iter->second.empty())
+				pool_.erase(iter);
+
+			poolSize_ -= size;
+			return fd;
+		}
+	}
+
+	switch (type_) {
+	case CmaHeap:
+	case SystemHeap:
+		return allocFromHeap(name, size);
+	case UDmaBuf:
+		return allocFromUDmaBuf(name, size);
+	case Memfd:
+		return allocFromMemfd(name, size);
+	default:
+		return FileDescriptor();
+	}
+}
+
+/**
+ * \brief Return a buffer to the pool
+ * \param[in] fd The file descriptor of the buffer
+ *
+ * The buffer is kept in the pool if it was allocated while pooling was enabled
+ * and the pool has room for it, and is otherwise freed once all other
+ * references to \a fd are dropped. Only buffers allocated by this allocator
+ * shall be released.
+ *
+ * A pooled buffer is handed out again by the next alloc() call of its size
+ * class. The allocator can't tell whether other copies of \a fd, duplicates
+ * of its file descriptor or memory mappings of the buffer still exist, so the
+ * caller shall drop all of them, and ensure no device still accesses the
+ * buffer, before releasing it. Otherwise the memory would be shared with the
+ * buffer's next user.
+ */
+void DmaBufAllocator::release(FileDescriptor fd)
+{
+	if (!fd.isValid())
+		return;
+
+	off_t size = lseek(fd.fd(), 0, SEEK_END);
+	if (size <= 0 || sizeClass(size) != static_cast<size_t>(size))
+		return;
+
+	if (poolSize_ + size > poolLimit_)
+		return;
+
+	pool_[size].push_back(std::move(fd));
+	poolSize_ += size;
+}
+
+/**
+ * \brief Allocate frame buffers
+ * \param[in] name The name to set for the allocated buffers
+ * \param[in] count The number of frame buffers to allocate
+ * \param[in] planeSizes The size of each plane of the frame buffers
+ * \param[out] buffers Array of buffers successfully allocated
+ *
+ * Allocate \a count frame buffers with one buffer per plane, and append them
+ * to \a buffers. Pipeline handlers compute \a planeSizes from the format of the
+ * V4L2 device that the buffers will be imported in.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -ENOMEM Buffer allocation failed
+ */
+int DmaBufAllocator::exportFrameBuffers(const char *name, unsigned int count,
+					const std::vector<unsigned int> &planeSizes,
+					std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	std::vector<std::unique_ptr<FrameBuffer>> newBuffers;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int planeSize : planeSizes) {
+			FrameBuffer::Plane plane;
+			plane.fd = alloc(name, planeSize);
+			plane.length = planeSize;
+
+			if (!plane.fd.isValid()) {
+				for (FrameBuffer::Plane &p : planes)
+					release(std::move(p.fd));
+				recycle(&newBuffers);
+				return -ENOMEM;
+			}
+
+			planes.push_back(std::move(plane));
+		}
+
+		newBuffers.push_back(std::make_unique<FrameBuffer>(planes));
+	}
+
+	std::move(newBuffers.begin(), newBuffers.end(),
+		  std::back_inserter(*buffers));
+
+	return count;
+}
+
+/**
+ * \brief Free frame buffers, returning their memory to the pool
+ * \param[inout] buffers The frame buffers
+ *
+ * The memory of the frame buffers in \a buffers is returned to the pool with
+ * release(), and the \a buffers vector is cleared. As for release(), the
+ * frame buffers shall not be used anymore, and no other reference to their
+ * planes' file descriptors or memory shall remain.
+ */
+void DmaBufAllocator::recycle(std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	for (std::unique_ptr<FrameBuffer> &buffer : *buffers) {
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			release(plane.fd);
+	}
+
+	buffers->clear();
+}
+
+/**
+ * \brief Set the maximum amount of memory kept in the pool
+ * \param[in] limit The pool size limit in bytes, 0 to disable pooling
+ *
+ * Lowering the limit frees pooled buffers, largest first, until the pool fits
+ * in the new limit.
+ */
+void DmaBufAllocator::setPoolLimit(size_t limit)
+{
+	poolLimit_ = limit;
+
+	while (poolSize_ > poolLimit_) {
+		auto iter = std::prev(pool_.end());
+		poolSize_ -= iter->first;
+		iter->second.pop_back();
+		if (iter->second.empty())
+			pool_.erase(iter);
+	}
+}
+
+/**
+ * \fn DmaBufAllocator::poolLimit()
+ * \brief Retrieve the maximum amount of memory kept in the pool
+ * \return The pool size limit in bytes, 0 if pooling is disabled
+ */
+
+/**
+ * \fn DmaBufAllocator::poolSize()
+ * \brief Retrieve the amount of memory currently kept in the pool
+ * \return The pool size in bytes
+ */
+
+/**
+ * \brief Free all pooled buffers
+ */
+void DmaBufAllocator::clear()
+{
+	pool_.clear();
+	poolSize_ = 0;
+}
+
+/**
+ * \brief Compute the size class of an allocation
+ * \param[in] size The allocation size
+ *
+ * Pooled allocations are rounded up to a size class to increase the chance of
+ * reusing buffers across configurations with slightly different frame sizes.
+ * Size classes are multiples of the page size, with four classes per power of
+ * two above 8 pages, which bounds the wasted memory to 25% of the allocation.
+ *
+ * \return The size class of \a size
+ */
+size_t DmaBufAllocator::sizeClass(size_t size)
+{
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+	size_t msb = 1;
+	while (msb <= size / 2)
+		msb <<= 1;
+
+	size_t granule = std::max(msb / 4, pageSize);
+
+	return (size + granule - 1) / granule * granule;
+}
+
+FileDescriptor DmaBufAllocator::allocFromHeap(const char *name, size_t size)
+{
+	struct dma_heap_allocation_data alloc = {};
+	int ret;
+
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	ret = ::ioctl(providerHandle_.fd(), DMA_HEAP_IOCTL_ALLOC, &alloc);
+	if (ret < 0) {
+		LOG(DmaBufAllocator, Error)
+			<< "dma-heap allocation failure for " << name;
+		return FileDescriptor();
+	}
+
+	FileDescriptor fd(std::move(alloc.fd));
+
+	ret = ::ioctl(fd.fd(), DMA_BUF_SET_NAME, name);
+	if (ret < 0) {
+		LOG(DmaBufAllocator, Error)
+			<< "dma-heap naming failure for " << name;
+		return FileDescriptor();
+	}
+
+	return fd;
+}
+
+FileDescriptor DmaBufAllocator::allocFromUDmaBuf(const char *name, size_t size)
+{
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+	/* udmabuf requires page-aligned memfd backing memory. */
+	size = (size + pageSize - 1) / pageSize * pageSize;
+
+	FileDescriptor memfd = allocFromMemfd(name, size);
+	if (!memfd.isValid())
+		return FileDescriptor();
+
+	struct udmabuf_create create = {};
+
+	create.memfd = memfd.fd();
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = size;
+
+	int ret = ::ioctl(providerHandle_.fd(), UDMABUF_CREATE, &create);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(DmaBufAllocator, Error)
+			<< "udmabuf allocation failure for " << name << ": "
+			<< strerror(-ret);
+		return FileDescriptor();
+	}
+
+	/* The memfd is kept alive by the dma-buf. */
+	return FileDescriptor(std::move(ret));
+}
+
+FileDescriptor DmaBufAllocator::allocFromMemfd(const char *name, size_t size)
+{
+	int ret = memfd_create(name, MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(DmaBufAllocator, Error)
+			<< "memfd allocation failure for " << name << ": "
+			<< strerror(-ret);
+		return FileDescriptor();
+	}
+
+	FileDescriptor fd(std::move(ret));
+
+	ret = ftruncate(fd.fd(), size);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(DmaBufAllocator, Error)
+			<< "memfd resizing failure for " << name << ": "
+			<< strerror(-ret);
+		return FileDescriptor();
+	}
+
+	/* The buffer size is fixed, and is used to pool the buffer. */
+	ret = fcntl(fd.fd(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(DmaBufAllocator, Error)
+			<< "memfd sealing failure for " << name << ": "
+			<< strerror(-ret);
+		return FileDescriptor();
+	}
+
+	return fd;
+}
+
+} /* namespace libcamera */
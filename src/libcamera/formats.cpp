@@ -7,8 +7,8 @@
 
 #include "libcamera/internal/formats.h"
 
-#include <algorithm>
 #include <errno.h>
+#include <unordered_map>
 
 #include <libcamera/formats.h>
 
@@ -141,9 +141,16 @@ LOG_DEFINE_CATEGORY(Formats)
 
 namespace {
 
+struct PixelFormatHash {
+	std::size_t operator()(const PixelFormat &format) const
+	{
+		return std::hash<uint64_t>()(format.modifier()) ^ format.fourcc();
+	}
+};
+
 const PixelFormatInfo pixelFormatInfoInvalid{};
 
-const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
+const std::unordered_map<PixelFormat, PixelFormatInfo, PixelFormatHash> pixelFormatInfo{
 	/* RGB formats. */
 	{ formats::RGB565, {
 		.name = "RGB565",
@@ -658,6 +665,34 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 	} },
 };
 
+/*
+ * Secondary indexes of the pixelFormatInfo table, to look formats up by V4L2
+ * FourCC or by name in constant time. They are populated once, after the table
+ * they point to.
+ */
+std::unordered_map<uint32_t, const PixelFormatInfo *> indexByV4L2Format()
+{
+	std::unordered_map<uint32_t, const PixelFormatInfo *> index;
+	for (const auto &info : pixelFormatInfo)
+		index.emplace(info.second.v4l2Format, &info.second);
+
+	return index;
+}
+
+std::unordered_map<std::string, const PixelFormatInfo *> indexByName()
+{
+	std::unordered_map<std::string, const PixelFormatInfo *> index;
+	for (const auto &info : pixelFormatInfo)
+		index.emplace(info.second.name, &info.second);
+
+	return index;
+}
+
+const std::unordered_map<uint32_t, const PixelFormatInfo *> pixelFormatInfoByV4L2 =
+	indexByV4L2Format();
+const std::unordered_map<std::string, const PixelFormatInfo *> pixelFormatInfoByName =
+	indexByName();
+
 } /* namespace */
 
 /**
@@ -693,14 +728,11 @@ const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
 {
-	const auto &info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-					[format](auto pair) {
-						return pair.second.v4l2Format == format;
-					});
-	if (info == pixelFormatInfo.end())
+	const auto iter = pixelFormatInfoByV4L2.find(format);
+	if (iter == pixelFormatInfoByV4L2.end())
 		return pixelFormatInfoInvalid;
 
-	return info->second;
+	return *iter->second;
 }
 
 /**
@@ -711,12 +743,11 @@ const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const std::string &name)
 {
-	for (const auto &info : pixelFormatInfo) {
-		if (info.second.name == name)
-			return info.second;
-	}
+	const auto iter = pixelFormatInfoByName.find(name);
+	if (iter == pixelFormatInfoByName.end())
+		return pixelFormatInfoInvalid;
 
-	return pixelFormatInfoInvalid;
+	return *iter->second;
 }
 
 /**
@@ -0,0 +1,429 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_broadcaster.cpp - Delivery of completed requests to multiple consumers
+ */
+
+#include <libcamera/frame_broadcaster.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/thread.h"
+
+/**
+ * \file frame_broadcaster.h
+ * \brief Delivery of completed requests to multiple consumers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Broadcaster)
+
+/**
+ * \class FrameSubscriber
+ * \brief Consumer of the frames delivered by a FrameBroadcaster
+ *
+ * A frame subscriber receives the requests completed by a camera through a
+ * FrameBroadcaster, as references to the completed requests. Frames are
+ * queued to the subscriber, which is notified through the frameAvailable
+ * signal, and retrieved with nextFrame().
+ *
+ * The subscriber queue is limited to depth() frames, which is lower than the
+ * number of requests circulated through the broadcaster. When a frame completes
+ * while the queue is full, the subscriber drops a frame according to its
+ * policy(). Slow subscribers thus miss frames instead of holding back the
+ * capture pipeline or the other subscribers.
+ *
+ * Subscribers are created by FrameBroadcaster::subscribe(), and are owned by
+ * the broadcaster.
+ */
+
+/**
+ * \enum FrameSubscriber::DropPolicy
+ * \brief Frame to drop when a frame completes while the queue is full
+ * \var FrameSubscriber::DropOldest
+ * Drop the oldest frame from the queue, and queue the completed frame
+ * \var FrameSubscriber::DropNewest
+ * Drop the completed frame
+ */
+
+/**
+ * \struct FrameSubscriber::Statistics
+ * \brief Frame delivery statistics of a subscriber
+ *
+ * \var FrameSubscriber::Statistics::frames
+ * \brief The number of frames queued to the subscriber
+ *
+ * \var FrameSubscriber::Statistics::dropped
+ * \brief The number of frames dropped because the queue was full, or because
+ * the frames pinned by all subscribers would have left no request to the
+ * camera
+ *
+ * \var FrameSubscriber::Statistics::queued
+ * \brief The number of frames currently queued
+ *
+ * \var FrameSubscriber::Statistics::maxQueued
+ * \brief The maximum number of frames that have been queued at once
+ */
+
+FrameSubscriber::FrameSubscriber(unsigned int depth, DropPolicy policy)
+	: depth_(depth), policy_(policy), stats_({})
+{
+}
+
+/**
+ * \fn FrameSubscriber::depth()
+ * \brief Retrieve the maximum number of frames queued to the subscriber
+ * \return The maximum number of frames queued to the subscriber
+ */
+
+/**
+ * \fn FrameSubscriber::policy()
+ * \brief Retrieve the policy applied when the subscriber queue is full
+ * \return The drop policy of the subscriber
+ */
+
+/**
+ * \brief Retrieve the oldest frame queued to the subscriber
+ *
+ * The frame is a reference to a completed request. The request isn't queued
+ * to the camera again until all the subscribers have released their
+ * reference to it. Subscribers shall thus release frames as soon as they're
+ * done with them, and shall not modify the request.
+ *
+ * This function is \threadsafe.
+ *
+ * \return The oldest frame, or nullptr if no frame is queued
+ */
+std::shared_ptr<Request> FrameSubscriber::nextFrame()
+{
+	MutexLocker locker(mutex_);
+
+	if (queue_.empty())
+		return nullptr;
+
+	std::shared_ptr<Request> frame = std::move(queue_.front());
+	queue_.pop_front();
+
+	return frame;
+}
+
+/**
+ * \brief Retrieve the frame delivery statistics of the subscriber
+ *
+ * This function is \threadsafe.
+ *
+ * \return The frame delivery statistics
+ */
+FrameSubscriber::Statistics FrameSubscriber::statistics() const
+{
+	MutexLocker locker(mutex_);
+
+	Statistics stats = stats_;
+	stats.queued = queue_.size();
+
+	return stats;
+}
+
+/**
+ * \var FrameSubscriber::frameAvailable
+ * \brief Signal emitted when a frame is queued to the subscriber
+ *
+ * The signal is emitted in the thread that completes requests. Subscribers
+ * that need to process frames in a different thread shall connect an Object
+ * living in that thread to the signal.
+ */
+
+void FrameSubscriber::deliver(const std::shared_ptr<Request> &frame)
+{
+	/* Release the dropped frame without holding the lock. */
+	std::shared_ptr<Request> dropped;
+
+	{
+		MutexLocker locker(mutex_);
+
+		if (queue_.size() >= depth_) {
+			stats_.dropped++;
+
+			if (policy_ == DropNewest)
+				return;
+
+			dropped = std::move(queue_.front());
+			queue_.pop_front();
+		}
+
+		queue_.push_back(frame);
+
+		stats_.frames++;
+		stats_.maxQueued = std::max<unsigned int>(stats_.maxQueued,
+							  queue_.size());
+	}
+
+	frameAvailable.emit(this);
+}
+
+void FrameSubscriber::drop()
+{
+	MutexLocker locker(mutex_);
+	stats_.dropped++;
+}
+
+void FrameSubscriber::clear()
+{
+	std::deque<std::shared_ptr<Request>> queue;
+
+	{
+		MutexLocker locker(mutex_);
+		queue.swap(queue_);
+	}
+}
+
+/**
+ * \class FrameBroadcaster
+ * \brief Deliver the requests completed by a camera to multiple consumers
+ *
+ * A request completes to the Camera::requestCompleted signal, and its buffers
+ * are expected to be returned to the camera once the signal handler returns.
+ * Applications that process the frames captured by a camera in multiple
+ * places, such as a video encoder, a viewfinder and an image analysis
+ * engine, would need to copy the frames or track their usage manually.
+ *
+ * The FrameBroadcaster handles this by sharing reference-counted frames with
+ * multiple subscribers. It handles completion of the requests queued to the
+ * camera, and delivers each completed request to all the subscribers created
+ * with subscribe(). The request is reset with Request::reuse(), keeping its
+ * buffers, and queued to the camera again when all the subscribers have
+ * released it. The requestReleased signal is emitted before the request is
+ * queued, to let the application set controls on the request.
+ *
+ * Frames held by subscribers are not available to the camera. To prevent
+ * subscribers from collectively pinning all the requests and stalling capture,
+ * the broadcaster keeps track of the frames that haven't been released yet.
+ * When delivering a completed request would leave no request queued to the
+ * camera, the frame is dropped for all subscribers and the request is queued
+ * again immediately.
+ *
+ * Only requests created with Camera::createReusableRequest() can be
+ * broadcast. Applications create and queue reusable requests as usual, and
+ * shall not queue them again themselves. Cancelled requests are not
+ * broadcast, and stay owned by the application.
+ *
+ * Frames released after the broadcaster is destroyed are not queued to the
+ * camera again, and stay owned by the application.
+ */
+
+/*
+ * Link from the frames to the broadcaster. Frames hold a weak reference to it,
+ * and the broadcaster detaches itself when destroyed.
+ */
+struct FrameBroadcaster::Releaser {
+	std::mutex mutex;
+	FrameBroadcaster *broadcaster;
+};
+
+/**
+ * \brief Construct a FrameBroadcaster for a camera
+ * \param[in] camera The camera
+ * \param[in] requestCount The number of requests circulated by the application
+ *
+ * The \a requestCount is the number of reusable requests the application queues
+ * to the camera, and is usually the bufferCount of the stream configuration.
+ * It limits the depth of the subscriber queues and the number of frames
+ * pinned by all subscribers, to keep at least one request available to the
+ * camera.
+ */
+FrameBroadcaster::FrameBroadcaster(std::shared_ptr<Camera> camera,
+				   unsigned int requestCount)
+	: camera_(camera), requestCount_(requestCount),
+	  releaser_(std::make_shared<Releaser>()), pinned_(0)
+{
+	releaser_->broadcaster = this;
+
+	camera_->requestCompleted.connect(this, &FrameBroadcaster::requestComplete);
+}
+
+FrameBroadcaster::~FrameBroadcaster()
+{
+	camera_->requestCompleted.disconnect(this, &FrameBroadcaster::requestComplete);
+
+	/* Wait for concurrent releases to complete, and stop later ones. */
+	{
+		MutexLocker locker(releaser_->mutex);
+		releaser_->broadcaster = nullptr;
+	}
+
+	std::vector<std::shared_ptr<FrameSubscriber>> subscribers;
+
+	{
+		MutexLocker locker(mutex_);
+		subscribers.swap(subscribers_);
+	}
+
+	for (std::shared_ptr<FrameSubscriber> &subscriber : subscribers)
+		subscriber->clear();
+}
+
+/**
+ * \brief Create a subscriber for the frames completed by the camera
+ * \param[in] depth The maximum number of frames queued to the subscriber
+ * \param[in] policy The frame to drop when the queue is full
+ *
+ * The subscriber receives all the frames that complete after this function
+ * returns. It is owned by the broadcaster and stays valid until it is passed
+ * to unsubscribe() or the broadcaster is destroyed.
+ *
+ * Frames queued to the subscriber are not available to the camera. The \a depth
+ * is thus capped to one less than the number of requests circulated through
+ * the broadcaster, so that the subscriber queue alone can't stall capture.
+ * Frames are furthermore dropped for all subscribers when the frames they hold
+ * together would leave no request to the camera.
+ *
+ * This function is \threadsafe.
+ *
+ * \return The subscriber, or nullptr if \a depth is 0 or less than two requests
+ * are circulated
+ */
+FrameSubscriber *FrameBroadcaster::subscribe(unsigned int depth,
+					     FrameSubscriber::DropPolicy policy)
+{
+	if (requestCount_ < 2)
+		return nullptr;
+
+	depth = std::min(depth, requestCount_ - 1);
+	if (!depth)
+		return nullptr;
+
+	std::shared_ptr<FrameSubscriber> subscriber(new FrameSubscriber(depth, policy));
+
+	MutexLocker locker(mutex_);
+	subscribers_.push_back(subscriber);
+
+	return subscriber.get();
+}
+
+/**
+ * \brief Delete a subscriber
+ * \param[in] subscriber The subscriber
+ *
+ * Frames queued to the subscriber are released, and frames retrieved with
+ * FrameSubscriber::nextFrame() stay valid until they are released. The
+ * \a subscriber shall not be used after this function returns.
+ *
+ * This function is \threadsafe.
+ */
+void FrameBroadcaster::unsubscribe(FrameSubscriber *subscriber)
+{
+	std::shared_ptr<FrameSubscriber> removed;
+
+	{
+		MutexLocker locker(mutex_);
+
+		auto it = std::find_if(subscribers_.begin(), subscribers_.end(),
+				       [subscriber](const std::shared_ptr<FrameSubscriber> &s) {
+					       return s.get() == subscriber;
+				       });
+		if (it == subscribers_.end())
+			return;
+
+		removed = std::move(*it);
+		subscribers_.erase(it);
+	}
+
+	LOG(Broadcaster, Debug)
+		<< "Subscriber dropped " << removed->statistics().dropped
+		<< " frames";
+
+	removed->clear();
+}
+
+/**
+ * \var FrameBroadcaster::requestReleased
+ * \brief Signal emitted when all subscribers have released a request
+ *
+ * The request has been reset for reuse and keeps its buffers. It is queued to
+ * the camera when the signal returns. The signal is emitted in the thread
+ * that released the last reference to the request. Handlers shall not destroy
+ * the broadcaster.
+ */
+
+void FrameBroadcaster::requestComplete(Request *request)
+{
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	if (!request->reusable_) {
+		LOG(Broadcaster, Warning)
+			<< "Can't broadcast request that isn't reusable";
+		return;
+	}
+
+	/*
+	 * The request is released when the last reference to the frame is
+	 * dropped, which may happen here if no subscriber has queued it, or
+	 * after the broadcaster is destroyed.
+	 */
+	std::weak_ptr<Releaser> releaser = releaser_;
+	std::shared_ptr<Request> frame(request, [releaser](Request *r) {
+		std::shared_ptr<Releaser> link = releaser.lock();
+		if (!link)
+			return;
+
+		MutexLocker locker(link->mutex);
+		if (link->broadcaster)
+			link->broadcaster->releaseRequest(r);
+	});
+
+	/*
+	 * Deliver the frame without holding the lock, to let subscribers
+	 * unsubscribe from their frameAvailable handler.
+	 */
+	std::vector<std::shared_ptr<FrameSubscriber>> subscribers;
+	bool drop;
+
+	{
+		MutexLocker locker(mutex_);
+		subscribers = subscribers_;
+
+		/*
+		 * Drop the frame if pinning it would leave no request queued to
+		 * the camera. The frame is released, and the request queued
+		 * again, when returning from this function.
+		 */
+		drop = pinned_ + 1 >= requestCount_;
+		pinned_++;
+	}
+
+	for (std::shared_ptr<FrameSubscriber> &subscriber : subscribers) {
+		if (drop)
+			subscriber->drop();
+		else
+			subscriber->deliver(frame);
+	}
+}
+
+void FrameBroadcaster::releaseRequest(Request *request)
+{
+	{
+		MutexLocker locker(mutex_);
+		pinned_--;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+
+	requestReleased.emit(request);
+
+	/* Requests released after the camera stops stay with the application. */
+	int ret = camera_->queueRequest(request);
+	if (ret < 0)
+		LOG(Broadcaster, Debug)
+			<< "Request not queued: " << strerror(-ret);
+}
+
+} /* namespace libcamera */
@@ -300,23 +300,39 @@ std::unique_ptr<IPAProxy> IPAManager::createIPA(PipelineHandler *pipe,
 	return proxy;
 }
 
-bool IPAManager::isSignatureValid(IPAModule *ipa) const
+/*
+ * \brief Verify the signature of an IPA module
+ * \param[in] ipa The IPA module
+ *
+ * The signature is verified the first time this function is called for a
+ * module, and the result is memoised for the lifetime of the IPAManager.
+ * Modules are not expected to be modified while libcamera runs, and the
+ * module is loaded from the same file when the proxy is created.
+ *
+ * \return True if the IPA module signature is valid, false otherwise
+ */
+bool IPAManager::isSignatureValid(IPAModule *ipa)
 {
 #if HAVE_IPA_PUBKEY
-	File file{ ipa->path() };
-	if (!file.open(File::ReadOnly))
-		return false;
+	auto it = signatures_.find(ipa);
+	if (it != signatures_.end())
+		return it->second;
 
-	Span<uint8_t> data = file.map();
-	if (data.empty())
-		return false;
+	bool valid = false;
 
-	bool valid = pubKey_.verify(data, ipa->signature());
+	File file{ ipa->path() };
+	if (file.open(File::ReadOnly)) {
+		Span<uint8_t> data = file.map();
+		if (!data.empty())
+			valid = pubKey_.verify(data, ipa->signature());
+	}
 
 	LOG(IPAManager, Debug)
 		<< "IPA module " << ipa->path() << " signature is "
 		<< (valid ? "valid" : "not valid");
 
+	signatures_[ipa] = valid;
+
 	return valid;
 #else
 	return false;
@@ -23,6 +23,7 @@
 
 #include <libcamera/span.h>
 
+#include "libcamera/internal/capability_cache.h"
 #include "libcamera/internal/file.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/pipeline_handler.h"
@@ -44,6 +45,48 @@ LOG_DEFINE_CATEGORY(IPAModule)
 
 namespace {
 
+/*
+ * Identification of a file in the IPA module index. The change time is used
+ * instead of the modification time as it can't be set from userspace, and
+ * also changes when the file permissions are modified.
+ */
+struct FileStamp {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t ctimeSec;
+	int64_t ctimeNsec;
+};
+
+/*
+ * Entry of the IPA module index, followed by the module signature. A module
+ * that failed validation is stored with valid set to 0 to avoid parsing it
+ * again.
+ */
+struct IPAModuleIndexEntry {
+	FileStamp module;
+	FileStamp signature;
+	uint32_t valid;
+	struct IPAModuleInfo info;
+};
+
+bool fileStamp(const std::string &path, FileStamp *stamp)
+{
+	struct stat st;
+
+	*stamp = {};
+	if (stat(path.c_str(), &st) < 0)
+		return false;
+
+	stamp->dev = st.st_dev;
+	stamp->ino = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->ctimeSec = st.st_ctim.tv_sec;
+	stamp->ctimeNsec = st.st_ctim.tv_nsec;
+
+	return true;
+}
+
 template<typename T>
 typename std::remove_extent_t<T> *elfPointer(Span<const uint8_t> elf,
 					     off_t offset, size_t objSize)
@@ -253,6 +296,10 @@ Span<const uint8_t> elfLoadSymbol(Span<const uint8_t> elf, const char *symbol)
  * The IPA module shared object file must be of the same endianness and
  * bitness as libcamera.
  *
+ * The information is retrieved from the IPA module index stored in the
+ * CapabilityCache when the module and its signature file haven't changed
+ * since they have been indexed, and parsed from the shared object otherwise.
+ *
  * The caller shall call the isValid() method after constructing an
  * IPAModule instance to verify the validity of the IPAModule.
  */
@@ -273,6 +320,54 @@ IPAModule::~IPAModule()
 }
 
 int IPAModule::loadIPAModuleInfo()
+{
+	IPAModuleIndexEntry entry = {};
+	if (!fileStamp(libPath_, &entry.module)) {
+		int ret = -errno;
+		LOG(IPAModule, Error) << "Failed to open IPA library: "
+				      << strerror(-ret);
+		return ret;
+	}
+
+	fileStamp(libPath_ + ".sign", &entry.signature);
+
+	const std::string key = "ipa/" + libPath_;
+
+	Span<const uint8_t> cached = CapabilityCache::lookup(key);
+	if (cached.size() >= sizeof(entry)) {
+		IPAModuleIndexEntry index;
+		memcpy(&index, cached.data(), sizeof(index));
+
+		if (!memcmp(&index.module, &entry.module, sizeof(entry.module)) &&
+		    !memcmp(&index.signature, &entry.signature, sizeof(entry.signature))) {
+			if (!index.valid) {
+				LOG(IPAModule, Debug)
+					<< "IPA module is indexed as invalid";
+				return -EINVAL;
+			}
+
+			info_ = index.info;
+			signature_.assign(cached.begin() + sizeof(index),
+					  cached.end());
+			return 0;
+		}
+	}
+
+	int ret = parseIPAModuleInfo();
+
+	entry.valid = !ret;
+	if (!ret)
+		entry.info = info_;
+
+	std::vector<uint8_t> data(sizeof(entry));
+	memcpy(data.data(), &entry, sizeof(entry));
+	data.insert(data.end(), signature_.begin(), signature_.end());
+	CapabilityCache::store(key, data);
+
+	return ret;
+}
+
+int IPAModule::parseIPAModuleInfo()
 {
 	File file{ libPath_ };
 	if (!file.open(File::ReadOnly)) {
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_process_pool.cpp - Pool of isolated IPA worker processes
+ */
+
+#include "libcamera/internal/ipa_process_pool.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/log.h"
+
+/**
+ * \file ipa_process_pool.h
+ * \brief Pool of isolated IPA worker processes
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAProcessPool)
+
+/**
+ * \enum IPAWorkerCommand
+ * \brief Commands sent by the IPAProcessPool to IPA worker processes
+ *
+ * Commands are sent as the first 32-bit word of an IPCUnixSocket payload. Their
+ * values are chosen not to collide with the messages of the IPA proxies.
+ *
+ * \var IPAWorkerCommandReset
+ * \brief Destroy the IPA context and create a new one
+ */
+
+/**
+ * \struct IPAWorker
+ * \brief An isolated IPA worker process and its IPC channel
+ *
+ * \var IPAWorker::module
+ * \brief The IPA module loaded by the worker
+ *
+ * \var IPAWorker::path
+ * \brief The path to the worker executable
+ *
+ * \var IPAWorker::process
+ * \brief The worker process
+ *
+ * \var IPAWorker::socket
+ * \brief The IPC channel to the worker process
+ */
+
+/**
+ * \class IPAProcessPool
+ * \brief Pool of warm IPA worker processes
+ *
+ * IPA modules that can't be run in the libcamera process are isolated in a
+ * worker process. Starting the worker requires a fork() and exec(), dynamic
+ * loading of the IPA module, and creation of the IPA context, which adds
+ * significant latency to camera initialisation.
+ *
+ * The IPAProcessPool keeps a number of started worker processes for each IPA
+ * module, and hands them out to the IPA proxies with acquire(). Workers released
+ * by the proxies with release() are reset and recycled, and count towards the
+ * idle workers kept for their module. Spare workers are started in the
+ * background only when an acquire() finds no idle worker. Only the first
+ * isolated IPA of a module thus pays the full startup latency.
+ *
+ * A single instance of the pool exists, owned by the CameraManager and bound to
+ * its thread. All functions are static, and start and stop workers directly when
+ * no pool instance exists.
+ */
+
+IPAProcessPool *IPAProcessPool::self_ = nullptr;
+
+/**
+ * \brief Construct the IPAProcessPool instance
+ * \param[in] spares The number of idle workers to keep per IPA module
+ */
+IPAProcessPool::IPAProcessPool(unsigned int spares)
+	: spares_(spares)
+{
+	if (self_)
+		LOG(IPAProcessPool, Fatal)
+			<< "Multiple IPAProcessPool objects are not allowed";
+
+	self_ = this;
+}
+
+IPAProcessPool::~IPAProcessPool()
+{
+	clear();
+
+	self_ = nullptr;
+}
+
+/**
+ * \brief Retrieve a worker process running an IPA module
+ * \param[in] ipam The IPA module
+ * \param[in] workerPath The path to the worker executable
+ *
+ * Hand out an idle worker for \a ipam if available. Otherwise, start a new
+ * worker, and start spare workers in the background for the next calls. Idle
+ * workers handed out are not replaced, as the worker is expected to be
+ * recycled when released.
+ *
+ * The caller owns the returned worker, and shall return it to the pool with
+ * release() when done with it.
+ *
+ * \return The worker, or nullptr if the worker process failed to start
+ */
+std::unique_ptr<IPAWorker> IPAProcessPool::acquire(IPAModule *ipam,
+						   const std::string &workerPath)
+{
+	if (!self_)
+		return spawn(ipam, workerPath);
+
+	std::unique_ptr<IPAWorker> worker;
+
+	std::list<std::unique_ptr<IPAWorker>> &idle = self_->idle_[ipam];
+	for (auto it = idle.begin(); it != idle.end(); ++it) {
+		if ((*it)->path != workerPath)
+			continue;
+
+		worker = std::move(*it);
+		idle.erase(it);
+
+		worker->process->finished.disconnect(self_, &IPAProcessPool::workerFinished);
+
+		LOG(IPAProcessPool, Debug)
+			<< "Reusing worker for IPA module " << ipam->path();
+		break;
+	}
+
+	if (worker)
+		return worker;
+
+	/* Start spares once the caller returns to the event loop. */
+	self_->invokeMethod(&IPAProcessPool::refill, ConnectionTypeQueued,
+			    ipam, workerPath);
+
+	return spawn(ipam, workerPath);
+}
+
+/**
+ * \brief Return a worker process to the pool
+ * \param[in] worker The worker
+ *
+ * The worker is reset and kept for later use if it is still running and the
+ * pool doesn't hold enough idle workers for its IPA module, and stopped
+ * otherwise. The caller shall have disconnected from the worker socket signals.
+ */
+void IPAProcessPool::release(std::unique_ptr<IPAWorker> worker)
+{
+	if (!self_ || worker->process->exitStatus() != Process::NotExited)
+		return;
+
+	std::list<std::unique_ptr<IPAWorker>> &idle = self_->idle_[worker->module];
+	if (idle.size() >= self_->spares_)
+		return;
+
+	IPCUnixSocket::Payload message;
+	message.data.resize(sizeof(uint32_t));
+	uint32_t command = IPAWorkerCommandReset;
+	memcpy(message.data.data(), &command, sizeof(command));
+
+	if (worker->socket->send(message) < 0)
+		return;
+
+	worker->process->finished.connect(self_, &IPAProcessPool::workerFinished);
+	idle.push_back(std::move(worker));
+}
+
+/**
+ * \brief Stop all idle workers
+ */
+void IPAProcessPool::clear()
+{
+	idle_.clear();
+}
+
+std::unique_ptr<IPAWorker> IPAProcessPool::spawn(IPAModule *ipam,
+						 const std::string &workerPath)
+{
+	std::unique_ptr<IPAWorker> worker = std::make_unique<IPAWorker>();
+	worker->module = ipam;
+	worker->path = workerPath;
+
+	worker->socket = std::make_unique<IPCUnixSocket>();
+	int fd = worker->socket->create();
+	if (fd < 0) {
+		LOG(IPAProcessPool, Error) << "Failed to create socket";
+		return nullptr;
+	}
+
+	std::vector<std::string> args{ ipam->path(), std::to_string(fd) };
+	std::vector<int> fds{ fd };
+
+	worker->process = std::make_unique<Process>();
+	int ret = worker->process->start(workerPath, args, fds);
+
+	/* The remote end of the socket is now owned by the worker. */
+	::close(fd);
+
+	if (ret) {
+		LOG(IPAProcessPool, Error)
+			<< "Failed to start proxy worker process";
+		return nullptr;
+	}
+
+	LOG(IPAProcessPool, Debug)
+		<< "Started worker for IPA module " << ipam->path();
+
+	return worker;
+}
+
+void IPAProcessPool::refill(IPAModule *ipam, const std::string &workerPath)
+{
+	std::list<std::unique_ptr<IPAWorker>> &idle = idle_[ipam];
+
+	while (idle.size() < spares_) {
+		std::unique_ptr<IPAWorker> worker = spawn(ipam, workerPath);
+		if (!worker)
+			return;
+
+		worker->process->finished.connect(this, &IPAProcessPool::workerFinished);
+		idle.push_back(std::move(worker));
+	}
+}
+
+void IPAProcessPool::workerFinished(Process *process,
+				    enum Process::ExitStatus status,
+				    int exitCode)
+{
+	for (auto &idle : idle_) {
+		idle.second.remove_if([process](const std::unique_ptr<IPAWorker> &worker) {
+			return worker->process.get() == process;
+		});
+	}
+}
+
+} /* namespace libcamera */
@@ -9,6 +9,9 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <algorithm>
+#include <iomanip>
+#include <new>
 #include <stdint.h>
 #include <string>
 #include <string.h>
@@ -42,13 +45,13 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * The instance is created with an empty media graph. Before performing any
  * other operation, it must be populate by calling populate(). Instances of
  * MediaEntity, MediaPad and MediaLink are created to model the media graph,
- * and stored in a map indexed by object id.
+ * stored in contiguous arrays, and indexed by object id.
  *
  * The graph is valid once successfully populated, as reported by the valid()
  * function. It can be queried to list all entities(), or entities can be
- * looked up by name with getEntityByName(). The graph can be traversed from
- * entity to entity through pads and links as exposed by the corresponding
- * classes.
+ * looked up by name with getEntityByName() in constant time. The graph can be
+ * traversed from entity to entity through pads and links as exposed by the
+ * corresponding classes.
  *
  * Media device can be claimed for exclusive use with acquire(), released with
  * release() and tested with busy(). This mechanism is aimed at pipeline
@@ -64,7 +67,9 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
 	: deviceNode_(deviceNode), fd_(-1), valid_(false), acquired_(false),
-	  lockOwner_(false)
+	  lockOwner_(false), topologyVersion_(0), entityStore_(nullptr),
+	  numEntities_(0), padStore_(nullptr), numPads_(0), linkStore_(nullptr),
+	  numLinks_(0)
 {
 }
 
@@ -134,6 +139,12 @@ void MediaDevice::release()
  * they provide at all times, while still allowing an instance to lock a
  * resource while it prepares to actively use a camera from the resource.
  *
+ * As other instances may have modified the links while the device wasn't
+ * locked, the link flags are refreshed from the kernel once the lock is taken.
+ * The link flags can then be trusted to skip setting up links that are already
+ * in the requested state. Locking fails if the links can't be refreshed, or if
+ * the topology of the media graph has changed.
+ *
  * This method shall not be called from a pipeline handler implementation
  * directly, as the base PipelineHandler implementation handles this on the
  * behalf of the specified implementation.
@@ -153,6 +164,14 @@ bool MediaDevice::lock()
 	if (lockf(fd_, F_TLOCK, 0))
 		return false;
 
+	int ret = refreshLinks();
+	if (ret) {
+		LOG(MediaDevice, Error)
+			<< "Failed to refresh links: " << strerror(-ret);
+		lockf(fd_, F_ULOCK, 0);
+		return false;
+	}
+
 	lockOwner_ = true;
 
 	return true;
@@ -201,25 +220,30 @@ void MediaDevice::unlock()
  * while pads are accessible from the entity they belong to and links from the
  * pads they connect.
  *
+ * The function can be called again to refresh a populated media device. If the
+ * topology version reported by the kernel hasn't changed, the media objects are
+ * kept and only the link flags are updated, and all pointers to media objects
+ * remain valid. Otherwise the media graph is rebuilt, which is only allowed if
+ * the media device isn't acquired.
+ *
  * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The topology of an acquired media device has changed
  */
 int MediaDevice::populate()
 {
 	struct media_v2_topology topology = {};
-	struct media_v2_entity *ents = nullptr;
-	struct media_v2_interface *interfaces = nullptr;
-	struct media_v2_link *links = nullptr;
-	struct media_v2_pad *pads = nullptr;
-	__u64 version = -1;
+	struct media_device_info info = {};
+	bool opened = false;
 	int ret;
 
-	clear();
+	if (fd_ == -1) {
+		ret = open();
+		if (ret)
+			return ret;
 
-	ret = open();
-	if (ret)
-		return ret;
+		opened = true;
+	}
 
-	struct media_device_info info = {};
 	ret = ioctl(fd_, MEDIA_IOC_DEVICE_INFO, &info);
 	if (ret) {
 		ret = -errno;
@@ -228,59 +252,41 @@ int MediaDevice::populate()
 		goto done;
 	}
 
-	driver_ = info.driver;
-	model_ = info.model;
-	version_ = info.media_version;
-
-	/*
-	 * Keep calling G_TOPOLOGY until the version number stays stable.
-	 */
-	while (true) {
-		topology.topology_version = 0;
-		topology.ptr_entities = reinterpret_cast<uintptr_t>(ents);
-		topology.ptr_interfaces = reinterpret_cast<uintptr_t>(interfaces);
-		topology.ptr_links = reinterpret_cast<uintptr_t>(links);
-		topology.ptr_pads = reinterpret_cast<uintptr_t>(pads);
-
-		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
-		if (ret < 0) {
-			ret = -errno;
-			LOG(MediaDevice, Error)
-				<< "Failed to enumerate topology: "
-				<< strerror(-ret);
-			goto done;
-		}
+	ret = readTopology(&topology);
+	if (ret)
+		goto done;
 
-		if (version == topology.topology_version)
-			break;
+	if (valid_ && topology.topology_version == topologyVersion_) {
+		LOG(MediaDevice, Debug) << "Topology unchanged, updating links";
+		updateLinks(topology);
+		goto done;
+	}
 
-		delete[] ents;
-		delete[] interfaces;
-		delete[] pads;
-		delete[] links;
+	if (valid_ && acquired_) {
+		LOG(MediaDevice, Warning)
+			<< "Topology of acquired device changed, not updating";
+		ret = -EBUSY;
+		goto done;
+	}
 
-		ents = new struct media_v2_entity[topology.num_entities]();
-		interfaces = new struct media_v2_interface[topology.num_interfaces]();
-		links = new struct media_v2_link[topology.num_links]();
-		pads = new struct media_v2_pad[topology.num_pads]();
+	clear();
 
-		version = topology.topology_version;
-	}
+	driver_ = info.driver;
+	model_ = info.model;
+	version_ = info.media_version;
 
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
-	    populateLinks(topology))
+	    populateLinks(topology)) {
 		valid_ = true;
+		topologyVersion_ = topology.topology_version;
+		cacheKey_ = computeCacheKey(info, topology);
+	}
 
-	ret = 0;
 done:
-	close();
-
-	delete[] ents;
-	delete[] interfaces;
-	delete[] pads;
-	delete[] links;
+	if (opened)
+		close();
 
 	if (!valid_) {
 		clear();
@@ -290,6 +296,54 @@ done:
 	return ret;
 }
 
+/**
+ * \brief Refresh the flags of the links of a populated media graph
+ *
+ * Links may be enabled or disabled behind the back of the media device, by
+ * another process or by the kernel. This function updates the flags of all
+ * links from the kernel, without modifying the media graph. All pointers to
+ * media objects remain valid.
+ *
+ * If the topology of the media graph has changed, the media objects don't
+ * match the kernel graph anymore. The function then fails, and the media device
+ * needs to be populated again or, if it is acquired, to be replaced by a new
+ * instance.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The media graph hasn't been populated
+ * \retval -ESTALE The topology of the media graph has changed
+ */
+int MediaDevice::refreshLinks()
+{
+	struct media_v2_topology topology = {};
+	bool opened = false;
+	int ret;
+
+	if (!valid_)
+		return -EINVAL;
+
+	if (fd_ == -1) {
+		ret = open();
+		if (ret)
+			return ret;
+
+		opened = true;
+	}
+
+	ret = readTopology(&topology);
+	if (!ret) {
+		if (topology.topology_version == topologyVersion_)
+			updateLinks(topology);
+		else
+			ret = -ESTALE;
+	}
+
+	if (opened)
+		close();
+
+	return ret;
+}
+
 /**
  * \fn MediaDevice::valid()
  * \brief Query whether the media graph has been populated and is valid
@@ -323,6 +377,19 @@ done:
  * \return The MediaDevice API version
  */
 
+/**
+ * \fn MediaDevice::cacheKey()
+ * \brief Retrieve a key identifying the media device and its capabilities
+ *
+ * The key identifies the media device instance through its driver, bus
+ * information and serial number, and changes with the hardware revision, the
+ * driver version or the topology of the media graph. It is used to identify
+ * the device in the CapabilityCache.
+ *
+ * \return The media device cache key, or an empty string if the media device
+ * hasn't been populated
+ */
+
 /**
  * \fn MediaDevice::entities()
  * \brief Retrieve the list of entities in the media graph
@@ -336,11 +403,8 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
-
-	return nullptr;
+	auto it = entitiesByName_.find(name);
+	return it != entitiesByName_.end() ? it->second : nullptr;
 }
 
 /**
@@ -427,28 +491,65 @@ MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
  * \brief Disable all links in the media device
  *
  * Disable all the media device links, clearing the MEDIA_LNK_FL_ENABLED flag
- * on links which are not flagged as IMMUTABLE.
+ * on links which are not flagged as IMMUTABLE. Links already disabled are
+ * skipped.
  *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaDevice::disableLinks()
 {
-	for (MediaEntity *entity : entities_) {
-		for (MediaPad *pad : entity->pads()) {
-			if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
-				continue;
-
-			for (MediaLink *link : pad->links()) {
-				if (link->flags() & MEDIA_LNK_FL_IMMUTABLE)
-					continue;
-
-				int ret = link->setEnabled(false);
-				if (ret)
-					return ret;
-			}
+	return setupLinks({});
+}
+
+/**
+ * \brief Configure the links of the media device
+ * \param[in] links The links to enable
+ *
+ * Enable all links in \a links and disable all other links in the media
+ * device, except for the links flagged as IMMUTABLE. This is equivalent to
+ * calling disableLinks() followed by MediaLink::setEnabled() for each link in
+ * \a links, but only the links whose state differs from the requested state
+ * are set up. Reconfiguring the media device with the same set of links thus
+ * doesn't access the device. The link state is refreshed from the kernel when
+ * the device is locked, see lock().
+ *
+ * Links are disabled before being enabled, as some entities don't allow
+ * multiple sink links to be enabled at the same time.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::setupLinks(const std::vector<MediaLink *> &links)
+{
+	for (MediaLink *link : links) {
+		if (link->device() != this) {
+			LOG(MediaDevice, Error)
+				<< "Link " << link->id()
+				<< " doesn't belong to the media device";
+			return -EINVAL;
 		}
 	}
 
+	for (unsigned int i = 0; i < numLinks_; ++i) {
+		MediaLink *link = &linkStore_[i];
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED) ||
+		    link->flags() & MEDIA_LNK_FL_IMMUTABLE)
+			continue;
+
+		if (std::find(links.begin(), links.end(), link) != links.end())
+			continue;
+
+		int ret = link->setEnabled(false);
+		if (ret)
+			return ret;
+	}
+
+	for (MediaLink *link : links) {
+		int ret = link->setEnabled(true);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
@@ -513,7 +614,7 @@ void MediaDevice::close()
 
 /**
  * \var MediaDevice::objects_
- * \brief Global map of media objects (entities, pads, links) keyed by their
+ * \brief Global index of media objects (entities, pads, links) keyed by their
  * object id.
  */
 
@@ -565,14 +666,176 @@ bool MediaDevice::addObject(MediaObject *object)
  */
 void MediaDevice::clear()
 {
-	for (auto const &o : objects_)
-		delete o.second;
+	for (unsigned int i = 0; i < numLinks_; ++i)
+		linkStore_[i].~MediaLink();
+	for (unsigned int i = 0; i < numPads_; ++i)
+		padStore_[i].~MediaPad();
+	for (unsigned int i = 0; i < numEntities_; ++i)
+		entityStore_[i].~MediaEntity();
+
+	::operator delete(linkStore_);
+	::operator delete(padStore_);
+	::operator delete(entityStore_);
+
+	linkStore_ = nullptr;
+	numLinks_ = 0;
+	padStore_ = nullptr;
+	numPads_ = 0;
+	entityStore_ = nullptr;
+	numEntities_ = 0;
 
 	objects_.clear();
+	entitiesByName_.clear();
 	entities_.clear();
+	cacheKey_.clear();
+	topologyVersion_ = 0;
 	valid_ = false;
 }
 
+/**
+ * \brief Retrieve the media graph topology from the kernel
+ * \param[out] topology The media graph topology
+ *
+ * The topology arrays are retrieved into buffers kept across calls, sized from
+ * the previous topology. A single MEDIA_IOC_G_TOPOLOGY call is thus needed
+ * unless the graph has grown, in which case the sizes are queried and the
+ * buffers enlarged.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::readTopology(struct media_v2_topology *topology)
+{
+	/* Start with buffers large enough for most devices. */
+	if (topologyEntities_.empty()) {
+		topologyEntities_.resize(32);
+		topologyInterfaces_.resize(32);
+		topologyPads_.resize(64);
+		topologyLinks_.resize(128);
+	}
+
+	while (true) {
+		*topology = {};
+		topology->num_entities = topologyEntities_.size();
+		topology->ptr_entities = reinterpret_cast<uintptr_t>(topologyEntities_.data());
+		topology->num_interfaces = topologyInterfaces_.size();
+		topology->ptr_interfaces = reinterpret_cast<uintptr_t>(topologyInterfaces_.data());
+		topology->num_pads = topologyPads_.size();
+		topology->ptr_pads = reinterpret_cast<uintptr_t>(topologyPads_.data());
+		topology->num_links = topologyLinks_.size();
+		topology->ptr_links = reinterpret_cast<uintptr_t>(topologyLinks_.data());
+
+		int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, topology);
+		if (!ret)
+			return 0;
+
+		ret = -errno;
+		if (ret != -ENOSPC) {
+			LOG(MediaDevice, Error)
+				<< "Failed to enumerate topology: "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		/* The buffers are too small, query the sizes and retry. */
+		*topology = {};
+		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, topology);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(MediaDevice, Error)
+				<< "Failed to enumerate topology: "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		topologyEntities_.resize(std::max<size_t>(topology->num_entities,
+							  topologyEntities_.size()));
+		topologyInterfaces_.resize(std::max<size_t>(topology->num_interfaces,
+							    topologyInterfaces_.size()));
+		topologyPads_.resize(std::max<size_t>(topology->num_pads,
+						      topologyPads_.size()));
+		topologyLinks_.resize(std::max<size_t>(topology->num_links,
+						       topologyLinks_.size()));
+	}
+}
+
+/**
+ * \brief Update the flags of all links from the media graph topology
+ * \param[in] topology The media graph topology
+ */
+void MediaDevice::updateLinks(const struct media_v2_topology &topology)
+{
+	const struct media_v2_link *mediaLinks =
+		reinterpret_cast<const struct media_v2_link *>(topology.ptr_links);
+
+	for (unsigned int i = 0; i < topology.num_links; ++i) {
+		if ((mediaLinks[i].flags & MEDIA_LNK_FL_LINK_TYPE) ==
+		    MEDIA_LNK_FL_INTERFACE_LINK)
+			continue;
+
+		MediaLink *link = dynamic_cast<MediaLink *>(object(mediaLinks[i].id));
+		if (link)
+			link->flags_ = mediaLinks[i].flags;
+	}
+}
+
+/*
+ * \brief Compute the cache key from the device information and topology
+ * \param[in] info The media device information
+ * \param[in] topology The media graph topology
+ *
+ * The topology is hashed with FNV-1a. The hash covers the entities, pads and
+ * links, but not the state of the links, as enabling or disabling links
+ * doesn't modify the capabilities of the devices.
+ *
+ * \return The cache key
+ */
+std::string MediaDevice::computeCacheKey(const struct media_device_info &info,
+					 const struct media_v2_topology &topology)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto update = [&hash](const void *data, size_t size) {
+		const uint8_t *bytes = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ULL;
+		}
+	};
+
+	const struct media_v2_entity *ents =
+		reinterpret_cast<const struct media_v2_entity *>(topology.ptr_entities);
+	for (unsigned int i = 0; i < topology.num_entities; ++i) {
+		update(&ents[i].id, sizeof(ents[i].id));
+		update(ents[i].name, strnlen(ents[i].name, sizeof(ents[i].name)));
+		update(&ents[i].function, sizeof(ents[i].function));
+	}
+
+	const struct media_v2_pad *pads =
+		reinterpret_cast<const struct media_v2_pad *>(topology.ptr_pads);
+	for (unsigned int i = 0; i < topology.num_pads; ++i) {
+		update(&pads[i].id, sizeof(pads[i].id));
+		update(&pads[i].entity_id, sizeof(pads[i].entity_id));
+		update(&pads[i].flags, sizeof(pads[i].flags));
+	}
+
+	const struct media_v2_link *links =
+		reinterpret_cast<const struct media_v2_link *>(topology.ptr_links);
+	for (unsigned int i = 0; i < topology.num_links; ++i) {
+		uint32_t flags = links[i].flags & ~MEDIA_LNK_FL_ENABLED;
+
+		update(&links[i].source_id, sizeof(links[i].source_id));
+		update(&links[i].sink_id, sizeof(links[i].sink_id));
+		update(&flags, sizeof(flags));
+	}
+
+	std::ostringstream key;
+	key << info.driver << ":" << info.bus_info << ":"
+	    << std::string(info.serial, strnlen(info.serial, sizeof(info.serial)))
+	    << ":" << std::hex << info.hw_revision << ":" << info.driver_version
+	    << ":" << std::setfill('0') << std::setw(16) << hash;
+
+	return key.str();
+}
+
 /**
  * \var MediaDevice::entities_
  * \brief Global list of media entities in the media graph
@@ -619,13 +882,21 @@ struct media_v2_interface *MediaDevice::findInterface(const struct media_v2_topo
 
 /*
  * For each entity in the media graph create a MediaEntity and store a
- * reference in the media device objects map and entities list.
+ * reference in the media device objects index and entities list.
  */
 bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 {
 	struct media_v2_entity *mediaEntities = reinterpret_cast<struct media_v2_entity *>
 						(topology.ptr_entities);
 
+	/* Entity, pad and link objects are stored in contiguous arrays. */
+	entityStore_ = static_cast<MediaEntity *>
+		       (::operator new(topology.num_entities * sizeof(MediaEntity)));
+	entities_.reserve(topology.num_entities);
+	entitiesByName_.reserve(topology.num_entities);
+	objects_.reserve(topology.num_entities + topology.num_pads +
+			 topology.num_links);
+
 	for (unsigned int i = 0; i < topology.num_entities; ++i) {
 		struct media_v2_entity *ent = &mediaEntities[i];
 
@@ -643,20 +914,21 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		struct media_v2_interface *iface =
 			findInterface(topology, ent->id);
 
-		MediaEntity *entity;
+		MediaEntity *entity = &entityStore_[numEntities_];
 		if (iface)
-			entity = new MediaEntity(this, ent,
-						 iface->devnode.major,
+			new (entity) MediaEntity(this, ent, iface->devnode.major,
 						 iface->devnode.minor);
 		else
-			entity = new MediaEntity(this, ent);
+			new (entity) MediaEntity(this, ent);
+
+		/* Constructed objects are destroyed by clear() on failure. */
+		numEntities_++;
 
-		if (!addObject(entity)) {
-			delete entity;
+		if (!addObject(entity))
 			return false;
-		}
 
 		entities_.push_back(entity);
+		entitiesByName_.emplace(entity->name(), entity);
 	}
 
 	return true;
@@ -667,6 +939,9 @@ bool MediaDevice::populatePads(const struct media_v2_topology &topology)
 	struct media_v2_pad *mediaPads = reinterpret_cast<struct media_v2_pad *>
 					 (topology.ptr_pads);
 
+	padStore_ = static_cast<MediaPad *>
+		    (::operator new(topology.num_pads * sizeof(MediaPad)));
+
 	for (unsigned int i = 0; i < topology.num_pads; ++i) {
 		unsigned int entity_id = mediaPads[i].entity_id;
 
@@ -680,11 +955,12 @@ bool MediaDevice::populatePads(const struct media_v2_topology &topology)
 			return false;
 		}
 
-		MediaPad *pad = new MediaPad(&mediaPads[i], mediaEntity);
-		if (!addObject(pad)) {
-			delete pad;
+		MediaPad *pad = new (&padStore_[numPads_]) MediaPad(&mediaPads[i],
+								     mediaEntity);
+		numPads_++;
+
+		if (!addObject(pad))
 			return false;
-		}
 
 		mediaEntity->addPad(pad);
 	}
@@ -697,6 +973,10 @@ bool MediaDevice::populateLinks(const struct media_v2_topology &topology)
 	struct media_v2_link *mediaLinks = reinterpret_cast<struct media_v2_link *>
 					   (topology.ptr_links);
 
+	/* Interface links are skipped, the store may be partly unused. */
+	linkStore_ = static_cast<MediaLink *>
+		     (::operator new(topology.num_links * sizeof(MediaLink)));
+
 	for (unsigned int i = 0; i < topology.num_links; ++i) {
 		/*
 		 * Skip links between entities and interfaces: we only care
@@ -727,11 +1007,12 @@ bool MediaDevice::populateLinks(const struct media_v2_topology &topology)
 			return false;
 		}
 
-		MediaLink *link = new MediaLink(&mediaLinks[i], source, sink);
-		if (!addObject(link)) {
-			delete link;
+		MediaLink *link = new (&linkStore_[numLinks_]) MediaLink(&mediaLinks[i],
+									 source, sink);
+		numLinks_++;
+
+		if (!addObject(link))
 			return false;
-		}
 
 		source->addLink(link);
 		sink->addLink(link);
@@ -71,6 +71,11 @@ LOG_DECLARE_CATEGORY(MediaDevice)
  * \return The MediaDevice
  */
 
+/**
+ * \fn MediaObject::device() const
+ * \copydoc MediaObject::device()
+ */
+
 /**
  * \fn MediaObject::id()
  * \brief Retrieve the media object id
@@ -111,17 +116,24 @@ LOG_DECLARE_CATEGORY(MediaDevice)
  * Enabling a link establishes a data connection between two pads, while
  * disabling it interrupts that connection.
  *
+ * The link status is tracked by the media device, and the device isn't
+ * accessed if the link is already in the requested state. The status is
+ * refreshed from the kernel when the media device is locked.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaLink::setEnabled(bool enable)
 {
 	unsigned int flags = enable ? MEDIA_LNK_FL_ENABLED : 0;
 
+	if ((flags_ & MEDIA_LNK_FL_ENABLED) == flags)
+		return 0;
+
 	int ret = dev_->setupLink(this, flags);
 	if (ret)
 		return ret;
 
-	flags_ = flags;
+	flags_ = (flags_ & ~MEDIA_LNK_FL_ENABLED) | flags;
 
 	return 0;
 }
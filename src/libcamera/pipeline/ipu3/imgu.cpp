@@ -7,6 +7,7 @@
 
 #include "imgu.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
@@ -638,58 +639,55 @@ int ImgUDevice::stop()
 }
 
 /**
- * \brief Enable or disable a single link on the ImgU instance
- *
- * This method assumes the media device associated with the ImgU instance
- * is open.
- *
- * \return 0 on success or a negative error code otherwise
+ * \brief Retrieve a link of the ImgU instance
+ * \return The link, or nullptr if the link can't be found
  */
-int ImgUDevice::linkSetup(const std::string &source, unsigned int sourcePad,
-			  const std::string &sink, unsigned int sinkPad,
-			  bool enable)
+MediaLink *ImgUDevice::link(const std::string &source, unsigned int sourcePad,
+			    const std::string &sink, unsigned int sinkPad)
 {
 	MediaLink *link = media_->link(source, sourcePad, sink, sinkPad);
-	if (!link) {
+	if (!link)
 		LOG(IPU3, Error)
 			<< "Failed to get link: '" << source << "':"
 			<< sourcePad << " -> '" << sink << "':" << sinkPad;
-		return -ENODEV;
-	}
 
-	return link->setEnabled(enable);
+	return link;
 }
 
 /**
- * \brief Enable or disable all media links in the ImgU instance to prepare
- * for capture operations
+ * \brief Enable the media links of the ImgU instance to prepare for capture
+ * operations
+ *
+ * All media links of the ImgU instance are enabled, and all other links of the
+ * ImgU media device, including the ones of the other ImgU instance, are
+ * disabled.
+ *
+ * This method assumes the media device associated with the ImgU instance
+ * is open.
  *
  * \todo This method will probably be removed or changed once links will be
  * enabled or disabled selectively.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::enableLinks(bool enable)
+int ImgUDevice::enableLinks()
 {
 	std::string viewfinderName = name_ + " viewfinder";
 	std::string outputName = name_ + " output";
 	std::string statName = name_ + " 3a stat";
 	std::string inputName = name_ + " input";
-	int ret;
-
-	ret = linkSetup(inputName, 0, name_, PAD_INPUT, enable);
-	if (ret)
-		return ret;
 
-	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable);
-	if (ret)
-		return ret;
+	std::vector<MediaLink *> links = {
+		link(inputName, 0, name_, PAD_INPUT),
+		link(name_, PAD_OUTPUT, outputName, 0),
+		link(name_, PAD_VF, viewfinderName, 0),
+		link(name_, PAD_STAT, statName, 0),
+	};
 
-	ret = linkSetup(name_, PAD_VF, viewfinderName, 0, enable);
-	if (ret)
-		return ret;
+	if (std::find(links.begin(), links.end(), nullptr) != links.end())
+		return -ENODEV;
 
-	return linkSetup(name_, PAD_STAT, statName, 0, enable);
+	return media_->setupLinks(links);
 }
 
 } /* namespace libcamera */
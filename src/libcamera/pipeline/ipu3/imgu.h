@@ -17,6 +17,7 @@ namespace libcamera {
 
 class FrameBuffer;
 class MediaDevice;
+class MediaLink;
 class Size;
 struct StreamConfiguration;
 
@@ -74,7 +75,7 @@ public:
 	int start();
 	int stop();
 
-	int enableLinks(bool enable);
+	int enableLinks();
 
 	std::unique_ptr<V4L2Subdevice> imgu_;
 	std::unique_ptr<V4L2VideoDevice> input_;
@@ -89,9 +90,8 @@ private:
 	static constexpr unsigned int PAD_VF = 3;
 	static constexpr unsigned int PAD_STAT = 4;
 
-	int linkSetup(const std::string &source, unsigned int sourcePad,
-		      const std::string &sink, unsigned int sinkPad,
-		      bool enable);
+	MediaLink *link(const std::string &source, unsigned int sourcePad,
+			const std::string &sink, unsigned int sinkPad);
 
 	int configureVideoDevice(V4L2VideoDevice *dev, unsigned int pad,
 				 const StreamConfiguration &cfg,
@@ -428,28 +428,24 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * would be 'stop()', but the Camera class state machine allows
 	 * start()<->stop() sequences without any configure() in between.
 	 *
-	 * As of now, disable all links in the ImgU media graph before
-	 * configuring the device, to allow alternate the usage of the two
-	 * ImgU pipes.
+	 * As of now, disable all links in the ImgU media graph but the ones
+	 * of the ImgU in use when configuring the device, to allow alternate
+	 * the usage of the two ImgU pipes. Only the links whose state changes
+	 * are set up.
 	 *
 	 * As a consequence, a Camera using an ImgU shall be configured before
 	 * any start()/stop() sequence. An application that wants to
 	 * pre-configure all the camera and then start/stop them alternatively
 	 * without going through any re-configuration (a sequence that is
 	 * allowed by the Camera state machine) would now fail on the IPU3.
-	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
-
-	/*
+	 *
 	 * \todo: Enable links selectively based on the requested streams.
 	 * As of now, enable all links unconditionally.
 	 * \todo Don't configure the ImgU at all if we only have a single
 	 * stream which is for raw capture, in which case no buffers will
 	 * ever be queued to the ImgU.
 	 */
-	ret = data->imgu_->enableLinks(true);
+	ret = data->imgu_->enableLinks();
 	if (ret)
 		return ret;
 
@@ -25,6 +25,7 @@
 
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_buf_allocator.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
@@ -32,7 +33,6 @@
 #include "libcamera/internal/v4l2_controls.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
-#include "dma_heaps.h"
 #include "staggered_ctrl.h"
 
 namespace libcamera {
@@ -41,6 +41,13 @@ LOG_DEFINE_CATEGORY(RPI)
 
 namespace {
 
+/*
+ * Image path buffers are pooled across reconfigure() only, and the pool is
+ * emptied when the camera is started or stopped. Bound it to a generous size
+ * nonetheless, as it holds CMA memory.
+ */
+constexpr size_t kImageBufferPoolLimit = 128 * 1024 * 1024;
+
 bool isRaw(PixelFormat &pixFmt)
 {
 	/*
@@ -132,12 +139,13 @@ class RPiStream : public Stream
 {
 public:
 	RPiStream()
+		: allocator_(nullptr)
 	{
 	}
 
 	RPiStream(const char *name, MediaEntity *dev, bool importOnly = false)
 		: external_(false), importOnly_(importOnly), name_(name),
-		  dev_(std::make_unique<V4L2VideoDevice>(dev))
+		  dev_(std::make_unique<V4L2VideoDevice>(dev)), allocator_(nullptr)
 	{
 	}
 
@@ -192,8 +200,13 @@ public:
 	void releaseBuffers()
 	{
 		dev_->releaseBuffers();
-		if (!external_ && !importOnly_)
+		if (!external_ && !importOnly_) {
+			if (allocator_)
+				allocator_->recycle(&internalBuffers_);
 			internalBuffers_.clear();
+		}
+
+		allocator_ = nullptr;
 	}
 
 	int importBuffers(unsigned int count)
@@ -206,6 +219,37 @@ public:
 		return dev_->allocateBuffers(count, &internalBuffers_);
 	}
 
+	/*
+	 * Allocate the internal buffers from \a allocator and import them in
+	 * the device. The buffers are recycled to the allocator when released.
+	 */
+	int allocateBuffers(DmaBufAllocator *allocator, unsigned int count)
+	{
+		V4L2DeviceFormat format;
+		int ret = dev_->getFormat(&format);
+		if (ret)
+			return ret;
+
+		std::vector<unsigned int> planeSizes;
+		for (unsigned int i = 0; i < format.planesCount; ++i)
+			planeSizes.push_back(format.planes[i].size);
+
+		ret = allocator->exportFrameBuffers(name_.c_str(), count,
+						    planeSizes, &internalBuffers_);
+		if (ret < 0)
+			return ret;
+
+		ret = dev_->importBuffers(count);
+		if (ret < 0) {
+			allocator->recycle(&internalBuffers_);
+			return ret;
+		}
+
+		allocator_ = allocator;
+
+		return ret;
+	}
+
 	int queueBuffers()
 	{
 		if (external_)
@@ -254,6 +298,8 @@ private:
 	std::vector<std::unique_ptr<FrameBuffer>> internalBuffers_;
 	/* Externally allocated framebuffers associated with this device stream. */
 	std::vector<std::unique_ptr<FrameBuffer>> *externalBuffers_;
+	/* Allocator the internal buffers are recycled to, if any. */
+	DmaBufAllocator *allocator_;
 };
 
 /*
@@ -286,9 +332,18 @@ class RPiCameraData : public CameraData
 {
 public:
 	RPiCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), sensor_(nullptr), state_(State::Stopped),
+		: CameraData(pipe), sensor_(nullptr), ipaActive_(false),
+		  dmaHeap_(DmaBufAllocator::CmaHeap), state_(State::Stopped),
 		  dropFrame_(false), ispOutputCount_(0)
 	{
+		dmaHeap_.setPoolLimit(kImageBufferPoolLimit);
+
+		/*
+		 * Allocating the image path buffers from the dma-heap hasn't
+		 * been validated on all platforms yet, keep V4L2 allocation by
+		 * default.
+		 */
+		poolImageBuffers_ = !!utils::secure_getenv("LIBCAMERA_RPI_POOL_BUFFERS");
 	}
 
 	void frameStarted(uint32_t sequence);
@@ -315,9 +370,13 @@ public:
 	std::vector<RPiStream *> streams_;
 	/* Buffers passed to the IPA. */
 	std::vector<IPABuffer> ipaBuffers_;
+	/* The IPA is started and the buffers in ipaBuffers_ are mapped. */
+	bool ipaActive_;
 
-	/* DMAHEAP allocation helper. */
-	RPi::DmaHeap dmaHeap_;
+	/* Contiguous memory allocator for buffers shared with the VideoCore. */
+	DmaBufAllocator dmaHeap_;
+	/* Allocate the image path buffers from dmaHeap_ instead of V4L2. */
+	bool poolImageBuffers_;
 	FileDescriptor lsTable_;
 
 	RPi::StaggeredCtrl staggeredCtrl_;
@@ -369,7 +428,9 @@ public:
 
 	int start(Camera *camera) override;
 	void stop(Camera *camera) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
+	int initCameraDevice(Camera *camera) override;
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
@@ -380,9 +441,13 @@ private:
 		return static_cast<RPiCameraData *>(PipelineHandler::cameraData(camera));
 	}
 
+	int configureImagePath(Camera *camera, CameraConfiguration *config);
+	void stopDevices(Camera *camera);
 	int queueAllBuffers(Camera *camera);
+	int allocateBuffers(Camera *camera, const std::vector<RPiStream *> &streams);
 	int prepareBuffers(Camera *camera);
 	void freeBuffers(Camera *camera);
+	std::vector<RPiStream *> imageStreams(RPiCameraData *data);
 
 	MediaDevice *unicam_;
 	MediaDevice *isp_;
@@ -599,12 +664,55 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 {
 	RPiCameraData *data = cameraData(camera);
+	V4L2DeviceFormat format;
 	int ret;
 
 	/* Start by resetting the Unicam and ISP stream states. */
 	for (auto const stream : data->streams_)
 		stream->reset();
 
+	ret = configureImagePath(camera, config);
+	if (ret)
+		return ret;
+
+	/* ISP statistics output format. */
+	format = {};
+	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_BCM2835_ISP_STATS);
+	ret = data->isp_[Isp::Stats].dev()->setFormat(&format);
+	if (ret) {
+		LOG(RPI, Error) << "Failed to set format on ISP stats stream: "
+				<< format.toString();
+		return ret;
+	}
+
+	/* Unicam embedded data output format. */
+	format = {};
+	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_SENSOR_DATA);
+	LOG(RPI, Debug) << "Setting embedded data format.";
+	ret = data->unicam_[Unicam::Embedded].dev()->setFormat(&format);
+	if (ret) {
+		LOG(RPI, Error) << "Failed to set format on Unicam embedded: "
+				<< format.toString();
+		return ret;
+	}
+
+	ret = data->configureIPA();
+	if (ret)
+		LOG(RPI, Error) << "Failed to configure the IPA: " << ret;
+
+	return ret;
+}
+
+/*
+ * Configure the sensor mode, the Unicam image output and the ISP input and
+ * image outputs. The formats of the ISP statistics and Unicam embedded data
+ * don't depend on the camera configuration.
+ */
+int PipelineHandlerRPi::configureImagePath(Camera *camera, CameraConfiguration *config)
+{
+	RPiCameraData *data = cameraData(camera);
+	int ret;
+
 	Size maxSize, sensorSize;
 	unsigned int maxIndex = 0;
 	bool rawStream = false;
@@ -714,27 +822,6 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		}
 	}
 
-	/* ISP statistics output format. */
-	format = {};
-	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_BCM2835_ISP_STATS);
-	ret = data->isp_[Isp::Stats].dev()->setFormat(&format);
-	if (ret) {
-		LOG(RPI, Error) << "Failed to set format on ISP stats stream: "
-				<< format.toString();
-		return ret;
-	}
-
-	/* Unicam embedded data output format. */
-	format = {};
-	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_SENSOR_DATA);
-	LOG(RPI, Debug) << "Setting embedded data format.";
-	ret = data->unicam_[Unicam::Embedded].dev()->setFormat(&format);
-	if (ret) {
-		LOG(RPI, Error) << "Failed to set format on Unicam embedded: "
-				<< format.toString();
-		return ret;
-	}
-
 	/* Adjust aspect ratio by providing crops on the input image. */
 	Rectangle crop{ 0, 0, sensorFormat.size };
 
@@ -751,11 +838,7 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	crop.y = (sensorFormat.size.height - crop.height) >> 1;
 	data->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &crop);
 
-	ret = data->configureIPA();
-	if (ret)
-		LOG(RPI, Error) << "Failed to configure the IPA: " << ret;
-
-	return ret;
+	return 0;
 }
 
 int PipelineHandlerRPi::exportFrameBuffers(Camera *camera, Stream *stream,
@@ -775,10 +858,22 @@ int PipelineHandlerRPi::start(Camera *camera)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = prepareBuffers(camera);
+	/*
+	 * Allocate buffers for internal pipeline usage. When restarting after
+	 * reconfigure(), the IPA is still running and only the image path
+	 * buffers have been released.
+	 */
+	if (data->ipaActive_)
+		ret = allocateBuffers(camera, imageStreams(data));
+	else
+		ret = prepareBuffers(camera);
+
+	/* Free the pooled buffers that the new configuration didn't reuse. */
+	data->dmaHeap_.clear();
+
 	if (ret) {
 		LOG(RPI, Error) << "Failed to allocate buffers";
+		stop(camera);
 		return ret;
 	}
 
@@ -790,12 +885,16 @@ int PipelineHandlerRPi::start(Camera *camera)
 	}
 
 	/* Start the IPA. */
-	ret = data->ipa_->start();
-	if (ret) {
-		LOG(RPI, Error)
-			<< "Failed to start IPA for " << camera->id();
-		stop(camera);
-		return ret;
+	if (!data->ipaActive_) {
+		ret = data->ipa_->start();
+		if (ret) {
+			LOG(RPI, Error)
+				<< "Failed to start IPA for " << camera->id();
+			stop(camera);
+			return ret;
+		}
+
+		data->ipaActive_ = true;
 	}
 
 	/*
@@ -841,21 +940,78 @@ void PipelineHandlerRPi::stop(Camera *camera)
 {
 	RPiCameraData *data = cameraData(camera);
 
-	data->state_ = RPiCameraData::State::Stopped;
-
-	/* Disable SOF event generation. */
-	data->unicam_[Unicam::Image].dev()->setFrameStartEnabled(false);
-
-	/* This also stops the streams. */
-	data->clearIncompleteRequests();
-	/* The default std::queue constructor is explicit with gcc 5 and 6. */
-	data->bayerQueue_ = std::queue<FrameBuffer *>{};
-	data->embeddedQueue_ = std::queue<FrameBuffer *>{};
+	stopDevices(camera);
 
 	/* Stop the IPA. */
 	data->ipa_->stop();
+	data->ipaActive_ = false;
 
 	freeBuffers(camera);
+	data->dmaHeap_.clear();
+}
+
+int PipelineHandlerRPi::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	RPiCameraData *data = cameraData(camera);
+	int ret;
+
+	/*
+	 * Stop streaming, but keep the IPA running and the statistics and
+	 * embedded data buffers allocated and mapped to the IPA, as their
+	 * formats don't depend on the configuration. Only the image path is
+	 * reconfigured, and its buffers reallocated by start().
+	 */
+	stopDevices(camera);
+
+	std::vector<RPiStream *> streams = imageStreams(data);
+	for (RPiStream *stream : streams) {
+		stream->releaseBuffers();
+		stream->reset();
+	}
+
+	V4L2DeviceFormat sensorFormat;
+	data->unicam_[Unicam::Image].dev()->getFormat(&sensorFormat);
+
+	ret = configureImagePath(camera, config);
+	if (ret) {
+		stop(camera);
+		return ret;
+	}
+
+	/*
+	 * The IPA only needs to be configured again, recomputing the lens
+	 * shading tables and sensor controls, when the sensor mode changes.
+	 */
+	V4L2DeviceFormat format;
+	data->unicam_[Unicam::Image].dev()->getFormat(&format);
+	if (format.size == sensorFormat.size && format.fourcc == sensorFormat.fourcc)
+		return 0;
+
+	ret = data->configureIPA();
+	if (ret) {
+		LOG(RPI, Error) << "Failed to configure the IPA: " << ret;
+		stop(camera);
+		return ret;
+	}
+
+	return 0;
+}
+
+int PipelineHandlerRPi::initCameraDevice(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	/*
+	 * Loading the IPA parses the sensor tuning file, defer it until the
+	 * camera is used.
+	 */
+	int ret = data->loadIPA();
+	if (ret) {
+		LOG(RPI, Error) << "Failed to load a suitable IPA library";
+		return ret;
+	}
+
+	return 0;
 }
 
 int PipelineHandlerRPi::queueRequestDevice(Camera *camera, Request *request)
@@ -951,11 +1107,6 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	if (data->sensor_->init())
 		return false;
 
-	if (data->loadIPA()) {
-		LOG(RPI, Error) << "Failed to load a suitable IPA library";
-		return false;
-	}
-
 	/* Register the controls that the Raspberry Pi IPA can handle. */
 	data->controlInfo_ = RPiControls;
 	/* Initialize the camera properties. */
@@ -979,6 +1130,22 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	return true;
 }
 
+void PipelineHandlerRPi::stopDevices(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	data->state_ = RPiCameraData::State::Stopped;
+
+	/* Disable SOF event generation. */
+	data->unicam_[Unicam::Image].dev()->setFrameStartEnabled(false);
+
+	/* This also stops the streams. */
+	data->clearIncompleteRequests();
+	/* The default std::queue constructor is explicit with gcc 5 and 6. */
+	data->bayerQueue_ = std::queue<FrameBuffer *>{};
+	data->embeddedQueue_ = std::queue<FrameBuffer *>{};
+}
+
 int PipelineHandlerRPi::queueAllBuffers(Camera *camera)
 {
 	RPiCameraData *data = cameraData(camera);
@@ -993,7 +1160,8 @@ int PipelineHandlerRPi::queueAllBuffers(Camera *camera)
 	return 0;
 }
 
-int PipelineHandlerRPi::prepareBuffers(Camera *camera)
+int PipelineHandlerRPi::allocateBuffers(Camera *camera,
+					const std::vector<RPiStream *> &streams)
 {
 	RPiCameraData *data = cameraData(camera);
 	int count, ret;
@@ -1008,7 +1176,9 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 		if (static_cast<const RPiStream *>(s)->isExternal())
 			maxBuffers = std::max(maxBuffers, s->configuration().bufferCount);
 
-	for (auto const stream : data->streams_) {
+	std::vector<RPiStream *> pooledStreams = imageStreams(data);
+
+	for (auto const stream : streams) {
 		if (stream->isExternal() || stream->isImporter()) {
 			/*
 			 * If a stream is marked as external reserve memory to
@@ -1028,13 +1198,21 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 			/*
 			 * If the stream is an internal exporter allocate and
 			 * export as many buffers as possible to its internal
-			 * pool.
+			 * pool. When enabled with LIBCAMERA_RPI_POOL_BUFFERS,
+			 * the image path buffers are allocated from the
+			 * dma-heap when available, for reconfigure() to reuse
+			 * them.
 			 */
-			ret = stream->allocateBuffers(maxBuffers);
-			if (ret < 0) {
-				freeBuffers(camera);
+			bool pooled = data->poolImageBuffers_ &&
+				      data->dmaHeap_.isValid() &&
+				      std::find(pooledStreams.begin(), pooledStreams.end(),
+						stream) != pooledStreams.end();
+			if (pooled)
+				ret = stream->allocateBuffers(&data->dmaHeap_, maxBuffers);
+			else
+				ret = stream->allocateBuffers(maxBuffers);
+			if (ret < 0)
 				return ret;
-			}
 		}
 	}
 
@@ -1047,6 +1225,18 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 		b->setCookie(count++);
 	}
 
+	return 0;
+}
+
+int PipelineHandlerRPi::prepareBuffers(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+	int count, ret;
+
+	ret = allocateBuffers(camera, data->streams_);
+	if (ret < 0)
+		return ret;
+
 	/*
 	 * Add cookies to the stats and embedded data buffers and link them with
 	 * the IPA.
@@ -1085,6 +1275,20 @@ void PipelineHandlerRPi::freeBuffers(Camera *camera)
 		stream->releaseBuffers();
 }
 
+/*
+ * Retrieve the streams whose formats and buffers depend on the camera
+ * configuration.
+ */
+std::vector<RPiStream *> PipelineHandlerRPi::imageStreams(RPiCameraData *data)
+{
+	return {
+		&data->unicam_[Unicam::Image],
+		&data->isp_[Isp::Input],
+		&data->isp_[Isp::Output0],
+		&data->isp_[Isp::Output1],
+	};
+}
+
 void RPiCameraData::frameStarted(uint32_t sequence)
 {
 	LOG(RPI, Debug) << "frame start " << sequence;
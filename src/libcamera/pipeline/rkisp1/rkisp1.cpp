@@ -183,6 +183,7 @@ public:
 	int start(Camera *camera) override;
 	void stop(Camera *camera) override;
 
+	int initCameraDevice(Camera *camera) override;
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
@@ -893,6 +894,14 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 	activeCamera_ = nullptr;
 }
 
+int PipelineHandlerRkISP1::initCameraDevice(Camera *camera)
+{
+	RkISP1CameraData *data = cameraData(camera);
+
+	/* Defer loading the IPA until the camera is used. */
+	return data->loadIPA();
+}
+
 int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera,
 					      Request *request)
 {
@@ -925,22 +934,11 @@ int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera,
 
 int PipelineHandlerRkISP1::initLinks()
 {
-	MediaLink *link;
-	int ret;
-
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
-
-	link = media_->link("rkisp1_isp", 2, "rkisp1_resizer_mainpath", 0);
+	MediaLink *link = media_->link("rkisp1_isp", 2, "rkisp1_resizer_mainpath", 0);
 	if (!link)
 		return -ENODEV;
 
-	ret = link->setEnabled(true);
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return media_->setupLinks({ link });
 }
 
 int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
@@ -965,10 +963,6 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	/* Initialize the camera properties. */
 	data->properties_ = data->sensor_->properties();
 
-	ret = data->loadIPA();
-	if (ret)
-		return ret;
-
 	std::set<Stream *> streams{ &data->stream_ };
 	std::shared_ptr<Camera> camera =
 		Camera::create(this, data->sensor_->id(), streams);
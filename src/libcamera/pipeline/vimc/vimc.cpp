@@ -95,6 +95,7 @@ public:
 	int start(Camera *camera) override;
 	void stop(Camera *camera) override;
 
+	int initCameraDevice(Camera *camera) override;
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
@@ -377,6 +378,21 @@ int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 	return ret;
 }
 
+int PipelineHandlerVimc::initCameraDevice(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	data->ipa_ = IPAManager::createIPA(this, 0, 0);
+	if (data->ipa_ != nullptr) {
+		std::string conf = data->ipa_->configurationFile("vimc.conf");
+		data->ipa_->init(IPASettings{ conf });
+	} else {
+		LOG(VIMC, Warning) << "no matching IPA found";
+	}
+
+	return 0;
+}
+
 int PipelineHandlerVimc::queueRequestDevice(Camera *camera, Request *request)
 {
 	VimcCameraData *data = cameraData(camera);
@@ -419,14 +435,6 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 
 	std::unique_ptr<VimcCameraData> data = std::make_unique<VimcCameraData>(this, media);
 
-	data->ipa_ = IPAManager::createIPA(this, 0, 0);
-	if (data->ipa_ != nullptr) {
-		std::string conf = data->ipa_->configurationFile("vimc.conf");
-		data->ipa_->init(IPASettings{ conf });
-	} else {
-		LOG(VIMC, Warning) << "no matching IPA found";
-	}
-
 	/* Locate and open the capture video node. */
 	if (data->init())
 		return false;
@@ -444,15 +452,11 @@ int VimcCameraData::init()
 {
 	int ret;
 
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
-
 	MediaLink *link = media_->link("Debayer B", 1, "Scaler", 0);
 	if (!link)
 		return -ENODEV;
 
-	ret = link->setEnabled(true);
+	ret = media_->setupLinks({ link });
 	if (ret < 0)
 		return ret;
 
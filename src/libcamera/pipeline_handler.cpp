@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/pipeline_handler.h"
 
+#include <string.h>
 #include <sys/sysmacros.h>
 
 #include <libcamera/buffer.h>
@@ -166,6 +167,13 @@ PipelineHandler::~PipelineHandler()
  * the media devices is has acquired by calling MediaDevice::release()) and
  * return false.
  *
+ * Matching is performed for all pipeline handlers when the camera manager
+ * starts, including for cameras that the application will never use. It shall
+ * thus be limited to the operations needed to create the cameras and report
+ * their properties, controls and supported configurations. Expensive
+ * operations that are only needed to operate the camera, such as loading IPA
+ * modules, shall be deferred to initCameraDevice().
+ *
  * If multiple instances of a pipeline are available in the system, the
  * PipelineHandler class will be instantiated once per instance, and its match()
  * function called for every instance. Each call shall acquire media devices for
@@ -251,6 +259,37 @@ void PipelineHandler::unlock()
 		media->unlock();
 }
 
+/**
+ * \brief Complete the initialisation of a camera
+ * \param[in] camera The camera to initialise
+ *
+ * This function is called by the Camera class when the camera is acquired. It
+ * calls initCameraDevice() the first time the camera is acquired, and does
+ * nothing otherwise. If initialisation fails, it is attempted again the next
+ * time the camera is acquired.
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::initCamera(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	if (data->initialized_)
+		return 0;
+
+	int ret = initCameraDevice(camera);
+	if (ret < 0) {
+		LOG(Pipeline, Error)
+			<< "Failed to initialise camera " << camera->id()
+			<< ": " << strerror(-ret);
+		return ret;
+	}
+
+	data->initialized_ = true;
+	return 0;
+}
+
 /**
  * \brief Retrieve the list of controls for a camera
  * \param[in] camera The camera
@@ -373,6 +412,36 @@ const ControlList &PipelineHandler::properties(Camera *camera)
  * \context This function is called from the CameraManager thread.
  */
 
+/**
+ * \brief Stop a running camera and apply a new configuration
+ * \param[in] camera The camera to reconfigure
+ * \param[in] config The new camera configuration
+ *
+ * This method implements the first half of Camera::reconfigure(). It stops
+ * capture on the running \a camera and applies the new configuration. As for
+ * configure(), the pipeline handler shall associate each StreamConfiguration
+ * entry of \a config with a stream. The Camera class then updates the stream
+ * configurations and restarts the camera with start().
+ *
+ * The default implementation calls stop() and configure(). Pipeline handlers
+ * should override this method to switch configurations incrementally,
+ * preserving the resources that the new configuration doesn't affect, such as
+ * internal buffers and the IPA state, and reuse them in start(). As with
+ * stop(), all pending requests shall be completed.
+ *
+ * On failure, the camera shall be left stopped.
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	stop(camera);
+
+	return configure(camera, config);
+}
+
 /**
  * \fn PipelineHandler::queueRequest()
  * \brief Queue a request to the camera
@@ -403,6 +472,25 @@ int PipelineHandler::queueRequest(Camera *camera, Request *request)
 	return ret;
 }
 
+/**
+ * \brief Complete the device-specific initialisation of a camera
+ * \param[in] camera The camera to initialise
+ *
+ * This function performs the initialisation steps of \a camera that have been
+ * deferred from match(). It is called once, the first time the camera is
+ * acquired, before any other operation that affects the camera state. Pipeline
+ * handlers that don't defer any initialisation don't need to override this
+ * function. The default implementation does nothing.
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::initCameraDevice(Camera *camera)
+{
+	return 0;
+}
+
 /**
  * \fn PipelineHandler::queueRequestDevice()
  * \brief Queue a request to the device
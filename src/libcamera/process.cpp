@@ -45,6 +45,7 @@ class ProcessManager
 {
 public:
 	void registerProcess(Process *proc);
+	void unregisterProcess(Process *proc);
 
 	static ProcessManager *instance();
 
@@ -58,6 +59,7 @@ private:
 	~ProcessManager();
 
 	std::list<Process *> processes_;
+	std::list<pid_t> orphans_;
 
 	struct sigaction oldsa_;
 	EventNotifier *sigEvent_;
@@ -112,6 +114,10 @@ void ProcessManager::sighandler(EventNotifier *notifier)
 		it = processes_.erase(it);
 		process->died(wstatus);
 	}
+
+	orphans_.remove_if([](pid_t pid) {
+		return waitpid(pid, nullptr, WNOHANG) == pid;
+	});
 }
 
 /**
@@ -127,6 +133,21 @@ void ProcessManager::registerProcess(Process *proc)
 	processes_.push_back(proc);
 }
 
+/**
+ * \brief Unregister process from process manager
+ * \param[in] proc Process to unregister
+ *
+ * This method unregisters the \a proc from the process manager. It shall be
+ * called when a running Process is destroyed, to avoid signalling the
+ * termination of a deleted process. The child process is still reaped when it
+ * terminates.
+ */
+void ProcessManager::unregisterProcess(Process *proc)
+{
+	processes_.remove(proc);
+	orphans_.push_back(proc->pid_);
+}
+
 ProcessManager::ProcessManager()
 {
 	sigaction(SIGCHLD, NULL, &oldsa_);
@@ -223,6 +244,9 @@ Process::~Process()
 {
 	kill();
 	/* \todo wait for child process to exit */
+
+	if (running_)
+		ProcessManager::instance()->unregisterProcess(this);
 }
 
 /**
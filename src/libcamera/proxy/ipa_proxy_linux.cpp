@@ -5,16 +5,16 @@
  * ipa_proxy_linux.cpp - Default Image Processing Algorithm proxy for Linux
  */
 
-#include <vector>
+#include <memory>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
 
 #include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_process_pool.h"
 #include "libcamera/internal/ipa_proxy.h"
 #include "libcamera/internal/ipc_unixsocket.h"
 #include "libcamera/internal/log.h"
-#include "libcamera/internal/process.h"
 
 namespace libcamera {
 
@@ -41,21 +41,16 @@ public:
 private:
 	void readyRead(IPCUnixSocket *ipc);
 
-	Process *proc_;
-
-	IPCUnixSocket *socket_;
+	std::unique_ptr<IPAWorker> worker_;
 };
 
 IPAProxyLinux::IPAProxyLinux(IPAModule *ipam)
-	: IPAProxy(ipam), proc_(nullptr), socket_(nullptr)
+	: IPAProxy(ipam)
 {
 	LOG(IPAProxy, Debug)
 		<< "initializing dummy proxy: loading IPA from "
 		<< ipam->path();
 
-	std::vector<int> fds;
-	std::vector<std::string> args;
-	args.push_back(ipam->path());
 	const std::string path = resolvePath("ipa_proxy_linux");
 	if (path.empty()) {
 		LOG(IPAProxy, Error)
@@ -63,32 +58,22 @@ IPAProxyLinux::IPAProxyLinux(IPAModule *ipam)
 		return;
 	}
 
-	socket_ = new IPCUnixSocket();
-	int fd = socket_->create();
-	if (fd < 0) {
-		LOG(IPAProxy, Error)
-			<< "Failed to create socket";
+	worker_ = IPAProcessPool::acquire(ipam, path);
+	if (!worker_)
 		return;
-	}
-	socket_->readyRead.connect(this, &IPAProxyLinux::readyRead);
-	args.push_back(std::to_string(fd));
-	fds.push_back(fd);
 
-	proc_ = new Process();
-	int ret = proc_->start(path, args, fds);
-	if (ret) {
-		LOG(IPAProxy, Error)
-			<< "Failed to start proxy worker process";
-		return;
-	}
+	worker_->socket->readyRead.connect(this, &IPAProxyLinux::readyRead);
 
 	valid_ = true;
 }
 
 IPAProxyLinux::~IPAProxyLinux()
 {
-	delete proc_;
-	delete socket_;
+	if (!worker_)
+		return;
+
+	worker_->socket->readyRead.disconnect(this, &IPAProxyLinux::readyRead);
+	IPAProcessPool::release(std::move(worker_));
 }
 
 void IPAProxyLinux::readyRead(IPCUnixSocket *ipc)
@@ -5,7 +5,9 @@
  * ipa_proxy_linux_worker.cpp - Default Image Processing Algorithm proxy worker for Linux
  */
 
+#include <errno.h>
 #include <iostream>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -14,6 +16,7 @@
 #include <libcamera/logging.h>
 
 #include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_process_pool.h"
 #include "libcamera/internal/ipc_unixsocket.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/thread.h"
@@ -22,6 +25,28 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(IPAProxyLinuxWorker)
 
+static IPAModule *ipam;
+static struct ipa_context *ipac;
+
+/*
+ * Reset the worker to a pristine state before it gets handed to another proxy
+ * by the IPAProcessPool.
+ */
+static int resetContext()
+{
+	ipac->ops->destroy(ipac);
+
+	ipac = ipam->createContext();
+	if (!ipac) {
+		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
+		return -ENOMEM;
+	}
+
+	LOG(IPAProxyLinuxWorker, Debug) << "IPA context reset";
+
+	return 0;
+}
+
 void readyRead(IPCUnixSocket *ipc)
 {
 	IPCUnixSocket::Payload message;
@@ -34,6 +59,16 @@ void readyRead(IPCUnixSocket *ipc)
 		return;
 	}
 
+	uint32_t command = 0;
+	if (message.data.size() >= sizeof(command))
+		memcpy(&command, message.data.data(), sizeof(command));
+
+	if (command == IPAWorkerCommandReset) {
+		if (resetContext())
+			exit(EXIT_FAILURE);
+		return;
+	}
+
 	LOG(IPAProxyLinuxWorker, Debug) << "Received a message!";
 }
 
@@ -57,7 +92,8 @@ int main(int argc, char **argv)
 		<< "Starting worker for IPA module " << argv[1]
 		<< " with IPC fd = " << fd;
 
-	std::unique_ptr<IPAModule> ipam = std::make_unique<IPAModule>(argv[1]);
+	std::unique_ptr<IPAModule> module = std::make_unique<IPAModule>(argv[1]);
+	ipam = module.get();
 	if (!ipam->isValid() || !ipam->load()) {
 		LOG(IPAProxyLinuxWorker, Error)
 			<< "IPAModule " << argv[1] << " should be valid but isn't";
@@ -71,7 +107,7 @@ int main(int argc, char **argv)
 	}
 	socket.readyRead.connect(&readyRead);
 
-	struct ipa_context *ipac = ipam->createContext();
+	ipac = ipam->createContext();
 	if (!ipac) {
 		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
 		return EXIT_FAILURE;
@@ -63,7 +63,7 @@ LOG_DEFINE_CATEGORY(Request)
  */
 Request::Request(Camera *camera, uint64_t cookie)
 	: camera_(camera), cookie_(cookie), status_(RequestPending),
-	  cancelled_(false)
+	  cancelled_(false), reusable_(false)
 {
 	/**
 	 * \todo Should the Camera expose a validator instance, to avoid
@@ -85,6 +85,50 @@ Request::~Request()
 	delete validator_;
 }
 
+/**
+ * \enum Request::ReuseFlag
+ * Flags to control the behaviour of Request::reuse()
+ * \var Request::Default
+ * Don't reuse buffers
+ * \var Request::ReuseBuffers
+ * Reuse the buffers that were previously added by addBuffer()
+ */
+
+/**
+ * \brief Reset the request for reuse
+ * \param[in] flags Indicate whether or not to reuse the buffers
+ *
+ * Reset the status and controls associated with the request, to allow it to
+ * be reused and queued again to the camera. Only requests created with
+ * Camera::createReusableRequest() can be queued again after they complete.
+ *
+ * By default all buffers associated with the request are removed. When the \a
+ * flags contain ReuseBuffers, the buffers are kept and will be used again
+ * when the request is queued, without requiring a new call to addBuffer().
+ *
+ * This function shall not be called while the request is queued to the camera.
+ */
+void Request::reuse(ReuseFlag flags)
+{
+	pending_.clear();
+
+	if (flags & ReuseBuffers) {
+		for (auto &it : bufferMap_) {
+			FrameBuffer *buffer = it.second;
+			buffer->request_ = this;
+			pending_.insert(buffer);
+		}
+	} else {
+		bufferMap_.clear();
+	}
+
+	status_ = RequestPending;
+	cancelled_ = false;
+
+	controls_->clear();
+	metadata_->clear();
+}
+
 /**
  * \fn Request::controls()
  * \brief Retrieve the request's ControlList
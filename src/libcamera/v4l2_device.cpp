@@ -16,6 +16,7 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include "libcamera/internal/capability_cache.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/sysfs.h"
 #include "libcamera/internal/utils.h"
@@ -411,13 +412,82 @@ int V4L2Device::ioctl(unsigned long request, void *argp)
  * \return The V4L2 device file descriptor, -1 if the device node is not open
  */
 
+/**
+ * \var V4L2Device::cacheKey_
+ * \brief Key identifying the device in the CapabilityCache
+ *
+ * Derived classes shall set the key when the device is associated with a
+ * media entity. Capabilities of devices with an empty key are not cached.
+ */
+
 /*
  * \brief List and store information about all controls supported by the
  * V4L2 device
+ *
+ * Only the list of supported controls is stored in the CapabilityCache, as it
+ * is static for a given device. Control limits may change at runtime, for
+ * instance when the format of a sensor changes, and are thus always queried
+ * from the device. The list is enumerated again if a cached control can't be
+ * queried.
  */
 void V4L2Device::listControls()
 {
 	ControlInfoMap::Map ctrls;
+	std::vector<struct v4l2_query_ext_ctrl> queried;
+
+	const std::string key = cacheKey_.empty() ? "" : cacheKey_ + "/control-ids";
+
+	Span<const uint8_t> cached = CapabilityCache::lookup(key);
+	bool valid = !cached.empty() && !(cached.size() % sizeof(uint32_t));
+	if (valid) {
+		std::vector<uint32_t> ids(cached.size() / sizeof(uint32_t));
+		memcpy(ids.data(), cached.data(), cached.size());
+
+		for (uint32_t id : ids) {
+			struct v4l2_query_ext_ctrl ctrl = {};
+			ctrl.id = id;
+
+			if (ioctl(VIDIOC_QUERY_EXT_CTRL, &ctrl) ||
+			    ctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
+				LOG(V4L2, Debug)
+					<< "Cached control " << utils::hex(id)
+					<< " not available";
+				valid = false;
+				break;
+			}
+
+			queried.push_back(ctrl);
+		}
+	}
+
+	if (!valid) {
+		queried = queryControls();
+
+		std::vector<uint32_t> ids;
+		for (const struct v4l2_query_ext_ctrl &ctrl : queried)
+			ids.push_back(ctrl.id);
+
+		CapabilityCache::store(key, { reinterpret_cast<const uint8_t *>(ids.data()),
+					      ids.size() * sizeof(ids[0]) });
+	}
+
+	for (const struct v4l2_query_ext_ctrl &ctrl : queried) {
+		controlIds_.emplace_back(std::make_unique<V4L2ControlId>(ctrl));
+		controlInfo_.emplace(ctrl.id, ctrl);
+
+		ctrls.emplace(controlIds_.back().get(), V4L2ControlInfo(ctrl));
+	}
+
+	controls_ = std::move(ctrls);
+}
+
+/*
+ * \brief Query the supported controls from the device
+ * \return The list of controls of supported types
+ */
+std::vector<struct v4l2_query_ext_ctrl> V4L2Device::queryControls()
+{
+	std::vector<struct v4l2_query_ext_ctrl> queried;
 	struct v4l2_query_ext_ctrl ctrl = {};
 
 	/* \todo Add support for menu controls. */
@@ -449,13 +519,10 @@ void V4L2Device::listControls()
 			continue;
 		}
 
-		controlIds_.emplace_back(std::make_unique<V4L2ControlId>(ctrl));
-		controlInfo_.emplace(ctrl.id, ctrl);
-
-		ctrls.emplace(controlIds_.back().get(), V4L2ControlInfo(ctrl));
+		queried.push_back(ctrl);
 	}
 
-	controls_ = std::move(ctrls);
+	return queried;
 }
 
 /*
@@ -9,8 +9,8 @@
 #include "libcamera/internal/v4l2_pixelformat.h"
 
 #include <ctype.h>
-#include <map>
 #include <string.h>
+#include <unordered_map>
 
 #include <libcamera/formats.h>
 #include <libcamera/pixel_format.h>
@@ -43,7 +43,7 @@ LOG_DECLARE_CATEGORY(V4L2)
 
 namespace {
 
-const std::map<V4L2PixelFormat, PixelFormat> vpf2pf{
+const std::unordered_map<uint32_t, PixelFormat> vpf2pf{
 	/* RGB formats. */
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565), formats::RGB565 },
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB24), formats::BGR888 },
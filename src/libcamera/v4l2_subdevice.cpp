@@ -19,6 +19,7 @@
 
 #include <libcamera/geometry.h>
 
+#include "libcamera/internal/capability_cache.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
@@ -238,6 +239,7 @@ uint8_t V4L2SubdeviceFormat::bitsPerPixel() const
 V4L2Subdevice::V4L2Subdevice(const MediaEntity *entity)
 	: V4L2Device(entity->deviceNode()), entity_(entity)
 {
+	cacheKey_ = entity->device()->cacheKey() + "/" + entity->name();
 }
 
 V4L2Subdevice::~V4L2Subdevice()
@@ -341,7 +343,8 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
  * \param[in] pad The 0-indexed pad number to enumerate formats on
  *
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
- * a \a pad.
+ * a \a pad. The formats are retrieved from the CapabilityCache when they don't
+ * depend on the state of the subdevice, see formatsCacheKey().
  *
  * \return A list of the supported device formats
  */
@@ -354,6 +357,10 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		return {};
 	}
 
+	std::string key = formatsCacheKey(pad);
+	if (CapabilityCache::lookupFormats(key, &formats))
+		return formats;
+
 	for (unsigned int code : enumPadCodes(pad)) {
 		std::vector<SizeRange> sizes = enumPadSizes(pad, code);
 		if (sizes.empty())
@@ -368,6 +375,9 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		}
 	}
 
+	if (!formats.empty())
+		CapabilityCache::storeFormats(key, formats);
+
 	return formats;
 }
 
@@ -466,6 +476,50 @@ std::string V4L2Subdevice::logPrefix() const
 	return "'" + entity_->name() + "'";
 }
 
+/*
+ * \brief Compute the CapabilityCache key of the formats of a \a pad
+ *
+ * The formats of a source pad may depend on the formats of the sink pads of
+ * the subdevice, as for scalers or ISPs, and are only cached for subdevices
+ * without sink pads. The media bus codes of sensors further depend on the
+ * flips, which modify the Bayer pattern order. The current flips are thus
+ * included in the key.
+ *
+ * \return The cache key, or an empty string if the formats shall not be cached
+ */
+std::string V4L2Subdevice::formatsCacheKey(unsigned int pad)
+{
+	if (cacheKey_.empty())
+		return {};
+
+	if (entity_->pads()[pad]->flags() & MEDIA_PAD_FL_SOURCE) {
+		for (const MediaPad *p : entity_->pads()) {
+			if (p->flags() & MEDIA_PAD_FL_SINK)
+				return {};
+		}
+	}
+
+	std::string key = cacheKey_ + "/formats/" + std::to_string(pad);
+
+	std::vector<uint32_t> flips;
+	for (uint32_t id : { V4L2_CID_HFLIP, V4L2_CID_VFLIP }) {
+		if (controls().find(id) != controls().end())
+			flips.push_back(id);
+	}
+
+	if (flips.empty())
+		return key;
+
+	ControlList ctrls = getControls(flips);
+	if (ctrls.empty())
+		return {};
+
+	for (uint32_t id : flips)
+		key += "/" + std::to_string(ctrls.get(id).get<int32_t>());
+
+	return key;
+}
+
 std::vector<unsigned int> V4L2Subdevice::enumPadCodes(unsigned int pad)
 {
 	std::vector<unsigned int> codes;
@@ -23,6 +23,7 @@
 #include <libcamera/event_notifier.h>
 #include <libcamera/file_descriptor.h>
 
+#include "libcamera/internal/capability_cache.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
@@ -491,6 +492,7 @@ V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 V4L2VideoDevice::V4L2VideoDevice(const MediaEntity *entity)
 	: V4L2VideoDevice(entity->deviceNode())
 {
+	cacheKey_ = entity->device()->cacheKey() + "/" + entity->name();
 }
 
 V4L2VideoDevice::~V4L2VideoDevice()
@@ -954,12 +956,31 @@ int V4L2VideoDevice::trySetFormatSingleplane(V4L2DeviceFormat *format, bool set)
  * If the \a code argument is not zero, only formats compatible with that media
  * bus code will be enumerated.
  *
+ * The formats of media controller centric video devices created from a media
+ * entity are retrieved from the CapabilityCache when available. Other video
+ * devices may report formats that depend on their state, such as the format of
+ * the output queue of memory-to-memory devices, or the format of the connected
+ * sensor, and are always enumerated.
+ *
  * \return A list of the supported video device formats
  */
 V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 {
 	Formats formats;
 
+	std::string key;
+	if (!cacheKey_.empty() && caps_.device_caps() & V4L2_CAP_IO_MC)
+		key = cacheKey_ + "/formats/" + std::to_string(bufferType_) +
+		      "/" + std::to_string(code);
+
+	CapabilityCache::Formats cached;
+	if (CapabilityCache::lookupFormats(key, &cached)) {
+		for (auto &format : cached)
+			formats.emplace(V4L2PixelFormat(format.first),
+					std::move(format.second));
+		return formats;
+	}
+
 	for (V4L2PixelFormat pixelFormat : enumPixelformats(code)) {
 		std::vector<SizeRange> sizes = enumSizes(pixelFormat);
 		if (sizes.empty())
@@ -973,8 +994,12 @@ V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 		}
 
 		formats.emplace(pixelFormat, sizes);
+		cached.emplace(pixelFormat, sizes);
 	}
 
+	if (!cached.empty())
+		CapabilityCache::storeFormats(key, cached);
+
 	return formats;
 }
 
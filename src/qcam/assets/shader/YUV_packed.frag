@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * YUV_packed.frag - Fragment shader code for YUYV packed formats
+ */
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#elif defined(GL_ES)
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+
+/*
+ * The packed YUV data is stored in an RGBA texture that stores two pixels in
+ * each texel. tex_step is the size of one pixel of the image, in normalized
+ * texture coordinates.
+ */
+uniform sampler2D tex_y;
+uniform vec2 tex_step;
+
+void main(void)
+{
+	mat3 yuv2rgb_bt601_mat = mat3(
+		vec3(1.164,  1.164, 1.164),
+		vec3(0.000, -0.392, 2.017),
+		vec3(1.596, -0.813, 0.000)
+	);
+
+	vec4 texel = texture2D(tex_y, textureOut);
+
+	/* Select the first or second luma sample based on the pixel column. */
+	float odd = mod(floor(textureOut.x / tex_step.x), 2.0);
+
+#if defined(YUV_PATTERN_YUYV)
+	vec3 yuv = vec3(mix(texel.r, texel.b, odd), texel.g, texel.a);
+#elif defined(YUV_PATTERN_YVYU)
+	vec3 yuv = vec3(mix(texel.r, texel.b, odd), texel.a, texel.g);
+#elif defined(YUV_PATTERN_UYVY)
+	vec3 yuv = vec3(mix(texel.g, texel.a, odd), texel.r, texel.b);
+#elif defined(YUV_PATTERN_VYUY)
+	vec3 yuv = vec3(mix(texel.g, texel.a, odd), texel.b, texel.r);
+#else
+#error Invalid pattern
+#endif
+
+	yuv -= vec3(0.063, 0.500, 0.500);
+
+	vec3 rgb = yuv2rgb_bt601_mat * yuv;
+	gl_FragColor = vec4(rgb, 1.0);
+}
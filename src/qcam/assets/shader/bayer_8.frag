@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * bayer_8.frag - Fragment shader code for 8-bit Bayer formats
+ *
+ * Perform a bilinear demosaicing of the raw Bayer data. The missing colour
+ * components of each pixel are interpolated from the closest neighbours of
+ * the same colour.
+ */
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#elif defined(GL_ES)
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+
+/*
+ * tex_step is the size of one pixel of the image, in normalized texture
+ * coordinates. tex_bayer_first_red is the position of the first red pixel of
+ * the Bayer pattern, as (0|1, 0|1).
+ */
+uniform sampler2D tex_y;
+uniform vec2 tex_step;
+uniform vec2 tex_bayer_first_red;
+
+float fetch(float x, float y)
+{
+	return texture2D(tex_y, textureOut + vec2(x, y) * tex_step).r;
+}
+
+void main(void)
+{
+	vec2 site = mod(floor(textureOut / tex_step) + tex_bayer_first_red, 2.0);
+
+	float centre = fetch(0.0, 0.0);
+	float horz = (fetch(-1.0, 0.0) + fetch(1.0, 0.0)) / 2.0;
+	float vert = (fetch(0.0, -1.0) + fetch(0.0, 1.0)) / 2.0;
+	float cross = (horz + vert) / 2.0;
+	float diag = (fetch(-1.0, -1.0) + fetch(1.0, -1.0) +
+		      fetch(-1.0, 1.0) + fetch(1.0, 1.0)) / 4.0;
+
+	vec3 rgb;
+
+	if (site.x < 0.5 && site.y < 0.5)
+		rgb = vec3(centre, cross, diag);	/* Red */
+	else if (site.x > 0.5 && site.y > 0.5)
+		rgb = vec3(diag, cross, centre);	/* Blue */
+	else if (site.y < 0.5)
+		rgb = vec3(horz, centre, vert);		/* Green on red row */
+	else
+		rgb = vec3(vert, centre, horz);		/* Green on blue row */
+
+	gl_FragColor = vec4(rgb, 1.0);
+}
@@ -7,25 +7,74 @@
 
 #include "format_converter.h"
 
+#include <algorithm>
 #include <errno.h>
 
 #include <QImage>
+#include <QRunnable>
+#include <QThread>
 
 #include <libcamera/formats.h>
 
-#define RGBSHIFT		8
-#ifndef MAX
-#define MAX(a,b)		((a)>(b)?(a):(b))
-#endif
-#ifndef MIN
-#define MIN(a,b)		((a)<(b)?(a):(b))
-#endif
-#ifndef CLAMP
-#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
-#endif
-#ifndef CLIP
-#define CLIP(x)			CLAMP(x,0,255)
-#endif
+#include "format_kernels.h"
+
+/*
+ * Minimum number of lines processed by a conversion task, to avoid splitting
+ * small images in bands that would be dominated by the threading overhead.
+ */
+static constexpr unsigned int kMinLinesPerTask = 32;
+
+class FormatConverter::ConversionTask : public QRunnable
+{
+public:
+	ConversionTask(FormatConverter *converter)
+		: converter_(converter), src_(nullptr), dst_(nullptr),
+		  start_(0), end_(0)
+	{
+		setAutoDelete(false);
+	}
+
+	void setup(const unsigned char *src, unsigned char *dst,
+		   unsigned int start, unsigned int end)
+	{
+		src_ = src;
+		dst_ = dst;
+		start_ = start;
+		end_ = end;
+	}
+
+	void run() override
+	{
+		converter_->convertLines(src_, dst_, start_, end_);
+		converter_->done_.release();
+	}
+
+private:
+	FormatConverter *converter_;
+	const unsigned char *src_;
+	unsigned char *dst_;
+	unsigned int start_;
+	unsigned int end_;
+};
+
+FormatConverter::FormatConverter()
+	: width_(0), height_(0)
+{
+	/*
+	 * The calling thread converts one band of lines, the other bands are
+	 * processed by the thread pool.
+	 */
+	int threads = std::max(QThread::idealThreadCount(), 1);
+	pool_.setMaxThreadCount(std::max(threads - 1, 1));
+
+	for (int i = 0; i < threads - 1; ++i)
+		tasks_.emplace_back(std::make_unique<ConversionTask>(this));
+}
+
+FormatConverter::~FormatConverter()
+{
+	pool_.waitForDone();
+}
 
 int FormatConverter::configure(const libcamera::PixelFormat &format,
 			       const QSize &size)
@@ -136,6 +185,10 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 		formatFamily_ = MJPEG;
 		break;
 
+	/*
+	 * \todo Add Bayer formats, which require a debayering kernel, and
+	 * AVX2 and NEON versions of the SSE2 kernels.
+	 */
 	default:
 		return -EINVAL;
 	};
@@ -150,78 +203,79 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 void FormatConverter::convert(const unsigned char *src, size_t size,
 			      QImage *dst)
 {
-	switch (formatFamily_) {
-	case MJPEG:
+	if (formatFamily_ == MJPEG) {
 		dst->loadFromData(src, size, "JPEG");
-		break;
+		return;
+	}
+
+	/*
+	 * Split the image in bands of lines, convert the first band in the
+	 * calling thread and the other bands in the thread pool, and wait for
+	 * all bands to complete.
+	 */
+	unsigned int bands = std::min<unsigned int>(tasks_.size() + 1,
+						    height_ / kMinLinesPerTask);
+	bands = std::max(bands, 1U);
+
+	unsigned int linesPerBand = (height_ + bands - 1) / bands;
+	unsigned char *bits = dst->bits();
+
+	for (unsigned int i = 1; i < bands; ++i) {
+		unsigned int start = i * linesPerBand;
+		unsigned int end = std::min(start + linesPerBand, height_);
+
+		ConversionTask *task = tasks_[i - 1].get();
+		task->setup(src, bits, start, end);
+		pool_.start(task);
+	}
+
+	convertLines(src, bits, 0, std::min(linesPerBand, height_));
+
+	done_.acquire(bands - 1);
+}
+
+void FormatConverter::convertLines(const unsigned char *src, unsigned char *dst,
+				   unsigned int start, unsigned int end)
+{
+	switch (formatFamily_) {
 	case YUV:
-		convertYUV(src, dst->bits());
+		convertYUV(src, dst, start, end);
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		convertRGB(src, dst, start, end);
 		break;
 	case NV:
-		convertNV(src, dst->bits());
+		convertNV(src, dst, start, end);
+		break;
+	case MJPEG:
 		break;
 	};
 }
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
-{
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
-}
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst,
+				unsigned int start, unsigned int end)
 {
 	unsigned int c_stride = width_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
-	unsigned int cb_pos = nvSwap_ ? 1 : 0;
-	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 	const unsigned char *src_c = src + width_ * height_;
-	int r, g, b;
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
-		}
-	}
+	for (unsigned int y = start; y < end; y++)
+		convertNVLine(src + y * width_,
+			      src_c + (y / vertSubSample_) * c_stride,
+			      dst + y * width_ * 4, width_, horzSubSample_,
+			      nvSwap_);
 }
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst,
+				 unsigned int start, unsigned int end)
 {
 	unsigned int x, y;
 	int r, g, b;
 
-	for (y = 0; y < height_; y++) {
+	src += start * width_ * bpp_;
+	dst += start * width_ * 4;
+
+	for (y = start; y < end; y++) {
 		for (x = 0; x < width_; x++) {
 			r = src[bpp_ * x + r_pos_];
 			g = src[bpp_ * x + g_pos_];
@@ -238,40 +292,13 @@ void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
 	}
 }
 
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst,
+				 unsigned int start, unsigned int end)
 {
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
-		}
-	}
+	unsigned int src_stride = width_ * 2;
+	unsigned int dst_stride = width_ * 4;
+
+	for (unsigned int y = start; y < end; y++)
+		convertYUVLine(src + y * src_stride, dst + y * dst_stride,
+			       width_, y_pos_, cb_pos_);
 }
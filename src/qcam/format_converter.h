@@ -7,9 +7,13 @@
 #ifndef __QCAM_FORMAT_CONVERTER_H__
 #define __QCAM_FORMAT_CONVERTER_H__
 
+#include <memory>
 #include <stddef.h>
+#include <vector>
 
+#include <QSemaphore>
 #include <QSize>
+#include <QThreadPool>
 
 #include <libcamera/pixel_format.h>
 
@@ -18,11 +22,16 @@ class QImage;
 class FormatConverter
 {
 public:
+	FormatConverter();
+	~FormatConverter();
+
 	int configure(const libcamera::PixelFormat &format, const QSize &size);
 
 	void convert(const unsigned char *src, size_t size, QImage *dst);
 
 private:
+	class ConversionTask;
+
 	enum FormatFamily {
 		MJPEG,
 		NV,
@@ -30,9 +39,15 @@ private:
 		YUV,
 	};
 
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	void convertLines(const unsigned char *src, unsigned char *dst,
+			  unsigned int start, unsigned int end);
+
+	void convertNV(const unsigned char *src, unsigned char *dst,
+		       unsigned int start, unsigned int end);
+	void convertRGB(const unsigned char *src, unsigned char *dst,
+			unsigned int start, unsigned int end);
+	void convertYUV(const unsigned char *src, unsigned char *dst,
+			unsigned int start, unsigned int end);
 
 	libcamera::PixelFormat format_;
 	unsigned int width_;
@@ -54,6 +69,11 @@ private:
 	/* YUV parameters */
 	unsigned int y_pos_;
 	unsigned int cb_pos_;
+
+	/* Multi-threaded conversion, split in bands of lines */
+	QThreadPool pool_;
+	QSemaphore done_;
+	std::vector<std::unique_ptr<ConversionTask>> tasks_;
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels.cpp - qcam - Line conversion kernels to XRGB8888
+ */
+
+#include "format_kernels.h"
+
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define RGBSHIFT		8
+#ifndef MAX
+#define MAX(a,b)		((a)>(b)?(a):(b))
+#endif
+#ifndef MIN
+#define MIN(a,b)		((a)<(b)?(a):(b))
+#endif
+#ifndef CLAMP
+#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
+#endif
+#ifndef CLIP
+#define CLIP(x)			CLAMP(x,0,255)
+#endif
+
+static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
+{
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
+	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
+	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
+}
+
+#if defined(__SSE2__)
+/*
+ * Convert 8 pixels to XRGB8888. The luma samples are stored in the 8 16-bit
+ * lanes of \a y, and the 4 pairs of chroma samples in the 16-bit lanes of
+ * \a uv, with the Cb sample first unless \a swap is true. Each chroma pair
+ * applies to two consecutive pixels.
+ *
+ * The computation is identical to yuv_to_rgb(), with 32-bit intermediate
+ * values and saturation performed by the pack instructions.
+ */
+static inline void convert8PixelsSSE2(__m128i y, __m128i uv, bool swap,
+				      unsigned char *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+	const __m128i round = _mm_set1_epi32(128);
+	const __m128i lowMask = _mm_set1_epi32(0xffff);
+
+	/* Coefficients pairs for the _mm_madd_epi16() multiply-adds. */
+	const __m128i coeffR = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+	const __m128i coeffG1 = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+	const __m128i coeffG2 = _mm_setr_epi16(-208, 0, -208, 0, -208, 0, -208, 0);
+	const __m128i coeffB = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	uv = _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+	/* Split the chroma samples and duplicate them for the two pixels. */
+	__m128i u = _mm_and_si128(uv, lowMask);
+	__m128i v = _mm_srli_epi32(uv, 16);
+	if (swap)
+		std::swap(u, v);
+
+	__m128i d = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+	__m128i e = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+	__m128i rgb[2][3];
+	for (unsigned int half = 0; half < 2; ++half) {
+		__m128i ce = half ? _mm_unpackhi_epi16(c, e) : _mm_unpacklo_epi16(c, e);
+		__m128i cd = half ? _mm_unpackhi_epi16(c, d) : _mm_unpacklo_epi16(c, d);
+		__m128i e0 = half ? _mm_unpackhi_epi16(e, zero) : _mm_unpacklo_epi16(e, zero);
+
+		__m128i r = _mm_madd_epi16(ce, coeffR);
+		__m128i g = _mm_add_epi32(_mm_madd_epi16(cd, coeffG1),
+					  _mm_madd_epi16(e0, coeffG2));
+		__m128i b = _mm_madd_epi16(cd, coeffB);
+
+		rgb[half][0] = _mm_srai_epi32(_mm_add_epi32(r, round), RGBSHIFT);
+		rgb[half][1] = _mm_srai_epi32(_mm_add_epi32(g, round), RGBSHIFT);
+		rgb[half][2] = _mm_srai_epi32(_mm_add_epi32(b, round), RGBSHIFT);
+	}
+
+	/* Clamp to [0, 255] and interleave to B, G, R, A. */
+	__m128i r = _mm_packus_epi16(_mm_packs_epi32(rgb[0][0], rgb[1][0]), zero);
+	__m128i g = _mm_packus_epi16(_mm_packs_epi32(rgb[0][1], rgb[1][1]), zero);
+	__m128i b = _mm_packus_epi16(_mm_packs_epi32(rgb[0][2], rgb[1][2]), zero);
+
+	__m128i bg = _mm_unpacklo_epi8(b, g);
+	__m128i ra = _mm_unpacklo_epi8(r, alpha);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+/*
+ * Convert a line of a semi-planar YUV image with horizontally subsampled
+ * chroma. Return the number of pixels converted, the remaining pixels need to
+ * be converted by the caller.
+ */
+static unsigned int convertNVLineSSE2(const unsigned char *src_y,
+				      const unsigned char *src_c,
+				      unsigned char *dst, unsigned int width,
+				      bool swap)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_y + x));
+		__m128i uv = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_c + x));
+
+		convert8PixelsSSE2(_mm_unpacklo_epi8(y, zero),
+				   _mm_unpacklo_epi8(uv, zero), swap,
+				   dst + 4 * x);
+	}
+
+	return x;
+}
+
+/*
+ * Convert a line of a packed YUV 4:2:2 image. The luma samples are stored in
+ * the low (\a yHigh is false) or high byte of each 16-bit word. Return the
+ * number of pixels converted, the remaining pixels need to be converted by
+ * the caller.
+ */
+static unsigned int convertYUVLineSSE2(const unsigned char *src,
+				       unsigned char *dst, unsigned int width,
+				       bool yHigh, bool swap)
+{
+	const __m128i lowMask = _mm_set1_epi16(0xff);
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * x));
+		__m128i low = _mm_and_si128(data, lowMask);
+		__m128i high = _mm_srli_epi16(data, 8);
+
+		convert8PixelsSSE2(yHigh ? high : low, yHigh ? low : high,
+				   swap, dst + 4 * x);
+	}
+
+	return x;
+}
+#endif /* __SSE2__ */
+
+static inline void store_pixel(int y, int u, int v, unsigned char *dst)
+{
+	int r, g, b;
+
+	yuv_to_rgb(y, u, v, &r, &g, &b);
+	dst[0] = b;
+	dst[1] = g;
+	dst[2] = r;
+	dst[3] = 0xff;
+}
+
+void convertNVLine(const unsigned char *src_y, const unsigned char *src_c,
+		   unsigned char *dst, unsigned int width,
+		   unsigned int horzSubSample, bool swap, bool simd)
+{
+	unsigned int cb_pos = swap ? 1 : 0;
+	unsigned int cr_pos = swap ? 0 : 1;
+	unsigned int x = 0;
+
+#if defined(__SSE2__)
+	if (simd && horzSubSample == 2)
+		x = convertNVLineSSE2(src_y, src_c, dst, width, swap);
+#endif
+
+	for (; x < width; x++) {
+		const unsigned char *c = src_c + x / horzSubSample * 2;
+		store_pixel(src_y[x], c[cb_pos], c[cr_pos], dst + 4 * x);
+	}
+}
+
+void convertYUVLine(const unsigned char *src, unsigned char *dst,
+		    unsigned int width, unsigned int y_pos,
+		    unsigned int cb_pos, bool simd)
+{
+	unsigned int cr_pos = (cb_pos + 2) % 4;
+	unsigned int x = 0;
+
+#if defined(__SSE2__)
+	if (simd)
+		x = convertYUVLineSSE2(src, dst, width, y_pos == 1, cb_pos & 2);
+#endif
+
+	for (; x < width; x++) {
+		const unsigned char *group = src + x / 2 * 4;
+		store_pixel(group[y_pos + x % 2 * 2], group[cb_pos],
+			    group[cr_pos], dst + 4 * x);
+	}
+}
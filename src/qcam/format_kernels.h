@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels.h - qcam - Line conversion kernels to XRGB8888
+ */
+#ifndef __QCAM_FORMAT_KERNELS_H__
+#define __QCAM_FORMAT_KERNELS_H__
+
+/*
+ * The kernels convert one line of \a width pixels to XRGB8888. They use SIMD
+ * instructions when available and \a simd is true, and produce bit-exact
+ * results in all cases. Lines don't need to be aligned, and \a width doesn't
+ * need to be a multiple of the SIMD vector size or even.
+ */
+
+/*
+ * Semi-planar YUV, with the interleaved chroma samples of the line in
+ * \a src_c, horizontally subsampled by \a horzSubSample (1 or 2). The Cr
+ * sample comes first when \a swap is true.
+ */
+void convertNVLine(const unsigned char *src_y, const unsigned char *src_c,
+		   unsigned char *dst, unsigned int width,
+		   unsigned int horzSubSample, bool swap, bool simd = true);
+
+/*
+ * Packed YUV 4:2:2, with the first luma and the Cb samples of each 4-byte
+ * group at offsets \a y_pos and \a cb_pos.
+ */
+void convertYUVLine(const unsigned char *src, unsigned char *dst,
+		    unsigned int width, unsigned int y_pos,
+		    unsigned int cb_pos, bool simd = true);
+
+#endif /* __QCAM_FORMAT_KERNELS_H__ */
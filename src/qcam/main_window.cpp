@@ -28,6 +28,10 @@
 #include <libcamera/version.h>
 
 #include "dng_writer.h"
+#ifdef HAVE_QT_OPENGL
+#include "viewfinder_gl.h"
+#endif
+#include "viewfinder_qt.h"
 
 using namespace libcamera;
 
@@ -90,8 +94,8 @@ private:
 };
 
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
-	: saveRaw_(nullptr), options_(options), cm_(cm), allocator_(nullptr),
-	  isCapturing_(false), captureRaw_(false)
+	: saveRaw_(nullptr), viewfinder_(nullptr), options_(options), cm_(cm),
+	  allocator_(nullptr), isCapturing_(false), captureRaw_(false)
 {
 	int ret;
 
@@ -105,10 +109,32 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	setWindowTitle(title_);
 	connect(&titleTimer_, SIGNAL(timeout()), this, SLOT(updateTitle()));
 
-	viewfinder_ = new ViewFinder(this);
-	connect(viewfinder_, &ViewFinder::renderComplete,
-		this, &MainWindow::queueRequest);
-	setCentralWidget(viewfinder_);
+	/* Create the viewfinder widget based on the renderer option. */
+	std::string renderType = "qt";
+	if (options_.isSet(OptRenderer))
+		renderType = options_[OptRenderer].toString();
+
+	if (renderType == "qt") {
+		ViewFinderQt *viewfinder = new ViewFinderQt(this);
+		connect(viewfinder, &ViewFinderQt::renderComplete,
+			this, &MainWindow::queueRequest);
+		viewfinder_ = viewfinder;
+		setCentralWidget(viewfinder);
+#ifdef HAVE_QT_OPENGL
+	} else if (renderType == "gles") {
+		ViewFinderGL *viewfinder = new ViewFinderGL(this);
+		connect(viewfinder, &ViewFinderGL::renderComplete,
+			this, &MainWindow::queueRequest);
+		viewfinder_ = viewfinder;
+		setCentralWidget(viewfinder);
+#endif
+	} else {
+		qWarning() << "Invalid render type"
+			   << QString::fromStdString(renderType);
+		quit();
+		return;
+	}
+
 	adjustSize();
 
 	/* Hotplug/unplug support */
@@ -0,0 +1,583 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.cpp - qcam - OpenGL ES viewfinder with shader-based format
+ * conversion
+ */
+
+#include "viewfinder_gl.h"
+
+#include <errno.h>
+#include <utility>
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtDebug>
+
+#include <libcamera/formats.h>
+
+static const QList<libcamera::PixelFormat> supportedFormats{
+	/* YUV - packed (single plane) */
+	libcamera::formats::UYVY,
+	libcamera::formats::VYUY,
+	libcamera::formats::YUYV,
+	libcamera::formats::YVYU,
+	/* YUV - semi planar (two planes) */
+	libcamera::formats::NV12,
+	libcamera::formats::NV21,
+	libcamera::formats::NV16,
+	libcamera::formats::NV61,
+	libcamera::formats::NV24,
+	libcamera::formats::NV42,
+	/* YUV - fully planar (three planes) */
+	libcamera::formats::YUV420,
+	libcamera::formats::YVU420,
+	/* Raw Bayer 8-bit */
+	libcamera::formats::SBGGR8,
+	libcamera::formats::SGBRG8,
+	libcamera::formats::SGRBG8,
+	libcamera::formats::SRGGB8,
+};
+
+ViewFinderGL::ViewFinderGL(QWidget *parent)
+	: QOpenGLWidget(parent), buffer_(nullptr), data_(nullptr),
+	  vertexShaderFile_(":identity.vert"),
+	  vertexBuffer_(QOpenGLBuffer::VertexBuffer),
+	  textureMinMagFilters_(GL_LINEAR), horzSubSample_(1),
+	  vertSubSample_(1)
+{
+}
+
+ViewFinderGL::~ViewFinderGL()
+{
+	/* Release the OpenGL resources with the widget context current. */
+	makeCurrent();
+
+	removeShader();
+
+	for (std::unique_ptr<QOpenGLTexture> &texture : textures_)
+		texture.reset();
+
+	vertexBuffer_.destroy();
+
+	doneCurrent();
+}
+
+const QList<libcamera::PixelFormat> &ViewFinderGL::nativeFormats() const
+{
+	return supportedFormats;
+}
+
+int ViewFinderGL::setFormat(const libcamera::PixelFormat &format,
+			    const QSize &size)
+{
+	/*
+	 * If a fragment shader has been created for a previous format, remove
+	 * it. The shader for the new format will be created when the next
+	 * frame is painted, as a valid OpenGL context is required.
+	 */
+	if (fragmentShader_) {
+		makeCurrent();
+
+		if (shaderProgram_.isLinked()) {
+			shaderProgram_.release();
+			shaderProgram_.removeShader(fragmentShader_.get());
+		}
+
+		fragmentShader_.reset();
+
+		doneCurrent();
+	}
+
+	if (!selectFormat(format))
+		return -EINVAL;
+
+	format_ = format;
+	size_ = size;
+
+	qInfo() << "Using OpenGL format conversion from"
+		<< format.toString().c_str();
+
+	updateGeometry();
+	return 0;
+}
+
+void ViewFinderGL::render(libcamera::FrameBuffer *buffer, MappedBuffer *map)
+{
+	if (buffer->planes().size() != 1) {
+		qWarning() << "Multi-planar buffers are not supported";
+		return;
+	}
+
+	/*
+	 * The textures are uploaded directly from the mapped frame buffer
+	 * when the widget is painted. Keep a reference to the frame buffer
+	 * until the next frame is rendered, and release the previous one.
+	 */
+	{
+		QMutexLocker locker(&mutex_);
+
+		data_ = static_cast<unsigned char *>(map->memory);
+		std::swap(buffer, buffer_);
+	}
+
+	update();
+
+	if (buffer)
+		renderComplete(buffer);
+}
+
+void ViewFinderGL::stop()
+{
+	libcamera::FrameBuffer *buffer = nullptr;
+
+	{
+		QMutexLocker locker(&mutex_);
+
+		data_ = nullptr;
+		std::swap(buffer, buffer_);
+	}
+
+	if (buffer)
+		renderComplete(buffer);
+
+	update();
+}
+
+QImage ViewFinderGL::getCurrentImage()
+{
+	/*
+	 * Grabbing the frame buffer renders the widget through paintGL(),
+	 * which takes the lock.
+	 */
+	return grabFramebuffer();
+}
+
+bool ViewFinderGL::selectFormat(const libcamera::PixelFormat &format)
+{
+	fragmentShaderDefines_.clear();
+	textureMinMagFilters_ = GL_LINEAR;
+	horzSubSample_ = 1;
+	vertSubSample_ = 1;
+
+	switch (format) {
+	case libcamera::formats::NV12:
+		horzSubSample_ = 2;
+		vertSubSample_ = 2;
+		fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::NV21:
+		horzSubSample_ = 2;
+		vertSubSample_ = 2;
+		fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::NV16:
+		horzSubSample_ = 2;
+		vertSubSample_ = 1;
+		fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::NV61:
+		horzSubSample_ = 2;
+		vertSubSample_ = 1;
+		fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::NV24:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::NV42:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+		fragmentShaderFile_ = ":YUV_2_planes.frag";
+		break;
+	case libcamera::formats::YUV420:
+	case libcamera::formats::YVU420:
+		horzSubSample_ = 2;
+		vertSubSample_ = 2;
+		fragmentShaderFile_ = ":YUV_3_planes.frag";
+		break;
+	case libcamera::formats::UYVY:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_UYVY");
+		fragmentShaderFile_ = ":YUV_packed.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::VYUY:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_VYUY");
+		fragmentShaderFile_ = ":YUV_packed.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::YUYV:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_YUYV");
+		fragmentShaderFile_ = ":YUV_packed.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::YVYU:
+		fragmentShaderDefines_.append("#define YUV_PATTERN_YVYU");
+		fragmentShaderFile_ = ":YUV_packed.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SBGGR8:
+		firstRed_ = QPointF(1.0, 1.0);
+		fragmentShaderFile_ = ":bayer_8.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGBRG8:
+		firstRed_ = QPointF(0.0, 1.0);
+		fragmentShaderFile_ = ":bayer_8.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGRBG8:
+		firstRed_ = QPointF(1.0, 0.0);
+		fragmentShaderFile_ = ":bayer_8.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SRGGB8:
+		firstRed_ = QPointF(0.0, 0.0);
+		fragmentShaderFile_ = ":bayer_8.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	default:
+		qWarning() << "Format" << format.toString().c_str()
+			   << "not supported by the OpenGL viewfinder";
+		return false;
+	};
+
+	return true;
+}
+
+bool ViewFinderGL::createVertexShader()
+{
+	/* Create Vertex Shader */
+	vertexShader_ = std::make_unique<QOpenGLShader>(QOpenGLShader::Vertex);
+
+	/* Compile the vertex shader */
+	if (!vertexShader_->compileSourceFile(vertexShaderFile_)) {
+		qWarning() << "[ViewFinderGL]:" << vertexShader_->log();
+		return false;
+	}
+
+	shaderProgram_.addShader(vertexShader_.get());
+	return true;
+}
+
+bool ViewFinderGL::createFragmentShader()
+{
+	int attributeVertex;
+	int attributeTexture;
+
+	/*
+	 * Create the fragment shader, prepending the format-specific defines
+	 * to the shader source code.
+	 */
+	QFile file(fragmentShaderFile_);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qWarning() << "Shader" << fragmentShaderFile_ << "not found";
+		return false;
+	}
+
+	QString defines = fragmentShaderDefines_.join('\n') + "\n";
+	QByteArray src = file.readAll();
+	src.prepend(defines.toUtf8());
+
+	fragmentShader_ = std::make_unique<QOpenGLShader>(QOpenGLShader::Fragment);
+
+	/* Compile the fragment shader */
+	if (!fragmentShader_->compileSourceCode(src)) {
+		qWarning() << "[ViewFinderGL]:" << fragmentShader_->log();
+		return false;
+	}
+
+	shaderProgram_.addShader(fragmentShader_.get());
+
+	/* Link shader pipeline */
+	if (!shaderProgram_.link()) {
+		qWarning() << "[ViewFinderGL]:" << shaderProgram_.log();
+		return false;
+	}
+
+	/* Bind shader pipeline for use */
+	if (!shaderProgram_.bind()) {
+		qWarning() << "[ViewFinderGL]:" << shaderProgram_.log();
+		return false;
+	}
+
+	vertexBuffer_.bind();
+
+	attributeVertex = shaderProgram_.attributeLocation("vertexIn");
+	attributeTexture = shaderProgram_.attributeLocation("textureIn");
+
+	shaderProgram_.enableAttributeArray(attributeVertex);
+	shaderProgram_.setAttributeBuffer(attributeVertex,
+					  GL_FLOAT,
+					  0,
+					  2,
+					  2 * sizeof(GLfloat));
+
+	shaderProgram_.enableAttributeArray(attributeTexture);
+	shaderProgram_.setAttributeBuffer(attributeTexture,
+					  GL_FLOAT,
+					  8 * sizeof(GLfloat),
+					  2,
+					  2 * sizeof(GLfloat));
+
+	textureUniformY_ = shaderProgram_.uniformLocation("tex_y");
+	textureUniformU_ = shaderProgram_.uniformLocation("tex_u");
+	textureUniformV_ = shaderProgram_.uniformLocation("tex_v");
+	textureUniformStep_ = shaderProgram_.uniformLocation("tex_step");
+	textureUniformBayerFirstRed_ = shaderProgram_.uniformLocation("tex_bayer_first_red");
+
+	/* Create the textures. */
+	for (std::unique_ptr<QOpenGLTexture> &texture : textures_) {
+		if (texture)
+			continue;
+
+		texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+		texture->create();
+	}
+
+	return true;
+}
+
+void ViewFinderGL::configureTexture(QOpenGLTexture &texture)
+{
+	glBindTexture(GL_TEXTURE_2D, texture.textureId());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			textureMinMagFilters_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+			textureMinMagFilters_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void ViewFinderGL::removeShader()
+{
+	if (shaderProgram_.isLinked()) {
+		shaderProgram_.release();
+		shaderProgram_.removeAllShaders();
+	}
+}
+
+void ViewFinderGL::initializeGL()
+{
+	initializeOpenGLFunctions();
+
+	/*
+	 * Vertex and texture coordinates of the quad covering the whole
+	 * viewport. The texture is flipped vertically as frame buffers store
+	 * the top line first.
+	 */
+	static const GLfloat coordinates[2][4][2]{
+		{
+			/* Vertex coordinates */
+			{ -1.0f, -1.0f },
+			{ -1.0f, +1.0f },
+			{ +1.0f, +1.0f },
+			{ +1.0f, -1.0f },
+		},
+		{
+			/* Texture coordinates */
+			{ 0.0f, 1.0f },
+			{ 0.0f, 0.0f },
+			{ 1.0f, 0.0f },
+			{ 1.0f, 1.0f },
+		},
+	};
+
+	vertexBuffer_.create();
+	vertexBuffer_.bind();
+	vertexBuffer_.allocate(coordinates, sizeof(coordinates));
+
+	/* Create Vertex Shader */
+	if (!createVertexShader())
+		qWarning() << "[ViewFinderGL]: create vertex shader failed.";
+
+	/* Texture rows are tightly packed. */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+}
+
+void ViewFinderGL::doRender()
+{
+	/*
+	 * \todo Get the stride from the buffer instead of assuming tightly
+	 * packed lines.
+	 */
+	switch (format_) {
+	case libcamera::formats::NV12:
+	case libcamera::formats::NV21:
+	case libcamera::formats::NV16:
+	case libcamera::formats::NV61:
+	case libcamera::formats::NV24:
+	case libcamera::formats::NV42:
+		/* Activate texture Y */
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     size_.width(),
+			     size_.height(),
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     data_);
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+
+		/* Activate texture UV/VU */
+		glActiveTexture(GL_TEXTURE1);
+		configureTexture(*textures_[1]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE_ALPHA,
+			     size_.width() / horzSubSample_,
+			     size_.height() / vertSubSample_,
+			     0,
+			     GL_LUMINANCE_ALPHA,
+			     GL_UNSIGNED_BYTE,
+			     data_ + size_.width() * size_.height());
+		shaderProgram_.setUniformValue(textureUniformU_, 1);
+		break;
+
+	case libcamera::formats::YUV420:
+	case libcamera::formats::YVU420: {
+		unsigned int lumaSize = size_.width() * size_.height();
+		unsigned int chromaSize = lumaSize / (horzSubSample_ * vertSubSample_);
+		bool swap = format_ == libcamera::formats::YVU420;
+
+		/* Activate texture Y */
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     size_.width(),
+			     size_.height(),
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     data_);
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+
+		/* Activate texture U */
+		glActiveTexture(GL_TEXTURE1);
+		configureTexture(*textures_[1]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     size_.width() / horzSubSample_,
+			     size_.height() / vertSubSample_,
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     data_ + lumaSize + (swap ? chromaSize : 0));
+		shaderProgram_.setUniformValue(textureUniformU_, 1);
+
+		/* Activate texture V */
+		glActiveTexture(GL_TEXTURE2);
+		configureTexture(*textures_[2]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     size_.width() / horzSubSample_,
+			     size_.height() / vertSubSample_,
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     data_ + lumaSize + (swap ? 0 : chromaSize));
+		shaderProgram_.setUniformValue(textureUniformV_, 2);
+		break;
+	}
+
+	case libcamera::formats::UYVY:
+	case libcamera::formats::VYUY:
+	case libcamera::formats::YUYV:
+	case libcamera::formats::YVYU:
+		/*
+		 * Packed YUV formats are stored in an RGBA texture to match
+		 * the pixel layout, with two pixels stored in each texel.
+		 */
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_RGBA,
+			     size_.width() / 2,
+			     size_.height(),
+			     0,
+			     GL_RGBA,
+			     GL_UNSIGNED_BYTE,
+			     data_);
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		shaderProgram_.setUniformValue(textureUniformStep_,
+					       1.0f / size_.width(),
+					       1.0f / size_.height());
+		break;
+
+	case libcamera::formats::SBGGR8:
+	case libcamera::formats::SGBRG8:
+	case libcamera::formats::SGRBG8:
+	case libcamera::formats::SRGGB8:
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     size_.width(),
+			     size_.height(),
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     data_);
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		shaderProgram_.setUniformValue(textureUniformStep_,
+					       1.0f / size_.width(),
+					       1.0f / size_.height());
+		shaderProgram_.setUniformValue(textureUniformBayerFirstRed_,
+					       firstRed_);
+		break;
+
+	default:
+		break;
+	};
+}
+
+void ViewFinderGL::paintGL()
+{
+	if (!fragmentShader_ && !fragmentShaderFile_.isEmpty()) {
+		if (!createFragmentShader()) {
+			qWarning() << "[ViewFinderGL]:"
+				   << "create fragment shader failed.";
+
+			/* Don't retry until a new format is set. */
+			shaderProgram_.removeShader(fragmentShader_.get());
+			fragmentShader_.reset();
+			fragmentShaderFile_.clear();
+			return;
+		}
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	QMutexLocker locker(&mutex_);
+
+	if (data_ && fragmentShader_) {
+		doRender();
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	}
+}
+
+void ViewFinderGL::resizeGL(int w, int h)
+{
+	glViewport(0, 0, w, h);
+}
+
+QSize ViewFinderGL::sizeHint() const
+{
+	return size_.isValid() ? size_ : QSize(640, 480);
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.h - qcam - OpenGL ES viewfinder with shader-based format
+ * conversion
+ */
+#ifndef __QCAM_VIEWFINDER_GL_H__
+#define __QCAM_VIEWFINDER_GL_H__
+
+#include <array>
+#include <memory>
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QOpenGLShader>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLWidget>
+#include <QPointF>
+#include <QSize>
+#include <QStringList>
+
+#include <libcamera/buffer.h>
+#include <libcamera/pixel_format.h>
+
+#include "viewfinder.h"
+
+class ViewFinderGL : public QOpenGLWidget,
+		     public ViewFinder,
+		     protected QOpenGLFunctions
+{
+	Q_OBJECT
+
+public:
+	ViewFinderGL(QWidget *parent = nullptr);
+	~ViewFinderGL();
+
+	const QList<libcamera::PixelFormat> &nativeFormats() const override;
+
+	int setFormat(const libcamera::PixelFormat &format, const QSize &size) override;
+	void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) override;
+	void stop() override;
+
+	QImage getCurrentImage() override;
+
+Q_SIGNALS:
+	void renderComplete(libcamera::FrameBuffer *buffer);
+
+protected:
+	void initializeGL() override;
+	void paintGL() override;
+	void resizeGL(int w, int h) override;
+	QSize sizeHint() const override;
+
+private:
+	bool selectFormat(const libcamera::PixelFormat &format);
+
+	void configureTexture(QOpenGLTexture &texture);
+	bool createFragmentShader();
+	bool createVertexShader();
+	void removeShader();
+	void doRender();
+
+	/* Captured image size, format and buffer */
+	libcamera::FrameBuffer *buffer_;
+	libcamera::PixelFormat format_;
+	QSize size_;
+	unsigned char *data_;
+
+	/* Shaders */
+	QOpenGLShaderProgram shaderProgram_;
+	std::unique_ptr<QOpenGLShader> vertexShader_;
+	std::unique_ptr<QOpenGLShader> fragmentShader_;
+	QString vertexShaderFile_;
+	QString fragmentShaderFile_;
+	QStringList fragmentShaderDefines_;
+
+	/* Vertex buffer */
+	QOpenGLBuffer vertexBuffer_;
+
+	/* Textures */
+	std::array<std::unique_ptr<QOpenGLTexture>, 3> textures_;
+	GLint textureMinMagFilters_;
+
+	/* Common texture parameters */
+	GLuint textureUniformY_;
+	GLuint textureUniformU_;
+	GLuint textureUniformV_;
+	GLuint textureUniformStep_;
+
+	/* YUV texture parameters */
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+
+	/* Raw Bayer texture parameters */
+	GLuint textureUniformBayerFirstRed_;
+	QPointF firstRed_;
+
+	QMutex mutex_; /* Prevent concurrent access to data_ and buffer_ */
+};
+
+#endif /* __QCAM_VIEWFINDER_GL_H__ */
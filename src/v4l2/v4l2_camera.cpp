@@ -7,118 +7,320 @@
 
 #include "v4l2_camera.h"
 
+#include <algorithm>
+#include <array>
 #include <errno.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
 #include "libcamera/internal/log.h"
 
+#include "v4l2_compat_manager.h"
+
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat);
 
+namespace {
+
+/*
+ * Roles of the streams exposed by the camera, in the order of their V4L2
+ * nodes. The first node keeps the behaviour of the single stream camera.
+ */
+const std::array<StreamRole, 3> streamRoles = {
+	StreamRole::Viewfinder,
+	StreamRole::StillCapture,
+	StreamRole::VideoRecording,
+};
+
+/*
+ * Maximum number of completed buffers queued to an observer. Older buffers
+ * are dropped when observers don't keep up with the frame rate.
+ */
+constexpr unsigned int observerQueueDepth = 2;
+
+void signalEventfd(int efd)
+{
+	uint64_t value = 1;
+	int ret = ::write(efd, &value, sizeof(value));
+	if (ret != sizeof(value))
+		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+}
+
+/*
+ * read() is intercepted by the compatibility layer, call the C library
+ * directly.
+ */
+void clearEventfd(int efd)
+{
+	uint64_t value;
+	int ret = V4L2CompatManager::instance()->fops().read(efd, &value,
+							     sizeof(value));
+	if (ret != sizeof(value))
+		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+}
+
+} /* namespace */
+
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
-	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr),
-	  efd_(-1), bufferAvailableCount_(0)
+	: camera_(camera), refcount_(0), isRunning_(false),
+	  bufferAllocator_(nullptr)
 {
+	/*
+	 * Expose as many streams as the camera can capture concurrently, up to
+	 * the number of roles we know how to map to nodes.
+	 */
+	unsigned int count = std::min<size_t>(camera_->streams().size(),
+					      streamRoles.size());
+	for (; count > 1; count--) {
+		StreamRoles roles(streamRoles.begin(), streamRoles.begin() + count);
+		if (camera_->generateConfiguration(roles))
+			break;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ streamRoles[i] });
+		if (!config)
+			break;
+
+		streams_.push_back(std::make_unique<StreamData>(streamRoles[i]));
+		streams_.back()->config = config->at(0);
+	}
+
 	camera_->requestCompleted.connect(this, &V4L2Camera::requestComplete);
 }
 
 V4L2Camera::~V4L2Camera()
 {
-	close();
+	for (unsigned int i = 0; i < streams_.size(); i++)
+		close(i);
+
+	camera_->requestCompleted.disconnect(this, &V4L2Camera::requestComplete);
 }
 
-int V4L2Camera::open()
+/*
+ * The camera is acquired when the first stream is opened, and released when
+ * the last one is closed.
+ */
+int V4L2Camera::open(unsigned int stream)
 {
-	if (camera_->acquire() < 0) {
-		LOG(V4L2Compat, Error) << "Failed to acquire camera";
-		return -EINVAL;
-	}
+	MutexLocker locker(mutex_);
 
-	config_ = camera_->generateConfiguration({ StreamRole::Viewfinder });
-	if (!config_) {
-		camera_->release();
+	if (stream >= streams_.size())
 		return -EINVAL;
+
+	StreamData *data = streams_[stream].get();
+	if (data->open)
+		return 0;
+
+	if (!refcount_) {
+		if (camera_->acquire() < 0) {
+			LOG(V4L2Compat, Error) << "Failed to acquire camera";
+			return -EINVAL;
+		}
+
+		bufferAllocator_ = new FrameBufferAllocator(camera_);
 	}
 
-	bufferAllocator_ = new FrameBufferAllocator(camera_);
+	refcount_++;
+	data->open = true;
 
 	return 0;
 }
 
-void V4L2Camera::close()
+void V4L2Camera::close(unsigned int stream)
 {
+	StreamData *data = streams_[stream].get();
+
+	streamOff(stream);
+
+	MutexLocker locker(mutex_);
+
+	if (!data->open)
+		return;
+
+	releaseBuffers(data);
+	data->open = false;
+
+	if (--refcount_)
+		return;
+
 	delete bufferAllocator_;
 	bufferAllocator_ = nullptr;
 
+	config_.reset();
+	for (std::unique_ptr<StreamData> &s : streams_)
+		s->stream = nullptr;
+
 	camera_->release();
 }
 
-void V4L2Camera::bind(int efd)
+void V4L2Camera::bind(unsigned int stream, int efd)
 {
-	efd_ = efd;
+	streams_[stream]->efd = efd;
 }
 
-void V4L2Camera::unbind()
+void V4L2Camera::unbind(unsigned int stream)
 {
-	efd_ = -1;
+	streams_[stream]->efd = -1;
 }
 
-void V4L2Camera::getStreamConfig(StreamConfiguration *streamConfig)
+void V4L2Camera::getStreamConfig(unsigned int stream,
+				 StreamConfiguration *streamConfig)
 {
-	*streamConfig = config_->at(0);
+	MutexLocker locker(mutex_);
+
+	*streamConfig = streams_[stream]->config;
 }
 
-std::vector<V4L2Camera::Buffer> V4L2Camera::completedBuffers()
+/*
+ * Retrieve the index of the next completed buffer of \a stream, in completion
+ * order. Return false if no buffer has completed.
+ */
+bool V4L2Camera::nextCompletedBuffer(unsigned int stream, unsigned int *index)
 {
-	std::vector<Buffer> v;
+	StreamData *data = streams_[stream].get();
+
+	unsigned int tail = data->completedTail.load(std::memory_order_relaxed);
+	if (tail == data->completedHead.load(std::memory_order_acquire))
+		return false;
 
-	bufferLock_.lock();
-	for (std::unique_ptr<Buffer> &metadata : completedBuffers_)
-		v.push_back(*metadata.get());
-	completedBuffers_.clear();
-	bufferLock_.unlock();
+	*index = data->completed[tail & (data->completed.size() - 1)];
+	data->completedTail.store(tail + 1, std::memory_order_release);
 
-	return v;
+	return true;
 }
 
-void V4L2Camera::requestComplete(Request *request)
+/*
+ * The metadata stays valid until the buffer is queued again, which can only
+ * happen after it has been retrieved with nextCompletedBuffer().
+ */
+const FrameMetadata &V4L2Camera::bufferMetadata(unsigned int stream,
+						unsigned int index)
 {
-	if (request->status() == Request::RequestCancelled)
-		return;
+	return streams_[stream]->buffers[index]->metadata();
+}
 
-	/* We only have one stream at the moment. */
-	bufferLock_.lock();
-	FrameBuffer *buffer = request->buffers().begin()->second;
-	std::unique_ptr<Buffer> metadata =
-		std::make_unique<Buffer>(request->cookie(), buffer->metadata());
-	completedBuffers_.push_back(std::move(metadata));
-	bufferLock_.unlock();
-
-	uint64_t data = 1;
-	int ret = ::write(efd_, &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+void V4L2Camera::requestComplete(Request *request)
+{
+	/* Requests carry the stream index and the buffer index. */
+	StreamData *data = streams_[request->cookie() >> 32].get();
+	unsigned int index = request->cookie() & 0xffffffff;
+
+	/*
+	 * Buffers of a stream that has been stopped while the camera keeps
+	 * running for other streams are returned by streamOff(). A buffer
+	 * completed concurrently with streamOff() is discarded there, as it
+	 * waits for queuedCount to drop to zero before flushing the ring.
+	 */
+	bool completed = data->isRunning &&
+			 request->status() != Request::RequestCancelled;
+
+	/*
+	 * Publish the buffer to the owner without taking the lock, the lock
+	 * is only needed to wake up blocked waiters and feed the observers.
+	 */
+	if (completed) {
+		unsigned int head = data->completedHead.load(std::memory_order_relaxed);
+		data->completed[head & (data->completed.size() - 1)] = index;
+		data->completedHead.store(head + 1, std::memory_order_release);
+
+		data->bufferAvailableCount++;
+		signalEventfd(data->efd);
+	}
 
 	{
 		MutexLocker locker(bufferMutex_);
-		bufferAvailableCount_++;
+
+		data->queuedCount--;
+
+		if (completed) {
+			for (auto &it : data->observers) {
+				Observer &observer = it.second;
+
+				if (observer.queue.size() >= observerQueueDepth)
+					dropObserverBuffer(&observer, observer.queue.front());
+
+				observer.queue.push_back(index);
+				signalEventfd(observer.efd);
+			}
+		}
 	}
+
 	bufferCV_.notify_all();
 }
 
-int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
+/*
+ * All the open streams are part of the camera configuration. Configuring a
+ * stream thus reconfigures the camera, which isn't possible once another
+ * stream has buffers. Nodes shall therefore all be opened, and their formats
+ * set, before buffers are requested on any of them.
+ */
+int V4L2Camera::configure(unsigned int stream,
+			  StreamConfiguration *streamConfigOut,
 			  const Size &size, const PixelFormat &pixelformat,
 			  unsigned int bufferCount)
 {
-	StreamConfiguration &streamConfig = config_->at(0);
-	streamConfig.size.width = size.width;
-	streamConfig.size.height = size.height;
-	streamConfig.pixelFormat = pixelformat;
-	streamConfig.bufferCount = bufferCount;
-	/* \todo memoryType (interval vs external) */
+	MutexLocker locker(mutex_);
+
+	StreamData *data = streams_[stream].get();
+
+	if (isRunning_)
+		return -EBUSY;
+
+	/*
+	 * Don't reconfigure the camera if the stream already has the requested
+	 * format, to let the nodes of the other streams allocate buffers in
+	 * turn. The buffer count is a hint only and is ignored here.
+	 */
+	if (data->stream && data->config.size == size &&
+	    data->config.pixelFormat == pixelformat) {
+		*streamConfigOut = data->config;
+		return 0;
+	}
 
-	CameraConfiguration::Status validation = config_->validate();
+	for (const std::unique_ptr<StreamData> &other : streams_) {
+		if (other.get() != data && other->allocated) {
+			LOG(V4L2Compat, Debug)
+				<< "Can't reconfigure camera, another stream has buffers";
+			return -EBUSY;
+		}
+	}
+
+	StreamRoles roles;
+	std::vector<StreamData *> active;
+	for (const std::unique_ptr<StreamData> &s : streams_) {
+		if (!s->open)
+			continue;
+
+		roles.push_back(s->role);
+		active.push_back(s.get());
+	}
+
+	std::unique_ptr<CameraConfiguration> config =
+		camera_->generateConfiguration(roles);
+	if (!config)
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < active.size(); i++) {
+		StreamConfiguration &streamConfig = config->at(i);
+
+		if (active[i] == data) {
+			streamConfig.size = size;
+			streamConfig.pixelFormat = pixelformat;
+			streamConfig.bufferCount = bufferCount;
+		} else {
+			streamConfig.size = active[i]->config.size;
+			streamConfig.pixelFormat = active[i]->config.pixelFormat;
+			streamConfig.bufferCount = active[i]->config.bufferCount;
+		}
+		/* \todo memoryType (interval vs external) */
+	}
+
+	CameraConfiguration::Status validation = config->validate();
 	if (validation == CameraConfiguration::Invalid) {
 		LOG(V4L2Compat, Debug) << "Configuration invalid";
 		return -EINVAL;
@@ -126,24 +328,39 @@ int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
 	if (validation == CameraConfiguration::Adjusted)
 		LOG(V4L2Compat, Debug) << "Configuration adjusted";
 
-	LOG(V4L2Compat, Debug) << "Validated configuration is: "
-			      << streamConfig.toString();
+	for (const StreamConfiguration &streamConfig : *config)
+		LOG(V4L2Compat, Debug) << "Validated configuration is: "
+				       << streamConfig.toString();
 
-	int ret = camera_->configure(config_.get());
+	int ret = camera_->configure(config.get());
 	if (ret < 0)
 		return ret;
 
-	*streamConfigOut = config_->at(0);
+	for (std::unique_ptr<StreamData> &s : streams_)
+		s->stream = nullptr;
+
+	for (unsigned int i = 0; i < active.size(); i++) {
+		active[i]->config = config->at(i);
+		active[i]->stream = config->at(i).stream();
+	}
+
+	config_ = std::move(config);
+
+	*streamConfigOut = data->config;
 
 	return 0;
 }
 
-int V4L2Camera::validateConfiguration(const PixelFormat &pixelFormat,
+int V4L2Camera::validateConfiguration(unsigned int stream,
+				      const PixelFormat &pixelFormat,
 				      const Size &size,
 				      StreamConfiguration *streamConfigOut)
 {
 	std::unique_ptr<CameraConfiguration> config =
-		camera_->generateConfiguration({ StreamRole::Viewfinder });
+		camera_->generateConfiguration({ streams_[stream]->role });
+	if (!config)
+		return -EINVAL;
+
 	StreamConfiguration &cfg = config->at(0);
 	cfg.size = size;
 	cfg.pixelFormat = pixelFormat;
@@ -158,100 +375,340 @@ int V4L2Camera::validateConfiguration(const PixelFormat &pixelFormat,
 	return 0;
 }
 
-int V4L2Camera::allocBuffers(unsigned int count)
+int V4L2Camera::allocBuffers(unsigned int stream, unsigned int count)
 {
-	Stream *stream = config_->at(0).stream();
+	MutexLocker locker(mutex_);
 
-	return bufferAllocator_->allocate(stream);
+	StreamData *data = streams_[stream].get();
+
+	int ret = bufferAllocator_->allocate(data->stream);
+	if (ret < 0)
+		return ret;
+
+	data->allocated = true;
+
+	/*
+	 * Keep a copy of the buffer pointers, as the allocator is shared with
+	 * the other streams and can't be accessed without the lock.
+	 */
+	data->buffers.clear();
+	for (const std::unique_ptr<FrameBuffer> &buffer :
+	     bufferAllocator_->buffers(data->stream))
+		data->buffers.push_back(buffer.get());
+
+	return createRequests(stream, count);
 }
 
-void V4L2Camera::freeBuffers()
+/*
+ * Prepare \a count slots for buffers provided by the application through
+ * importBuffer(), for the V4L2_MEMORY_DMABUF memory type.
+ */
+int V4L2Camera::importBuffers(unsigned int stream, unsigned int count)
 {
-	pendingRequests_.clear();
+	MutexLocker locker(mutex_);
+
+	StreamData *data = streams_[stream].get();
 
-	Stream *stream = config_->at(0).stream();
-	bufferAllocator_->free(stream);
+	data->importedBuffers.clear();
+	data->importedBuffers.resize(count);
+	data->buffers.assign(count, nullptr);
+	data->allocated = true;
+
+	return createRequests(stream, count);
 }
 
-FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
+/*
+ * Wrap the dmabuf \a fd as the FrameBuffer for slot \a index. Applications
+ * usually cycle through the same set of dmabufs, so the FrameBuffer is reused
+ * when the same dmabuf is queued again for the same index, to avoid
+ * remapping it in the pipeline handler.
+ *
+ * The dmabuf is identified by its inode, which is only unique for kernels that
+ * give dmabufs a file system of their own (v5.3 and newer). Older kernels
+ * create all dmabufs on a single anonymous inode, the buffer is then wrapped
+ * again every time it is queued.
+ */
+int V4L2Camera::importBuffer(unsigned int stream, unsigned int index, int fd,
+			     unsigned int length)
 {
-	Stream *stream = config_->at(0).stream();
-	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
-		bufferAllocator_->buffers(stream);
+	StreamData *data = streams_[stream].get();
 
-	if (buffers.size() <= index)
+	if (index >= data->importedBuffers.size())
+		return -EINVAL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int ret = -errno;
+		LOG(V4L2Compat, Error) << "Invalid dmabuf fd " << fd;
+		return ret;
+	}
+
+	struct statfs sfs;
+	bool unique = !fstatfs(fd, &sfs) && sfs.f_type == DMA_BUF_MAGIC;
+
+	ImportedBuffer &imported = data->importedBuffers[index];
+	if (unique && imported.buffer && imported.fd == fd &&
+	    imported.dev == st.st_dev && imported.ino == st.st_ino)
+		return 0;
+
+	std::vector<FrameBuffer::Plane> planes(1);
+	planes[0].fd = FileDescriptor(fd);
+	planes[0].length = length;
+	if (!planes[0].fd.isValid())
+		return -EINVAL;
+
+	imported.buffer = std::make_unique<FrameBuffer>(planes);
+	imported.fd = fd;
+	imported.dev = st.st_dev;
+	imported.ino = st.st_ino;
+
+	data->buffers[index] = imported.buffer.get();
+
+	return 0;
+}
+
+void V4L2Camera::freeBuffers(unsigned int stream)
+{
+	MutexLocker locker(mutex_);
+
+	releaseBuffers(streams_[stream].get());
+}
+
+void V4L2Camera::releaseBuffers(StreamData *data)
+{
+	{
+		MutexLocker locker(bufferMutex_);
+
+		for (auto &it : data->observers) {
+			for (unsigned int i = 0; i < it.second.queue.size(); i++)
+				clearEventfd(it.first);
+		}
+
+		data->observers.clear();
+	}
+	bufferCV_.notify_all();
+
+	data->pendingRequests.clear();
+	data->requests.clear();
+	data->completed.clear();
+	data->buffers.clear();
+	data->importedBuffers.clear();
+
+	if (data->allocated && data->stream)
+		bufferAllocator_->free(data->stream);
+
+	data->allocated = false;
+}
+
+FileDescriptor V4L2Camera::getBufferFd(unsigned int stream, unsigned int index)
+{
+	StreamData *data = streams_[stream].get();
+
+	if (data->buffers.size() <= index || !data->buffers[index])
 		return FileDescriptor();
 
-	return buffers[index]->planes()[0].fd;
+	return data->buffers[index]->planes()[0].fd;
 }
 
-int V4L2Camera::streamOn()
+/*
+ * The camera is started with the first stream, and stopped with the last one.
+ */
+int V4L2Camera::streamOn(unsigned int stream)
 {
-	if (isRunning_)
+	MutexLocker locker(mutex_);
+
+	StreamData *data = streams_[stream].get();
+	if (data->isRunning)
 		return 0;
 
-	int ret = camera_->start();
-	if (ret < 0)
-		return ret == -EACCES ? -EBUSY : ret;
+	int ret;
 
-	isRunning_ = true;
+	if (!isRunning_) {
+		ret = camera_->start();
+		if (ret < 0)
+			return ret == -EACCES ? -EBUSY : ret;
+
+		isRunning_ = true;
+	}
+
+	{
+		MutexLocker bufferLocker(bufferMutex_);
+		data->isRunning = true;
+	}
+
+	for (Request *req : data->pendingRequests) {
+		data->queuedCount++;
 
-	for (std::unique_ptr<Request> &req : pendingRequests_) {
 		/* \todo What should we do if this returns -EINVAL? */
-		ret = camera_->queueRequest(req.release());
-		if (ret < 0)
+		ret = camera_->queueRequest(req);
+		if (ret < 0) {
+			data->queuedCount--;
 			return ret == -EACCES ? -EBUSY : ret;
+		}
 	}
 
-	pendingRequests_.clear();
+	data->pendingRequests.clear();
 
 	return 0;
 }
 
-int V4L2Camera::streamOff()
+int V4L2Camera::streamOff(unsigned int stream)
 {
-	if (!isRunning_)
-		return 0;
+	MutexLocker locker(mutex_);
 
-	pendingRequests_.clear();
+	StreamData *data = streams_[stream].get();
 
-	int ret = camera_->stop();
-	if (ret < 0)
-		return ret == -EACCES ? -EBUSY : ret;
+	data->pendingRequests.clear();
+
+	if (!data->isRunning)
+		return 0;
 
 	{
-		MutexLocker locker(bufferMutex_);
+		MutexLocker bufferLocker(bufferMutex_);
+		data->isRunning = false;
+	}
+
+	bool running = std::any_of(streams_.begin(), streams_.end(),
+				   [](const std::unique_ptr<StreamData> &s) {
+					   return s->isRunning.load();
+				   });
+	if (!running) {
+		int ret = camera_->stop();
+		if (ret < 0)
+			return ret == -EACCES ? -EBUSY : ret;
+
 		isRunning_ = false;
 	}
+
+	{
+		/*
+		 * When other streams keep the camera running, the requests of
+		 * this stream complete normally. Wait for them, as all the
+		 * buffers are returned to the application.
+		 */
+		MutexLocker bufferLocker(bufferMutex_);
+		bufferCV_.wait(bufferLocker, [&] {
+				       return data->queuedCount == 0;
+			       });
+		data->bufferAvailableCount = 0;
+
+		for (auto &it : data->observers) {
+			Observer &observer = it.second;
+
+			for (unsigned int i = 0; i < observer.queue.size(); i++)
+				clearEventfd(observer.efd);
+			observer.queue.clear();
+		}
+	}
+
+	/* Drop the buffers that haven't been dequeued. */
+	data->completedTail.store(data->completedHead.load(std::memory_order_acquire),
+				  std::memory_order_release);
+
 	bufferCV_.notify_all();
 
 	return 0;
 }
 
-int V4L2Camera::qbuf(unsigned int index)
+/*
+ * Create one reusable request per buffer index, to keep allocations out of
+ * qbuf(), and size the completion ring accordingly.
+ */
+int V4L2Camera::createRequests(unsigned int stream, unsigned int count)
 {
-	std::unique_ptr<Request> request =
-		std::unique_ptr<Request>(camera_->createRequest(index));
-	if (!request) {
-		LOG(V4L2Compat, Error) << "Can't create request";
-		return -ENOMEM;
+	StreamData *data = streams_[stream].get();
+
+	data->requests.clear();
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint64_t cookie = (static_cast<uint64_t>(stream) << 32) | i;
+		std::unique_ptr<Request> request = camera_->createReusableRequest(cookie);
+		if (!request) {
+			LOG(V4L2Compat, Error) << "Can't create request";
+			data->requests.clear();
+			return -ENOMEM;
+		}
+
+		data->requests.push_back(std::move(request));
 	}
 
-	Stream *stream = config_->at(0).stream();
-	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
-	int ret = request->addBuffer(stream, buffer);
-	if (ret < 0) {
-		LOG(V4L2Compat, Error) << "Can't set buffer for request";
-		return -ENOMEM;
+	unsigned int ringSize = 1;
+	while (ringSize < count)
+		ringSize <<= 1;
+
+	data->completed.assign(ringSize, 0);
+	data->completedHead.store(0, std::memory_order_relaxed);
+	data->completedTail.store(0, std::memory_order_relaxed);
+
+	data->pendingRequests.clear();
+	data->pendingRequests.reserve(count);
+
+	return 0;
+}
+
+int V4L2Camera::qbuf(unsigned int stream, unsigned int index)
+{
+	StreamData *data = streams_[stream].get();
+
+	if (index >= data->requests.size())
+		return -EINVAL;
+
+	FrameBuffer *buffer = index < data->buffers.size() ? data->buffers[index] : nullptr;
+	if (!buffer) {
+		LOG(V4L2Compat, Error) << "No buffer for index " << index;
+		return -EINVAL;
 	}
 
-	if (!isRunning_) {
-		pendingRequests_.push_back(std::move(request));
+	/*
+	 * The buffer for an index only changes when the application imports a
+	 * different dmabuf, reuse it otherwise.
+	 */
+	Request *request = data->requests[index].get();
+	if (request->findBuffer(data->stream) == buffer) {
+		request->reuse(Request::ReuseBuffers);
+	} else {
+		request->reuse();
+
+		int ret = request->addBuffer(data->stream, buffer);
+		if (ret < 0) {
+			LOG(V4L2Compat, Error) << "Can't set buffer for request";
+			return -ENOMEM;
+		}
+	}
+
+	/*
+	 * Observers can't hold the owner back. Drop the buffer from their
+	 * queues, and revoke it from the observers that have dequeued it.
+	 * The observers map can be checked without bufferMutex_, as it is
+	 * only modified with the proxy lock held.
+	 */
+	if (!data->observers.empty()) {
+		{
+			MutexLocker locker(bufferMutex_);
+
+			for (auto &it : data->observers) {
+				dropObserverBuffer(&it.second, index);
+				revokeObserverBuffer(&it.second, index);
+			}
+		}
+		bufferCV_.notify_all();
+	}
+
+	return queueRequest(data, request);
+}
+
+int V4L2Camera::queueRequest(StreamData *data, Request *request)
+{
+	if (!data->isRunning) {
+		data->pendingRequests.push_back(request);
 		return 0;
 	}
 
-	ret = camera_->queueRequest(request.release());
+	data->queuedCount++;
+
+	int ret = camera_->queueRequest(request);
 	if (ret < 0) {
+		data->queuedCount--;
 		LOG(V4L2Compat, Error) << "Can't queue request";
 		return ret == -EACCES ? -EBUSY : ret;
 	}
@@ -259,27 +716,187 @@ int V4L2Camera::qbuf(unsigned int index)
 	return 0;
 }
 
-void V4L2Camera::waitForBufferAvailable()
+void V4L2Camera::waitForBufferAvailable(unsigned int stream)
 {
+	StreamData *data = streams_[stream].get();
+
 	MutexLocker locker(bufferMutex_);
 	bufferCV_.wait(locker, [&] {
-			       return bufferAvailableCount_ >= 1 || !isRunning_;
+			       return !data->isRunning || claimBuffer(data);
 		       });
-	if (isRunning_)
-		bufferAvailableCount_--;
 }
 
-bool V4L2Camera::isBufferAvailable()
+bool V4L2Camera::isBufferAvailable(unsigned int stream)
 {
-	MutexLocker locker(bufferMutex_);
-	if (bufferAvailableCount_ < 1)
-		return false;
+	return claimBuffer(streams_[stream].get());
+}
+
+/*
+ * Claim one of the completed buffers of \a data for a dequeue. Return false
+ * if none is available.
+ */
+bool V4L2Camera::claimBuffer(StreamData *data)
+{
+	unsigned int count = data->bufferAvailableCount.load();
+
+	do {
+		if (!count)
+			return false;
+	} while (!data->bufferAvailableCount.compare_exchange_weak(count, count - 1));
 
-	bufferAvailableCount_--;
 	return true;
 }
 
-bool V4L2Camera::isRunning()
+bool V4L2Camera::isRunning(unsigned int stream)
 {
-	return isRunning_;
+	return streams_[stream]->isRunning.load();
+}
+
+/*
+ * Observers are read-only clients of a stream owned by another file. They
+ * receive the buffers completed for the owner, and can't queue buffers to
+ * the camera.
+ */
+void V4L2Camera::addObserver(unsigned int stream, int efd)
+{
+	StreamData *data = streams_[stream].get();
+
+	MutexLocker locker(bufferMutex_);
+
+	Observer &observer = data->observers[efd];
+	observer.efd = efd;
+	observer.dropped = 0;
+	observer.revoked = false;
+}
+
+void V4L2Camera::removeObserver(unsigned int stream, int efd)
+{
+	StreamData *data = streams_[stream].get();
+
+	{
+		MutexLocker locker(bufferMutex_);
+
+		auto it = data->observers.find(efd);
+		if (it == data->observers.end())
+			return;
+
+		Observer &observer = it->second;
+
+		LOG(V4L2Compat, Debug)
+			<< "Observer " << efd << " dropped " << observer.dropped
+			<< " buffers";
+
+		for (unsigned int i = 0; i < observer.queue.size(); i++)
+			clearEventfd(efd);
+
+		data->observers.erase(it);
+	}
+
+	bufferCV_.notify_all();
+}
+
+/*
+ * Dequeue the oldest buffer from the queue of the observer. The buffer is
+ * held until released with observerRelease(), or until the owner queues it
+ * again. In the latter case the hold is revoked, as the buffer contents may
+ * have been overwritten by the time the observer reads them, and the next
+ * dequeue fails with -EIO to report it.
+ *
+ * Return 0 on success, -EAGAIN if the queue is empty, or -EIO if a held buffer
+ * has been revoked.
+ */
+int V4L2Camera::observerDequeue(unsigned int stream, int efd,
+				unsigned int *index)
+{
+	StreamData *data = streams_[stream].get();
+
+	MutexLocker locker(bufferMutex_);
+
+	auto it = data->observers.find(efd);
+	if (it == data->observers.end())
+		return -EAGAIN;
+
+	Observer &observer = it->second;
+	if (observer.revoked) {
+		observer.revoked = false;
+		return -EIO;
+	}
+
+	if (observer.queue.empty())
+		return -EAGAIN;
+
+	*index = observer.queue.front();
+	observer.queue.pop_front();
+	clearEventfd(efd);
+
+	observer.held.push_back(*index);
+
+	return 0;
+}
+
+/*
+ * Release a buffer held by an observer. Releasing a buffer that isn't held,
+ * including a buffer whose hold has been revoked, is a no-op.
+ */
+int V4L2Camera::observerRelease(unsigned int stream, int efd,
+				unsigned int index)
+{
+	StreamData *data = streams_[stream].get();
+
+	MutexLocker locker(bufferMutex_);
+
+	auto it = data->observers.find(efd);
+	if (it == data->observers.end())
+		return -EINVAL;
+
+	std::vector<unsigned int> &held = it->second.held;
+	auto pos = std::find(held.begin(), held.end(), index);
+	if (pos != held.end())
+		held.erase(pos);
+
+	return 0;
+}
+
+void V4L2Camera::waitForObserverBuffer(unsigned int stream, int efd)
+{
+	StreamData *data = streams_[stream].get();
+
+	MutexLocker locker(bufferMutex_);
+	bufferCV_.wait(locker, [&] {
+			       auto it = data->observers.find(efd);
+			       return it == data->observers.end() ||
+				      !it->second.queue.empty() ||
+				      it->second.revoked ||
+				      !data->isRunning;
+		       });
+}
+
+/*
+ * Remove \a index from the queue of \a observer, keeping the eventfd counter
+ * in sync. Must be called with bufferMutex_ held.
+ */
+void V4L2Camera::dropObserverBuffer(Observer *observer, unsigned int index)
+{
+	auto it = std::find(observer->queue.begin(), observer->queue.end(), index);
+	if (it == observer->queue.end())
+		return;
+
+	observer->queue.erase(it);
+	observer->dropped++;
+	clearEventfd(observer->efd);
+}
+
+/*
+ * Revoke the hold of \a observer on \a index when the owner queues the buffer
+ * to the camera. Must be called with bufferMutex_ held.
+ */
+void V4L2Camera::revokeObserverBuffer(Observer *observer, unsigned int index)
+{
+	auto it = std::find(observer->held.begin(), observer->held.end(), index);
+	if (it == observer->held.end())
+		return;
+
+	observer->held.erase(it);
+	observer->dropped++;
+	observer->revoked = true;
 }
@@ -8,9 +8,14 @@
 #ifndef __V4L2_CAMERA_H__
 #define __V4L2_CAMERA_H__
 
+#include <atomic>
 #include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <sys/types.h>
 #include <utility>
+#include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
@@ -24,66 +29,168 @@ using namespace libcamera;
 class V4L2Camera
 {
 public:
-	struct Buffer {
-		Buffer(unsigned int index, const FrameMetadata &data)
-			: index(index), data(data)
-		{
-		}
-
-		unsigned int index;
-		FrameMetadata data;
-	};
-
 	V4L2Camera(std::shared_ptr<Camera> camera);
 	~V4L2Camera();
 
-	int open();
-	void close();
-	void bind(int efd);
-	void unbind();
-	void getStreamConfig(StreamConfiguration *streamConfig);
-	std::vector<Buffer> completedBuffers();
+	std::shared_ptr<Camera> camera() const { return camera_; }
+	unsigned int streamCount() const { return streams_.size(); }
 
-	int configure(StreamConfiguration *streamConfigOut,
+	int open(unsigned int stream);
+	void close(unsigned int stream);
+	void bind(unsigned int stream, int efd);
+	void unbind(unsigned int stream);
+	void getStreamConfig(unsigned int stream, StreamConfiguration *streamConfig);
+	bool nextCompletedBuffer(unsigned int stream, unsigned int *index);
+	const FrameMetadata &bufferMetadata(unsigned int stream, unsigned int index);
+
+	int configure(unsigned int stream, StreamConfiguration *streamConfigOut,
 		      const Size &size, const PixelFormat &pixelformat,
 		      unsigned int bufferCount);
-	int validateConfiguration(const PixelFormat &pixelformat,
+	int validateConfiguration(unsigned int stream,
+				  const PixelFormat &pixelformat,
 				  const Size &size,
 				  StreamConfiguration *streamConfigOut);
 
-	int allocBuffers(unsigned int count);
-	void freeBuffers();
-	FileDescriptor getBufferFd(unsigned int index);
+	int allocBuffers(unsigned int stream, unsigned int count);
+	int importBuffers(unsigned int stream, unsigned int count);
+	int importBuffer(unsigned int stream, unsigned int index, int fd,
+			 unsigned int length);
+	void freeBuffers(unsigned int stream);
+	FileDescriptor getBufferFd(unsigned int stream, unsigned int index);
+
+	int streamOn(unsigned int stream);
+	int streamOff(unsigned int stream);
 
-	int streamOn();
-	int streamOff();
+	int qbuf(unsigned int stream, unsigned int index);
 
-	int qbuf(unsigned int index);
+	void waitForBufferAvailable(unsigned int stream);
+	bool isBufferAvailable(unsigned int stream);
 
-	void waitForBufferAvailable();
-	bool isBufferAvailable();
+	bool isRunning(unsigned int stream);
 
-	bool isRunning();
+	void addObserver(unsigned int stream, int efd);
+	void removeObserver(unsigned int stream, int efd);
+	int observerDequeue(unsigned int stream, int efd, unsigned int *index);
+	int observerRelease(unsigned int stream, int efd, unsigned int index);
+	void waitForObserverBuffer(unsigned int stream, int efd);
 
 private:
+	struct ImportedBuffer {
+		std::unique_ptr<FrameBuffer> buffer;
+		int fd;
+		dev_t dev;
+		ino_t ino;
+	};
+
+	/*
+	 * Read-only client of a stream. Completed buffers are added to its
+	 * queue, and held from the time they're dequeued until they're
+	 * released or requeued by the owner. The eventfd counter always
+	 * matches the queue size.
+	 */
+	struct Observer {
+		int efd;
+		std::deque<unsigned int> queue;
+		std::vector<unsigned int> held;
+		unsigned int dropped;
+		/* A held buffer has been requeued by the owner */
+		bool revoked;
+	};
+
+	/*
+	 * State of one libcamera stream, exposed through its own V4L2 node.
+	 * Apart from the fields documented otherwise, it is only accessed by
+	 * the proxy of that node, with the proxy lock held.
+	 */
+	struct StreamData {
+		StreamData(StreamRole r)
+			: role(r), stream(nullptr), open(false),
+			  allocated(false), isRunning(false), completedHead(0),
+			  completedTail(0), queuedCount(0), efd(-1),
+			  bufferAvailableCount(0)
+		{
+		}
+
+		StreamRole role;
+		/* Protected by V4L2Camera::mutex_ */
+		StreamConfiguration config;
+		Stream *stream;
+		bool open;
+		bool allocated;
+
+		/*
+		 * Written with V4L2Camera::bufferMutex_ held, read without
+		 * the lock by isRunning().
+		 */
+		std::atomic<bool> isRunning;
+
+		/* Buffers indexed by V4L2 buffer index */
+		std::vector<FrameBuffer *> buffers;
+		std::vector<ImportedBuffer> importedBuffers;
+
+		/*
+		 * One reusable request per buffer index. The pending requests
+		 * storage is reserved for all of them, so that queuing a
+		 * request before streaming starts doesn't allocate memory.
+		 */
+		std::vector<std::unique_ptr<Request>> requests;
+		std::vector<Request *> pendingRequests;
+
+		/*
+		 * Single-producer, single-consumer ring of completed buffer
+		 * indices. The camera thread produces without any lock held,
+		 * and the proxy consumes with its lock held. The ring can't overflow as its size is
+		 * at least the number of requests. The size is a power of two
+		 * so that indexing with the free-running head and tail stays
+		 * consistent when they wrap around.
+		 */
+		std::vector<unsigned int> completed;
+		std::atomic<unsigned int> completedHead;
+		std::atomic<unsigned int> completedTail;
+
+		/* Number of requests queued to the camera. */
+		std::atomic<unsigned int> queuedCount;
+
+		int efd;
+
+		/*
+		 * Number of completed buffers not yet claimed by a dequeue.
+		 * Waiters sleep on V4L2Camera::bufferCV_.
+		 */
+		std::atomic<unsigned int> bufferAvailableCount;
+
+		/*
+		 * Modified with both the proxy lock and V4L2Camera::bufferMutex_
+		 * held, and read with either of them held.
+		 */
+		std::map<int, Observer> observers;
+	};
+
+	int createRequests(unsigned int stream, unsigned int count);
+	void releaseBuffers(StreamData *data);
+	int queueRequest(StreamData *data, Request *request);
+	bool claimBuffer(StreamData *data);
+	void dropObserverBuffer(Observer *observer, unsigned int index);
+	void revokeObserverBuffer(Observer *observer, unsigned int index);
 	void requestComplete(Request *request);
 
 	std::shared_ptr<Camera> camera_;
 	std::unique_ptr<CameraConfiguration> config_;
 
+	/*
+	 * Serialises the operations that affect the camera as a whole, as
+	 * the nodes of the different streams are accessed concurrently.
+	 */
+	Mutex mutex_;
+	unsigned int refcount_;
 	bool isRunning_;
 
-	std::mutex bufferLock_;
 	FrameBufferAllocator *bufferAllocator_;
 
-	std::deque<std::unique_ptr<Request>> pendingRequests_;
-	std::deque<std::unique_ptr<Buffer>> completedBuffers_;
-
-	int efd_;
+	std::vector<std::unique_ptr<StreamData>> streams_;
 
 	Mutex bufferMutex_;
 	std::condition_variable bufferCV_;
-	unsigned int bufferAvailableCount_;
 };
 
 #endif /* __V4L2_CAMERA_H__ */
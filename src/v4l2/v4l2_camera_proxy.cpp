@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <array>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <set>
 #include <string.h>
@@ -34,12 +35,13 @@ using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat);
 
-V4L2CameraProxy::V4L2CameraProxy(unsigned int index,
-				 std::shared_ptr<Camera> camera)
-	: refcount_(0), index_(index), bufferCount_(0), currentBuf_(0),
-	  vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
+V4L2CameraProxy::V4L2CameraProxy(unsigned int index, unsigned int stream,
+				 std::shared_ptr<V4L2Camera> vcam)
+	: refcount_(0), index_(index), stream_(stream), bufferCount_(0),
+	  currentBuf_(0), memory_(V4L2_MEMORY_MMAP), readMode_(false),
+	  readBytesLeft_(0), vcam_(vcam), owner_(nullptr)
 {
-	querycap(camera);
+	querycap(vcam_->camera());
 }
 
 int V4L2CameraProxy::open(V4L2CameraFile *file)
@@ -63,13 +65,13 @@ int V4L2CameraProxy::open(V4L2CameraFile *file)
 	 * with count = 0.
 	 */
 
-	int ret = vcam_->open();
+	int ret = vcam_->open(stream_);
 	if (ret < 0) {
 		refcount_--;
 		return ret;
 	}
 
-	vcam_->getStreamConfig(&streamConfig_);
+	vcam_->getStreamConfig(stream_, &streamConfig_);
 	setFmtFromConfig(streamConfig_);
 
 	files_.insert(file);
@@ -85,23 +87,50 @@ void V4L2CameraProxy::close(V4L2CameraFile *file)
 
 	files_.erase(file);
 
+	removeObserver(file);
+
+	/*
+	 * Closing the owner stops streaming and frees the buffers, which
+	 * stops the observers too.
+	 */
+	if (hasOwnership(file) && !readMode_) {
+		vcam_->streamOff(stream_);
+		freeBuffers();
+	}
+
 	release(file);
 
 	if (--refcount_ > 0)
 		return;
 
-	vcam_->close();
+	vcam_->close(stream_);
 }
 
-void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
-			    off64_t offset)
+void *V4L2CameraProxy::mmap(V4L2CameraFile *file, void *addr, size_t length,
+			    int prot, int flags, off64_t offset)
 {
 	LOG(V4L2Compat, Debug) << "Servicing mmap";
 
 	MutexLocker locker(proxyMutex_);
 
-	/* \todo Validate prot and flags properly. */
-	if (prot != (PROT_READ | PROT_WRITE)) {
+	bool observer = isObserver(file);
+
+	/*
+	 * \todo Validate prot and flags properly. Observers share the buffers
+	 * of the owner, which may use any memory type backed by libcamera
+	 * buffers. They have read-only access to them.
+	 */
+	if (observer) {
+		if (prot & PROT_WRITE) {
+			errno = EACCES;
+			return MAP_FAILED;
+		}
+
+		if (!(prot & PROT_READ) || memory_ == V4L2_MEMORY_DMABUF) {
+			errno = EINVAL;
+			return MAP_FAILED;
+		}
+	} else if (prot != (PROT_READ | PROT_WRITE) || memory_ != V4L2_MEMORY_MMAP) {
 		errno = EINVAL;
 		return MAP_FAILED;
 	}
@@ -113,7 +142,7 @@ void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
 		return MAP_FAILED;
 	}
 
-	FileDescriptor fd = vcam_->getBufferFd(index);
+	FileDescriptor fd = vcam_->getBufferFd(stream_, index);
 	if (!fd.isValid()) {
 		errno = EINVAL;
 		return MAP_FAILED;
@@ -124,6 +153,15 @@ void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
 	if (map == MAP_FAILED)
 		return map;
 
+	/*
+	 * Mappings of observers don't prevent the owner from freeing the
+	 * buffers, the memory stays valid until they're unmapped.
+	 */
+	if (observer) {
+		observerMmaps_.insert(map);
+		return map;
+	}
+
 	buffers_[index].flags |= V4L2_BUF_FLAG_MAPPED;
 	mmaps_[map] = index;
 
@@ -136,6 +174,15 @@ int V4L2CameraProxy::munmap(void *addr, size_t length)
 
 	MutexLocker locker(proxyMutex_);
 
+	auto observerMap = observerMmaps_.find(addr);
+	if (observerMap != observerMmaps_.end()) {
+		if (V4L2CompatManager::instance()->fops().munmap(addr, length))
+			return -1;
+
+		observerMmaps_.erase(observerMap);
+		return 0;
+	}
+
 	auto iter = mmaps_.find(addr);
 	if (iter == mmaps_.end() || length != sizeimage_) {
 		errno = EINVAL;
@@ -146,12 +193,57 @@ int V4L2CameraProxy::munmap(void *addr, size_t length)
 		LOG(V4L2Compat, Error) << "Failed to unmap " << addr
 				       << " with length " << length;
 
-	buffers_[iter->second].flags &= ~V4L2_BUF_FLAG_MAPPED;
+	/* The buffers may have been freed when closing the owner. */
+	if (iter->second < buffers_.size())
+		buffers_[iter->second].flags &= ~V4L2_BUF_FLAG_MAPPED;
 	mmaps_.erase(iter);
 
 	return 0;
 }
 
+ssize_t V4L2CameraProxy::read(V4L2CameraFile *file, void *buf, size_t count)
+{
+	LOG(V4L2Compat, Debug) << "Servicing read fd = " << file->efd();
+
+	MutexLocker locker(proxyMutex_);
+
+	int ret = readStart(file);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	while (!readBytesLeft_) {
+		ret = readFrame(file, &locker);
+		if (ret < 0) {
+			errno = -ret;
+			return -1;
+		}
+	}
+
+	/*
+	 * Frames larger than the application buffer are returned over
+	 * multiple reads.
+	 */
+	const struct v4l2_buffer &vbuf = buffers_[currentBuf_];
+	const uint8_t *data = static_cast<const uint8_t *>(bounceBuffers_[currentBuf_])
+			    + vbuf.bytesused - readBytesLeft_;
+	size_t size = std::min<size_t>(count, readBytesLeft_);
+
+	memcpy(buf, data, size);
+	readBytesLeft_ -= size;
+
+	if (!readBytesLeft_) {
+		ret = readRequeue();
+		if (ret < 0) {
+			errno = -ret;
+			return -1;
+		}
+	}
+
+	return size;
+}
+
 bool V4L2CameraProxy::validateBufferType(uint32_t type)
 {
 	return type == V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -159,7 +251,9 @@ bool V4L2CameraProxy::validateBufferType(uint32_t type)
 
 bool V4L2CameraProxy::validateMemoryType(uint32_t memory)
 {
-	return memory == V4L2_MEMORY_MMAP;
+	return memory == V4L2_MEMORY_MMAP ||
+	       memory == V4L2_MEMORY_DMABUF ||
+	       memory == V4L2_MEMORY_USERPTR;
 }
 
 void V4L2CameraProxy::setFmtFromConfig(StreamConfiguration &streamConfig)
@@ -186,16 +280,24 @@ void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 {
 	std::string driver = "libcamera";
 	std::string bus_info = driver + ":" + std::to_string(index_);
+	std::string card = camera->id();
+
+	/* Nodes of the additional streams are told apart by their bus info. */
+	if (stream_) {
+		bus_info += "." + std::to_string(stream_);
+		card += " (stream " + std::to_string(stream_) + ")";
+	}
 
 	utils::strlcpy(reinterpret_cast<char *>(capabilities_.driver), driver.c_str(),
 		       sizeof(capabilities_.driver));
-	utils::strlcpy(reinterpret_cast<char *>(capabilities_.card), camera->id().c_str(),
+	utils::strlcpy(reinterpret_cast<char *>(capabilities_.card), card.c_str(),
 		       sizeof(capabilities_.card));
 	utils::strlcpy(reinterpret_cast<char *>(capabilities_.bus_info), bus_info.c_str(),
 		       sizeof(capabilities_.bus_info));
 	/* \todo Put this in a header/config somewhere. */
 	capabilities_.version = KERNEL_VERSION(5, 2, 0);
 	capabilities_.device_caps = V4L2_CAP_VIDEO_CAPTURE
+				  | V4L2_CAP_READWRITE
 				  | V4L2_CAP_STREAMING
 				  | V4L2_CAP_EXT_PIX_FORMAT;
 	capabilities_.capabilities = capabilities_.device_caps
@@ -205,17 +307,18 @@ void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 
 void V4L2CameraProxy::updateBuffers()
 {
-	std::vector<V4L2Camera::Buffer> completedBuffers = vcam_->completedBuffers();
-	for (const V4L2Camera::Buffer &buffer : completedBuffers) {
-		const FrameMetadata &fmd = buffer.data;
-		struct v4l2_buffer &buf = buffers_[buffer.index];
+	unsigned int index;
+
+	while (vcam_->nextCompletedBuffer(stream_, &index)) {
+		const FrameMetadata &fmd = vcam_->bufferMetadata(stream_, index);
+		struct v4l2_buffer &buf = buffers_[index];
 
 		switch (fmd.status) {
 		case FrameMetadata::FrameSuccess:
 			buf.bytesused = fmd.planes[0].bytesused;
 			buf.field = V4L2_FIELD_NONE;
 			buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
-			buf.timestamp.tv_usec = fmd.timestamp % 1000000;
+			buf.timestamp.tv_usec = (fmd.timestamp / 1000) % 1000000;
 			buf.sequence = fmd.sequence;
 
 			buf.flags |= V4L2_BUF_FLAG_DONE;
@@ -303,7 +406,7 @@ int V4L2CameraProxy::tryFormat(struct v4l2_format *arg)
 	Size size(arg->fmt.pix.width, arg->fmt.pix.height);
 
 	StreamConfiguration config;
-	int ret = vcam_->validateConfiguration(format, size, &config);
+	int ret = vcam_->validateConfiguration(stream_, format, size, &config);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error)
 			<< "Failed to negotiate a valid format: "
@@ -348,11 +451,11 @@ int V4L2CameraProxy::vidioc_s_fmt(V4L2CameraFile *file, struct v4l2_format *arg)
 
 	Size size(arg->fmt.pix.width, arg->fmt.pix.height);
 	V4L2PixelFormat v4l2Format = V4L2PixelFormat(arg->fmt.pix.pixelformat);
-	ret = vcam_->configure(&streamConfig_, size,
+	ret = vcam_->configure(stream_, &streamConfig_, size,
 			       PixelFormatInfo::info(v4l2Format).format,
 			       bufferCount_);
 	if (ret < 0)
-		return -EINVAL;
+		return ret == -EBUSY ? ret : -EINVAL;
 
 	setFmtFromConfig(streamConfig_);
 
@@ -443,15 +546,353 @@ int V4L2CameraProxy::vidioc_s_input(V4L2CameraFile *file, int *arg)
 	return 0;
 }
 
+/*
+ * Map the buffers allocated by libcamera to copy frames to the application
+ * memory with V4L2_MEMORY_USERPTR and read().
+ *
+ * \todo Capture directly to the application memory when it is backed by a
+ * memfd, by turning it into a dmabuf with udmabuf.
+ */
+int V4L2CameraProxy::mapBounceBuffers()
+{
+	for (unsigned int i = 0; i < bufferCount_; i++) {
+		FileDescriptor fd = vcam_->getBufferFd(stream_, i);
+		if (!fd.isValid())
+			return -EINVAL;
+
+		void *map = V4L2CompatManager::instance()->fops().mmap(nullptr, sizeimage_,
+								       PROT_READ, MAP_SHARED,
+								       fd.fd(), 0);
+		if (map == MAP_FAILED)
+			return -errno;
+
+		bounceBuffers_.push_back(map);
+	}
+
+	return 0;
+}
+
 void V4L2CameraProxy::freeBuffers()
 {
 	LOG(V4L2Compat, Debug) << "Freeing libcamera bufs";
 
-	vcam_->freeBuffers();
+	/* Observers lose access to the buffers of the owner. */
+	observers_.clear();
+
+	for (void *map : bounceBuffers_)
+		V4L2CompatManager::instance()->fops().munmap(map, sizeimage_);
+	bounceBuffers_.clear();
+
+	vcam_->freeBuffers(stream_);
 	buffers_.clear();
 	bufferCount_ = 0;
 }
 
+/*
+ * Configure the stream with the current format, and allocate or prepare
+ * \a count buffers of the \a memory type.
+ */
+int V4L2CameraProxy::setupBuffers(unsigned int count, enum v4l2_memory memory)
+{
+	if (bufferCount_ > 0)
+		freeBuffers();
+
+	Size size(curV4L2Format_.fmt.pix.width, curV4L2Format_.fmt.pix.height);
+	V4L2PixelFormat v4l2Format = V4L2PixelFormat(curV4L2Format_.fmt.pix.pixelformat);
+	int ret = vcam_->configure(stream_, &streamConfig_, size,
+				   PixelFormatInfo::info(v4l2Format).format,
+				   count);
+	if (ret < 0)
+		return ret == -EBUSY ? ret : -EINVAL;
+
+	setFmtFromConfig(streamConfig_);
+
+	bufferCount_ = streamConfig_.bufferCount;
+	memory_ = memory;
+
+	/*
+	 * DMABUF buffers are provided by the application at qbuf time. USERPTR
+	 * buffers are captured to buffers allocated by libcamera, and copied.
+	 */
+	if (memory_ == V4L2_MEMORY_DMABUF)
+		ret = vcam_->importBuffers(stream_, bufferCount_);
+	else
+		ret = vcam_->allocBuffers(stream_, bufferCount_);
+
+	if (ret == 0 && memory_ == V4L2_MEMORY_USERPTR)
+		ret = mapBounceBuffers();
+
+	if (ret < 0) {
+		freeBuffers();
+		return ret;
+	}
+
+	buffers_.resize(bufferCount_);
+	for (unsigned int i = 0; i < bufferCount_; i++) {
+		struct v4l2_buffer buf = {};
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.length = curV4L2Format_.fmt.pix.sizeimage;
+		buf.memory = memory_;
+		if (memory_ == V4L2_MEMORY_MMAP)
+			buf.m.offset = i * curV4L2Format_.fmt.pix.sizeimage;
+		else if (memory_ == V4L2_MEMORY_DMABUF)
+			buf.m.fd = -1;
+		buf.index = i;
+		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+
+		buffers_[i] = buf;
+	}
+
+	return 0;
+}
+
+/*
+ * Start streaming to an internal ring of buffers on the first read() call.
+ * The file becomes the owner of the device, and streaming I/O ioctls are
+ * rejected until it releases it.
+ */
+int V4L2CameraProxy::readStart(V4L2CameraFile *file)
+{
+	/* Number of buffers to smooth the latency of the reader. */
+	static constexpr unsigned int kReadBufferCount = 4;
+
+	if (readMode_)
+		return hasOwnership(file) ? 0 : -EBUSY;
+
+	if (!hasOwnership(file) && owner_)
+		return -EBUSY;
+
+	if (bufferCount_ > 0)
+		return -EBUSY;
+
+	int ret = setupBuffers(kReadBufferCount, V4L2_MEMORY_MMAP);
+	if (ret < 0)
+		return ret;
+
+	ret = mapBounceBuffers();
+	if (ret < 0)
+		goto error;
+
+	acquire(file);
+
+	for (unsigned int i = 0; i < bufferCount_; i++) {
+		ret = vcam_->qbuf(stream_, i);
+		if (ret < 0)
+			goto error;
+
+		buffers_[i].flags |= V4L2_BUF_FLAG_QUEUED;
+	}
+
+	ret = vcam_->streamOn(stream_);
+	if (ret < 0)
+		goto error;
+
+	currentBuf_ = 0;
+	readBytesLeft_ = 0;
+	readMode_ = true;
+
+	return 0;
+
+error:
+	vcam_->streamOff(stream_);
+	freeBuffers();
+	release(file);
+	return ret;
+}
+
+void V4L2CameraProxy::readStop()
+{
+	readMode_ = false;
+	readBytesLeft_ = 0;
+
+	vcam_->streamOff(stream_);
+	freeBuffers();
+}
+
+/*
+ * Wait for the next frame and make it the current read buffer. Frames that
+ * failed to be captured are queued back, and leave readBytesLeft_ to 0.
+ */
+int V4L2CameraProxy::readFrame(V4L2CameraFile *file, MutexLocker *locker)
+{
+	if (!file->nonBlocking()) {
+		locker->unlock();
+		vcam_->waitForBufferAvailable(stream_);
+		locker->lock();
+	} else if (!vcam_->isBufferAvailable(stream_))
+		return -EAGAIN;
+
+	/* The file may have been closed from another thread while we waited. */
+	if (!readMode_ || !vcam_->isRunning(stream_))
+		return -EIO;
+
+	updateBuffers();
+
+	uint64_t data;
+	int ret = V4L2CompatManager::instance()->fops().read(file->efd(), &data,
+							     sizeof(data));
+	if (ret != sizeof(data))
+		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+
+	const struct v4l2_buffer &buf = buffers_[currentBuf_];
+	if (!(buf.flags & V4L2_BUF_FLAG_ERROR)) {
+		readBytesLeft_ = buf.bytesused;
+		if (readBytesLeft_)
+			return 0;
+	}
+
+	return readRequeue();
+}
+
+int V4L2CameraProxy::readRequeue()
+{
+	struct v4l2_buffer &buf = buffers_[currentBuf_];
+	buf.flags &= ~(V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_ERROR);
+
+	int ret = vcam_->qbuf(stream_, currentBuf_);
+	if (ret < 0) {
+		buf.flags &= ~V4L2_BUF_FLAG_QUEUED;
+		return ret;
+	}
+
+	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
+
+	return 0;
+}
+
+bool V4L2CameraProxy::isObserver(V4L2CameraFile *file)
+{
+	return observers_.find(file) != observers_.end();
+}
+
+void V4L2CameraProxy::removeObserver(V4L2CameraFile *file)
+{
+	auto it = observers_.find(file);
+	if (it == observers_.end())
+		return;
+
+	if (it->second)
+		vcam_->removeObserver(stream_, file->efd());
+
+	observers_.erase(it);
+}
+
+/*
+ * Requesting buffers while another file owns the device turns the file into
+ * an observer, which shares the buffers of the owner through read-only mmap().
+ * As the compatibility layer lives in the application process, only files
+ * opened by the process of the owner can observe it. Other processes open the
+ * camera separately and get -EBUSY as before.
+ */
+int V4L2CameraProxy::observerReqbufs(V4L2CameraFile *file,
+				     struct v4l2_requestbuffers *arg)
+{
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+
+	if (arg->count == 0) {
+		removeObserver(file);
+		return 0;
+	}
+
+	if (arg->memory != V4L2_MEMORY_MMAP || !bufferCount_ ||
+	    memory_ == V4L2_MEMORY_DMABUF)
+		return -EBUSY;
+
+	observers_.emplace(file, false);
+	arg->count = bufferCount_;
+
+	LOG(V4L2Compat, Debug) << "File " << file->efd() << " observes "
+			       << arg->count << " buffers";
+
+	return 0;
+}
+
+/*
+ * Buffers are queued by the owner only. Queuing a buffer releases it if the
+ * observer holds it, and is a no-op otherwise. Observers never delay the
+ * owner: when the owner queues a buffer that an observer still holds, the
+ * hold is revoked and the next observer DQBUF fails with -EIO.
+ */
+int V4L2CameraProxy::observerQbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
+{
+	if (!validateBufferType(arg->type) ||
+	    arg->memory != V4L2_MEMORY_MMAP ||
+	    arg->index >= bufferCount_)
+		return -EINVAL;
+
+	int ret = vcam_->observerRelease(stream_, file->efd(), arg->index);
+	if (ret < 0 && ret != -EINVAL)
+		return ret;
+
+	arg->flags = (buffers_[arg->index].flags & V4L2_BUF_FLAG_MAPPED)
+		   | V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+
+	return 0;
+}
+
+int V4L2CameraProxy::observerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+				   MutexLocker *locker)
+{
+	if (!validateBufferType(arg->type) ||
+	    arg->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
+	unsigned int index;
+	int ret;
+
+	while ((ret = vcam_->observerDequeue(stream_, file->efd(), &index)) == -EAGAIN) {
+		if (!observers_[file] || !vcam_->isRunning(stream_))
+			return -EINVAL;
+
+		if (file->nonBlocking())
+			return -EAGAIN;
+
+		locker->unlock();
+		vcam_->waitForObserverBuffer(stream_, file->efd());
+		locker->lock();
+
+		/* The owner may have freed the buffers while we were waiting. */
+		if (!isObserver(file))
+			return -EINVAL;
+	}
+
+	/* The owner has requeued a buffer the observer was still reading. */
+	if (ret < 0)
+		return ret;
+
+	const FrameMetadata &fmd = vcam_->bufferMetadata(stream_, index);
+	struct v4l2_buffer buf = buffers_[index];
+
+	buf.flags &= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.m.offset = index * sizeimage_;
+	buf.length = sizeimage_;
+	buf.field = V4L2_FIELD_NONE;
+	buf.sequence = fmd.sequence;
+	buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
+	buf.timestamp.tv_usec = (fmd.timestamp / 1000) % 1000000;
+
+	if (fmd.status == FrameMetadata::FrameSuccess)
+		buf.bytesused = fmd.planes[0].bytesused;
+	else
+		buf.flags |= V4L2_BUF_FLAG_ERROR;
+
+	*arg = buf;
+
+	return 0;
+}
+
+int V4L2CameraProxy::observerStreamon(V4L2CameraFile *file)
+{
+	if (!observers_[file]) {
+		vcam_->addObserver(stream_, file->efd());
+		observers_[file] = true;
+	}
+
+	return 0;
+}
+
 int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuffers *arg)
 {
 	LOG(V4L2Compat, Debug) << "Servicing vidioc_reqbufs fd = " << file->efd();
@@ -466,9 +907,14 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		return -EBUSY;
 
 	if (!hasOwnership(file) && owner_)
+		return observerReqbufs(file, arg);
+
+	if (readMode_)
 		return -EBUSY;
 
-	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP
+			  | V4L2_BUF_CAP_SUPPORTS_USERPTR
+			  | V4L2_BUF_CAP_SUPPORTS_DMABUF;
 	memset(arg->reserved, 0, sizeof(arg->reserved));
 
 	if (arg->count == 0) {
@@ -476,7 +922,7 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		if (!mmaps_.empty())
 			return -EBUSY;
 
-		if (vcam_->isRunning())
+		if (vcam_->isRunning(stream_))
 			return -EBUSY;
 
 		freeBuffers();
@@ -485,40 +931,17 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		return 0;
 	}
 
-	if (bufferCount_ > 0)
-		freeBuffers();
-
-	Size size(curV4L2Format_.fmt.pix.width, curV4L2Format_.fmt.pix.height);
-	V4L2PixelFormat v4l2Format = V4L2PixelFormat(curV4L2Format_.fmt.pix.pixelformat);
-	int ret = vcam_->configure(&streamConfig_, size,
-				   PixelFormatInfo::info(v4l2Format).format,
-				   arg->count);
-	if (ret < 0)
-		return -EINVAL;
-
-	setFmtFromConfig(streamConfig_);
-
-	arg->count = streamConfig_.bufferCount;
-	bufferCount_ = arg->count;
+	/* Buffers can't be reallocated while requests are queued. */
+	if (vcam_->isRunning(stream_))
+		return -EBUSY;
 
-	ret = vcam_->allocBuffers(arg->count);
+	int ret = setupBuffers(arg->count, static_cast<enum v4l2_memory>(arg->memory));
 	if (ret < 0) {
 		arg->count = 0;
 		return ret;
 	}
 
-	buffers_.resize(arg->count);
-	for (unsigned int i = 0; i < arg->count; i++) {
-		struct v4l2_buffer buf = {};
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.length = curV4L2Format_.fmt.pix.sizeimage;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.offset = i * curV4L2Format_.fmt.pix.sizeimage;
-		buf.index = i;
-		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
-
-		buffers_[i] = buf;
-	}
+	arg->count = bufferCount_;
 
 	LOG(V4L2Compat, Debug) << "Allocated " << arg->count << " buffers";
 
@@ -553,18 +976,58 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
+	if (isObserver(file))
+		return observerQbuf(file, arg);
+
 	if (buffers_[arg->index].flags & V4L2_BUF_FLAG_QUEUED)
 		return -EINVAL;
 
-	if (!hasOwnership(file))
+	if (!hasOwnership(file) || readMode_)
 		return -EBUSY;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory) ||
+	    arg->memory != memory_ ||
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
-	int ret = vcam_->qbuf(arg->index);
+	struct v4l2_buffer &buf = buffers_[arg->index];
+	int ret;
+
+	switch (memory_) {
+	case V4L2_MEMORY_DMABUF: {
+		unsigned int length = arg->length;
+
+		/* A zero length means the whole dmabuf. */
+		if (!length) {
+			off_t size = lseek(arg->m.fd, 0, SEEK_END);
+			if (size < 0)
+				return -EINVAL;
+			length = size;
+		}
+
+		if (length < sizeimage_)
+			return -EINVAL;
+
+		ret = vcam_->importBuffer(stream_, arg->index, arg->m.fd, length);
+		if (ret < 0)
+			return ret;
+
+		buf.m.fd = arg->m.fd;
+		buf.length = length;
+		break;
+	}
+	case V4L2_MEMORY_USERPTR:
+		if (!arg->m.userptr || arg->length < sizeimage_)
+			return -EINVAL;
+
+		buf.m.userptr = arg->m.userptr;
+		buf.length = arg->length;
+		break;
+	default:
+		break;
+	}
+
+	ret = vcam_->qbuf(stream_, arg->index);
 	if (ret < 0)
 		return ret;
 
@@ -583,48 +1046,90 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
-	if (!hasOwnership(file))
+	if (isObserver(file))
+		return observerDqbuf(file, arg, locker);
+
+	if (!hasOwnership(file) || readMode_)
 		return -EBUSY;
 
-	if (!vcam_->isRunning())
+	if (!vcam_->isRunning(stream_))
 		return -EINVAL;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
 	if (!file->nonBlocking()) {
 		locker->unlock();
-		vcam_->waitForBufferAvailable();
+		vcam_->waitForBufferAvailable(stream_);
 		locker->lock();
-	} else if (!vcam_->isBufferAvailable())
+	} else if (!vcam_->isBufferAvailable(stream_))
 		return -EAGAIN;
 
 	/*
 	 * We need to check here again in case stream was turned off while we
 	 * were blocked on waitForBufferAvailable().
 	 */
-	if (!vcam_->isRunning())
+	if (!vcam_->isRunning(stream_))
 		return -EINVAL;
 
 	updateBuffers();
 
 	struct v4l2_buffer &buf = buffers_[currentBuf_];
 
+	if (memory_ == V4L2_MEMORY_USERPTR &&
+	    !(buf.flags & V4L2_BUF_FLAG_ERROR))
+		memcpy(reinterpret_cast<void *>(buf.m.userptr),
+		       bounceBuffers_[currentBuf_], buf.bytesused);
+
 	buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
-	buf.length = sizeimage_;
+	if (memory_ == V4L2_MEMORY_MMAP)
+		buf.length = sizeimage_;
 	*arg = buf;
 
 	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
 
 	uint64_t data;
-	int ret = ::read(file->efd(), &data, sizeof(data));
+	int ret = V4L2CompatManager::instance()->fops().read(file->efd(), &data,
+							     sizeof(data));
 	if (ret != sizeof(data))
 		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
 
 	return 0;
 }
 
+int V4L2CameraProxy::vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_expbuf fd = " << file->efd();
+
+	if (!validateBufferType(arg->type) ||
+	    memory_ != V4L2_MEMORY_MMAP ||
+	    arg->index >= bufferCount_ ||
+	    arg->plane != 0)
+		return -EINVAL;
+
+	if (arg->flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	FileDescriptor fd = vcam_->getBufferFd(stream_, arg->index);
+	if (!fd.isValid())
+		return -EINVAL;
+
+	/*
+	 * The buffers are dmabufs already, export a new reference to them.
+	 * The access mode can't be changed by duplicating the fd, and the
+	 * buffers are allocated read-write.
+	 */
+	int ret = fcntl(fd.fd(), arg->flags & O_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (ret < 0)
+		return -errno;
+
+	arg->fd = ret;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+
+	return 0;
+}
+
 int V4L2CameraProxy::vidioc_streamon(V4L2CameraFile *file, int *arg)
 {
 	LOG(V4L2Compat, Debug) << "Servicing vidioc_streamon fd = " << file->efd();
@@ -635,18 +1140,21 @@ int V4L2CameraProxy::vidioc_streamon(V4L2CameraFile *file, int *arg)
 	if (!validateBufferType(*arg))
 		return -EINVAL;
 
+	if (isObserver(file))
+		return observerStreamon(file);
+
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
-	if (!hasOwnership(file))
+	if (!hasOwnership(file) || readMode_)
 		return -EBUSY;
 
-	if (vcam_->isRunning())
+	if (vcam_->isRunning(stream_))
 		return 0;
 
 	currentBuf_ = 0;
 
-	return vcam_->streamOn();
+	return vcam_->streamOn(stream_);
 }
 
 int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
@@ -656,13 +1164,22 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	if (!validateBufferType(*arg))
 		return -EINVAL;
 
+	if (isObserver(file)) {
+		if (observers_[file]) {
+			vcam_->removeObserver(stream_, file->efd());
+			observers_[file] = false;
+		}
+
+		return 0;
+	}
+
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
-	if (!hasOwnership(file) && owner_)
+	if ((!hasOwnership(file) && owner_) || readMode_)
 		return -EBUSY;
 
-	int ret = vcam_->streamOff();
+	int ret = vcam_->streamOff(stream_);
 
 	for (struct v4l2_buffer &buf : buffers_)
 		buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
@@ -686,6 +1203,7 @@ const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_QUERYBUF,
 	VIDIOC_QBUF,
 	VIDIOC_DQBUF,
+	VIDIOC_EXPBUF,
 	VIDIOC_STREAMON,
 	VIDIOC_STREAMOFF,
 };
@@ -756,6 +1274,9 @@ int V4L2CameraProxy::ioctl(V4L2CameraFile *file, unsigned long request, void *ar
 	case VIDIOC_DQBUF:
 		ret = vidioc_dqbuf(file, static_cast<struct v4l2_buffer *>(arg), &locker);
 		break;
+	case VIDIOC_EXPBUF:
+		ret = vidioc_expbuf(file, static_cast<struct v4l2_exportbuffer *>(arg));
+		break;
 	case VIDIOC_STREAMON:
 		ret = vidioc_streamon(file, static_cast<int *>(arg));
 		break;
@@ -799,7 +1320,7 @@ int V4L2CameraProxy::acquire(V4L2CameraFile *file)
 	if (owner_)
 		return -EBUSY;
 
-	vcam_->bind(file->efd());
+	vcam_->bind(stream_, file->efd());
 
 	owner_ = file;
 
@@ -811,7 +1332,10 @@ void V4L2CameraProxy::release(V4L2CameraFile *file)
 	if (owner_ != file)
 		return;
 
-	vcam_->unbind();
+	if (readMode_)
+		readStop();
+
+	vcam_->unbind(stream_);
 
 	owner_ = nullptr;
 }
@@ -27,12 +27,15 @@ class V4L2CameraFile;
 class V4L2CameraProxy
 {
 public:
-	V4L2CameraProxy(unsigned int index, std::shared_ptr<Camera> camera);
+	V4L2CameraProxy(unsigned int index, unsigned int stream,
+			std::shared_ptr<V4L2Camera> vcam);
 
 	int open(V4L2CameraFile *file);
 	void close(V4L2CameraFile *file);
-	void *mmap(void *addr, size_t length, int prot, int flags, off64_t offset);
+	void *mmap(V4L2CameraFile *file, void *addr, size_t length, int prot,
+		   int flags, off64_t offset);
 	int munmap(void *addr, size_t length);
+	ssize_t read(V4L2CameraFile *file, void *buf, size_t count);
 
 	int ioctl(V4L2CameraFile *file, unsigned long request, void *arg);
 
@@ -44,7 +47,20 @@ private:
 	int tryFormat(struct v4l2_format *arg);
 	enum v4l2_priority maxPriority();
 	void updateBuffers();
+	int mapBounceBuffers();
+	int setupBuffers(unsigned int count, enum v4l2_memory memory);
 	void freeBuffers();
+	int readStart(V4L2CameraFile *file);
+	void readStop();
+	int readFrame(V4L2CameraFile *file, MutexLocker *locker);
+	int readRequeue();
+	bool isObserver(V4L2CameraFile *file);
+	void removeObserver(V4L2CameraFile *file);
+	int observerReqbufs(V4L2CameraFile *file, struct v4l2_requestbuffers *arg);
+	int observerQbuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
+	int observerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+			  MutexLocker *locker);
+	int observerStreamon(V4L2CameraFile *file);
 
 	int vidioc_querycap(struct v4l2_capability *arg);
 	int vidioc_enum_framesizes(V4L2CameraFile *file, struct v4l2_frmsizeenum *arg);
@@ -61,6 +77,7 @@ private:
 	int vidioc_querybuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
 	int vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
 	int vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg, MutexLocker *locker);
+	int vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg);
 	int vidioc_streamon(V4L2CameraFile *file, int *arg);
 	int vidioc_streamoff(V4L2CameraFile *file, int *arg);
 
@@ -72,6 +89,7 @@ private:
 
 	unsigned int refcount_;
 	unsigned int index_;
+	unsigned int stream_;
 
 	struct v4l2_format curV4L2Format_;
 	StreamConfiguration streamConfig_;
@@ -79,13 +97,31 @@ private:
 	unsigned int bufferCount_;
 	unsigned int currentBuf_;
 	unsigned int sizeimage_;
+	enum v4l2_memory memory_;
 
 	std::vector<struct v4l2_buffer> buffers_;
 	std::map<void *, unsigned int> mmaps_;
+	std::set<void *> observerMmaps_;
+
+	/*
+	 * Mappings of the buffers allocated by libcamera when the application
+	 * uses V4L2_MEMORY_USERPTR or read(). Frames are copied to the
+	 * application memory at dqbuf or read time.
+	 */
+	std::vector<void *> bounceBuffers_;
+
+	/*
+	 * read() I/O streams to an internal ring of buffers, started by the
+	 * first read() and stopped when its file releases the device. The
+	 * frame being read is buffers_[currentBuf_], with readBytesLeft_ bytes
+	 * left to copy.
+	 */
+	bool readMode_;
+	unsigned int readBytesLeft_;
 
 	std::set<V4L2CameraFile *> files_;
 
-	std::unique_ptr<V4L2Camera> vcam_;
+	std::shared_ptr<V4L2Camera> vcam_;
 
 	/*
 	 * This is the exclusive owner of this V4L2CameraProxy instance.
@@ -98,6 +134,14 @@ private:
 	 */
 	V4L2CameraFile *owner_;
 
+	/*
+	 * Files that share the buffers of the owner read-only. They request
+	 * buffers while the device is owned, and receive the buffers completed
+	 * for the owner once they start streaming, without being able to
+	 * throttle it. The value tells whether the observer is streaming.
+	 */
+	std::map<V4L2CameraFile *, bool> observers_;
+
 	/* This mutex is to serialize access to the proxy. */
 	Mutex proxyMutex_;
 };
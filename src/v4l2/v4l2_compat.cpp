@@ -28,6 +28,9 @@ using namespace libcamera;
 
 extern "C" {
 
+/* Provided by the C library, not declared in its public headers. */
+void __chk_fail(void) __attribute__((__noreturn__));
+
 LIBCAMERA_PUBLIC int open(const char *path, int oflag, ...)
 {
 	mode_t mode = 0;
@@ -123,6 +126,22 @@ LIBCAMERA_PUBLIC int munmap(void *addr, size_t length)
 	return V4L2CompatManager::instance()->munmap(addr, length);
 }
 
+LIBCAMERA_PUBLIC ssize_t read(int fd, void *buf, size_t count)
+{
+	return V4L2CompatManager::instance()->read(fd, buf, count);
+}
+
+/* _FORTIFY_SOURCE redirects read to __read_chk */
+LIBCAMERA_PUBLIC ssize_t __read_chk(int fd, void *buf, size_t count,
+				    size_t buflen)
+{
+	/* Abort on buffer overflows as the C library implementation does. */
+	if (count > buflen)
+		__chk_fail();
+
+	return read(fd, buf, count);
+}
+
 LIBCAMERA_PUBLIC int ioctl(int fd, unsigned long request, ...)
 {
 	void *arg;
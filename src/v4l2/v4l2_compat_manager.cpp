@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <map>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/eventfd.h>
 #include <sys/mman.h>
@@ -24,6 +25,7 @@
 
 #include "libcamera/internal/log.h"
 
+#include "v4l2_camera.h"
 #include "v4l2_camera_file.h"
 
 using namespace libcamera;
@@ -47,6 +49,10 @@ V4L2CompatManager::V4L2CompatManager()
 	get_symbol(fops_.ioctl, "ioctl");
 	get_symbol(fops_.mmap, "mmap64");
 	get_symbol(fops_.munmap, "munmap");
+	get_symbol(fops_.read, "read");
+
+	for (std::atomic<uint64_t> &word : cameraFds_)
+		word.store(0, std::memory_order_relaxed);
 }
 
 V4L2CompatManager::~V4L2CompatManager()
@@ -79,12 +85,27 @@ int V4L2CompatManager::start()
 
 	/*
 	 * For each Camera registered in the system, a V4L2CameraProxy gets
-	 * created here to wrap a camera device.
+	 * created here for each stream of the camera device. The first stream
+	 * is accessed through the video node of the camera, and the other
+	 * ones through virtual paths.
 	 */
 	unsigned int index = 0;
 	for (auto &camera : cm_->cameras()) {
-		V4L2CameraProxy *proxy = new V4L2CameraProxy(index, camera);
-		proxies_.emplace_back(proxy);
+		std::shared_ptr<V4L2Camera> vcam = std::make_shared<V4L2Camera>(camera);
+		std::vector<std::unique_ptr<V4L2CameraProxy>> proxies;
+
+		for (unsigned int stream = 0; stream < vcam->streamCount(); stream++) {
+			proxies.emplace_back(new V4L2CameraProxy(index, stream, vcam));
+
+			if (stream)
+				LOG(V4L2Compat, Debug)
+					<< "Stream " << stream << " of camera "
+					<< camera->id() << " available as "
+					<< "/dev/libcamera/camera" << index
+					<< "/stream" << stream;
+		}
+
+		proxies_.push_back(std::move(proxies));
 		++index;
 	}
 
@@ -99,6 +120,8 @@ V4L2CompatManager *V4L2CompatManager::instance()
 
 std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
 {
+	MutexLocker locker(mutex_);
+
 	auto file = files_.find(fd);
 	if (file == files_.end())
 		return nullptr;
@@ -106,6 +129,39 @@ std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
 	return file->second;
 }
 
+/*
+ * Record whether \a fd is a camera file in the file descriptors bitmap. Must
+ * be called with mutex_ held.
+ */
+void V4L2CompatManager::markCameraFd(int fd, bool camera)
+{
+	if (fd < 0 || static_cast<unsigned int>(fd) >= kFdBitmapSize)
+		return;
+
+	uint64_t bit = 1ULL << (fd % 64);
+	if (camera)
+		cameraFds_[fd / 64].fetch_or(bit, std::memory_order_relaxed);
+	else
+		cameraFds_[fd / 64].fetch_and(~bit, std::memory_order_relaxed);
+}
+
+/*
+ * Check without locking whether \a fd may be a camera file. A false return
+ * value is definitive, as file descriptors are marked before they're returned
+ * to the application and unmarked before they're closed.
+ */
+bool V4L2CompatManager::mayBeCameraFd(int fd) const
+{
+	if (fd < 0)
+		return false;
+
+	if (static_cast<unsigned int>(fd) >= kFdBitmapSize)
+		return true;
+
+	uint64_t bit = 1ULL << (fd % 64);
+	return cameraFds_[fd / 64].load(std::memory_order_relaxed) & bit;
+}
+
 int V4L2CompatManager::getCameraIndex(int fd)
 {
 	struct stat statbuf;
@@ -127,8 +183,59 @@ int V4L2CompatManager::getCameraIndex(int fd)
 	return -1;
 }
 
+/*
+ * Parse the virtual path of a stream node, /dev/libcamera/camera<N>/stream<M>
+ * where N is the camera index and M the stream index.
+ */
+bool V4L2CompatManager::parseVirtualPath(const char *path, unsigned int *camera,
+					 unsigned int *stream)
+{
+	static const char prefix[] = "/dev/libcamera/camera";
+
+	if (strncmp(path, prefix, sizeof(prefix) - 1))
+		return false;
+
+	int end = 0;
+	if (sscanf(path + sizeof(prefix) - 1, "%u/stream%u%n",
+		   camera, stream, &end) != 2)
+		return false;
+
+	return path[sizeof(prefix) - 1 + end] == '\0';
+}
+
+int V4L2CompatManager::createFile(V4L2CameraProxy *proxy, int oflag)
+{
+	int efd = eventfd(0, EFD_SEMAPHORE |
+			     ((oflag & O_CLOEXEC) ? EFD_CLOEXEC : 0) |
+			     ((oflag & O_NONBLOCK) ? EFD_NONBLOCK : 0));
+	if (efd < 0)
+		return efd;
+
+	MutexLocker locker(mutex_);
+	files_.emplace(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
+	markCameraFd(efd, true);
+
+	return efd;
+}
+
 int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mode)
 {
+	unsigned int cameraIndex;
+	unsigned int streamIndex;
+
+	if (parseVirtualPath(path, &cameraIndex, &streamIndex)) {
+		if (!cm_)
+			start();
+
+		if (cameraIndex >= proxies_.size() ||
+		    streamIndex >= proxies_[cameraIndex].size()) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		return createFile(proxies_[cameraIndex][streamIndex].get(), oflag);
+	}
+
 	int fd = fops_.openat(dirfd, path, oflag, mode);
 	if (fd < 0)
 		return fd;
@@ -143,23 +250,14 @@ int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mod
 		start();
 
 	ret = getCameraIndex(fd);
-	if (ret < 0) {
+	if (ret < 0 || proxies_[ret].empty()) {
 		LOG(V4L2Compat, Info) << "No camera found for " << path;
 		return fd;
 	}
 
 	fops_.close(fd);
 
-	int efd = eventfd(0, EFD_SEMAPHORE |
-			     ((oflag & O_CLOEXEC) ? EFD_CLOEXEC : 0) |
-			     ((oflag & O_NONBLOCK) ? EFD_NONBLOCK : 0));
-	if (efd < 0)
-		return efd;
-
-	V4L2CameraProxy *proxy = proxies_[ret].get();
-	files_.emplace(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
-
-	return efd;
+	return createFile(proxies_[ret][0].get(), oflag);
 }
 
 int V4L2CompatManager::dup(int oldfd)
@@ -168,18 +266,28 @@ int V4L2CompatManager::dup(int oldfd)
 	if (newfd < 0)
 		return newfd;
 
+	MutexLocker locker(mutex_);
+
 	auto file = files_.find(oldfd);
-	if (file != files_.end())
+	if (file != files_.end()) {
 		files_[newfd] = file->second;
+		markCameraFd(newfd, true);
+	}
 
 	return newfd;
 }
 
 int V4L2CompatManager::close(int fd)
 {
-	auto file = files_.find(fd);
-	if (file != files_.end())
-		files_.erase(file);
+	{
+		MutexLocker locker(mutex_);
+
+		auto file = files_.find(fd);
+		if (file != files_.end()) {
+			markCameraFd(fd, false);
+			files_.erase(file);
+		}
+	}
 
 	/* We still need to close the eventfd. */
 	return fops_.close(fd);
@@ -192,7 +300,8 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	if (!file)
 		return fops_.mmap(addr, length, prot, flags, fd, offset);
 
-	void *map = file->proxy()->mmap(addr, length, prot, flags, offset);
+	void *map = file->proxy()->mmap(file.get(), addr, length, prot, flags,
+					offset);
 	if (map == MAP_FAILED)
 		return map;
 
@@ -200,29 +309,55 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	 * Map to V4L2CameraProxy directly to prevent adding more references
 	 * to V4L2CameraFile.
 	 */
+	MutexLocker locker(mutex_);
 	mmaps_[map] = file->proxy();
 	return map;
 }
 
 int V4L2CompatManager::munmap(void *addr, size_t length)
 {
-	auto device = mmaps_.find(addr);
-	if (device == mmaps_.end())
-		return fops_.munmap(addr, length);
+	V4L2CameraProxy *proxy;
 
-	V4L2CameraProxy *proxy = device->second;
+	{
+		MutexLocker locker(mutex_);
+
+		auto device = mmaps_.find(addr);
+		if (device == mmaps_.end())
+			proxy = nullptr;
+		else
+			proxy = device->second;
+	}
+
+	if (!proxy)
+		return fops_.munmap(addr, length);
 
 	int ret = proxy->munmap(addr, length);
 	if (ret < 0)
 		return ret;
 
-	mmaps_.erase(device);
+	MutexLocker locker(mutex_);
+	mmaps_.erase(addr);
 
 	return 0;
 }
 
+ssize_t V4L2CompatManager::read(int fd, void *buf, size_t count)
+{
+	if (!mayBeCameraFd(fd))
+		return fops_.read(fd, buf, count);
+
+	std::shared_ptr<V4L2CameraFile> file = cameraFile(fd);
+	if (!file)
+		return fops_.read(fd, buf, count);
+
+	return file->proxy()->read(file.get(), buf, count);
+}
+
 int V4L2CompatManager::ioctl(int fd, unsigned long request, void *arg)
 {
+	if (!mayBeCameraFd(fd))
+		return fops_.ioctl(fd, request, arg);
+
 	std::shared_ptr<V4L2CameraFile> file = cameraFile(fd);
 	if (!file)
 		return fops_.ioctl(fd, request, arg);
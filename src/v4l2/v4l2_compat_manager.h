@@ -8,8 +8,11 @@
 #ifndef __V4L2_COMPAT_MANAGER_H__
 #define __V4L2_COMPAT_MANAGER_H__
 
+#include <array>
+#include <atomic>
 #include <fcntl.h>
 #include <map>
+#include <stdint.h>
 #include <memory>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -17,6 +20,8 @@
 
 #include <libcamera/camera_manager.h>
 
+#include "libcamera/internal/thread.h"
+
 #include "v4l2_camera_proxy.h"
 
 using namespace libcamera;
@@ -33,6 +38,7 @@ public:
 		using mmap_func_t = void *(*)(void *addr, size_t length, int prot,
 					      int flags, int fd, off64_t offset);
 		using munmap_func_t = int (*)(void *addr, size_t length);
+		using read_func_t = ssize_t (*)(int fd, void *buf, size_t count);
 
 		openat_func_t openat;
 		dup_func_t dup;
@@ -40,6 +46,7 @@ public:
 		ioctl_func_t ioctl;
 		mmap_func_t mmap;
 		munmap_func_t munmap;
+		read_func_t read;
 	};
 
 	static V4L2CompatManager *instance();
@@ -53,6 +60,7 @@ public:
 	void *mmap(void *addr, size_t length, int prot, int flags,
 		   int fd, off64_t offset);
 	int munmap(void *addr, size_t length);
+	ssize_t read(int fd, void *buf, size_t count);
 	int ioctl(int fd, unsigned long request, void *arg);
 
 private:
@@ -61,15 +69,35 @@ private:
 
 	int start();
 	int getCameraIndex(int fd);
+	bool parseVirtualPath(const char *path, unsigned int *camera,
+			      unsigned int *stream);
+	int createFile(V4L2CameraProxy *proxy, int oflag);
 	std::shared_ptr<V4L2CameraFile> cameraFile(int fd);
+	void markCameraFd(int fd, bool camera);
+	bool mayBeCameraFd(int fd) const;
 
 	FileOperations fops_;
 
 	CameraManager *cm_;
 
-	std::vector<std::unique_ptr<V4L2CameraProxy>> proxies_;
+	/* Proxies indexed by camera and stream */
+	std::vector<std::vector<std::unique_ptr<V4L2CameraProxy>>> proxies_;
+
+	/*
+	 * Protects the files and mappings, which are accessed from all the
+	 * application threads.
+	 */
+	Mutex mutex_;
 	std::map<int, std::shared_ptr<V4L2CameraFile>> files_;
 	std::map<void *, V4L2CameraProxy *> mmaps_;
+
+	/*
+	 * Bitmap of the file descriptors in files_, updated with mutex_ held,
+	 * and read without any lock to pass calls on other files through.
+	 * File descriptors beyond its size always take the locked lookup.
+	 */
+	static constexpr unsigned int kFdBitmapSize = 4096;
+	std::array<std::atomic<uint64_t>, kFdBitmapSize / 64> cameraFds_;
 };
 
 #endif /* __V4L2_COMPAT_MANAGER_H__ */
@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests - Deferred camera initialisation
+ */
+
+#include <iostream>
+#include <memory>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/media_device.h"
+#include "libcamera/internal/pipeline_handler.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+/*
+ * A pipeline handler that registers a camera backed by the vimc media device,
+ * and records calls to initCameraDevice().
+ */
+class PipelineHandlerTest : public PipelineHandler
+{
+public:
+	PipelineHandlerTest(CameraManager *manager)
+		: PipelineHandler(manager), media_(nullptr), initCount_(0),
+		  initResult_(0)
+	{
+	}
+
+	bool match(DeviceEnumerator *enumerator) override
+	{
+		DeviceMatch dm("vimc");
+
+		media_ = acquireMediaDevice(enumerator, dm);
+		if (!media_)
+			return false;
+
+		std::set<Stream *> streams{ &stream_ };
+		std::shared_ptr<Camera> camera =
+			Camera::create(this, "test-deferred-init", streams);
+		registerCamera(std::move(camera),
+			       std::make_unique<CameraData>(this));
+
+		return true;
+	}
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override
+	{
+		return nullptr;
+	}
+
+	int configure(Camera *camera, CameraConfiguration *config) override
+	{
+		return -EINVAL;
+	}
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override
+	{
+		return -EINVAL;
+	}
+
+	int start(Camera *camera) override
+	{
+		return -EINVAL;
+	}
+
+	void stop(Camera *camera) override
+	{
+	}
+
+	MediaDevice *media_;
+	unsigned int initCount_;
+	int initResult_;
+
+protected:
+	int initCameraDevice(Camera *camera) override
+	{
+		initCount_++;
+		return initResult_;
+	}
+
+	int queueRequestDevice(Camera *camera, Request *request) override
+	{
+		return -EINVAL;
+	}
+
+private:
+	Stream stream_;
+};
+
+class DeferredInitTest : public Test
+{
+protected:
+	int init() override
+	{
+		cm_ = new CameraManager();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		std::shared_ptr<Camera> vimc = cm_->get("platform/vimc.0 Sensor B");
+		if (!vimc) {
+			cerr << "vimc camera not found" << endl;
+			return TestSkip;
+		}
+
+		/*
+		 * Use a separate enumerator to acquire the vimc media device,
+		 * as the camera manager's vimc pipeline handler owns its own
+		 * instance. Cameras shall be registered from the camera
+		 * manager thread, move the pipeline handler there.
+		 */
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_ || enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		pipe_ = std::make_shared<PipelineHandlerTest>(cm_);
+		pipe_->moveToThread(vimc->thread());
+
+		bool matched = pipe_->invokeMethod(&PipelineHandlerTest::match,
+						   ConnectionTypeBlocking,
+						   enumerator_.get());
+		if (!matched) {
+			cerr << "Failed to match vimc media device" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("test-deferred-init");
+		if (!camera_) {
+			cerr << "Test camera not registered" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/* Initialisation is deferred until the camera is acquired. */
+		if (pipe_->initCount_ != 0) {
+			cerr << "Camera initialised before acquire()" << endl;
+			return TestFail;
+		}
+
+		/* A failed initialisation fails acquire() and unlocks the camera. */
+		pipe_->initResult_ = -EIO;
+
+		if (camera_->acquire() != -EIO) {
+			cerr << "Initialisation failure not reported" << endl;
+			return TestFail;
+		}
+
+		if (pipe_->initCount_ != 1) {
+			cerr << "Camera not initialised on acquire()" << endl;
+			return TestFail;
+		}
+
+		if (!pipe_->media_->lock()) {
+			cerr << "Media device still locked after failure" << endl;
+			return TestFail;
+		}
+
+		pipe_->media_->unlock();
+
+		/* Initialisation is attempted again, and succeeds. */
+		pipe_->initResult_ = 0;
+
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire camera" << endl;
+			return TestFail;
+		}
+
+		if (pipe_->initCount_ != 2) {
+			cerr << "Initialisation not retried" << endl;
+			return TestFail;
+		}
+
+		camera_->release();
+
+		/* Subsequent acquisitions don't initialise the camera again. */
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire camera again" << endl;
+			return TestFail;
+		}
+
+		camera_->release();
+
+		if (pipe_->initCount_ != 2) {
+			cerr << "Camera initialised more than once" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		camera_.reset();
+		pipe_.reset();
+
+		cm_->stop();
+		delete cm_;
+	}
+
+private:
+	CameraManager *cm_;
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::shared_ptr<PipelineHandlerTest> pipe_;
+	std::shared_ptr<Camera> camera_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(DeferredInitTest)
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests - Frame broadcaster
+ */
+
+#include <iostream>
+
+#include <libcamera/frame_broadcaster.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class FrameBroadcasterTest : public CameraTest, public Test
+{
+public:
+	FrameBroadcasterTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	unsigned int consumed_;
+	bool invalidFrame_;
+
+	/* The fast subscriber releases frames as soon as they're delivered. */
+	void frameAvailable(FrameSubscriber *subscriber)
+	{
+		std::shared_ptr<Request> frame = subscriber->nextFrame();
+		if (!frame || frame->status() != Request::RequestComplete ||
+		    frame->buffers().size() != 1) {
+			invalidFrame_ = true;
+			return;
+		}
+
+		consumed_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	/* Queue all requests and capture for one second. */
+	int capture(std::vector<std::unique_ptr<Request>> &requests)
+	{
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests) {
+			request->reuse(Request::ReuseBuffers);
+
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (invalidFrame_) {
+			cout << "Invalid frame delivered" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createReusableRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(std::move(request));
+		}
+
+		unsigned int nbuffers = requests.size();
+		FrameBroadcaster broadcaster(camera_, nbuffers);
+
+		if (broadcaster.subscribe(0, FrameSubscriber::DropOldest)) {
+			cout << "Subscriber with no queue created" << endl;
+			return TestFail;
+		}
+
+		/* Subscribers can't hold all the requests on their own. */
+		FrameSubscriber *deep = broadcaster.subscribe(nbuffers + 1,
+							      FrameSubscriber::DropOldest);
+		if (!deep || deep->depth() != nbuffers - 1) {
+			cout << "Subscriber depth not capped" << endl;
+			return TestFail;
+		}
+
+		broadcaster.unsubscribe(deep);
+
+		FrameSubscriber *fast = broadcaster.subscribe(2, FrameSubscriber::DropOldest);
+		FrameSubscriber *slow = broadcaster.subscribe(1, FrameSubscriber::DropNewest);
+
+		consumed_ = 0;
+		invalidFrame_ = false;
+
+		fast->frameAvailable.connect(this, &FrameBroadcasterTest::frameAvailable);
+
+		ret = capture(requests);
+		if (ret != TestPass)
+			return ret;
+
+		/*
+		 * The slow subscriber holds one request, the other ones shall
+		 * be queued again as soon as the fast subscriber releases them.
+		 */
+		if (consumed_ <= nbuffers * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << consumed_ << " expected at least "
+			     << nbuffers * 2 << ")" << endl;
+			return TestFail;
+		}
+
+		FrameSubscriber::Statistics fastStats = fast->statistics();
+		FrameSubscriber::Statistics slowStats = slow->statistics();
+
+		if (fastStats.frames != consumed_ || fastStats.dropped != 0 ||
+		    fastStats.queued != 0 || fastStats.maxQueued != 1) {
+			cout << "Invalid fast subscriber statistics" << endl;
+			return TestFail;
+		}
+
+		if (slowStats.frames != 1 || slowStats.queued != 1 ||
+		    slowStats.maxQueued != 1 ||
+		    slowStats.frames + slowStats.dropped != fastStats.frames) {
+			cout << "Invalid slow subscriber statistics" << endl;
+			return TestFail;
+		}
+
+		broadcaster.unsubscribe(slow);
+		broadcaster.unsubscribe(fast);
+
+		/*
+		 * A subscriber that never releases frames, along with another
+		 * one, would pin all the requests. Frames shall then be dropped
+		 * for all subscribers to keep capture running.
+		 */
+		fast = broadcaster.subscribe(2, FrameSubscriber::DropOldest);
+		FrameSubscriber *stalled = broadcaster.subscribe(nbuffers - 1,
+								 FrameSubscriber::DropNewest);
+
+		consumed_ = 0;
+
+		fast->frameAvailable.connect(this, &FrameBroadcasterTest::frameAvailable);
+
+		ret = capture(requests);
+		if (ret != TestPass)
+			return ret;
+
+		fastStats = fast->statistics();
+		FrameSubscriber::Statistics stalledStats = stalled->statistics();
+
+		if (stalledStats.queued != nbuffers - 1 ||
+		    fastStats.frames != nbuffers - 1 ||
+		    fastStats.frames != consumed_) {
+			cout << "Invalid pinned frames statistics" << endl;
+			return TestFail;
+		}
+
+		if (fastStats.frames + fastStats.dropped <= nbuffers * 2) {
+			cout << "Capture stalled by pinned frames" << endl;
+			return TestFail;
+		}
+
+		broadcaster.unsubscribe(stalled);
+		broadcaster.unsubscribe(fast);
+
+		/* Cancelled requests stay owned by the test, and are freed here. */
+		requests.clear();
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(FrameBroadcasterTest);
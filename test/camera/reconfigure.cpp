@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests - Reconfiguration while running
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class Reconfigure : public CameraTest, public Test
+{
+public:
+	Reconfigure()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	unsigned int completeRequestsCount_;
+	Size expectedSize_;
+	bool invalidSize_;
+	bool reconfiguring_;
+	bool queuedWhileReconfiguring_;
+
+	void requestComplete(Request *request)
+	{
+		/*
+		 * Requests cancelled by reconfigure() complete before it
+		 * returns, and can't be queued again until then.
+		 */
+		if (reconfiguring_ &&
+		    request->status() == Request::RequestCancelled) {
+			request->reuse(Request::ReuseBuffers);
+			if (camera_->queueRequest(request) != -EACCES)
+				queuedWhileReconfiguring_ = true;
+			return;
+		}
+
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		const Stream *stream = request->buffers().begin()->first;
+		if (stream->configuration().size != expectedSize_)
+			invalidSize_ = true;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int queueRequests()
+	{
+		for (std::unique_ptr<Request> &request : requests_) {
+			/* Requests cancelled by a reconfiguration are requeued. */
+			if (request->status() != Request::RequestPending)
+				request->reuse(Request::ReuseBuffers);
+
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int capture(const Size &size, bool queue = true)
+	{
+		completeRequestsCount_ = 0;
+		expectedSize_ = size;
+		invalidSize_ = false;
+
+		if (queue && queueRequests() != TestPass)
+			return TestFail;
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (!completeRequestsCount_) {
+			cout << "Failed to capture frames at " << size.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		if (invalidSize_) {
+			cout << "Frames captured with invalid size" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> configuration(const Size &size)
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || config->size() != 1)
+			return nullptr;
+
+		config->at(0).size = size;
+		if (config->validate() == CameraConfiguration::Invalid)
+			return nullptr;
+
+		return config;
+	}
+
+	int reconfigure(CameraConfiguration *config)
+	{
+		reconfiguring_ = true;
+		queuedWhileReconfiguring_ = false;
+
+		int ret = camera_->reconfigure(config);
+
+		reconfiguring_ = false;
+
+		if (queuedWhileReconfiguring_) {
+			cout << "Request queued during reconfiguration" << endl;
+			return TestFail;
+		}
+
+		return ret;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+		reconfiguring_ = false;
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		/* Buffers are allocated for the largest configuration. */
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createReusableRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &Reconfigure::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		if (capture(cfg.size) != TestPass)
+			return TestFail;
+
+		/* Switch to a smaller size while running. */
+		std::unique_ptr<CameraConfiguration> small =
+			configuration({ cfg.size.width / 2, cfg.size.height / 2 });
+		if (!small) {
+			cout << "Failed to generate reconfiguration" << endl;
+			return TestFail;
+		}
+
+		auto begin = chrono::steady_clock::now();
+		ret = reconfigure(small.get());
+		auto end = chrono::steady_clock::now();
+
+		if (ret) {
+			cout << "Failed to reconfigure camera" << endl;
+			return TestFail;
+		}
+
+		cout << "Reconfigure latency: "
+		     << chrono::duration_cast<chrono::microseconds>(end - begin).count()
+		     << "us" << endl;
+
+		if (small->at(0).stream() != stream) {
+			cout << "Stream changed on reconfiguration" << endl;
+			return TestFail;
+		}
+
+		if (capture(small->at(0).size) != TestPass)
+			return TestFail;
+
+		/*
+		 * Reconfigure with the same size. Pipeline handlers that
+		 * reconfigure incrementally, such as Raspberry Pi, then keep
+		 * the sensor mode and the IPA configuration.
+		 */
+		if (reconfigure(small.get())) {
+			cout << "Failed to reconfigure camera with the same size"
+			     << endl;
+			return TestFail;
+		}
+
+		if (capture(small->at(0).size) != TestPass)
+			return TestFail;
+
+		/* An invalid configuration is rejected without stopping. */
+		std::unique_ptr<CameraConfiguration> invalid =
+			configuration(cfg.size);
+		if (!invalid) {
+			cout << "Failed to generate reconfiguration" << endl;
+			return TestFail;
+		}
+
+		invalid->at(0).pixelFormat = PixelFormat();
+		invalid->at(0).size = {};
+		if (camera_->reconfigure(invalid.get()) != -EINVAL) {
+			cout << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		/* The requests are still queued and keep completing. */
+		if (capture(small->at(0).size, false) != TestPass)
+			return TestFail;
+
+		/* Compare with a full stop, configure and start sequence. */
+		begin = chrono::steady_clock::now();
+		ret = camera_->stop();
+		if (!ret)
+			ret = camera_->configure(config_.get());
+		if (!ret)
+			ret = camera_->start();
+		end = chrono::steady_clock::now();
+
+		if (ret) {
+			cout << "Failed to restart camera" << endl;
+			return TestFail;
+		}
+
+		cout << "Stop, configure and start latency: "
+		     << chrono::duration_cast<chrono::microseconds>(end - begin).count()
+		     << "us" << endl;
+
+		if (capture(cfg.size) != TestPass)
+			return TestFail;
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/* Reconfiguring a stopped camera isn't allowed. */
+		if (camera_->reconfigure(small.get()) != -EACCES) {
+			cout << "Stopped camera reconfigured" << endl;
+			return TestFail;
+		}
+
+		/* Cancelled requests stay owned by the test, and are freed here. */
+		requests_.clear();
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::vector<std::unique_ptr<Request>> requests_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(Reconfigure);
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests - Reusable requests
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class RequestReuse : public CameraTest, public Test
+{
+public:
+	RequestReuse()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	unsigned int completeRequestsCount_;
+	bool invalidBuffer_;
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/* The buffer shall be kept across reuse. */
+		FrameBuffer *buffer = request->buffers().begin()->second;
+
+		request->reuse(Request::ReuseBuffers);
+
+		if (request->buffers().size() != 1 ||
+		    request->buffers().begin()->second != buffer ||
+		    request->status() != Request::RequestPending)
+			invalidBuffer_ = true;
+
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createReusableRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		invalidBuffer_ = false;
+
+		camera_->requestCompleted.connect(this, &RequestReuse::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		unsigned int nbuffers = allocator_->buffers(stream).size();
+
+		if (completeRequestsCount_ <= nbuffers * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << " expected at least "
+			     << nbuffers * 2 << ")" << endl;
+			return TestFail;
+		}
+
+		if (invalidBuffer_) {
+			cout << "Request not reset correctly for reuse" << endl;
+			return TestFail;
+		}
+
+		/* Cancelled requests stay owned by the test, and are freed here. */
+		requests.clear();
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestReuse);
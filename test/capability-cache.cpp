@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capability-cache.cpp - CapabilityCache file parsing tests
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/camera_manager.h>
+
+#include "libcamera/internal/capability_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+const vector<uint8_t> blob = { 1, 2, 3, 4, 5 };
+
+const CapabilityCache::Formats formats = {
+	{ 0x1234, { SizeRange({ 640, 480 }, { 1920, 1080 }, 2, 2) } },
+	{ 0x5678, { SizeRange({ 320, 240 }), SizeRange({ 640, 480 }) } },
+};
+
+/* Offsets in the cache file, see the CacheHeader and CacheEntry structures. */
+constexpr size_t headerSize = 16;
+constexpr size_t headerVersionOffset = 4;
+constexpr size_t headerEntriesOffset = 8;
+
+size_t alignUp(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+class CapabilityCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		char tmpl[] = "/tmp/libcamera.capability_cache.XXXXXX";
+		if (!mkdtemp(tmpl)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = tmpl;
+		path_ = dir_ + "/cache";
+
+		setenv("LIBCAMERA_CAPABILITY_CACHE", path_.c_str(), 1);
+
+		return TestPass;
+	}
+
+	vector<uint8_t> readFile()
+	{
+		ifstream file(path_, ios::binary);
+		return vector<uint8_t>(istreambuf_iterator<char>(file),
+				       istreambuf_iterator<char>());
+	}
+
+	void writeFile(const vector<uint8_t> &data)
+	{
+		/* Replace the file, as the previous one may still be mapped. */
+		unlink(path_.c_str());
+		ofstream file(path_, ios::binary);
+		file.write(reinterpret_cast<const char *>(data.data()), data.size());
+	}
+
+	template<typename T>
+	void patch(vector<uint8_t> &data, size_t offset, T value)
+	{
+		memcpy(data.data() + offset, &value, sizeof(value));
+	}
+
+	/* Check whether a cache loaded from the file contains the entries. */
+	bool hasEntries()
+	{
+		CapabilityCache cache;
+
+		Span<const uint8_t> data = CapabilityCache::lookup("blob");
+		if (data.empty())
+			return false;
+
+		if (vector<uint8_t>(data.begin(), data.end()) != blob) {
+			cerr << "Cached data corrupted" << endl;
+			return false;
+		}
+
+		CapabilityCache::Formats cached;
+		if (!CapabilityCache::lookupFormats("formats", &cached))
+			return false;
+
+		if (cached.size() != formats.size()) {
+			cerr << "Cached formats corrupted" << endl;
+			return false;
+		}
+
+		for (const auto &format : formats) {
+			const vector<SizeRange> &sizes = cached[format.first];
+			if (sizes != format.second) {
+				cerr << "Cached sizes corrupted" << endl;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/* Check that a cache loaded from the file is empty. */
+	bool isEmpty()
+	{
+		CapabilityCache cache;
+		CapabilityCache::Formats cached;
+
+		return CapabilityCache::lookup("blob").empty() &&
+		       !CapabilityCache::lookupFormats("formats", &cached);
+	}
+
+	int run() override
+	{
+		/* Store entries and load them back. */
+		{
+			CapabilityCache cache;
+			CapabilityCache::store("blob", blob);
+			CapabilityCache::storeFormats("formats", formats);
+			CapabilityCache::save();
+		}
+
+		const vector<uint8_t> valid = readFile();
+		if (valid.empty()) {
+			cerr << "Cache file not written" << endl;
+			return TestFail;
+		}
+
+		if (!hasEntries()) {
+			cerr << "Failed to load cache entries" << endl;
+			return TestFail;
+		}
+
+		/* Keys must match exactly. */
+		{
+			CapabilityCache cache;
+			CapabilityCache::Formats cached;
+
+			if (!CapabilityCache::lookup("blo").empty() ||
+			    !CapabilityCache::lookup("blob/").empty() ||
+			    !CapabilityCache::lookup("BLOB").empty() ||
+			    !CapabilityCache::lookup("").empty()) {
+				cerr << "Lookup of a mismatched key succeeded" << endl;
+				return TestFail;
+			}
+
+			/* Data stored in another format isn't parsed as formats. */
+			if (CapabilityCache::lookupFormats("blob", &cached)) {
+				cerr << "Invalid formats data parsed" << endl;
+				return TestFail;
+			}
+
+			/* A corrupted format count doesn't overrun the data. */
+			CapabilityCache::store("formats", vector<uint8_t>(8, 0xff));
+			if (CapabilityCache::lookupFormats("formats", &cached)) {
+				cerr << "Corrupted formats data parsed" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Truncated files are ignored. */
+		for (size_t size = 0; size < valid.size(); ++size) {
+			writeFile({ valid.begin(), valid.begin() + size });
+			if (!isEmpty()) {
+				cerr << "Cache truncated to " << size
+				     << " bytes not ignored" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Files with a corrupted header or entry are ignored. */
+		vector<uint8_t> corrupted = valid;
+		corrupted[0] ^= 0xff;
+		writeFile(corrupted);
+		if (!isEmpty()) {
+			cerr << "Cache with an invalid magic not ignored" << endl;
+			return TestFail;
+		}
+
+		corrupted = valid;
+		patch<uint32_t>(corrupted, headerVersionOffset, 0xffffffff);
+		writeFile(corrupted);
+		if (!isEmpty()) {
+			cerr << "Cache with an unknown format not ignored" << endl;
+			return TestFail;
+		}
+
+		corrupted = valid;
+		patch<uint32_t>(corrupted, headerEntriesOffset, 0xffffffff);
+		writeFile(corrupted);
+		if (!isEmpty()) {
+			cerr << "Cache with an invalid entry count not ignored" << endl;
+			return TestFail;
+		}
+
+		const string &version = CameraManager::version();
+		size_t entryOffset = headerSize + alignUp(version.size());
+
+		corrupted = valid;
+		patch<uint32_t>(corrupted, entryOffset, 0xffffffff);
+		writeFile(corrupted);
+		if (!isEmpty()) {
+			cerr << "Cache with an invalid key length not ignored" << endl;
+			return TestFail;
+		}
+
+		corrupted = valid;
+		patch<uint32_t>(corrupted, entryOffset + 4, 0xffffffff);
+		writeFile(corrupted);
+		if (!isEmpty()) {
+			cerr << "Cache with an invalid data length not ignored" << endl;
+			return TestFail;
+		}
+
+		/* Caches created by a different libcamera version are stale. */
+		if (!version.empty()) {
+			corrupted = valid;
+			corrupted[headerSize] ^= 0xff;
+			writeFile(corrupted);
+			if (!isEmpty()) {
+				cerr << "Stale cache not ignored" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The valid file is still loaded. */
+		writeFile(valid);
+		if (!hasEntries()) {
+			cerr << "Failed to reload cache entries" << endl;
+			return TestFail;
+		}
+
+		/* An empty path disables the cache. */
+		setenv("LIBCAMERA_CAPABILITY_CACHE", "", 1);
+		{
+			CapabilityCache cache;
+			CapabilityCache::store("blob", blob);
+			if (!CapabilityCache::lookup("blob").empty()) {
+				cerr << "Disabled cache stored data" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(path_.c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string dir_;
+	string path_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CapabilityCacheTest)
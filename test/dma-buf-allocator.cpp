@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma-buf-allocator.cpp - DmaBufAllocator allocation and pooling test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/dma_buf_allocator.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* NV12 frame sizes of a sequence of configurations. */
+const vector<unsigned int> frameSizes = {
+	640 * 480 * 3 / 2,
+	1280 * 720 * 3 / 2,
+	1296 * 972 * 3 / 2,
+	1920 * 1080 * 3 / 2,
+	1280 * 720 * 3 / 2,
+	2592 * 1944 * 3 / 2,
+	1920 * 1088 * 3 / 2,
+	640 * 480 * 3 / 2,
+};
+
+constexpr unsigned int bufferCount = 4;
+constexpr unsigned int iterations = 20;
+
+ino_t inode(const FileDescriptor &fd)
+{
+	struct stat st;
+	if (fstat(fd.fd(), &st) < 0)
+		return 0;
+
+	return st.st_ino;
+}
+
+class DmaBufAllocatorTest : public Test
+{
+protected:
+	/*
+	 * Run the configuration sequence, allocating buffers for each
+	 * configuration and recycling them before the next one.
+	 */
+	int runSequence(DmaBufAllocator &allocator, const char *name)
+	{
+		size_t requested = 0;
+		size_t allocated = 0;
+
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < iterations; ++i) {
+			for (unsigned int frameSize : frameSizes) {
+				vector<unique_ptr<FrameBuffer>> buffers;
+
+				int ret = allocator.exportFrameBuffers("test", bufferCount,
+								       { frameSize }, &buffers);
+				if (ret != bufferCount) {
+					cerr << "Failed to allocate buffers" << endl;
+					return TestFail;
+				}
+
+				for (const unique_ptr<FrameBuffer> &buffer : buffers) {
+					int fd = buffer->planes()[0].fd.fd();
+					off_t size = lseek(fd, 0, SEEK_END);
+					if (size < frameSize) {
+						cerr << "Buffer too small" << endl;
+						return TestFail;
+					}
+
+					requested += frameSize;
+					allocated += size;
+				}
+
+				allocator.recycle(&buffers);
+			}
+		}
+
+		auto end = chrono::steady_clock::now();
+		unsigned int count = iterations * frameSizes.size() * bufferCount;
+
+		cout << name << ": "
+		     << chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / count
+		     << "ns per buffer, "
+		     << (allocated - requested) * 100 / requested
+		     << "% memory overhead, "
+		     << allocator.poolSize() << " bytes pooled" << endl;
+
+		/* Size classes bound the memory overhead to 25%. */
+		if (allocated > requested + requested / 4) {
+			cerr << "Excessive memory overhead" << endl;
+			return TestFail;
+		}
+
+		if (allocator.poolSize() > allocator.poolLimit()) {
+			cerr << "Pool limit exceeded" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		DmaBufAllocator allocator(DmaBufAllocator::Memfd);
+		if (!allocator.isValid() || allocator.type() != DmaBufAllocator::Memfd) {
+			cerr << "Failed to create memfd allocator" << endl;
+			return TestFail;
+		}
+
+		/* Test the allocated memory is usable. */
+		FileDescriptor fd = allocator.alloc("test", 4096);
+		if (!fd.isValid()) {
+			cerr << "Failed to allocate buffer" << endl;
+			return TestFail;
+		}
+
+		void *mem = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED,
+				 fd.fd(), 0);
+		if (mem == MAP_FAILED) {
+			cerr << "Failed to map buffer" << endl;
+			return TestFail;
+		}
+
+		static_cast<char *>(mem)[4095] = 1;
+		munmap(mem, 4096);
+
+		/* Without pooling, released buffers are freed. */
+		allocator.release(fd);
+		if (allocator.poolSize()) {
+			cerr << "Buffer pooled with pooling disabled" << endl;
+			return TestFail;
+		}
+
+		if (runSequence(allocator, "unpooled") != TestPass)
+			return TestFail;
+
+		/* Pool enough memory for the largest configuration. */
+		allocator.setPoolLimit(64 << 20);
+
+		if (runSequence(allocator, "pooled") != TestPass)
+			return TestFail;
+
+		/* Pooled buffers are reused for allocations of the same size class. */
+		fd = allocator.alloc("test", frameSizes[0]);
+		int reused = fd.fd();
+		allocator.release(fd);
+		fd = allocator.alloc("test", frameSizes[0] - 1);
+		if (fd.fd() != reused) {
+			cerr << "Pooled buffer not reused" << endl;
+			return TestFail;
+		}
+
+		/* Buffers in use are never handed out twice. */
+		vector<unique_ptr<FrameBuffer>> buffers;
+		int ret = allocator.exportFrameBuffers("test", bufferCount,
+						       { frameSizes[0] }, &buffers);
+		if (ret != bufferCount) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		set<ino_t> inodes = { inode(fd) };
+		for (const unique_ptr<FrameBuffer> &buffer : buffers) {
+			if (!inodes.insert(inode(buffer->planes()[0].fd)).second) {
+				cerr << "Buffer in use handed out twice" << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * Recycled buffers are handed out again, so any reference kept
+		 * by the caller across recycle() or release() aliases the
+		 * memory of the next allocation. This is why callers must drop
+		 * all references first.
+		 */
+		FileDescriptor stale = buffers.back()->planes()[0].fd;
+		allocator.recycle(&buffers);
+
+		FileDescriptor next = allocator.alloc("test", frameSizes[0]);
+		if (inode(next) != inode(stale)) {
+			cerr << "Recycled buffer not reused" << endl;
+			return TestFail;
+		}
+
+		/* Lowering the pool limit frees buffers. */
+		allocator.setPoolLimit(1 << 20);
+		if (allocator.poolSize() > 1 << 20) {
+			cerr << "Pool not trimmed" << endl;
+			return TestFail;
+		}
+
+		allocator.clear();
+		if (allocator.poolSize()) {
+			cerr << "Pool not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(DmaBufAllocatorTest)
@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * multisrc_sync_test.cpp - Test the multi-camera frame synchronisation helpers
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "gstlibcamera-sync.h"
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t kMsec = 1000000;
+constexpr uint64_t kInterval = 33 * kMsec;
+constexpr uint64_t kTolerance = kInterval / 2;
+
+/* Frames are identified by their camera and index, and are move-only. */
+struct TestFrame {
+	unsigned int camera;
+	unsigned int index;
+};
+
+using Matcher = FrameSetMatcher<unique_ptr<TestFrame>>;
+
+struct Drop {
+	unsigned int camera;
+	unsigned int index;
+	Matcher::DropReason reason;
+};
+
+class MultiSrcSyncTest : public Test
+{
+protected:
+	void push(unsigned int camera, unsigned int index, uint64_t timestamp)
+	{
+		matcher_.push(camera, timestamp,
+			      unique_ptr<TestFrame>(new TestFrame{ camera, index }));
+	}
+
+	/*
+	 * Match a set, recording the dropped frames. Cameras in \a starving
+	 * have no request queued.
+	 */
+	bool match(vector<unique_ptr<TestFrame>> *set,
+		   const vector<bool> &starving = {})
+	{
+		return matcher_.match(kTolerance, set,
+			[&](unsigned int camera) {
+				return camera < starving.size() && starving[camera];
+			},
+			[&](unsigned int camera, unique_ptr<TestFrame> frame,
+			    uint64_t age, Matcher::DropReason reason) {
+				drops_.push_back({ camera, frame->index, reason });
+			});
+	}
+
+	/* Check that \a set holds frame \a index of all cameras, in order. */
+	bool checkSet(const vector<unique_ptr<TestFrame>> &set,
+		      const vector<unsigned int> &indices)
+	{
+		if (set.size() != indices.size())
+			return false;
+
+		for (unsigned int i = 0; i < set.size(); ++i) {
+			if (set[i]->camera != i || set[i]->index != indices[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	int testMatch()
+	{
+		vector<unique_ptr<TestFrame>> set;
+
+		/* Frames captured within the tolerance form sets. */
+		matcher_.reset(3);
+		for (unsigned int i = 0; i < 4; ++i) {
+			push(0, i, i * kInterval);
+			push(1, i, i * kInterval + 2 * kMsec);
+			push(2, i, i * kInterval + kTolerance);
+		}
+
+		for (unsigned int i = 0; i < 4; ++i) {
+			set.clear();
+			if (!match(&set) || !checkSet(set, { i, i, i })) {
+				cerr << "Synchronised frames not matched" << endl;
+				return TestFail;
+			}
+		}
+
+		if (match(&set) || !drops_.empty() || !matcher_.empty()) {
+			cerr << "Unexpected frames after matching" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * When a camera misses a frame, the frames of the other cameras
+		 * captured at the same time are discarded.
+		 */
+		matcher_.reset(2);
+		push(0, 0, 0);
+		push(0, 1, kInterval);
+		push(0, 2, 2 * kInterval);
+		push(1, 0, kMsec);
+		push(1, 2, 2 * kInterval + kMsec);
+
+		set.clear();
+		if (!match(&set) || !checkSet(set, { 0, 0 })) {
+			cerr << "First set not matched" << endl;
+			return TestFail;
+		}
+
+		set.clear();
+		if (!match(&set) || !checkSet(set, { 2, 2 })) {
+			cerr << "Set after a missed frame not matched" << endl;
+			return TestFail;
+		}
+
+		if (drops_.size() != 1 || drops_[0].camera != 0 ||
+		    drops_[0].index != 1 || drops_[0].reason != Matcher::DropUnmatched) {
+			cerr << "Unmatched frame not dropped" << endl;
+			return TestFail;
+		}
+
+		drops_.clear();
+
+		/* Incomplete sets are kept until a camera starves. */
+		matcher_.reset(2);
+		push(0, 0, 0);
+		push(0, 1, kInterval);
+
+		set.clear();
+		if (match(&set) || !set.empty() || !drops_.empty()) {
+			cerr << "Incomplete set matched or dropped" << endl;
+			return TestFail;
+		}
+
+		if (match(&set, { false, true }) || !drops_.empty()) {
+			cerr << "Frame dropped for a camera without frames" << endl;
+			return TestFail;
+		}
+
+		if (match(&set, { true, false }) || drops_.size() != 1 ||
+		    drops_[0].camera != 0 || drops_[0].index != 0 ||
+		    drops_[0].reason != Matcher::DropStarving) {
+			cerr << "Oldest frame of a starving camera not dropped" << endl;
+			return TestFail;
+		}
+
+		drops_.clear();
+
+		push(1, 1, kInterval + kMsec);
+
+		set.clear();
+		if (!match(&set) || !checkSet(set, { 1, 1 }) || !drops_.empty()) {
+			cerr << "Set not matched after starvation" << endl;
+			return TestFail;
+		}
+
+		/* Resetting the matcher releases all frames. */
+		push(0, 2, 2 * kInterval);
+		matcher_.reset(2);
+		if (!matcher_.empty()) {
+			cerr << "Frames left after reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testLatency()
+	{
+		LatencyTracker tracker(2000 * kMsec);
+		uint64_t time = 0;
+
+		/* The first sample and increases are reported immediately. */
+		if (!tracker.update(time, 10 * kMsec) ||
+		    tracker.latency() != 10 * kMsec) {
+			cerr << "Initial latency not reported" << endl;
+			return TestFail;
+		}
+
+		time += 100 * kMsec;
+		if (!tracker.update(time, 50 * kMsec) ||
+		    tracker.latency() != 50 * kMsec) {
+			cerr << "Latency increase not reported" << endl;
+			return TestFail;
+		}
+
+		/* The maximum is kept for the duration of the window. */
+		uint64_t spike = time;
+		while (time < spike + 2000 * kMsec) {
+			time += 100 * kMsec;
+			if (tracker.update(time, 10 * kMsec)) {
+				cerr << "Latency decreased within the window" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The latency falls once the spike leaves the window. */
+		time += 100 * kMsec;
+		if (!tracker.update(time, 10 * kMsec) ||
+		    tracker.latency() != 10 * kMsec) {
+			cerr << "Latency decrease not reported" << endl;
+			return TestFail;
+		}
+
+		/* Small variations aren't reported. */
+		for (unsigned int i = 0; i < 30; ++i) {
+			time += 100 * kMsec;
+			if (tracker.update(time, (i % 2 ? 10 : 9) * kMsec)) {
+				cerr << "Latency jitter reported" << endl;
+				return TestFail;
+			}
+		}
+
+		tracker.reset();
+		if (tracker.latency() != 0 || !tracker.update(time, 5 * kMsec)) {
+			cerr << "Latency not reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testMatch() != TestPass)
+			return TestFail;
+
+		return testLatency();
+	}
+
+private:
+	Matcher matcher_;
+	vector<Drop> drops_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(MultiSrcSyncTest)
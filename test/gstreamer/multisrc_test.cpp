@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * multisrc_test.cpp - Test capture with the libcameramultisrc element
+ */
+
+#include <iostream>
+
+#include <gst/gst.h>
+
+#include <libcamera/camera_manager.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+constexpr unsigned int kNumBuffers = 30;
+
+class MultiSrcTest : public Test
+{
+protected:
+	int init() override
+	{
+		/*
+		 * Check for the vimc camera first. Only one camera manager may
+		 * exist at a time, destroy it before the element creates its
+		 * own.
+		 */
+		CameraManager *cm = new CameraManager();
+		if (cm->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			delete cm;
+			return TestFail;
+		}
+
+		bool found = cm->get("platform/vimc.0 Sensor B") != nullptr;
+		cm->stop();
+		delete cm;
+
+		if (!found) {
+			cout << "vimc camera not found" << endl;
+			return TestSkip;
+		}
+
+		gst_init(nullptr, nullptr);
+
+		pipeline_ = gst_pipeline_new("multisrc-test");
+		src_ = gst_element_factory_make("libcameramultisrc", nullptr);
+		sink_ = gst_element_factory_make("fakesink", nullptr);
+		if (!pipeline_ || !src_ || !sink_) {
+			cerr << "Failed to create elements" << endl;
+			if (src_)
+				gst_object_unref(src_);
+			if (sink_)
+				gst_object_unref(sink_);
+			return TestFail;
+		}
+
+		g_object_set(src_, "camera-names", "platform/vimc.0 Sensor B", nullptr);
+		g_object_set(sink_, "num-buffers", kNumBuffers, nullptr);
+
+		gst_bin_add_many(GST_BIN(pipeline_), src_, sink_, nullptr);
+
+		/* The src pads are created when the cameras are opened. */
+		g_signal_connect(src_, "pad-added", G_CALLBACK(padAdded), sink_);
+
+		GstPad *pad = gst_element_get_static_pad(sink_, "sink");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, bufferProbe,
+				  this, nullptr);
+		gst_object_unref(pad);
+
+		return TestPass;
+	}
+
+	static void padAdded(GstElement *src, GstPad *pad, gpointer data)
+	{
+		GstElement *sink = GST_ELEMENT(data);
+		GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+
+		gst_pad_link(pad, sinkpad);
+		gst_object_unref(sinkpad);
+	}
+
+	/*
+	 * With a single camera all frames form a set, check that sets are
+	 * numbered consecutively and carry the capture timestamp.
+	 */
+	static GstPadProbeReturn bufferProbe(GstPad *pad, GstPadProbeInfo *info,
+					     gpointer data)
+	{
+		MultiSrcTest *test = static_cast<MultiSrcTest *>(data);
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+		if (GST_BUFFER_OFFSET(buffer) != test->buffers_) {
+			cerr << "Set " << GST_BUFFER_OFFSET(buffer)
+			     << " received, expected " << test->buffers_ << endl;
+			test->valid_ = false;
+		}
+
+		if (!GST_BUFFER_PTS_IS_VALID(buffer) ||
+		    !gst_buffer_get_reference_timestamp_meta(buffer, nullptr)) {
+			cerr << "Buffer without timestamps" << endl;
+			test->valid_ = false;
+		}
+
+		test->buffers_++;
+
+		return GST_PAD_PROBE_OK;
+	}
+
+	int run() override
+	{
+		if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) ==
+		    GST_STATE_CHANGE_FAILURE) {
+			cerr << "Failed to start the pipeline" << endl;
+			return TestFail;
+		}
+
+		GstBus *bus = gst_element_get_bus(pipeline_);
+		GstMessage *msg = gst_bus_timed_pop_filtered(bus, 10 * GST_SECOND,
+							     (GstMessageType)(GST_MESSAGE_EOS |
+									      GST_MESSAGE_ERROR));
+		gst_object_unref(bus);
+
+		if (!msg) {
+			cerr << "Timeout waiting for end of stream" << endl;
+			return TestFail;
+		}
+
+		if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+			GError *error;
+			gst_message_parse_error(msg, &error, nullptr);
+			cerr << "Pipeline error: " << error->message << endl;
+			g_error_free(error);
+			gst_message_unref(msg);
+			return TestFail;
+		}
+
+		gst_message_unref(msg);
+
+		if (!valid_ || buffers_ != kNumBuffers) {
+			cerr << "Invalid sets received" << endl;
+			return TestFail;
+		}
+
+		/* The element is live and reports its capture latency. */
+		GstQuery *query = gst_query_new_latency();
+		gboolean live = FALSE;
+		if (gst_element_query(pipeline_, query))
+			gst_query_parse_latency(query, &live, nullptr, nullptr);
+		gst_query_unref(query);
+
+		if (!live) {
+			cerr << "Pipeline not reported as live" << endl;
+			return TestFail;
+		}
+
+		GstStructure *stats;
+		guint64 sets = 0;
+		g_object_get(src_, "stats", &stats, nullptr);
+		gst_structure_get_uint64(stats, "sets", &sets);
+		gst_structure_free(stats);
+
+		if (sets < kNumBuffers) {
+			cerr << "Only " << sets << " sets reported" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (pipeline_) {
+			gst_element_set_state(pipeline_, GST_STATE_NULL);
+			gst_object_unref(pipeline_);
+		}
+	}
+
+private:
+	GstElement *pipeline_ = nullptr;
+	GstElement *src_ = nullptr;
+	GstElement *sink_ = nullptr;
+
+	unsigned int buffers_ = 0;
+	bool valid_ = true;
+};
+
+} /* namespace */
+
+TEST_REGISTER(MultiSrcTest)
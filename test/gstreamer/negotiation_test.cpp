@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * negotiation_test.cpp - Test caps negotiation with the libcamerasrc element
+ */
+
+#include <iostream>
+#include <string>
+
+#include <gst/allocators/allocators.h>
+#include <gst/gst.h>
+
+#include <libcamera/camera_manager.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+constexpr unsigned int kNumBuffers = 5;
+const char *kCameraName = "platform/vimc.0 Sensor B";
+
+class NegotiationTest : public Test
+{
+protected:
+	int init() override
+	{
+		/*
+		 * Check for the vimc camera first. Only one camera manager may
+		 * exist at a time, destroy it before the element creates its
+		 * own.
+		 */
+		CameraManager *cm = new CameraManager();
+		if (cm->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			delete cm;
+			return TestFail;
+		}
+
+		bool found = cm->get(kCameraName) != nullptr;
+		cm->stop();
+		delete cm;
+
+		if (!found) {
+			cout << "vimc camera not found" << endl;
+			return TestSkip;
+		}
+
+		gst_init(nullptr, nullptr);
+
+		return TestPass;
+	}
+
+	/* Record the caps features and memory of the buffers reaching the sink. */
+	static GstPadProbeReturn bufferProbe(GstPad *pad, GstPadProbeInfo *info,
+					     gpointer data)
+	{
+		NegotiationTest *test = static_cast<NegotiationTest *>(data);
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+		GstCaps *caps = gst_pad_get_current_caps(pad);
+		if (caps) {
+			GstCapsFeatures *features = gst_caps_get_features(caps, 0);
+			if (gst_caps_features_contains(features,
+						       GST_CAPS_FEATURE_MEMORY_DMABUF))
+				test->dmabufCaps_ = true;
+			gst_caps_unref(caps);
+		}
+
+		for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+			if (!gst_is_dmabuf_memory(gst_buffer_peek_memory(buffer, i)))
+				test->systemMemory_ = true;
+		}
+
+		test->buffers_++;
+
+		return GST_PAD_PROBE_OK;
+	}
+
+	/* Run the pipeline with \a filter between the source and the sink. */
+	int capture(const string &filter)
+	{
+		string description = string("libcamerasrc camera-name=\"") +
+				     kCameraName + "\" ! " + filter +
+				     " ! fakesink name=sink num-buffers=" +
+				     to_string(kNumBuffers);
+
+		GError *error = nullptr;
+		GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+		if (!pipeline) {
+			cerr << "Failed to create pipeline: " << error->message << endl;
+			g_error_free(error);
+			return TestFail;
+		}
+
+		GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+		GstPad *pad = gst_element_get_static_pad(sink, "sink");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, bufferProbe,
+				  this, nullptr);
+		gst_object_unref(pad);
+		gst_object_unref(sink);
+
+		dmabufCaps_ = false;
+		systemMemory_ = false;
+		buffers_ = 0;
+
+		int ret = TestPass;
+
+		if (gst_element_set_state(pipeline, GST_STATE_PLAYING) ==
+		    GST_STATE_CHANGE_FAILURE) {
+			cerr << "Failed to start the pipeline" << endl;
+			ret = TestFail;
+		} else {
+			GstBus *bus = gst_element_get_bus(pipeline);
+			GstMessage *msg = gst_bus_timed_pop_filtered(bus, 10 * GST_SECOND,
+								     (GstMessageType)(GST_MESSAGE_EOS |
+										      GST_MESSAGE_ERROR));
+			gst_object_unref(bus);
+
+			if (!msg || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_EOS) {
+				cerr << "Pipeline didn't reach end of stream" << endl;
+				ret = TestFail;
+			}
+
+			if (msg)
+				gst_message_unref(msg);
+		}
+
+		gst_element_set_state(pipeline, GST_STATE_NULL);
+		gst_object_unref(pipeline);
+
+		if (ret == TestPass && buffers_ != kNumBuffers) {
+			cerr << "Received " << buffers_ << " buffers, expected "
+			     << kNumBuffers << endl;
+			ret = TestFail;
+		}
+
+		return ret;
+	}
+
+	int run() override
+	{
+		/* Downstream elements that request dmabufs get zero-copy. */
+		int ret = capture("video/x-raw(" GST_CAPS_FEATURE_MEMORY_DMABUF ")");
+		if (ret != TestPass)
+			return ret;
+
+		if (!dmabufCaps_ || systemMemory_) {
+			cerr << "Zero-copy dmabuf path not negotiated" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Elements that accept any caps features keep system memory,
+		 * as they may not handle dmabufs.
+		 */
+		ret = capture("identity");
+		if (ret != TestPass)
+			return ret;
+
+		if (dmabufCaps_) {
+			cerr << "DMABuf caps negotiated by default" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	bool dmabufCaps_;
+	bool systemMemory_;
+	unsigned int buffers_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(NegotiationTest)
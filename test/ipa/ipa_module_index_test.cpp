@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_index_test.cpp - Test the IPA module index and signature checks
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/logging.h>
+
+#include "libcamera/internal/capability_cache.h"
+#include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_proxy.h"
+#include "libcamera/internal/pipeline_handler.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static const char *const modulePath = "src/ipa/vimc/ipa_vimc.so";
+
+class IPAModuleIndexTest : public Test
+{
+protected:
+	int init() override
+	{
+		char tmpl[] = "/tmp/libcamera.ipa_module_index.XXXXXX";
+		if (!mkdtemp(tmpl)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = tmpl;
+		cachePath_ = dir_ + "/cache";
+		libPath_ = dir_ + "/ipa_vimc.so";
+
+		/* Work on a copy of the module to modify its change time. */
+		ifstream src(modulePath, ios::binary);
+		ofstream dst(libPath_, ios::binary);
+		if (!src || !dst) {
+			cerr << "Failed to copy the vimc IPA module" << endl;
+			return TestFail;
+		}
+
+		dst << src.rdbuf();
+		dst.close();
+
+		setenv("LIBCAMERA_CAPABILITY_CACHE", cachePath_.c_str(), 1);
+
+		return TestPass;
+	}
+
+	/* Locate the module information in the index entry of the module. */
+	ssize_t infoOffset(Span<const uint8_t> entry, const IPAModuleInfo &info)
+	{
+		for (size_t offset = 0; offset + sizeof(info) <= entry.size(); ++offset) {
+			if (!memcmp(entry.data() + offset, &info, sizeof(info)))
+				return offset;
+		}
+
+		return -1;
+	}
+
+	int testIndex()
+	{
+		const string key = "ipa/" + libPath_;
+
+		/* The first load parses the module and indexes it. */
+		IPAModule parsed(libPath_);
+		if (!parsed.isValid()) {
+			cerr << "Failed to load the vimc IPA module" << endl;
+			return TestFail;
+		}
+
+		Span<const uint8_t> cached = CapabilityCache::lookup(key);
+		ssize_t offset = infoOffset(cached, parsed.info());
+		if (offset < 0) {
+			cerr << "IPA module not indexed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Tamper with the indexed module name. The index is used as
+		 * long as the module doesn't change, which exposes the
+		 * tampered name.
+		 */
+		vector<uint8_t> entry(cached.begin(), cached.end());
+		IPAModuleInfo info = parsed.info();
+		strncpy(info.name, "indexed", sizeof(info.name));
+		memcpy(entry.data() + offset, &info, sizeof(info));
+		CapabilityCache::store(key, entry);
+
+		IPAModule indexed(libPath_);
+		if (!indexed.isValid() || strcmp(indexed.info().name, "indexed")) {
+			cerr << "IPA module index not used" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Changing the module permissions updates its change time,
+		 * which invalidates the index entry. Wait to ensure the change
+		 * time differs with coarse file system timestamps.
+		 */
+		usleep(20000);
+		if (chmod(libPath_.c_str(), 0755) < 0) {
+			cerr << "Failed to change the module permissions" << endl;
+			return TestFail;
+		}
+
+		IPAModule reparsed(libPath_);
+		if (!reparsed.isValid() ||
+		    strcmp(reparsed.info().name, parsed.info().name)) {
+			cerr << "Stale IPA module index entry used" << endl;
+			return TestFail;
+		}
+
+		/* The index entry is updated for the new change time. */
+		IPAModule reindexed(libPath_);
+		if (!reindexed.isValid() ||
+		    strcmp(reindexed.info().name, parsed.info().name)) {
+			cerr << "IPA module index not updated" << endl;
+			return TestFail;
+		}
+
+		/* The index also records modules that are invalid. */
+		string invalidPath = dir_ + "/invalid.so";
+		ofstream(invalidPath) << "not an ELF file";
+
+		IPAModule invalid(invalidPath);
+		if (invalid.isValid() ||
+		    CapabilityCache::lookup("ipa/" + invalidPath).empty()) {
+			cerr << "Invalid IPA module not indexed" << endl;
+			unlink(invalidPath.c_str());
+			return TestFail;
+		}
+
+		unlink(invalidPath.c_str());
+
+		return TestPass;
+	}
+
+	int testSignatureMemoisation()
+	{
+#if HAVE_IPA_PUBKEY
+		shared_ptr<PipelineHandler> pipe;
+		for (PipelineHandlerFactory *factory : PipelineHandlerFactory::factories()) {
+			if (factory->name() == "PipelineHandlerVimc") {
+				pipe = factory->create(nullptr);
+				break;
+			}
+		}
+
+		if (!pipe) {
+			cerr << "Vimc pipeline not found" << endl;
+			return TestSkip;
+		}
+
+		/*
+		 * Capture the IPAManager debug messages, which report every
+		 * signature verification.
+		 */
+		ostringstream log;
+		logSetStream(&log);
+		logSetLevel("IPAManager", "DEBUG");
+
+		int ret = TestPass;
+
+		{
+			IPAManager ipam;
+
+			for (unsigned int i = 0; i < 2; ++i) {
+				unique_ptr<IPAProxy> ipa = IPAManager::createIPA(pipe.get(), 0, 0);
+				if (!ipa) {
+					cerr << "Failed to create the vimc IPA" << endl;
+					ret = TestFail;
+					break;
+				}
+			}
+		}
+
+		logSetStream(&cerr);
+
+		if (ret != TestPass)
+			return ret;
+
+		unsigned int verifications = 0;
+		istringstream lines(log.str());
+		for (string line; getline(lines, line);) {
+			if (line.find("ipa_vimc.so signature is") != string::npos)
+				verifications++;
+		}
+
+		if (verifications != 1) {
+			cerr << "Signature verified " << verifications
+			     << " times instead of once" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+#else
+		cout << "No IPA public key, skipping signature memoisation test"
+		     << endl;
+		return TestPass;
+#endif
+	}
+
+	int run() override
+	{
+		CapabilityCache cache;
+
+		if (testIndex() != TestPass)
+			return TestFail;
+
+		return testSignatureMemoisation();
+	}
+
+	void cleanup() override
+	{
+		unlink(libPath_.c_str());
+		unlink(cachePath_.c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string dir_;
+	string cachePath_;
+	string libPath_;
+};
+
+TEST_REGISTER(IPAModuleIndexTest)
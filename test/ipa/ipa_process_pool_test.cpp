@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_process_pool_test.cpp - Test the IPA process pool
+ */
+
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+
+#include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_process_pool.h"
+#include "libcamera/internal/message.h"
+#include "libcamera/internal/thread.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static const char *const workerPath = "src/libcamera/proxy/worker/ipa_proxy_linux";
+
+class IPAProcessPoolTest : public Test
+{
+protected:
+	int init() override
+	{
+		if (access(workerPath, X_OK)) {
+			cerr << "IPA proxy worker not found" << endl;
+			return TestSkip;
+		}
+
+		ipam_ = make_unique<IPAModule>("src/ipa/vimc/ipa_vimc.so");
+		if (!ipam_->isValid()) {
+			cerr << "Failed to load the vimc IPA module" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unique_ptr<IPAWorker> acquire(const char *name)
+	{
+		auto begin = chrono::steady_clock::now();
+		unique_ptr<IPAWorker> worker = IPAProcessPool::acquire(ipam_.get(), workerPath);
+		auto end = chrono::steady_clock::now();
+
+		cout << name << " acquire: "
+		     << chrono::duration_cast<chrono::microseconds>(end - begin).count()
+		     << "us" << endl;
+
+		if (!worker)
+			cerr << "Failed to acquire " << name << " worker" << endl;
+
+		return worker;
+	}
+
+	bool isRunning(const unique_ptr<IPAWorker> &worker)
+	{
+		return worker->process->exitStatus() == Process::NotExited;
+	}
+
+	int run() override
+	{
+		IPAProcessPool pool;
+
+		/* The first worker is started synchronously. */
+		unique_ptr<IPAWorker> cold = acquire("cold");
+		if (!cold)
+			return TestFail;
+
+		/* Let the pool start a spare worker. */
+		Thread::current()->dispatchMessages(Message::Type::InvokeMessage);
+
+		unique_ptr<IPAWorker> warm = acquire("warm");
+		if (!warm)
+			return TestFail;
+
+		if (warm->process.get() == cold->process.get()) {
+			cerr << "Worker handed out twice" << endl;
+			return TestFail;
+		}
+
+		if (!isRunning(cold) || !isRunning(warm)) {
+			cerr << "Worker process died" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Handing out an idle worker doesn't start a replacement, the
+		 * first released worker is recycled and the second one stopped.
+		 */
+		Thread::current()->dispatchMessages(Message::Type::InvokeMessage);
+
+		Process *recycledProcess = cold->process.get();
+		IPAProcessPool::release(move(cold));
+		IPAProcessPool::release(move(warm));
+
+		unique_ptr<IPAWorker> recycled = acquire("recycled");
+		if (!recycled)
+			return TestFail;
+
+		if (recycled->process.get() != recycledProcess) {
+			cerr << "Released worker not recycled" << endl;
+			return TestFail;
+		}
+
+		if (!isRunning(recycled)) {
+			cerr << "Recycled worker process died" << endl;
+			return TestFail;
+		}
+
+		IPAProcessPool::release(move(recycled));
+		pool.clear();
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<IPAModule> ipam_;
+};
+
+TEST_REGISTER(IPAProcessPoolTest)
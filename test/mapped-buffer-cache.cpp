@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera internal MappedBufferCache tests
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+
+#include "libcamera/internal/buffer.h"
+#include "libcamera/internal/dma_buf_allocator.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int iterations = 1000;
+
+class MappedBufferCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		DmaBufAllocator allocator(DmaBufAllocator::Memfd);
+
+		int ret = allocator.exportFrameBuffers("test", 2, { 640 * 480, 640 * 240 },
+						       &buffers_);
+		if (ret != 2) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	template<typename Map>
+	void benchmark(const char *name)
+	{
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < iterations; ++i) {
+			Map map(buffers_[i % 2].get(), PROT_READ);
+			volatile uint8_t value = map.maps()[0].data()[0];
+			(void)value;
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		cout << name << ": "
+		     << chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / iterations
+		     << "ns per map" << endl;
+	}
+
+	/*
+	 * Map a buffer through new duplicated file descriptors for every frame,
+	 * as the Android HAL does, and check the mapping is reused and the file
+	 * descriptors are not kept by the cache.
+	 */
+	int testDuplicatedFds(const FrameBuffer *buffer, const char *name)
+	{
+		MappedBufferCache *cache = MappedBufferCache::instance();
+		unsigned int size = cache->size();
+		uint8_t *address = nullptr;
+
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < iterations; ++i) {
+			/* Duplicate the file descriptor. */
+			const int fd = buffer->planes()[0].fd.fd();
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(fd);
+			plane.length = buffer->planes()[0].length;
+			FrameBuffer frame({ plane });
+
+			{
+				CachedMappedFrameBuffer map(&frame, PROT_READ);
+				if (!map.isValid()) {
+					cerr << "Failed to map " << name << endl;
+					return TestFail;
+				}
+
+				if (!address)
+					address = map.maps()[0].data();
+
+				if (map.maps()[0].data() != address) {
+					cerr << "Mapping of " << name
+					     << " not reused for duplicated file descriptor"
+					     << endl;
+					return TestFail;
+				}
+			}
+
+			cache->release(plane.fd);
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		cout << name << " with duplicated fds: "
+		     << chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / iterations
+		     << "ns per map" << endl;
+
+		if (cache->size() != size) {
+			cerr << "Released file descriptors kept by the cache" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		MappedBufferCache *cache = MappedBufferCache::instance();
+		FrameBuffer *buffer = buffers_[0].get();
+		uint8_t *address;
+
+		/* Mappings are kept across accesses. */
+		{
+			CachedMappedFrameBuffer map(buffer, PROT_READ | PROT_WRITE);
+			if (!map.isValid() || map.maps().size() != 2) {
+				cerr << "Failed to map buffer" << endl;
+				return TestFail;
+			}
+
+			address = map.maps()[0].data();
+			memset(address, 0x55, map.maps()[0].size());
+		}
+
+		if (cache->size() != 2) {
+			cerr << "Mappings not cached" << endl;
+			return TestFail;
+		}
+
+		{
+			CachedMappedFrameBuffer map(buffer, PROT_READ);
+			if (map.maps()[0].data() != address || address[0] != 0x55) {
+				cerr << "Cached mapping not reused" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Mappings are shared between file descriptors of the same buffer. */
+		const int fd = buffer->planes()[0].fd.fd();
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = buffer->planes()[0].length;
+		FrameBuffer duplicate({ plane });
+
+		{
+			CachedMappedFrameBuffer map(&duplicate, PROT_READ);
+			if (map.maps()[0].data() != address) {
+				cerr << "Mapping not shared for duplicated file descriptor"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/* Mappings stay valid for their users when evicted. */
+		{
+			CachedMappedFrameBuffer map(buffer, PROT_READ);
+
+			cache->evict(plane.fd);
+			for (const FrameBuffer::Plane &p : buffer->planes())
+				cache->evict(p.fd);
+
+			if (cache->size() != 0) {
+				cerr << "Buffers not evicted" << endl;
+				return TestFail;
+			}
+
+			if (map.maps()[0].data()[0] != 0x55) {
+				cerr << "Mapping invalidated by eviction" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The cache size is limited. */
+		cache->setLimit(1);
+		{
+			CachedMappedFrameBuffer map(buffer, PROT_READ);
+		}
+
+		if (cache->size() != 1) {
+			cerr << "Cache limit not enforced" << endl;
+			return TestFail;
+		}
+
+		cache->setLimit(64);
+
+		if (testDuplicatedFds(buffer, "memfd") != TestPass)
+			return TestFail;
+
+		DmaBufAllocator allocator;
+		if (allocator.isValid()) {
+			vector<unique_ptr<FrameBuffer>> dmaBufs;
+			int ret = allocator.exportFrameBuffers("test", 1, { 640 * 480 },
+							       &dmaBufs);
+			if (ret != 1) {
+				cerr << "Failed to allocate dma-buf" << endl;
+				return TestFail;
+			}
+
+			if (testDuplicatedFds(dmaBufs[0].get(), "dma-buf") != TestPass)
+				return TestFail;
+
+			for (const FrameBuffer::Plane &plane : dmaBufs[0]->planes())
+				cache->evict(plane.fd);
+		} else {
+			cout << "No dma-buf provider, skipping dma-buf test" << endl;
+		}
+
+		benchmark<MappedFrameBuffer>("uncached");
+		benchmark<CachedMappedFrameBuffer>("cached");
+
+		cache->clear();
+		if (cache->size() != 0) {
+			cerr << "Cache not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	vector<unique_ptr<FrameBuffer>> buffers_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(MappedBufferCacheTest)
@@ -210,6 +210,35 @@ class MediaDeviceLinkTest : public MediaDeviceTest
 			return TestFail;
 		}
 
+		/*
+		 * Configure a set of links, and verify that all other links
+		 * are disabled while immutable links are left untouched.
+		 */
+		MediaLink *debayerA = media_->link("Debayer A", 1, "Scaler", 0);
+		MediaLink *immutable = media_->link("Sensor A", 0, "Raw Capture 0", 0);
+		if (!debayerA || !immutable) {
+			cerr << "Unable to find links for link setup test" << endl;
+			return TestFail;
+		}
+
+		if (link->setEnabled(true) || media_->setupLinks({ debayerA })) {
+			cerr << "Failed to set up links" << endl;
+			return TestFail;
+		}
+
+		if (!(debayerA->flags() & MEDIA_LNK_FL_ENABLED) ||
+		    link->flags() & MEDIA_LNK_FL_ENABLED ||
+		    !(immutable->flags() & MEDIA_LNK_FL_ENABLED)) {
+			cerr << "Links not set up as requested" << endl;
+			return TestFail;
+		}
+
+		/* Setting up the same links again shall be a no-op. */
+		if (media_->setupLinks({ debayerA })) {
+			cerr << "Failed to set up links again" << endl;
+			return TestFail;
+		}
+
 		return 0;
 	}
 
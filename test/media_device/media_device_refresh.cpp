@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_device_refresh.cpp - Tests media graph refresh on VIMC media device
+ */
+
+#include <iostream>
+
+#include "media_device_test.h"
+
+using namespace libcamera;
+using namespace std;
+
+/*
+ * Refresh the media graph of an acquired vimc media device after modifying a
+ * link through a separate MediaDevice instance, and verify that the media
+ * objects are preserved and the link flags updated.
+ */
+
+class MediaDeviceRefreshTest : public MediaDeviceTest
+{
+	int init()
+	{
+		int ret = MediaDeviceTest::init();
+		if (ret)
+			return ret;
+
+		if (!media_->acquire()) {
+			cerr << "Unable to acquire media device "
+			     << media_->deviceNode() << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (media_->disableLinks()) {
+			cerr << "Failed to disable all links in the media graph";
+			return TestFail;
+		}
+
+		MediaEntity *entity = media_->getEntityByName("Debayer A");
+		MediaLink *link = media_->link("Debayer A", 1, "Scaler", 0);
+		if (!entity || !link) {
+			cerr << "Unable to find link 'Debayer A':[1] -> 'Scaler':[0]"
+			     << endl;
+			return TestFail;
+		}
+
+		/* Enable the link behind the back of the media device. */
+		MediaDevice other(media_->deviceNode());
+		if (other.populate() || !other.acquire()) {
+			cerr << "Failed to open a second media device instance"
+			     << endl;
+			return TestFail;
+		}
+
+		MediaLink *otherLink = other.link("Debayer A", 1, "Scaler", 0);
+		if (!otherLink || otherLink->setEnabled(true)) {
+			cerr << "Failed to enable link through the second instance"
+			     << endl;
+			return TestFail;
+		}
+
+		other.release();
+
+		if (media_->populate()) {
+			cerr << "Failed to refresh the media graph" << endl;
+			return TestFail;
+		}
+
+		if (media_->getEntityByName("Debayer A") != entity ||
+		    media_->link("Debayer A", 1, "Scaler", 0) != link) {
+			cerr << "Media objects not preserved across refresh" << endl;
+			return TestFail;
+		}
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED)) {
+			cerr << "Link flags not updated by refresh" << endl;
+			return TestFail;
+		}
+
+		/* Link flags can also be refreshed alone. */
+		if (media_->disableLinks() || !other.acquire() ||
+		    otherLink->setEnabled(true)) {
+			cerr << "Failed to enable link through the second instance"
+			     << endl;
+			return TestFail;
+		}
+
+		other.release();
+
+		if (media_->refreshLinks() ||
+		    !(link->flags() & MEDIA_LNK_FL_ENABLED)) {
+			cerr << "Link flags not updated by links refresh" << endl;
+			return TestFail;
+		}
+
+		/* Locking the device refreshes the link flags. */
+		if (media_->disableLinks() || !other.acquire() ||
+		    otherLink->setEnabled(true)) {
+			cerr << "Failed to enable link through the second instance"
+			     << endl;
+			return TestFail;
+		}
+
+		other.release();
+
+		if (!media_->lock()) {
+			cerr << "Failed to lock the media device" << endl;
+			return TestFail;
+		}
+
+		media_->unlock();
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED)) {
+			cerr << "Link flags not updated by lock" << endl;
+			return TestFail;
+		}
+
+		if (media_->getEntityByName("Nonexistent entity")) {
+			cerr << "Lookup of unknown entity succeeded" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		media_->disableLinks();
+		media_->release();
+	}
+};
+
+TEST_REGISTER(MediaDeviceRefreshTest);
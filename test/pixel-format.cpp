@@ -44,6 +44,24 @@ protected:
 			return TestFail;
 		}
 
+		for (const auto &format : formatsMap) {
+			/* Unknown formats have no name to convert from. */
+			if (format.second[0] == '<')
+				continue;
+
+			if (PixelFormat::fromString(format.second) != format.first) {
+				cerr << "Failed to convert string " << format.second
+				     << " to PixelFormat" << endl;
+				return TestFail;
+			}
+		}
+
+		if (PixelFormat::fromString("UNKNOWN").isValid()) {
+			cerr << "Converted unknown string to valid PixelFormat"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels_test.cpp - Test the qcam line conversion kernels
+ */
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "format_kernels.h"
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct NVFormat {
+	const char *name;
+	unsigned int horzSubSample;
+	bool swap;
+};
+
+struct YUVFormat {
+	const char *name;
+	unsigned int y_pos;
+	unsigned int cb_pos;
+};
+
+const vector<NVFormat> nvFormats = {
+	{ "NV12", 2, false },
+	{ "NV21", 2, true },
+	{ "NV24", 1, false },
+	{ "NV42", 1, true },
+};
+
+const vector<YUVFormat> yuvFormats = {
+	{ "YUYV", 0, 1 },
+	{ "YVYU", 0, 3 },
+	{ "UYVY", 1, 0 },
+	{ "VYUY", 1, 2 },
+};
+
+/* Guard bytes written after each destination line to detect overflows. */
+constexpr unsigned int kGuard = 16;
+constexpr unsigned char kGuardValue = 0xa5;
+
+constexpr unsigned int kBenchWidth = 1920;
+constexpr unsigned int kBenchHeight = 1080;
+
+class FormatKernelsTest : public Test
+{
+protected:
+	int init() override
+	{
+		mt19937 generator(42);
+		uniform_int_distribution<unsigned int> distribution(0, 255);
+
+		/* Enough data for a 1080p frame in any of the tested formats. */
+		source_.resize(kBenchWidth * kBenchHeight * 3 + 64);
+		for (unsigned char &value : source_)
+			value = distribution(generator);
+
+		return TestPass;
+	}
+
+	/*
+	 * Convert a line with the SIMD and scalar kernels, from a source at
+	 * \a offset bytes from an aligned address, and compare the results.
+	 */
+	template<typename Convert>
+	int compare(const char *name, unsigned int width, unsigned int offset,
+		    Convert convert)
+	{
+		vector<unsigned char> simd(width * 4 + kGuard, kGuardValue);
+		vector<unsigned char> scalar(width * 4 + kGuard, kGuardValue);
+
+		convert(source_.data() + offset, simd.data(), true);
+		convert(source_.data() + offset, scalar.data(), false);
+
+		if (memcmp(simd.data(), scalar.data(), width * 4)) {
+			cerr << name << ": SIMD and scalar results differ for width "
+			     << width << " at offset " << offset << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = width * 4; i < simd.size(); ++i) {
+			if (simd[i] != kGuardValue || scalar[i] != kGuardValue) {
+				cerr << name << ": line overflow for width "
+				     << width << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	template<typename Convert>
+	void benchmark(const char *name, unsigned int srcStride, Convert convert)
+	{
+		vector<unsigned char> dst(kBenchWidth * kBenchHeight * 4);
+
+		for (bool simd : { false, true }) {
+			auto begin = chrono::steady_clock::now();
+
+			for (unsigned int y = 0; y < kBenchHeight; ++y)
+				convert(source_.data() + y * srcStride,
+					dst.data() + y * kBenchWidth * 4, simd);
+
+			auto end = chrono::steady_clock::now();
+			double us = chrono::duration_cast<chrono::microseconds>(end - begin).count();
+
+			cout << name << (simd ? " SIMD: " : " scalar: ")
+			     << static_cast<unsigned int>(kBenchWidth * kBenchHeight / us)
+			     << " MP/s" << endl;
+		}
+	}
+
+	int run() override
+	{
+		/*
+		 * Test all widths up to several SIMD vectors, including odd
+		 * widths, from sources whose lines start at any alignment, as
+		 * for images with strides that are not multiples of 16.
+		 */
+		for (const NVFormat &format : nvFormats) {
+			for (unsigned int width = 1; width <= 70; ++width) {
+				for (unsigned int offset = 0; offset < 16; ++offset) {
+					/* Chroma follows the luma line, at any alignment. */
+					unsigned int chromaOffset = width + 3;
+					auto convert = [&](const unsigned char *src,
+							   unsigned char *dst, bool simd) {
+						convertNVLine(src, src + chromaOffset, dst,
+							      width, format.horzSubSample,
+							      format.swap, simd);
+					};
+
+					if (compare(format.name, width, offset, convert) != TestPass)
+						return TestFail;
+				}
+			}
+		}
+
+		for (const YUVFormat &format : yuvFormats) {
+			for (unsigned int width = 1; width <= 70; ++width) {
+				for (unsigned int offset = 0; offset < 16; ++offset) {
+					auto convert = [&](const unsigned char *src,
+							   unsigned char *dst, bool simd) {
+						convertYUVLine(src, dst, width, format.y_pos,
+							       format.cb_pos, simd);
+					};
+
+					if (compare(format.name, width, offset, convert) != TestPass)
+						return TestFail;
+				}
+			}
+		}
+
+		/* Report the single-threaded conversion throughput at 1080p. */
+		for (const NVFormat &format : nvFormats) {
+			const unsigned char *chroma = source_.data() + kBenchWidth * kBenchHeight;
+			unsigned int chromaStride = kBenchWidth * 2 / format.horzSubSample;
+
+			benchmark(format.name, kBenchWidth,
+				  [&](const unsigned char *src, unsigned char *dst, bool simd) {
+					  unsigned int y = (src - source_.data()) / kBenchWidth;
+					  convertNVLine(src, chroma + y / 2 * chromaStride,
+							dst, kBenchWidth,
+							format.horzSubSample,
+							format.swap, simd);
+				  });
+		}
+
+		for (const YUVFormat &format : yuvFormats) {
+			benchmark(format.name, kBenchWidth * 2,
+				  [&](const unsigned char *src, unsigned char *dst, bool simd) {
+					  convertYUVLine(src, dst, kBenchWidth, format.y_pos,
+							 format.cb_pos, simd);
+				  });
+		}
+
+		return TestPass;
+	}
+
+private:
+	vector<unsigned char> source_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(FormatKernelsTest)